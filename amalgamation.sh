@@ -19,6 +19,9 @@ ALLCHEADERS="
 $SCRIPTPATH/src/license-comment.h
 $SCRIPTPATH/include/roaring/roaring_version.h
 $SCRIPTPATH/include/roaring/portability.h
+$SCRIPTPATH/include/roaring/isadetection.h
+$SCRIPTPATH/include/roaring/memory.h
+$SCRIPTPATH/include/roaring/instrumentation.h
 $SCRIPTPATH/include/roaring/containers/perfparameters.h
 $SCRIPTPATH/include/roaring/array_util.h
 $SCRIPTPATH/include/roaring/roaring_types.h
@@ -27,6 +30,7 @@ $SCRIPTPATH/include/roaring/bitset_util.h
 $SCRIPTPATH/include/roaring/containers/array.h
 $SCRIPTPATH/include/roaring/containers/bitset.h
 $SCRIPTPATH/include/roaring/containers/run.h
+$SCRIPTPATH/include/roaring/containers/container_pool.h
 $SCRIPTPATH/include/roaring/containers/convert.h
 $SCRIPTPATH/include/roaring/containers/mixed_equal.h
 $SCRIPTPATH/include/roaring/containers/mixed_subset.h
@@ -39,6 +43,9 @@ $SCRIPTPATH/include/roaring/containers/containers.h
 $SCRIPTPATH/include/roaring/roaring_array.h
 $SCRIPTPATH/include/roaring/misc/configreport.h
 $SCRIPTPATH/include/roaring/roaring.h
+$SCRIPTPATH/include/roaring/roaring_collection.h
+$SCRIPTPATH/include/roaring/roaring_atomic_ref.h
+$SCRIPTPATH/include/roaring/roaring_sharded.h
 "
 
 for i in ${ALLCHEADERS} ${ALLCFILES}; do
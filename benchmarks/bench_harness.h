@@ -0,0 +1,109 @@
+/* bench_harness.h
+ *
+ * A small statistics-and-JSON layer over the RDTSC_START/RDTSC_FINAL macros
+ * from benchmark.h. Instead of best-of-N to stdout, a measurement is repeated
+ * after a configurable warmup, the sample distribution is summarized
+ * (min/median/p99/mean) and each benchmark is emitted as one JSON object, so
+ * that successive runs can be diffed by regression tooling.
+ */
+
+#ifndef BENCHMARKS_INCLUDE_BENCH_HARNESS_H_
+#define BENCHMARKS_INCLUDE_BENCH_HARNESS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "benchmark.h"
+
+#define BENCH_WARMUP_DEFAULT 3
+#define BENCH_SAMPLES_DEFAULT 64
+#define BENCH_MAX_SAMPLES 4096
+
+typedef struct bench_stats_s {
+    size_t samples;
+    uint64_t min;
+    uint64_t median;
+    uint64_t p99;
+    uint64_t max;
+    double mean;
+} bench_stats_t;
+
+static int bench_compare_uint64(const void *a, const void *b) {
+    const uint64_t va = *(const uint64_t *)a, vb = *(const uint64_t *)b;
+    return (va > vb) - (va < vb);
+}
+
+static inline bench_stats_t bench_summarize(uint64_t *samples, size_t n) {
+    bench_stats_t stats;
+    qsort(samples, n, sizeof(uint64_t), bench_compare_uint64);
+    stats.samples = n;
+    stats.min = samples[0];
+    stats.median = samples[n / 2];
+    stats.p99 = samples[(n * 99) / 100];
+    stats.max = samples[n - 1];
+    double total = 0;
+    for (size_t i = 0; i < n; i++) total += (double)samples[i];
+    stats.mean = total / (double)n;
+    return stats;
+}
+
+/* Time `statement` (any statement, possibly a block) `nsamples` times after
+ * `warmup` untimed executions, summarizing into *stats_ptr. */
+#define BENCH_MEASURE(stats_ptr, warmup, nsamples, statement)               \
+    do {                                                                    \
+        static uint64_t bench_samples_[BENCH_MAX_SAMPLES];                  \
+        const size_t bench_n_ = ((size_t)(nsamples) < BENCH_MAX_SAMPLES)    \
+                                    ? (size_t)(nsamples)                    \
+                                    : BENCH_MAX_SAMPLES;                    \
+        for (size_t bench_i_ = 0; bench_i_ < (size_t)(warmup);              \
+             bench_i_++) {                                                  \
+            statement;                                                      \
+            CLOBBER_MEMORY;                                                 \
+        }                                                                   \
+        for (size_t bench_i_ = 0; bench_i_ < bench_n_; bench_i_++) {        \
+            uint64_t bench_start_, bench_final_;                            \
+            RDTSC_START(bench_start_);                                      \
+            statement;                                                      \
+            RDTSC_FINAL(bench_final_);                                      \
+            CLOBBER_MEMORY;                                                 \
+            bench_samples_[bench_i_] = bench_final_ - bench_start_;         \
+        }                                                                   \
+        *(stats_ptr) = bench_summarize(bench_samples_, bench_n_);           \
+    } while (0)
+
+/* The JSON document is {"suite":..., "corpus":..., "results":[...]}; the
+ * emitter tracks whether a separating comma is due. */
+static int bench_json_results_emitted = 0;
+
+static inline void bench_json_begin(const char *suite, const char *corpus) {
+    printf("{\"suite\": \"%s\", \"corpus\": \"%s\", \"results\": [", suite,
+           corpus);
+    bench_json_results_emitted = 0;
+}
+
+/* Emit one result object. `bytes` is the number of input bytes one repetition
+ * processes; pass 0 when a throughput figure is not meaningful. */
+static inline void bench_json_result(const char *name,
+                                     const bench_stats_t *stats,
+                                     uint64_t bytes) {
+    printf("%s\n  {\"name\": \"%s\", \"samples\": %zu, "
+           "\"min_cycles\": %llu, \"median_cycles\": %llu, "
+           "\"p99_cycles\": %llu, \"max_cycles\": %llu, "
+           "\"mean_cycles\": %.1f",
+           bench_json_results_emitted ? "," : "", name, stats->samples,
+           (unsigned long long)stats->min, (unsigned long long)stats->median,
+           (unsigned long long)stats->p99, (unsigned long long)stats->max,
+           stats->mean);
+    if (bytes > 0 && stats->median > 0) {
+        printf(", \"bytes\": %llu, \"bytes_per_cycle\": %.3f",
+               (unsigned long long)bytes,
+               (double)bytes / (double)stats->median);
+    }
+    printf("}");
+    bench_json_results_emitted = 1;
+}
+
+static inline void bench_json_end(void) { printf("\n]}\n"); }
+
+#endif /* BENCHMARKS_INCLUDE_BENCH_HARNESS_H_ */
@@ -1,5 +1,6 @@
 #define _GNU_SOURCE
 #include "roaring/roaring.h"
+#include "roaring/roaring_collection.h"
 #include "benchmark.h"
 #include "numbersfromtextfiles.h"
 #include <stdio.h>
@@ -53,12 +54,110 @@ void populate(roaring_bitmap_t *r, int n, char **paths) {
     }
 }
 
+static uint64_t buffer_checksum(const char *buf, size_t len) {
+    uint64_t h = UINT64_C(1469598103934665603);  // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)buf[i];
+        h *= UINT64_C(1099511628211);
+    }
+    return h;
+}
+
+// AND a mutable query bitmap against many mmap'd frozen index bitmaps, the
+// query-tier pattern. The file is mapped PROT_READ, so any write to frozen
+// memory would fault, and a checksum guards against writes through other
+// mappings: finishing with an intact checksum proves the read paths only
+// stream from the buffer.
+static void stress_and_against_frozen(void) {
+    enum { NUM = 256 };
+    roaring_bitmap_t **bitmaps = malloc(NUM * sizeof(roaring_bitmap_t *));
+    uint64_t *keys = malloc(NUM * sizeof(uint64_t));
+    for (uint32_t i = 0; i < NUM; i++) {
+        roaring_bitmap_t *r = roaring_bitmap_create();
+        for (uint32_t j = 0; j < 50000; j++) {
+            roaring_bitmap_add(r, (j * 2654435761u + i * 40503u) % 10000000u);
+        }
+        roaring_bitmap_run_optimize(r);
+        bitmaps[i] = r;
+        keys[i] = i;
+    }
+    size_t len = roaring_collection_size_in_bytes(
+        NUM, (const roaring_bitmap_t **)bitmaps);
+    char *buf = roaring_bitmap_aligned_malloc(32, len);
+    roaring_collection_serialize(NUM, keys,
+                                 (const roaring_bitmap_t **)bitmaps, buf);
+    save(buf, len);
+    roaring_bitmap_aligned_free(buf);
+    free(keys);
+
+    int fd = open(FILENAME, O_RDONLY);
+    if (fd == -1) die("open");
+    char *ptr = (char *)mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) die("mmap");
+    const roaring_collection_t *collection =
+        roaring_collection_frozen_view(ptr, len);
+    const roaring_bitmap_t **views =
+        malloc(NUM * sizeof(roaring_bitmap_t *));
+    for (size_t i = 0; i < NUM; i++) {
+        views[i] = roaring_collection_get_at(collection, i);
+    }
+    roaring_bitmap_t *query = roaring_bitmap_copy(bitmaps[0]);
+    roaring_bitmap_or_inplace(query, bitmaps[NUM / 2]);
+    const uint64_t checksum = buffer_checksum(ptr, len);
+
+    uint64_t cycles_start, cycles_final, aggregate = 0;
+
+    RDTSC_START(cycles_start);
+    for (size_t i = 0; i < NUM; i++) {
+        aggregate += roaring_bitmap_and_cardinality(query, views[i]);
+    }
+    RDTSC_FINAL(cycles_final);
+    printf("and_cardinality vs frozen: %" PRIu64 " cycles per bitmap\n",
+           (cycles_final - cycles_start) / NUM);
+
+    RDTSC_START(cycles_start);
+    for (size_t i = 0; i < NUM; i++) {
+        aggregate += roaring_bitmap_intersect(query, views[i]);
+    }
+    RDTSC_FINAL(cycles_final);
+    printf("intersect vs frozen:       %" PRIu64 " cycles per bitmap\n",
+           (cycles_final - cycles_start) / NUM);
+
+    RDTSC_START(cycles_start);
+    for (size_t i = 0; i < NUM; i++) {
+        roaring_bitmap_t *r = roaring_bitmap_and(query, views[i]);
+        aggregate += roaring_bitmap_get_cardinality(r);
+        roaring_bitmap_free(r);
+    }
+    RDTSC_FINAL(cycles_final);
+    printf("and vs frozen:             %" PRIu64 " cycles per bitmap\n",
+           (cycles_final - cycles_start) / NUM);
+
+    printf("aggregate cardinality: %" PRIu64 "\n", aggregate);
+    printf("frozen memory untouched: %s\n",
+           buffer_checksum(ptr, len) == checksum ? "yes" : "NO -- BUG");
+
+    roaring_bitmap_free(query);
+    for (size_t i = 0; i < NUM; i++) {
+        roaring_bitmap_free(views[i]);
+        roaring_bitmap_free(bitmaps[i]);
+    }
+    free(views);
+    free(bitmaps);
+    roaring_collection_free(collection);
+    munmap(ptr, len);
+    close(fd);
+}
+
 int main(int argc, char* argv[]) {
     (void)&read_all_integer_files; // suppress unused warning
 
+    stress_and_against_frozen();
+
     if (argc < 2) {
         printf("Usage: %s <comma_separated_integers_file> ...\n", argv[0]);
-        return 1;
+        printf("(no input files given: only the frozen AND stress was run)\n");
+        return 0;
     }
 
     {
@@ -0,0 +1,244 @@
+/* serialization_benchmark.c
+ *
+ * Throughput yardstick for the (de)serialization paths:
+ * roaring_bitmap_portable_serialize, portable_deserialize (unsafe),
+ * portable_deserialize_safe and the native serialize/deserialize pair.
+ * Each path is measured over synthetic shapes (array-heavy, bitset-heavy,
+ * run-heavy) and over any realdata corpora passed on the command line, and
+ * reported as one JSON object with cycle statistics plus wall-clock GB/s and
+ * bitmaps/s, so the safe-vs-unsafe gap and format-level changes are visible.
+ *
+ * Usage: serialization_benchmark [-e extension] [-s samples] [-w warmup]
+ *                                [directory ...]
+ */
+#define _GNU_SOURCE
+#include <roaring/roaring.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench_harness.h"
+#include "numbersfromtextfiles.h"
+
+static int samples = BENCH_SAMPLES_DEFAULT;
+static int warmup = BENCH_WARMUP_DEFAULT;
+static int results_emitted = 0;
+
+static uint64_t wall_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static void emit_result(const char *corpus, const char *name,
+                        const bench_stats_t *stats, uint64_t bytes,
+                        size_t bitmaps, uint64_t elapsed_ns) {
+    // the elapsed wall time covers the warmup runs as well
+    const double reps = (double)(stats->samples + (size_t)warmup);
+    const double secs = (double)elapsed_ns / 1e9;
+    printf("%s\n  {\"corpus\": \"%s\", \"name\": \"%s\", \"samples\": %zu, "
+           "\"median_cycles\": %llu, \"p99_cycles\": %llu, "
+           "\"bytes\": %llu, \"gbps\": %.3f, \"bitmaps_per_sec\": %.0f}",
+           results_emitted ? "," : "", corpus, name, stats->samples,
+           (unsigned long long)stats->median, (unsigned long long)stats->p99,
+           (unsigned long long)bytes, (double)bytes * reps / secs / 1e9,
+           (double)bitmaps * reps / secs);
+    results_emitted = 1;
+}
+
+/* Serialize every bitmap into its own buffer; returns the buffers and fills
+ * sizes[], using the portable format when `portable`, the native one
+ * otherwise. */
+static char **serialize_all(roaring_bitmap_t **bitmaps, size_t count,
+                            size_t *sizes, bool portable) {
+    char **bufs = malloc(count * sizeof(char *));
+    for (size_t i = 0; i < count; i++) {
+        sizes[i] = portable ? roaring_bitmap_portable_size_in_bytes(bitmaps[i])
+                            : roaring_bitmap_size_in_bytes(bitmaps[i]);
+        bufs[i] = malloc(sizes[i]);
+        if (portable) {
+            roaring_bitmap_portable_serialize(bitmaps[i], bufs[i]);
+        } else {
+            roaring_bitmap_serialize(bitmaps[i], bufs[i]);
+        }
+    }
+    return bufs;
+}
+
+static void free_all(char **bufs, size_t count) {
+    for (size_t i = 0; i < count; i++) free(bufs[i]);
+    free(bufs);
+}
+
+static void bench_corpus(const char *corpus, roaring_bitmap_t **bitmaps,
+                         size_t count) {
+    size_t *sizes = malloc(count * sizeof(size_t));
+    char **bufs = serialize_all(bitmaps, count, sizes, true);
+    uint64_t portable_bytes = 0;
+    for (size_t i = 0; i < count; i++) portable_bytes += sizes[i];
+
+    bench_stats_t stats;
+    volatile uint64_t sink = 0;  // defeat dead-code elimination
+    uint64_t t0;
+
+    t0 = wall_ns();
+    BENCH_MEASURE(&stats, warmup, samples, {
+        for (size_t i = 0; i < count; i++) {
+            sink += roaring_bitmap_portable_serialize(bitmaps[i], bufs[i]);
+        }
+    });
+    emit_result(corpus, "portable_serialize", &stats, portable_bytes, count,
+                wall_ns() - t0);
+
+    t0 = wall_ns();
+    BENCH_MEASURE(&stats, warmup, samples, {
+        for (size_t i = 0; i < count; i++) {
+            roaring_bitmap_t *r = roaring_bitmap_portable_deserialize(bufs[i]);
+            sink += roaring_bitmap_minimum(r);
+            roaring_bitmap_free(r);
+        }
+    });
+    emit_result(corpus, "portable_deserialize_unsafe", &stats, portable_bytes,
+                count, wall_ns() - t0);
+
+    t0 = wall_ns();
+    BENCH_MEASURE(&stats, warmup, samples, {
+        for (size_t i = 0; i < count; i++) {
+            roaring_bitmap_t *r =
+                roaring_bitmap_portable_deserialize_safe(bufs[i], sizes[i]);
+            sink += roaring_bitmap_minimum(r);
+            roaring_bitmap_free(r);
+        }
+    });
+    emit_result(corpus, "portable_deserialize_safe", &stats, portable_bytes,
+                count, wall_ns() - t0);
+    free_all(bufs, count);
+
+    bufs = serialize_all(bitmaps, count, sizes, false);
+    uint64_t native_bytes = 0;
+    for (size_t i = 0; i < count; i++) native_bytes += sizes[i];
+
+    t0 = wall_ns();
+    BENCH_MEASURE(&stats, warmup, samples, {
+        for (size_t i = 0; i < count; i++) {
+            sink += roaring_bitmap_serialize(bitmaps[i], bufs[i]);
+        }
+    });
+    emit_result(corpus, "serialize", &stats, native_bytes, count,
+                wall_ns() - t0);
+
+    t0 = wall_ns();
+    BENCH_MEASURE(&stats, warmup, samples, {
+        for (size_t i = 0; i < count; i++) {
+            roaring_bitmap_t *r = roaring_bitmap_deserialize(bufs[i]);
+            sink += roaring_bitmap_minimum(r);
+            roaring_bitmap_free(r);
+        }
+    });
+    emit_result(corpus, "deserialize", &stats, native_bytes, count,
+                wall_ns() - t0);
+    free_all(bufs, count);
+    free(sizes);
+    (void)sink;
+}
+
+enum { SYNTHETIC_COUNT = 64 };
+
+static roaring_bitmap_t **make_synthetic(const char *shape) {
+    roaring_bitmap_t **bitmaps =
+        malloc(SYNTHETIC_COUNT * sizeof(roaring_bitmap_t *));
+    for (uint32_t i = 0; i < SYNTHETIC_COUNT; i++) {
+        roaring_bitmap_t *r = roaring_bitmap_create();
+        if (strcmp(shape, "array-heavy") == 0) {
+            // ~2000 scattered values per 65536-block, ten blocks
+            for (uint32_t j = 0; j < 20000; j++) {
+                roaring_bitmap_add(r, (j * 2654435761u + i * 40503u) %
+                                          (10 * 65536));
+            }
+        } else if (strcmp(shape, "bitset-heavy") == 0) {
+            // every other value over ten blocks
+            for (uint32_t j = 0; j < 5 * 65536; j++) {
+                roaring_bitmap_add(r, 2 * j + (i & 1));
+            }
+        } else {  // run-heavy
+            for (uint32_t j = 0; j < 2000; j++) {
+                const uint32_t start = j * 500 + (i % 50);
+                roaring_bitmap_add_range(r, start, start + 300);
+            }
+            roaring_bitmap_run_optimize(r);
+        }
+        bitmaps[i] = r;
+    }
+    return bitmaps;
+}
+
+static void printusage(char *command) {
+    fprintf(stderr,
+            " Try %s [-e extension] [-s samples] [-w warmup] [directory ...]\n"
+            " The synthetic shapes always run; each directory (e.g. "
+            "benchmarks/realdata/census1881) adds a corpus.\n",
+            command);
+}
+
+int main(int argc, char **argv) {
+    int c;
+    const char *extension = ".txt";
+    while ((c = getopt(argc, argv, "e:s:w:h")) != -1) switch (c) {
+            case 'e':
+                extension = optarg;
+                break;
+            case 's':
+                samples = atoi(optarg);
+                break;
+            case 'w':
+                warmup = atoi(optarg);
+                break;
+            case 'h':
+                printusage(argv[0]);
+                return 0;
+            default:
+                abort();
+        }
+    if (samples <= 0 || warmup < 0) {
+        printusage(argv[0]);
+        return -1;
+    }
+
+    printf("{\"suite\": \"serialization\", \"results\": [");
+
+    const char *shapes[] = {"array-heavy", "bitset-heavy", "run-heavy"};
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        roaring_bitmap_t **bitmaps = make_synthetic(shapes[s]);
+        bench_corpus(shapes[s], bitmaps, SYNTHETIC_COUNT);
+        for (size_t i = 0; i < SYNTHETIC_COUNT; i++) {
+            roaring_bitmap_free(bitmaps[i]);
+        }
+        free(bitmaps);
+    }
+
+    for (int a = optind; a < argc; a++) {
+        size_t count;
+        size_t *howmany = NULL;
+        uint32_t **numbers =
+            read_all_integer_files(argv[a], extension, &howmany, &count);
+        if (numbers == NULL || count == 0) {
+            fprintf(stderr, "could not load corpus %s, skipping\n", argv[a]);
+            continue;
+        }
+        roaring_bitmap_t **bitmaps =
+            malloc(count * sizeof(roaring_bitmap_t *));
+        for (size_t i = 0; i < count; i++) {
+            bitmaps[i] = roaring_bitmap_of_ptr(howmany[i], numbers[i]);
+            roaring_bitmap_run_optimize(bitmaps[i]);
+            roaring_bitmap_shrink_to_fit(bitmaps[i]);
+            free(numbers[i]);
+        }
+        bench_corpus(argv[a], bitmaps, count);
+        for (size_t i = 0; i < count; i++) roaring_bitmap_free(bitmaps[i]);
+        free(bitmaps);
+        free(howmany);
+        free(numbers);
+    }
+
+    printf("\n]}\n");
+    return 0;
+}
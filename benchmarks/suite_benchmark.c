@@ -0,0 +1,247 @@
+/* suite_benchmark.c
+ *
+ * Regression-tracking benchmark suite over the realdata corpora: every
+ * top-level operation is timed over all consecutive bitmap pairs of a corpus
+ * with warmup and repeated sampling, and the result is a single JSON document
+ * (see bench_harness.h) with median/p99 cycles and bytes/cycle. The container
+ * kernels are exercised through the top-level calls, since the run-optimized
+ * corpora mix array, bitset and run containers.
+ *
+ * Usage: suite_benchmark [-e extension] [-s samples] [-w warmup] directory
+ */
+#define _GNU_SOURCE
+#include <roaring/roaring.h>
+
+#include "bench_harness.h"
+#include "numbersfromtextfiles.h"
+
+static roaring_bitmap_t **create_all_bitmaps(size_t *howmany,
+                                             uint32_t **numbers,
+                                             size_t count) {
+    if (numbers == NULL) return NULL;
+    roaring_bitmap_t **answer = malloc(sizeof(roaring_bitmap_t *) * count);
+    for (size_t i = 0; i < count; i++) {
+        answer[i] = roaring_bitmap_of_ptr(howmany[i], numbers[i]);
+        roaring_bitmap_run_optimize(answer[i]);
+        roaring_bitmap_shrink_to_fit(answer[i]);
+    }
+    return answer;
+}
+
+static void printusage(char *command) {
+    fprintf(stderr,
+            " Try %s directory \n where directory could be "
+            "benchmarks/realdata/census1881\n",
+            command);
+    fprintf(stderr, " -e changes the file extension (default .txt)\n");
+    fprintf(stderr, " -s sets the number of timed samples (default %d)\n",
+            BENCH_SAMPLES_DEFAULT);
+    fprintf(stderr, " -w sets the number of warmup runs (default %d)\n",
+            BENCH_WARMUP_DEFAULT);
+}
+
+static bool dummy_iterator(uint32_t value, void *param) {
+    *(uint64_t *)param += value;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int c;
+    const char *extension = ".txt";
+    int samples = BENCH_SAMPLES_DEFAULT;
+    int warmup = BENCH_WARMUP_DEFAULT;
+    while ((c = getopt(argc, argv, "e:s:w:h")) != -1) switch (c) {
+            case 'e':
+                extension = optarg;
+                break;
+            case 's':
+                samples = atoi(optarg);
+                break;
+            case 'w':
+                warmup = atoi(optarg);
+                break;
+            case 'h':
+                printusage(argv[0]);
+                return 0;
+            default:
+                abort();
+        }
+    if (optind >= argc || samples <= 0 || warmup < 0) {
+        printusage(argv[0]);
+        return -1;
+    }
+    char *dirname = argv[optind];
+    size_t count;
+    size_t *howmany = NULL;
+    uint32_t **numbers =
+        read_all_integer_files(dirname, extension, &howmany, &count);
+    if (numbers == NULL || count < 2) {
+        fprintf(stderr,
+                "I could not find or load enough data files with extension %s "
+                "in directory %s.\n",
+                extension, dirname);
+        return -1;
+    }
+    roaring_bitmap_t **bitmaps = create_all_bitmaps(howmany, numbers, count);
+
+    // per-pair serialized operand bytes, for the bytes/cycle figures
+    uint64_t pair_bytes = 0, total_bytes = 0, total_values = 0;
+    for (size_t i = 0; i < count; i++) {
+        const uint64_t b = roaring_bitmap_portable_size_in_bytes(bitmaps[i]);
+        total_bytes += b;
+        pair_bytes += (i > 0 && i + 1 < count) ? 2 * b : b;
+        total_values += howmany[i];
+    }
+
+    bench_stats_t stats;
+    volatile uint64_t sink = 0;  // defeat dead-code elimination
+    bench_json_begin("croaring", dirname);
+
+    BENCH_MEASURE(&stats, warmup, samples, {
+        for (size_t i = 0; i + 1 < count; i++) {
+            roaring_bitmap_t *r = roaring_bitmap_and(bitmaps[i],
+                                                     bitmaps[i + 1]);
+            sink += roaring_bitmap_get_cardinality(r);
+            roaring_bitmap_free(r);
+        }
+    });
+    bench_json_result("and", &stats, pair_bytes);
+
+    BENCH_MEASURE(&stats, warmup, samples, {
+        for (size_t i = 0; i + 1 < count; i++) {
+            roaring_bitmap_t *r = roaring_bitmap_or(bitmaps[i],
+                                                    bitmaps[i + 1]);
+            sink += roaring_bitmap_get_cardinality(r);
+            roaring_bitmap_free(r);
+        }
+    });
+    bench_json_result("or", &stats, pair_bytes);
+
+    BENCH_MEASURE(&stats, warmup, samples, {
+        for (size_t i = 0; i + 1 < count; i++) {
+            roaring_bitmap_t *r = roaring_bitmap_xor(bitmaps[i],
+                                                     bitmaps[i + 1]);
+            sink += roaring_bitmap_get_cardinality(r);
+            roaring_bitmap_free(r);
+        }
+    });
+    bench_json_result("xor", &stats, pair_bytes);
+
+    BENCH_MEASURE(&stats, warmup, samples, {
+        for (size_t i = 0; i + 1 < count; i++) {
+            roaring_bitmap_t *r = roaring_bitmap_andnot(bitmaps[i],
+                                                        bitmaps[i + 1]);
+            sink += roaring_bitmap_get_cardinality(r);
+            roaring_bitmap_free(r);
+        }
+    });
+    bench_json_result("andnot", &stats, pair_bytes);
+
+    BENCH_MEASURE(&stats, warmup, samples, {
+        for (size_t i = 0; i + 1 < count; i++) {
+            sink += roaring_bitmap_and_cardinality(bitmaps[i], bitmaps[i + 1]);
+        }
+    });
+    bench_json_result("and_cardinality", &stats, pair_bytes);
+
+    BENCH_MEASURE(&stats, warmup, samples, {
+        for (size_t i = 0; i + 1 < count; i++) {
+            sink += roaring_bitmap_or_cardinality(bitmaps[i], bitmaps[i + 1]);
+        }
+    });
+    bench_json_result("or_cardinality", &stats, pair_bytes);
+
+    BENCH_MEASURE(&stats, warmup, samples, {
+        for (size_t i = 0; i + 1 < count; i++) {
+            sink += roaring_bitmap_intersect(bitmaps[i], bitmaps[i + 1]);
+        }
+    });
+    bench_json_result("intersect", &stats, pair_bytes);
+
+    BENCH_MEASURE(&stats, warmup, samples, {
+        for (size_t i = 0; i + 1 < count; i++) {
+            sink += roaring_bitmap_equals(bitmaps[i], bitmaps[i + 1]);
+            sink += roaring_bitmap_is_subset(bitmaps[i], bitmaps[i + 1]);
+        }
+    });
+    bench_json_result("equals_and_is_subset", &stats, pair_bytes);
+
+    BENCH_MEASURE(&stats, warmup, samples, {
+        for (size_t i = 0; i < count; i++) {
+            for (size_t j = 0; j < howmany[i]; j += 4) {
+                sink += roaring_bitmap_contains(bitmaps[i],
+                                                numbers[i][j]);
+            }
+        }
+    });
+    bench_json_result("contains", &stats, total_values * sizeof(uint32_t) / 4);
+
+    BENCH_MEASURE(&stats, warmup, samples, {
+        for (size_t i = 0; i < count; i++) {
+            uint64_t accumulator = 0;
+            roaring_iterate(bitmaps[i], dummy_iterator, &accumulator);
+            sink += accumulator;
+        }
+    });
+    bench_json_result("iterate", &stats, total_bytes);
+
+    uint32_t *scratch = malloc(total_values * sizeof(uint32_t));
+    BENCH_MEASURE(&stats, warmup, samples, {
+        for (size_t i = 0; i < count; i++) {
+            roaring_bitmap_to_uint32_array(bitmaps[i], scratch);
+            sink += scratch[0];
+        }
+    });
+    bench_json_result("to_uint32_array", &stats,
+                      total_values * sizeof(uint32_t));
+    free(scratch);
+
+    size_t max_serialized = 0;
+    for (size_t i = 0; i < count; i++) {
+        const size_t b = roaring_bitmap_portable_size_in_bytes(bitmaps[i]);
+        if (b > max_serialized) max_serialized = b;
+    }
+    char *buf = malloc(max_serialized);
+    BENCH_MEASURE(&stats, warmup, samples, {
+        for (size_t i = 0; i < count; i++) {
+            sink += roaring_bitmap_portable_serialize(bitmaps[i], buf);
+        }
+    });
+    bench_json_result("portable_serialize", &stats, total_bytes);
+
+    BENCH_MEASURE(&stats, warmup, samples, {
+        for (size_t i = 0; i < count; i++) {
+            size_t b = roaring_bitmap_portable_serialize(bitmaps[i], buf);
+            roaring_bitmap_t *r =
+                roaring_bitmap_portable_deserialize_safe(buf, b);
+            sink += roaring_bitmap_minimum(r);
+            roaring_bitmap_free(r);
+        }
+    });
+    bench_json_result("portable_serialize_deserialize", &stats,
+                      2 * total_bytes);
+    free(buf);
+
+    BENCH_MEASURE(&stats, warmup, samples, {
+        for (size_t i = 0; i < count; i++) {
+            roaring_bitmap_t *r = roaring_bitmap_of_ptr(howmany[i],
+                                                        numbers[i]);
+            sink += roaring_bitmap_minimum(r);
+            roaring_bitmap_free(r);
+        }
+    });
+    bench_json_result("create_of_ptr", &stats,
+                      total_values * sizeof(uint32_t));
+
+    bench_json_end();
+
+    for (size_t i = 0; i < count; i++) {
+        roaring_bitmap_free(bitmaps[i]);
+        free(numbers[i]);
+    }
+    free(bitmaps);
+    free(howmany);
+    free(numbers);
+    (void)sink;
+    return 0;
+}
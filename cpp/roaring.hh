@@ -6,11 +6,13 @@ A C++ header for Roaring Bitmaps.
 
 #include <stdarg.h>
 
+#include <roaring/memory.h>
 #include <roaring/roaring.h>
 #include <algorithm>
 #include <new>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #ifdef ROARING_DOUBLECHECK_CPP
     /**
      * When ROARING_DOUBLECHECK_CPP is defined, a `std::set` is kept parallel
@@ -70,6 +72,8 @@ class Roaring {
      */
     Roaring(Roaring &&r) noexcept {
         roaring = std::move(r.roaring);
+        ra_rebase_inline(&roaring.high_low_container,
+                         &r.roaring.high_low_container);
         ra_init(&r.roaring.high_low_container);
       #ifdef ROARING_DOUBLECHECK_CPP
         check = std::move(r.check);
@@ -85,8 +89,11 @@ class Roaring {
     Roaring(roaring_bitmap_t *s) noexcept {
         // steal the interior struct
         roaring.high_low_container = s->high_low_container;
-        // deallocate the old container
-        free(s);
+        ra_rebase_inline(&roaring.high_low_container,
+                         &s->high_low_container);
+        // deallocate the old container through the library's hooks, which
+        // allocated it
+        roaring_free(s);
       #ifdef ROARING_DOUBLECHECK_CPP
         roaring_iterate(&roaring,
             [](uint32_t value, void* param) {  // use lambda func for callback
@@ -224,6 +231,20 @@ class Roaring {
         return ans;
     }
 
+    /**
+     * Answer n_args membership queries at once: results[i] is set to
+     * whether vals[i] is present. Much faster than repeated contains calls
+     * when the values are sorted or clustered.
+     */
+    void containsMany(size_t n_args, const uint32_t *vals,
+                      bool *results) const {
+        roaring_bitmap_contains_many(&roaring, n_args, vals, results);
+      #ifdef ROARING_DOUBLECHECK_CPP
+        for (size_t i = 0; i < n_args; ++i)
+            assert(results[i] == (check.find(vals[i]) != check.end()));
+      #endif
+    }
+
     /**
     * Check if all values from x (included) to y (excluded) are present
     */
@@ -297,6 +318,8 @@ class Roaring {
     Roaring &operator=(Roaring &&r) noexcept {
         ra_clear(&roaring.high_low_container);
         roaring = std::move(r.roaring);
+        ra_rebase_inline(&roaring.high_low_container,
+                         &r.roaring.high_low_container);
         ra_init(&r.roaring.high_low_container);
       #ifdef ROARING_DOUBLECHECK_CPP
         check = std::move(r.check);
@@ -551,6 +574,17 @@ class Roaring {
         return ans;
     }
 
+    /**
+     * Selects the values at the ranks in [begin, end), which must be sorted
+     * in increasing order, writing them to ans in a single pass over the
+     * bitmap. Returns false (leaving ans partially filled) if some rank is
+     * greater than or equal to the cardinality.
+     */
+    bool selectMany(const uint32_t *begin, const uint32_t *end,
+                    uint32_t *ans) const {
+        return roaring_bitmap_select_many(&roaring, begin, end, ans);
+    }
+
     /**
      * Computes the size of the intersection between two bitmaps.
      *
@@ -728,6 +762,16 @@ class Roaring {
         return ans;
     }
 
+    /**
+     * Ranks all the values in [begin, end), which must be sorted in
+     * increasing order, in a single pass over the bitmap; the ranks are
+     * written to ans, using the same indexing convention as rank().
+     */
+    void rankMany(const uint32_t *begin, const uint32_t *end,
+                  uint64_t *ans) const {
+        roaring_bitmap_rank_many(&roaring, begin, end, ans);
+    }
+
     /**
     * write a bitmap to a char buffer. This is meant to be compatible with
     * the
@@ -938,8 +982,8 @@ class Roaring {
      * pointer).
      */
     static Roaring fastunion(size_t n, const Roaring **inputs) {
-        const roaring_bitmap_t **x =
-            (const roaring_bitmap_t **)malloc(n * sizeof(roaring_bitmap_t *));
+        const roaring_bitmap_t **x = (const roaring_bitmap_t **)roaring_malloc(
+            n * sizeof(roaring_bitmap_t *));
         if (x == NULL) {
             throw std::runtime_error("failed memory alloc in fastunion");
         }
@@ -947,11 +991,11 @@ class Roaring {
 
         roaring_bitmap_t *c_ans = roaring_bitmap_or_many(n, x);
         if (c_ans == NULL) {
-            free(x);
+            roaring_free(x);
             throw std::runtime_error("failed memory alloc in fastunion");
         }
         Roaring ans(c_ans);
-        free(x);
+        roaring_free(x);
       #ifdef ROARING_DOUBLECHECK_CPP
         if (n == 0)
             assert(ans.cardinality() == 0);
@@ -994,6 +1038,33 @@ class Roaring {
   #endif
 };
 
+/**
+ * Binary operators with a temporary left operand reuse its storage through
+ * the in-place calls, so a chained expression such as `a & b & c | d` fuses
+ * into in-place operations instead of materializing a fresh bitmap per
+ * operator. Overload resolution prefers these over the member operators
+ * whenever the left-hand side is an rvalue.
+ */
+inline Roaring operator&(Roaring &&lhs, const Roaring &rhs) {
+    lhs &= rhs;
+    return std::move(lhs);
+}
+
+inline Roaring operator-(Roaring &&lhs, const Roaring &rhs) {
+    lhs -= rhs;
+    return std::move(lhs);
+}
+
+inline Roaring operator|(Roaring &&lhs, const Roaring &rhs) {
+    lhs |= rhs;
+    return std::move(lhs);
+}
+
+inline Roaring operator^(Roaring &&lhs, const Roaring &rhs) {
+    lhs ^= rhs;
+    return std::move(lhs);
+}
+
 /**
  * Used to go through the set bits. Not optimally fast, but convenient.
  */
@@ -9,18 +9,119 @@ A C++ header for 64-bit Roaring Bitmaps, implemented by way of a map of many
 #include <cstdarg>
 #include <cstdio>
 #include <limits>
-#include <map>
 #include <new>
 #include <numeric>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #include "roaring.hh"
 
 class Roaring64MapSetBitForwardIterator;
 class Roaring64MapSetBitBiDirectionalIterator;
 
+/**
+ * A map from the high 32 bits of a value to its 32-bit Roaring shard, stored
+ * as a sorted flat vector (mirroring the C roaring_array_t design) rather
+ * than a red-black tree. It exposes just the slice of the std::map interface
+ * that Roaring64Map needs: lookups are binary searches over a dense array of
+ * keys, iteration is a linear scan, and both enjoy far better cache locality
+ * than chasing tree nodes. Inserting a new shard in the middle shifts the
+ * tail, but shards are almost always created in ascending key order or
+ * merely revisited, where this is cheap.
+ */
+class Roaring64ShardMap {
+   public:
+    typedef std::pair<uint32_t, Roaring> value_type;
+    typedef std::vector<value_type> container_type;
+    typedef container_type::iterator iterator;
+    typedef container_type::const_iterator const_iterator;
+    typedef container_type::const_reverse_iterator const_reverse_iterator;
+
+    iterator begin() { return shards.begin(); }
+    iterator end() { return shards.end(); }
+    const_iterator begin() const { return shards.begin(); }
+    const_iterator end() const { return shards.end(); }
+    const_iterator cbegin() const { return shards.cbegin(); }
+    const_iterator cend() const { return shards.cend(); }
+    const_reverse_iterator crbegin() const { return shards.crbegin(); }
+    const_reverse_iterator crend() const { return shards.crend(); }
+
+    bool empty() const { return shards.empty(); }
+    size_t size() const { return shards.size(); }
+    void clear() { shards.clear(); }
+    void swap(Roaring64ShardMap &other) { shards.swap(other.shards); }
+
+    iterator lower_bound(uint32_t key) {
+        return std::lower_bound(shards.begin(), shards.end(), key, KeyLess());
+    }
+    const_iterator lower_bound(uint32_t key) const {
+        return std::lower_bound(shards.begin(), shards.end(), key, KeyLess());
+    }
+
+    iterator find(uint32_t key) {
+        iterator it = lower_bound(key);
+        return (it != shards.end() && it->first == key) ? it : shards.end();
+    }
+    const_iterator find(uint32_t key) const {
+        const_iterator it = lower_bound(key);
+        return (it != shards.end() && it->first == key) ? it : shards.end();
+    }
+
+    size_t count(uint32_t key) const {
+        return find(key) != shards.end() ? 1 : 0;
+    }
+
+    const Roaring &at(uint32_t key) const {
+        const_iterator it = find(key);
+        if (it == shards.end()) {
+            throw std::out_of_range("no roaring shard for this key");
+        }
+        return it->second;
+    }
+
+    /**
+     * Return the shard for this key, default-constructing it in its sorted
+     * position if absent.
+     */
+    Roaring &operator[](uint32_t key) {
+        iterator it = lower_bound(key);
+        if (it == shards.end() || it->first != key) {
+            it = shards.insert(it, value_type(key, Roaring()));
+        }
+        return it->second;
+    }
+
+    /**
+     * Insert the shard for this key if absent (like std::map::emplace, an
+     * existing shard is left untouched).
+     */
+    void emplace(uint32_t key, const Roaring &value) {
+        iterator it = lower_bound(key);
+        if (it == shards.end() || it->first != key) {
+            shards.insert(it, value_type(key, value));
+        }
+    }
+    void emplace(uint32_t key, Roaring &&value) {
+        iterator it = lower_bound(key);
+        if (it == shards.end() || it->first != key) {
+            shards.insert(it, value_type(key, std::move(value)));
+        }
+    }
+
+    iterator erase(iterator it) { return shards.erase(it); }
+
+   private:
+    struct KeyLess {
+        bool operator()(const value_type &entry, uint32_t key) const {
+            return entry.first < key;
+        }
+    };
+    container_type shards;
+};
+
 class Roaring64Map {
    public:
     /**
@@ -113,15 +214,25 @@ class Roaring64Map {
      *
      */
     void addMany(size_t n_args, const uint32_t *vals) {
-        for (size_t lcv = 0; lcv < n_args; lcv++) {
-            roarings[0].add(vals[lcv]);
-            roarings[0].setCopyOnWrite(copyOnWrite);
-        }
+        Roaring &roaring = roarings[0];
+        roaring.addMany(n_args, vals);
+        roaring.setCopyOnWrite(copyOnWrite);
     }
     void addMany(size_t n_args, const uint64_t *vals) {
-        for (size_t lcv = 0; lcv < n_args; lcv++) {
-            roarings[highBytes(vals[lcv])].add(lowBytes(vals[lcv]));
-            roarings[highBytes(vals[lcv])].setCopyOnWrite(copyOnWrite);
+        // partition the input by its high 32 bits so that a run of values
+        // falling in the same shard costs a single shard lookup
+        uint32_t lows[1024];
+        size_t lcv = 0;
+        while (lcv < n_args) {
+            const uint32_t high = highBytes(vals[lcv]);
+            size_t count = 0;
+            do {
+                lows[count++] = lowBytes(vals[lcv++]);
+            } while (lcv < n_args && count < sizeof(lows) / sizeof(lows[0]) &&
+                     highBytes(vals[lcv]) == high);
+            Roaring &roaring = roarings[high];
+            roaring.addMany(count, lows);
+            roaring.setCopyOnWrite(copyOnWrite);
         }
     }
 
@@ -203,6 +314,40 @@ class Roaring64Map {
                    : roarings.at(highBytes(x)).contains(lowBytes(x));
     }
 
+    /**
+     * Answer n_args membership queries at once: results[i] is set to
+     * whether vals[i] is present. A run of values sharing their high 32
+     * bits costs a single shard lookup instead of one per value, so this
+     * is much faster than repeated contains calls on sorted or clustered
+     * input.
+     */
+    void containsMany(size_t n_args, const uint64_t *vals,
+                      bool *results) const {
+        uint32_t lows[1024];
+        size_t lcv = 0;
+        while (lcv < n_args) {
+            const uint32_t high = highBytes(vals[lcv]);
+            auto roaring_iter = roarings.find(high);
+            if (roaring_iter == roarings.cend()) {
+                do {
+                    results[lcv++] = false;
+                } while (lcv < n_args && highBytes(vals[lcv]) == high);
+                continue;
+            }
+            while (lcv < n_args && highBytes(vals[lcv]) == high) {
+                const size_t group_start = lcv;
+                size_t count = 0;
+                do {
+                    lows[count++] = lowBytes(vals[lcv++]);
+                } while (lcv < n_args &&
+                         count < sizeof(lows) / sizeof(lows[0]) &&
+                         highBytes(vals[lcv]) == high);
+                roaring_iter->second.containsMany(count, lows,
+                                                  results + group_start);
+            }
+        }
+    }
+
     /**
      * Compute the intersection between the current bitmap and the provided
      * bitmap,
@@ -268,6 +413,129 @@ class Roaring64Map {
         return *this;
     }
 
+    /**
+     * Parallel variant of operator&=: each shard pair is independent, so
+     * the shard-merge loop is spread over up to n_threads worker threads.
+     * Setting n_threads to zero (the default) uses one thread per hardware
+     * core.
+     */
+    Roaring64Map &andInplaceParallel(const Roaring64Map &r,
+                                     size_t n_threads = 0) {
+        if (n_threads == 0) n_threads = std::thread::hardware_concurrency();
+        const size_t n_shards = roarings.size();
+        if (n_threads <= 1 || n_shards < 2) return *this &= r;
+        if (n_threads > n_shards) n_threads = n_shards;
+        std::vector<Roaring *> lhs(n_shards);
+        std::vector<const Roaring *> rhs(n_shards);
+        size_t n = 0;
+        for (auto &map_entry : roarings) {
+            lhs[n] = &map_entry.second;
+            auto partner = r.roarings.find(map_entry.first);
+            rhs[n] = partner == r.roarings.cend() ? nullptr : &partner->second;
+            n++;
+        }
+        applyShardPairsParallel(lhs, rhs, n_threads,
+                                [](Roaring &mine, const Roaring *other) {
+                                    if (other == nullptr)
+                                        mine = Roaring();
+                                    else
+                                        mine &= *other;
+                                });
+        return *this;
+    }
+
+    /**
+     * Parallel variant of operator-=, with the same threading behavior as
+     * andInplaceParallel.
+     */
+    Roaring64Map &andnotInplaceParallel(const Roaring64Map &r,
+                                        size_t n_threads = 0) {
+        if (n_threads == 0) n_threads = std::thread::hardware_concurrency();
+        if (n_threads <= 1 || roarings.size() < 2) return *this -= r;
+        // only the shards present on both sides have any work to do
+        std::vector<Roaring *> lhs;
+        std::vector<const Roaring *> rhs;
+        for (auto &map_entry : roarings) {
+            auto partner = r.roarings.find(map_entry.first);
+            if (partner == r.roarings.cend()) continue;
+            lhs.push_back(&map_entry.second);
+            rhs.push_back(&partner->second);
+        }
+        if (lhs.empty()) return *this;
+        if (n_threads > lhs.size()) n_threads = lhs.size();
+        applyShardPairsParallel(lhs, rhs, n_threads,
+                                [](Roaring &mine, const Roaring *other) {
+                                    mine -= *other;
+                                });
+        return *this;
+    }
+
+    /**
+     * Parallel variant of operator|=, with the same threading behavior as
+     * andInplaceParallel. Shards of r that are missing on this side are
+     * inserted (empty) up front on the calling thread, after which every
+     * shard merge is independent.
+     */
+    Roaring64Map &orInplaceParallel(const Roaring64Map &r,
+                                    size_t n_threads = 0) {
+        if (n_threads == 0) n_threads = std::thread::hardware_concurrency();
+        const size_t n_shards = r.roarings.size();
+        if (n_threads <= 1 || n_shards < 2) return *this |= r;
+        if (n_threads > n_shards) n_threads = n_shards;
+        // create the missing shards first: inserting into the shard vector
+        // would invalidate the pointers the workers hold
+        for (const auto &map_entry : r.roarings) {
+            if (roarings.count(map_entry.first) == 0) {
+                roarings[map_entry.first].setCopyOnWrite(copyOnWrite);
+            }
+        }
+        std::vector<Roaring *> lhs(n_shards);
+        std::vector<const Roaring *> rhs(n_shards);
+        size_t n = 0;
+        for (const auto &map_entry : r.roarings) {
+            lhs[n] = &roarings.find(map_entry.first)->second;
+            rhs[n] = &map_entry.second;
+            n++;
+        }
+        applyShardPairsParallel(lhs, rhs, n_threads,
+                                [](Roaring &mine, const Roaring *other) {
+                                    mine |= *other;
+                                });
+        return *this;
+    }
+
+    /**
+     * Parallel variant of operator^=, with the same threading behavior as
+     * orInplaceParallel.
+     */
+    Roaring64Map &xorInplaceParallel(const Roaring64Map &r,
+                                     size_t n_threads = 0) {
+        if (n_threads == 0) n_threads = std::thread::hardware_concurrency();
+        const size_t n_shards = r.roarings.size();
+        if (n_threads <= 1 || n_shards < 2) return *this ^= r;
+        if (n_threads > n_shards) n_threads = n_shards;
+        // create the missing shards first: inserting into the shard vector
+        // would invalidate the pointers the workers hold
+        for (const auto &map_entry : r.roarings) {
+            if (roarings.count(map_entry.first) == 0) {
+                roarings[map_entry.first].setCopyOnWrite(copyOnWrite);
+            }
+        }
+        std::vector<Roaring *> lhs(n_shards);
+        std::vector<const Roaring *> rhs(n_shards);
+        size_t n = 0;
+        for (const auto &map_entry : r.roarings) {
+            lhs[n] = &roarings.find(map_entry.first)->second;
+            rhs[n] = &map_entry.second;
+            n++;
+        }
+        applyShardPairsParallel(lhs, rhs, n_threads,
+                                [](Roaring &mine, const Roaring *other) {
+                                    mine ^= *other;
+                                });
+        return *this;
+    }
+
     /**
      * Exchange the content of this bitmap with another.
      */
@@ -293,6 +561,44 @@ class Roaring64Map {
             });
     }
 
+    /**
+     * Parallel variant of cardinality(): the per-shard cardinalities are
+     * computed on up to n_threads worker threads. Setting n_threads to zero
+     * (the default) uses one thread per hardware core. Throws
+     * std::length_error when the bitmap is full, like cardinality().
+     */
+    uint64_t cardinalityParallel(size_t n_threads = 0) const {
+        if (n_threads == 0) n_threads = std::thread::hardware_concurrency();
+        const size_t n_shards = roarings.size();
+        if (n_threads <= 1 || n_shards < 2) return cardinality();
+        if (isFull()) {
+            throw std::length_error(
+                "bitmap is full, cardinality is 2^64, "
+                "unable to represent in a 64-bit integer");
+        }
+        if (n_threads > n_shards) n_threads = n_shards;
+        std::vector<const Roaring *> shards(n_shards);
+        size_t n = 0;
+        for (const auto &map_entry : roarings) {
+            shards[n++] = &map_entry.second;
+        }
+        std::vector<uint64_t> partial(n_threads, 0);
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < n_threads; t++) {
+            const size_t begin = n_shards * t / n_threads;
+            const size_t end = n_shards * (t + 1) / n_threads;
+            workers.emplace_back([&shards, &partial, t, begin, end]() {
+                uint64_t sum = 0;
+                for (size_t s = begin; s < end; s++) {
+                    sum += shards[s]->cardinality();
+                }
+                partial[t] = sum;
+            });
+        }
+        for (auto &worker : workers) worker.join();
+        return std::accumulate(partial.cbegin(), partial.cend(), (uint64_t)0);
+    }
+
     /**
     * Returns true if the bitmap is empty (cardinality is zero).
     */
@@ -367,6 +673,47 @@ class Roaring64Map {
                               });
     }
 
+    /**
+     * Parallel variant of toUint64Array: each shard's slot in the output is
+     * computed up front from the per-shard cardinalities, after which the
+     * shards are dumped independently on up to n_threads worker threads.
+     * Setting n_threads to zero (the default) uses one thread per hardware
+     * core.
+     */
+    void toUint64ArrayParallel(uint64_t *ans, size_t n_threads = 0) const {
+        if (n_threads == 0) n_threads = std::thread::hardware_concurrency();
+        const size_t n_shards = roarings.size();
+        if (n_threads <= 1 || n_shards < 2) return toUint64Array(ans);
+        if (n_threads > n_shards) n_threads = n_shards;
+        std::vector<const Roaring *> shards(n_shards);
+        std::vector<uint32_t> keys(n_shards);
+        std::vector<uint64_t> offsets(n_shards);
+        uint64_t offset = 0;
+        size_t n = 0;
+        for (const auto &map_entry : roarings) {
+            shards[n] = &map_entry.second;
+            keys[n] = map_entry.first;
+            offsets[n] = offset;
+            offset += map_entry.second.cardinality();
+            n++;
+        }
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < n_threads; t++) {
+            const size_t begin = n_shards * t / n_threads;
+            const size_t end = n_shards * (t + 1) / n_threads;
+            workers.emplace_back([&shards, &keys, &offsets, ans, begin,
+                                  end]() {
+                for (size_t s = begin; s < end; s++) {
+                    uint64_t *out = ans + offsets[s];
+                    for (uint32_t low_bits : *shards[s]) {
+                        *out++ = uniteBytes(keys[s], low_bits);
+                    }
+                }
+            });
+        }
+        for (auto &worker : workers) worker.join();
+    }
+
     /**
      * Return true if the two bitmaps contain the same elements.
      */
@@ -375,48 +722,28 @@ class Roaring64Map {
         // empty Roaring Bitmaps
         auto lhs_iter = roarings.cbegin();
         auto rhs_iter = r.roarings.cbegin();
-        do {
-            // if the left map has reached its end, ensure that the right map
-            // contains only empty Bitmaps
-            if (lhs_iter == roarings.cend()) {
-                while (rhs_iter != r.roarings.cend()) {
-                    if (rhs_iter->second.isEmpty()) {
-                        ++rhs_iter;
-                        continue;
-                    }
-                    return false;
-                }
-                return true;
-            }
-            // if the left map has an empty bitmap, skip it
-            if (lhs_iter->second.isEmpty()) {
+        while (true) {
+            // skip the empty shards on both sides; they carry no values
+            while (lhs_iter != roarings.cend() && lhs_iter->second.isEmpty()) {
                 ++lhs_iter;
-                continue;
             }
-
-            do {
-                // if the right map has reached its end, ensure that the right
-                // map contains only empty Bitmaps
-                if (rhs_iter == r.roarings.cend()) {
-                    while (lhs_iter != roarings.cend()) {
-                        if (lhs_iter->second.isEmpty()) {
-                            ++lhs_iter;
-                            continue;
-                        }
-                        return false;
-                    }
-                    return true;
-                }
-                // if the right map has an empty bitmap, skip it
-                if (rhs_iter->second.isEmpty()) {
-                    ++rhs_iter;
-                    continue;
-                }
-            } while (false);
-            // if neither map has reached its end ensure elements are equal and
-            // move to the next element in both
-        } while (lhs_iter++->second == rhs_iter++->second);
-        return false;
+            while (rhs_iter != r.roarings.cend() &&
+                   rhs_iter->second.isEmpty()) {
+                ++rhs_iter;
+            }
+            if (lhs_iter == roarings.cend() ||
+                rhs_iter == r.roarings.cend()) {
+                // equal iff both sides ran out of non-empty shards together
+                return lhs_iter == roarings.cend() &&
+                       rhs_iter == r.roarings.cend();
+            }
+            if (lhs_iter->first != rhs_iter->first ||
+                !(lhs_iter->second == rhs_iter->second)) {
+                return false;
+            }
+            ++lhs_iter;
+            ++rhs_iter;
+        }
     }
 
     /**
@@ -457,7 +784,7 @@ class Roaring64Map {
     bool removeRunCompression() {
         return std::accumulate(
             roarings.begin(), roarings.end(), true,
-            [](bool previous, std::pair<const uint32_t, Roaring> &map_entry) {
+            [](bool previous, std::pair<uint32_t, Roaring> &map_entry) {
                 return map_entry.second.removeRunCompression() && previous;
             });
     }
@@ -471,7 +798,7 @@ class Roaring64Map {
     bool runOptimize() {
         return std::accumulate(
             roarings.begin(), roarings.end(), true,
-            [](bool previous, std::pair<const uint32_t, Roaring> &map_entry) {
+            [](bool previous, std::pair<uint32_t, Roaring> &map_entry) {
                 return map_entry.second.runOptimize() && previous;
             });
     }
@@ -487,7 +814,7 @@ class Roaring64Map {
             if (iter->second.isEmpty()) {
                 // empty Roarings are 84 bytes
                 savedBytes += 88;
-                roarings.erase(iter++);
+                iter = roarings.erase(iter);
             } else {
                 savedBytes += iter->second.shrinkToFit();
                 iter++;
@@ -534,6 +861,44 @@ class Roaring64Map {
         return false;
     }
 
+    /**
+     * Selects the values at the ranks in [begin, end), which must be sorted
+     * in increasing order, writing them to ans. Each shard is located once
+     * and handed every rank falling inside it, rather than rescanning the
+     * shard map per rank. Returns false (leaving ans partially filled) if
+     * some rank is greater than or equal to the cardinality.
+     */
+    bool selectMany(const uint64_t *begin, const uint64_t *end,
+                    uint64_t *ans) const {
+        uint64_t accumulated = 0;
+        const uint64_t *cur = begin;
+        for (auto roaring_iter = roarings.cbegin();
+             roaring_iter != roarings.cend() && cur != end; ++roaring_iter) {
+            const uint64_t sub_cardinality =
+                roaring_iter->second.cardinality();
+            uint32_t sub_rnks[1024];
+            uint32_t sub_ans[1024];
+            while (cur != end && *cur - accumulated < sub_cardinality) {
+                size_t count = 0;
+                do {
+                    sub_rnks[count++] = (uint32_t)(*cur++ - accumulated);
+                } while (cur != end &&
+                         count < sizeof(sub_rnks) / sizeof(sub_rnks[0]) &&
+                         *cur - accumulated < sub_cardinality);
+                if (!roaring_iter->second.selectMany(sub_rnks,
+                                                     sub_rnks + count,
+                                                     sub_ans)) {
+                    return false;
+                }
+                for (size_t i = 0; i < count; ++i) {
+                    *ans++ = uniteBytes(roaring_iter->first, sub_ans[i]);
+                }
+            }
+            accumulated += sub_cardinality;
+        }
+        return cur == end;
+    }
+
     /**
     * Returns the number of integers that are smaller or equal to x.
     */
@@ -556,12 +921,61 @@ class Roaring64Map {
         return result;
     }
 
+    /**
+     * Ranks all the values in [begin, end), which must be sorted in
+     * increasing order; the ranks are written to ans. The shard map and the
+     * input are walked together, so the per-shard cardinality prefix is
+     * accumulated once instead of once per value as repeated rank calls
+     * would do.
+     */
+    void rankMany(const uint64_t *begin, const uint64_t *end,
+                  uint64_t *ans) const {
+        uint64_t accumulated = 0;
+        auto roaring_iter = roarings.cbegin();
+        uint32_t lows[1024];
+        uint64_t sub_rnks[1024];
+        const uint64_t *cur = begin;
+        while (cur != end) {
+            const uint32_t high = highBytes(*cur);
+            // fold in every shard strictly below the current high bits
+            while (roaring_iter != roarings.cend() &&
+                   roaring_iter->first < high) {
+                accumulated += roaring_iter->second.cardinality();
+                ++roaring_iter;
+            }
+            if (roaring_iter == roarings.cend() ||
+                roaring_iter->first != high) {
+                do {
+                    *ans++ = accumulated;
+                } while (++cur != end && highBytes(*cur) == high);
+                continue;
+            }
+            while (cur != end && highBytes(*cur) == high) {
+                size_t count = 0;
+                do {
+                    lows[count++] = lowBytes(*cur++);
+                } while (cur != end &&
+                         count < sizeof(lows) / sizeof(lows[0]) &&
+                         highBytes(*cur) == high);
+                roaring_iter->second.rankMany(lows, lows + count, sub_rnks);
+                for (size_t i = 0; i < count; ++i) {
+                    *ans++ = accumulated + sub_rnks[i];
+                }
+            }
+        }
+    }
+
     /**
      * write a bitmap to a char buffer. This is meant to be compatible with
      * the
      * Java and Go versions. Returns how many bytes were written which should be
      * getSizeInBytes().
      *
+     * With the portable flag set, the output follows the shared 64-bit
+     * Roaring format (a 64-bit shard count, then for each shard its 32-bit
+     * high bits followed by the portable 32-bit serialization), so the
+     * stream can be exchanged with the Java and Go implementations.
+     *
      * Setting the portable flag to false enable a custom format that
      * can save space compared to the portable format (e.g., for very
      * sparse bitmaps).
@@ -586,6 +1000,54 @@ class Roaring64Map {
         return buf - orig;
     }
 
+    /**
+     * write a bitmap to a char buffer like write(), except that the shards
+     * are serialized by several threads. The offset of every shard in the
+     * output is computed up front from getSizeInBytes(), after which the
+     * shards are fully independent, so the result is byte-identical to
+     * write(). Setting n_threads to zero (the default) uses one thread per
+     * hardware core.
+     */
+    size_t writeParallel(char *buf, size_t n_threads = 0,
+                         bool portable = true) const {
+        if (n_threads == 0) n_threads = std::thread::hardware_concurrency();
+        const size_t n_shards = roarings.size();
+        if (n_threads <= 1 || n_shards < 2) return write(buf, portable);
+        if (n_threads > n_shards) n_threads = n_shards;
+        // compute where each shard lands in the output
+        std::vector<const Roaring *> shards(n_shards);
+        std::vector<uint32_t> keys(n_shards);
+        size_t bytes = sizeof(uint64_t);
+        size_t n = 0;
+        std::vector<size_t> offsets(n_shards);
+        for (const auto &map_entry : roarings) {
+            shards[n] = &map_entry.second;
+            keys[n] = map_entry.first;
+            offsets[n] = bytes;
+            bytes +=
+                sizeof(uint32_t) + map_entry.second.getSizeInBytes(portable);
+            n++;
+        }
+        // push map size
+        *((uint64_t *)buf) = (uint64_t)n_shards;
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < n_threads; t++) {
+            const size_t begin = n_shards * t / n_threads;
+            const size_t end = n_shards * (t + 1) / n_threads;
+            workers.emplace_back([&, begin, end]() {
+                for (size_t s = begin; s < end; s++) {
+                    char *out = buf + offsets[s];
+                    // push map key
+                    memcpy(out, &keys[s], sizeof(uint32_t));
+                    // push map value Roaring
+                    shards[s]->write(out + sizeof(uint32_t), portable);
+                }
+            });
+        }
+        for (auto &worker : workers) worker.join();
+        return bytes;
+    }
+
     /**
      * read a bitmap from a serialized version. This is meant to be compatible
      * with
@@ -653,6 +1115,67 @@ class Roaring64Map {
         return result;
     }
 
+    /**
+     * read a bitmap serialized in the portable format, deserializing the
+     * shards on several threads. A cheap scan of the container headers
+     * locates each shard in the buffer without materializing its containers;
+     * the shards themselves are then fully independent. Setting n_threads to
+     * zero (the default) uses one thread per hardware core.
+     *
+     * This function is unsafe in the sense that if you provide bad data,
+     * many bytes could be read, possibly causing a buffer overflow. See also
+     * readSafe.
+     */
+    static Roaring64Map readParallel(const char *buf, size_t n_threads = 0) {
+        if (n_threads == 0) n_threads = std::thread::hardware_concurrency();
+        // get map size
+        uint64_t map_size = *((uint64_t *)buf);
+        if (n_threads <= 1 || map_size < 2) return read(buf, true);
+        if (n_threads > map_size) n_threads = (size_t)map_size;
+        buf += sizeof(uint64_t);
+        // locate each shard: the portable headers give the serialized sizes
+        // without deserializing the containers
+        std::vector<std::pair<uint32_t, Roaring>> entries((size_t)map_size);
+        std::vector<const char *> starts((size_t)map_size);
+        for (uint64_t lcv = 0; lcv < map_size; lcv++) {
+            // get map key
+            memcpy(&entries[lcv].first, buf, sizeof(uint32_t));
+            buf += sizeof(uint32_t);
+            starts[lcv] = buf;
+            buf += roaring_bitmap_portable_deserialize_size(
+                buf, (std::numeric_limits<size_t>::max)());
+        }
+        std::vector<char> failures(n_threads, 0);
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < n_threads; t++) {
+            const size_t begin = (size_t)map_size * t / n_threads;
+            const size_t end = (size_t)map_size * (t + 1) / n_threads;
+            workers.emplace_back([&, begin, end, t]() {
+                try {
+                    // read map value Roaring
+                    for (size_t s = begin; s < end; s++) {
+                        entries[s].second = Roaring::read(starts[s], true);
+                    }
+                } catch (...) {
+                    // the exception cannot cross the thread boundary
+                    failures[t] = 1;
+                }
+            });
+        }
+        for (auto &worker : workers) worker.join();
+        for (size_t t = 0; t < n_threads; t++) {
+            if (failures[t]) {
+                throw std::runtime_error("failed alloc while reading");
+            }
+        }
+        Roaring64Map result;
+        for (auto &entry : entries) {
+            // the keys arrive in increasing order, so these all append
+            result.roarings.emplace(entry.first, std::move(entry.second));
+        }
+        return result;
+    }
+
     /**
      * How many bytes are required to serialize this bitmap (meant to be
      * compatible
@@ -714,7 +1237,7 @@ class Roaring64Map {
         if (copyOnWrite == val) return;
         copyOnWrite = val;
         std::for_each(roarings.begin(), roarings.end(),
-                      [=](std::pair<const uint32_t, Roaring> &map_entry) {
+                      [=](std::pair<uint32_t, Roaring> &map_entry) {
                           map_entry.second.setCopyOnWrite(val);
                       });
     }
@@ -850,7 +1373,7 @@ class Roaring64Map {
     const_iterator end() const;
 	
    private:
-    std::map<uint32_t, Roaring> roarings;
+    Roaring64ShardMap roarings;
     bool copyOnWrite = false;
     static uint32_t highBytes(const uint64_t in) { return uint32_t(in >> 32); }
     static uint32_t lowBytes(const uint64_t in) { return uint32_t(in); }
@@ -858,14 +1381,29 @@ class Roaring64Map {
                                const uint32_t lowBytes) {
         return (uint64_t(highBytes) << 32) | uint64_t(lowBytes);
     }
-    // this is needed to tolerate gcc's C++11 libstdc++ lacking emplace
-    // prior to version 4.8
     void emplaceOrInsert(const uint32_t key, const Roaring &value) {
-#if defined(__GLIBCXX__) && __GLIBCXX__ < 20130322
-        roarings.insert(std::make_pair(key, value));
-#else
-        roarings.emplace(std::make_pair(key, value));
-#endif
+        roarings.emplace(key, value);
+    }
+
+    // run op over every (lhs shard, rhs shard) pair on n_threads workers;
+    // the pairs are independent, so no synchronization is needed beyond the
+    // final join
+    template <typename BinOp>
+    static void applyShardPairsParallel(std::vector<Roaring *> &lhs,
+                                        std::vector<const Roaring *> &rhs,
+                                        size_t n_threads, BinOp op) {
+        const size_t n_shards = lhs.size();
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < n_threads; t++) {
+            const size_t begin = n_shards * t / n_threads;
+            const size_t end = n_shards * (t + 1) / n_threads;
+            workers.emplace_back([&lhs, &rhs, begin, end, op]() {
+                for (size_t s = begin; s < end; s++) {
+                    op(*lhs[s], rhs[s]);
+                }
+            });
+        }
+        for (auto &worker : workers) worker.join();
     }
 };
 
@@ -992,9 +1530,9 @@ class Roaring64MapSetBitForwardIterator {
       }
 
    protected:
-	const std::map<uint32_t, Roaring>& p;
-    std::map<uint32_t, Roaring>::const_iterator map_iter;
-    std::map<uint32_t, Roaring>::const_iterator map_end;
+	const Roaring64ShardMap& p;
+    Roaring64ShardMap::const_iterator map_iter;
+    Roaring64ShardMap::const_iterator map_end;
     roaring_uint32_iterator_t i;
 };
 
@@ -1043,7 +1581,7 @@ class Roaring64MapSetBitBiDirectionalIterator final :public Roaring64MapSetBitFo
     }
 	
  protected:
-	std::map<uint32_t, Roaring>::const_iterator map_begin;
+	Roaring64ShardMap::const_iterator map_begin;
 };
 
 inline Roaring64MapSetBitForwardIterator Roaring64Map::begin() const {
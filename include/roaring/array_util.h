@@ -32,6 +32,68 @@ inline int32_t binarySearch(const uint16_t *array, int32_t lenarray,
     return -(low + 1);
 }
 
+/*
+ *  Like binarySearch (same return convention), but tuned for long arrays:
+ *  each probe prefetches both possible follow-up probes so the dependent
+ *  cache misses overlap, and the final stretch is resolved with vector
+ *  comparisons. Worthwhile once the array spans many cache lines.
+ */
+int32_t binarySearchLarge(const uint16_t *array, int32_t lenarray,
+                          uint16_t ikey);
+
+/**
+ * Branch-free lower bound: returns the number of keys strictly smaller than
+ * ikey, which is also the first index holding a key >= ikey (possibly
+ * lenarray). The search narrows with conditional moves down to a 16-key
+ * block, which is then resolved with vector comparisons and a movemask
+ * instead of further data-dependent branches, so mispredictions cost
+ * nothing on lookup-heavy workloads.
+ */
+inline int32_t lower_bound_uint16(const uint16_t *array, int32_t lenarray,
+                                  uint16_t ikey) {
+#ifdef USESSE4
+    int32_t low = 0;
+    int32_t n = lenarray;
+    while (n > 16) {
+        const int32_t half = n >> 1;
+        // compiles to a conditional move, not a branch
+        low = (array[low + half] < ikey) ? low + half : low;
+        n -= half;
+    }
+    // count the keys below ikey in the remaining block, eight per comparison
+    const __m128i conv = _mm_set1_epi16((int16_t)0x8000);
+    const __m128i key = _mm_set1_epi16((int16_t)(ikey ^ 0x8000));
+    const int32_t end = low + n;
+    int32_t pos = low;
+    int32_t count = 0;
+    while (pos + 8 <= end) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(array + pos));
+        v = _mm_xor_si128(v, conv);  // order the unsigned keys as signed
+        const __m128i lt = _mm_cmpgt_epi16(key, v);
+        count += _mm_popcnt_u32((uint32_t)_mm_movemask_epi8(lt)) >> 1;
+        pos += 8;
+    }
+    while (pos < end) {
+        count += (int32_t)(array[pos] < ikey);  // flag addition, no branch
+        pos++;
+    }
+    return low + count;
+#else
+    // the conditional-move halving alone is already branch free
+    int32_t low = 0;
+    int32_t n = lenarray;
+    while (n > 1) {
+        const int32_t half = n >> 1;
+        low = (array[low + half] < ikey) ? low + half : low;
+        n -= half;
+    }
+    if (n == 1) {
+        low += (int32_t)(array[low] < ikey);
+    }
+    return low;
+#endif
+}
+
 /**
  * Galloping search
  * Assumes that array is sorted, has logarithmic complexity.
@@ -146,6 +208,17 @@ int32_t intersect_skewed_uint16_cardinality(const uint16_t *smallarray,
 /* Check whether the size of the intersection between one small and one large set of uint16_t is non-zero. */
 bool intersect_skewed_uint16_nonempty(const uint16_t *smallarray, size_t size_s,
                                 const uint16_t *largearray, size_t size_l);
+
+/* For each of the n targets (which need not be sorted), check membership in
+ * the sorted array and write one bool per target; the probes are resolved
+ * several at a time so that their comparisons overlap. */
+void contains_many_uint16(const uint16_t *array, int32_t length,
+                          const uint16_t *targets, size_t n, bool *out);
+
+/* In-place reconstruction of a strictly increasing sequence from its
+ * delta-minus-one encoding: buf[0] holds the first value and buf[i] holds
+ * gap(i) - 1 on entry, the decoded values on exit (vectorized). */
+void prefix_sum_deltas_uint16(uint16_t *buf, int32_t length);
 /**
  * Generic intersection function.
  */
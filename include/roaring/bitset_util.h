@@ -148,6 +148,21 @@ size_t bitset_extract_setbits_avx2(uint64_t *bitset, size_t length, void *vout,
 size_t bitset_extract_setbits(uint64_t *bitset, size_t length, void *vout,
                               uint32_t base);
 
+/*
+ * Given a bitset containing "length" 64-bit words, write out the position
+ * of set bits to "out", values start at "base", writing out no more than
+ * "outcapacity" values. Decoding always stops on a word boundary: a word is
+ * either decoded in full or not consumed at all, so the caller can resume
+ * from the first unconsumed word. On return, *words_consumed holds how many
+ * words were consumed (trailing empty words count as consumed).
+ *
+ * Returns how many values were actually decoded. Uses SIMD decoding when
+ * available.
+ */
+size_t bitset_extract_setbits_partial(uint64_t *words, size_t length,
+                                      uint32_t *out, size_t outcapacity,
+                                      uint32_t base, size_t *words_consumed);
+
 /*
  * Given a bitset containing "length" 64-bit words, write out the position
  * of all the set bits to "out" as 16-bit integers, values start at "base" (can
@@ -535,4 +550,119 @@ AVXPOPCNTFNC(andnot, _mm256_andnot_si256)
 
 #endif  // USEAVX
 
+#ifdef USEAVX512
+#if defined(__GNUC__) && !defined(__clang__)
+// GCC implements some AVX-512 intrinsics on top of _mm512_undefined_epi32()
+// which trips -Wmaybe-uninitialized (GCC bug 105593); not a real issue.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+/***
+ * BEGIN AVX-512 popcount functions (VPOPCNTDQ).
+ *
+ * With a hardware 64-bit vector popcount there is no need for the
+ * Harley-Seal reduction: a simple unrolled sum is already limited by
+ * load bandwidth.
+ */
+
+static inline uint64_t avx512_vpopcount(const __m512i *data,
+                                        const uint64_t size) {
+    __m512i total0 = _mm512_setzero_si512();
+    __m512i total1 = _mm512_setzero_si512();
+    const uint64_t limit = size - size % 4;
+    uint64_t i = 0;
+    for (; i < limit; i += 4) {
+        total0 = _mm512_add_epi64(
+            total0, _mm512_popcnt_epi64(_mm512_loadu_si512(data + i)));
+        total1 = _mm512_add_epi64(
+            total1, _mm512_popcnt_epi64(_mm512_loadu_si512(data + i + 1)));
+        total0 = _mm512_add_epi64(
+            total0, _mm512_popcnt_epi64(_mm512_loadu_si512(data + i + 2)));
+        total1 = _mm512_add_epi64(
+            total1, _mm512_popcnt_epi64(_mm512_loadu_si512(data + i + 3)));
+    }
+    for (; i < size; i++) {
+        total0 = _mm512_add_epi64(
+            total0, _mm512_popcnt_epi64(_mm512_loadu_si512(data + i)));
+    }
+    return (uint64_t)_mm512_reduce_add_epi64(
+        _mm512_add_epi64(total0, total1));
+}
+
+#define AVX512POPCNTFNC(opname, avx_intrinsic)                                 \
+    static inline uint64_t avx512_popcount_##opname(                           \
+        const __m512i *data1, const __m512i *data2, const uint64_t size) {     \
+        __m512i total = _mm512_setzero_si512();                                \
+        const uint64_t limit = size - size % 4;                                \
+        uint64_t i = 0;                                                        \
+        for (; i < limit; i += 4) {                                            \
+            __m512i A1 = avx_intrinsic(_mm512_loadu_si512(data1 + i),          \
+                                       _mm512_loadu_si512(data2 + i));         \
+            __m512i A2 = avx_intrinsic(_mm512_loadu_si512(data1 + i + 1),      \
+                                       _mm512_loadu_si512(data2 + i + 1));     \
+            __m512i A3 = avx_intrinsic(_mm512_loadu_si512(data1 + i + 2),      \
+                                       _mm512_loadu_si512(data2 + i + 2));     \
+            __m512i A4 = avx_intrinsic(_mm512_loadu_si512(data1 + i + 3),      \
+                                       _mm512_loadu_si512(data2 + i + 3));     \
+            total = _mm512_add_epi64(total, _mm512_popcnt_epi64(A1));          \
+            total = _mm512_add_epi64(total, _mm512_popcnt_epi64(A2));          \
+            total = _mm512_add_epi64(total, _mm512_popcnt_epi64(A3));          \
+            total = _mm512_add_epi64(total, _mm512_popcnt_epi64(A4));          \
+        }                                                                      \
+        for (; i < size; i++) {                                                \
+            __m512i A1 = avx_intrinsic(_mm512_loadu_si512(data1 + i),          \
+                                       _mm512_loadu_si512(data2 + i));         \
+            total = _mm512_add_epi64(total, _mm512_popcnt_epi64(A1));          \
+        }                                                                      \
+        return (uint64_t)_mm512_reduce_add_epi64(total);                       \
+    }                                                                          \
+    static inline uint64_t avx512_popcountandstore_##opname(                   \
+        const __m512i *__restrict__ data1, const __m512i *__restrict__ data2,  \
+        __m512i *__restrict__ out, const uint64_t size) {                      \
+        __m512i total = _mm512_setzero_si512();                                \
+        const uint64_t limit = size - size % 4;                                \
+        uint64_t i = 0;                                                        \
+        for (; i < limit; i += 4) {                                            \
+            __m512i A1 = avx_intrinsic(_mm512_loadu_si512(data1 + i),          \
+                                       _mm512_loadu_si512(data2 + i));         \
+            _mm512_storeu_si512(out + i, A1);                                  \
+            __m512i A2 = avx_intrinsic(_mm512_loadu_si512(data1 + i + 1),      \
+                                       _mm512_loadu_si512(data2 + i + 1));     \
+            _mm512_storeu_si512(out + i + 1, A2);                              \
+            __m512i A3 = avx_intrinsic(_mm512_loadu_si512(data1 + i + 2),      \
+                                       _mm512_loadu_si512(data2 + i + 2));     \
+            _mm512_storeu_si512(out + i + 2, A3);                              \
+            __m512i A4 = avx_intrinsic(_mm512_loadu_si512(data1 + i + 3),      \
+                                       _mm512_loadu_si512(data2 + i + 3));     \
+            _mm512_storeu_si512(out + i + 3, A4);                              \
+            total = _mm512_add_epi64(total, _mm512_popcnt_epi64(A1));          \
+            total = _mm512_add_epi64(total, _mm512_popcnt_epi64(A2));          \
+            total = _mm512_add_epi64(total, _mm512_popcnt_epi64(A3));          \
+            total = _mm512_add_epi64(total, _mm512_popcnt_epi64(A4));          \
+        }                                                                      \
+        for (; i < size; i++) {                                                \
+            __m512i A1 = avx_intrinsic(_mm512_loadu_si512(data1 + i),          \
+                                       _mm512_loadu_si512(data2 + i));         \
+            _mm512_storeu_si512(out + i, A1);                                  \
+            total = _mm512_add_epi64(total, _mm512_popcnt_epi64(A1));          \
+        }                                                                      \
+        return (uint64_t)_mm512_reduce_add_epi64(total);                       \
+    }
+
+AVX512POPCNTFNC(or, _mm512_or_si512)
+AVX512POPCNTFNC(union, _mm512_or_si512)
+AVX512POPCNTFNC(and, _mm512_and_si512)
+AVX512POPCNTFNC(intersection, _mm512_and_si512)
+AVX512POPCNTFNC (xor, _mm512_xor_si512)
+AVX512POPCNTFNC(andnot, _mm512_andnot_si512)
+
+/***
+ * END AVX-512 popcount functions.
+ */
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif  // USEAVX512
+
 #endif
@@ -19,7 +19,11 @@ enum { DEFAULT_MAX_SIZE = 4096 };
 /* struct array_container - sparse representation of a bitmap
  *
  * @cardinality: number of indices in `array` (and the bitmap)
- * @capacity:    allocated size of `array`
+ * @capacity:    allocated size of `array`; a negative value marks a
+ *               borrowed payload (see roaring_bitmap_compact): `array`
+ *               then points into an arena holding exactly -capacity
+ *               entries and must never be freed or reallocated, growth
+ *               falls back to an owned heap copy
  * @array:       sorted list of integers
  */
 struct array_container_s {
@@ -80,10 +84,12 @@ static inline bool array_container_empty(const array_container_t *array) {
     return array->cardinality == 0;
 }
 
-/* check whether the cardinality is equal to the capacity (this does not mean
-* that it contains 1<<16 elements) */
+/* check whether there is no spare room left (this does not mean that it
+* contains 1<<16 elements); >= so that borrowed payloads, whose capacity is
+* negative, always count as full and route insertions through
+* array_container_grow */
 static inline bool array_container_full(const array_container_t *array) {
-    return array->cardinality == array->capacity;
+    return array->cardinality >= array->capacity;
 }
 
 
@@ -167,6 +173,9 @@ bool array_container_iterate(const array_container_t *cont, uint32_t base,
 bool array_container_iterate64(const array_container_t *cont, uint32_t base,
                                roaring_iterator64 iterator, uint64_t high_bits,
                                void *ptr);
+bool array_container_iterate_ranges(const array_container_t *cont,
+                                    uint32_t base,
+                                    roaring_range_iterator iterator, void *ptr);
 
 /**
  * Writes the underlying array to buf, outputs how many bytes were written.
@@ -318,33 +327,11 @@ static inline bool array_container_remove(array_container_t *arr,
 /* Check whether x is present.  */
 inline bool array_container_contains(const array_container_t *arr,
                                      uint16_t pos) {
-    //    return binarySearch(arr->array, arr->cardinality, pos) >= 0;
-    // binary search with fallback to linear search for short ranges
-    int32_t low = 0;
-    const uint16_t * carr = (const uint16_t *) arr->array;
-    int32_t high = arr->cardinality - 1;
-    //    while (high - low >= 0) {
-    while(high >= low + 16) {
-        int32_t middleIndex = (low + high)>>1;
-        uint16_t middleValue = carr[middleIndex];
-        if (middleValue < pos) {
-            low = middleIndex + 1;
-        } else if (middleValue > pos) {
-            high = middleIndex - 1;
-        } else {
-            return true;
-        }
-    }
-
-    for (int i=low; i <= high; i++) {
-        uint16_t v = carr[i];
-        if (v == pos) {
-            return true;
-        }
-        if ( v > pos ) return false;
-    }
-    return false;
-
+    // branch-free lower bound plus one final comparison: the data-dependent
+    // branches of a classic binary search mispredict half the time on
+    // lookup-heavy workloads
+    const int32_t idx = lower_bound_uint16(arr->array, arr->cardinality, pos);
+    return (idx < arr->cardinality) && (arr->array[idx] == pos);
 }
 
 //* Check whether a range of values from range_start (included) to range_end (excluded) is present. */
@@ -378,13 +365,9 @@ inline uint16_t array_container_maximum(const array_container_t *arr) {
 
 /* Returns the number of values equal or smaller than x */
 inline int array_container_rank(const array_container_t *arr, uint16_t x) {
-    const int32_t idx = binarySearch(arr->array, arr->cardinality, x);
-    const bool is_present = idx >= 0;
-    if (is_present) {
-        return idx + 1;
-    } else {
-        return -idx - 1;
-    }
+    const int32_t idx = lower_bound_uint16(arr->array, arr->cardinality, x);
+    return idx +
+           (int)((idx < arr->cardinality) && (arr->array[idx] == x));
 }
 
 /* Returns the index of the first value equal or smaller than x, or -1 */
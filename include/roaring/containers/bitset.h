@@ -25,6 +25,11 @@ enum {
 
 struct bitset_container_s {
     int32_t cardinality;
+    // nonzero when 'array' is a borrowed payload (see
+    // roaring_bitmap_compact): it then points into an arena owned by the
+    // enclosing bitmap and must never be freed; occupies what was padding,
+    // so the struct size is unchanged
+    int32_t borrowed;
     uint64_t *array;
 };
 
@@ -42,6 +47,9 @@ void bitset_container_clear(bitset_container_t *bitset);
 /* Set all bits to 1. */
 void bitset_container_set_all(bitset_container_t *bitset);
 
+/* Flip every bit (vectorized when possible), updating the cardinality. */
+void bitset_container_negate(bitset_container_t *bitset);
+
 /* Duplicate bitset */
 bitset_container_t *bitset_container_clone(const bitset_container_t *src);
 
@@ -412,6 +420,10 @@ bool bitset_container_iterate(const bitset_container_t *cont, uint32_t base,
 bool bitset_container_iterate64(const bitset_container_t *cont, uint32_t base,
                                 roaring_iterator64 iterator, uint64_t high_bits,
                                 void *ptr);
+bool bitset_container_iterate_ranges(const bitset_container_t *cont,
+                                     uint32_t base,
+                                     roaring_range_iterator iterator,
+                                     void *ptr);
 
 /**
  * Writes the underlying array to buf, outputs how many bytes were written.
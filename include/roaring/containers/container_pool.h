@@ -0,0 +1,61 @@
+/*
+ * container_pool.h
+ *
+ * An optional per-thread recycling pool for container shells. In-place
+ * operations free containers that become empty and allocate fresh ones on
+ * type conversion, so steady-state query loops can spend a measurable
+ * fraction of their time in the allocator. When the pool is enabled,
+ * bitset_container_free and friends park fully-allocated shells here and
+ * the matching create functions draw from the pool before calling the
+ * allocator.
+ *
+ * The pool is disabled by default and is strictly per-thread: each thread
+ * that wants recycling must set a capacity, and shells cached by one
+ * thread are never handed to another. Cached shells hold memory obtained
+ * through the global memory hooks, so a thread must drain its pool before
+ * the hooks are changed.
+ */
+
+#ifndef INCLUDE_CONTAINERS_CONTAINER_POOL_H_
+#define INCLUDE_CONTAINERS_CONTAINER_POOL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct bitset_container_s;
+struct array_container_s;
+struct run_container_s;
+
+/**
+ * Sets the maximum number of shells of each container type that the
+ * calling thread may cache. A capacity of zero (the default) disables
+ * recycling and drains anything currently cached. Shrinking the capacity
+ * also drains the pool.
+ */
+void roaring_container_pool_set_capacity(uint32_t shells_per_type);
+
+/**
+ * Returns the capacity configured by the calling thread, zero when
+ * recycling is disabled.
+ */
+uint32_t roaring_container_pool_capacity(void);
+
+/**
+ * Frees every shell cached by the calling thread. The pool stays enabled
+ * at its current capacity.
+ */
+void roaring_container_pool_drain(void);
+
+/* Internal: create paths call these to reuse a cached shell; they return
+ * NULL when the pool is disabled or empty. */
+struct bitset_container_s *container_pool_get_bitset(void);
+struct array_container_s *container_pool_get_array(void);
+struct run_container_s *container_pool_get_run(void);
+
+/* Internal: free paths call these to park a shell; they return false when
+ * the pool is disabled or full and the shell must be freed normally. */
+bool container_pool_put_bitset(struct bitset_container_s *bitset);
+bool container_pool_put_array(struct array_container_s *arr);
+bool container_pool_put_run(struct run_container_s *run);
+
+#endif /* INCLUDE_CONTAINERS_CONTAINER_POOL_H_ */
@@ -36,6 +36,32 @@
 // macro for pairing container type codes
 #define CONTAINER_PAIR(c1, c2) (4 * (c1) + (c2))
 
+/**
+ * The reference count on shared containers is atomic when the compiler
+ * provides C11 atomics, unless the user defines
+ * ROARING_DISABLE_ATOMIC_REFCOUNT. With an atomic refcount, distinct threads
+ * may concurrently copy (roaring_bitmap_copy) and free bitmaps that share
+ * containers through copy-on-write, as long as no thread mutates them: a
+ * read-only "master" bitmap can thus hand out zero-copy COW snapshots to
+ * many query threads. Mutating a given bitmap, shared or not, still requires
+ * external synchronization.
+ */
+#if !defined(ROARING_DISABLE_ATOMIC_REFCOUNT) && !defined(__cplusplus) && \
+    defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) &&         \
+    !defined(__STDC_NO_ATOMICS__)
+#define ROARING_ATOMIC_REFCOUNT
+#endif
+
+#ifdef ROARING_ATOMIC_REFCOUNT
+#include <stdatomic.h>
+typedef _Atomic(uint32_t) croaring_refcount_t;
+#else
+// C++ translation units never manipulate the count (all refcounting happens
+// in C code); they only need the same struct layout, so a plain integer of
+// the same size and alignment is used
+typedef uint32_t croaring_refcount_t;
+#endif
+
 /**
  * A shared container is a wrapper around a container
  * with reference counting.
@@ -44,7 +70,7 @@
 struct shared_container_s {
     void *container;
     uint8_t typecode;
-    uint32_t counter;  // to be managed atomically
+    croaring_refcount_t counter;
 };
 
 typedef struct shared_container_s shared_container_t;
@@ -113,15 +139,50 @@ static inline uint8_t get_container_type(const void *container, uint8_t type) {
  */
 void *container_clone(const void *container, uint8_t typecode);
 
+/**
+ * Shift a container by 'offset' positions within the 32-bit value space.
+ * The shifted values that stay within the container's 16-bit block land in
+ * *loc, the ones that wrap into the next block land in *hic; either may be
+ * set to NULL when it would be empty. Both outputs have typecode
+ * *result_type (the input's type, unwrapped if shared) and are owned by the
+ * caller. A zero offset yields a plain clone in *loc.
+ */
+void container_add_offset(const void *container, uint8_t typecode, void **loc,
+                          void **hic, uint8_t *result_type, uint16_t offset);
+
+/**
+ * Rewrite 'dst' so that its content equals 'src', recycling dst's storage
+ * when the types match and the capacity suffices; otherwise dst is freed and
+ * a clone of src is returned (NULL on allocation failure, with dst already
+ * freed). The resulting typecode is written to *result_typecode. Takes
+ * ownership of dst; src is left untouched.
+ */
+void *container_overwrite(void *dst, uint8_t dst_typecode, const void *src,
+                          uint8_t src_typecode, uint8_t *result_typecode);
+
+/**
+ * Compute a 64-bit fingerprint of a container's content. The fingerprint is
+ * derived from the maximal ranges of consecutive values, so it depends only
+ * on the stored values, never on the container's representation: equal
+ * contents in an array, bitset or run container fingerprint identically.
+ */
+uint64_t container_fingerprint(const void *container, uint8_t typecode);
+
 /* access to container underneath, cloning it if needed */
 static inline void *get_writable_copy_if_shared(
     void *candidate_shared_container, uint8_t *type) {
     if (*type == SHARED_CONTAINER_TYPE_CODE) {
-        return shared_container_extract_copy(
+        candidate_shared_container = shared_container_extract_copy(
             (shared_container_t *)candidate_shared_container, type);
-    } else {
-        return candidate_shared_container;
     }
+    if (*type == RUN_CONTAINER_TYPE_CODE &&
+        run_container_is_full_singleton(
+            (const run_container_t *)candidate_shared_container)) {
+        // the shared full container is immutable: hand back a private copy
+        return run_container_clone(
+            (const run_container_t *)candidate_shared_container);
+    }
+    return candidate_shared_container;
 }
 
 /**
@@ -480,7 +541,9 @@ static inline void *container_add(void *container, uint16_t val,
             return container;
         case ARRAY_CONTAINER_TYPE_CODE: {
             array_container_t *ac = (array_container_t *)container;
-            if (array_container_try_add(ac, val, DEFAULT_MAX_SIZE) != -1) {
+            if (array_container_try_add(
+                    ac, val, roaring_runtime_tuning.array_bitset_threshold) !=
+                -1) {
                 *new_typecode = ARRAY_CONTAINER_TYPE_CODE;
                 return ac;
             } else {
@@ -516,7 +579,8 @@ static inline void *container_remove(void *container, uint16_t val,
         case BITSET_CONTAINER_TYPE_CODE:
             if (bitset_container_remove((bitset_container_t *)container, val)) {
                 if (bitset_container_cardinality(
-                        (bitset_container_t *)container) <= DEFAULT_MAX_SIZE) {
+                        (bitset_container_t *)container) <=
+                    roaring_runtime_tuning.bitset_array_threshold) {
                     *new_typecode = ARRAY_CONTAINER_TYPE_CODE;
                     return array_container_from_bitset(
                         (bitset_container_t *)container);
@@ -825,6 +889,45 @@ static inline int container_and_cardinality(const void *c1, uint8_t type1,
     }
 }
 
+/**
+ * Compute the size of the symmetric difference between two containers.
+ */
+static inline int container_xor_cardinality(const void *c1, uint8_t type1,
+                                            const void *c2, uint8_t type2) {
+    c1 = container_unwrap_shared(c1, &type1);
+    c2 = container_unwrap_shared(c2, &type2);
+    if (CONTAINER_PAIR(type1, type2) ==
+        CONTAINER_PAIR(BITSET_CONTAINER_TYPE_CODE,
+                       BITSET_CONTAINER_TYPE_CODE)) {
+        // fused xor+popcount, one pass over the words
+        return bitset_container_xor_justcard((const bitset_container_t *)c1,
+                                             (const bitset_container_t *)c2);
+    }
+    // for the remaining pairs the intersection kernel is already a single
+    // pass and the container cardinalities are known or cheap
+    const int inter = container_and_cardinality(c1, type1, c2, type2);
+    return container_get_cardinality(c1, type1) +
+           container_get_cardinality(c2, type2) - 2 * inter;
+}
+
+/**
+ * Compute the size of the difference (andnot) between two containers.
+ */
+static inline int container_andnot_cardinality(const void *c1, uint8_t type1,
+                                               const void *c2, uint8_t type2) {
+    c1 = container_unwrap_shared(c1, &type1);
+    c2 = container_unwrap_shared(c2, &type2);
+    if (CONTAINER_PAIR(type1, type2) ==
+        CONTAINER_PAIR(BITSET_CONTAINER_TYPE_CODE,
+                       BITSET_CONTAINER_TYPE_CODE)) {
+        // fused andnot+popcount, one pass over the words
+        return bitset_container_andnot_justcard(
+            (const bitset_container_t *)c1, (const bitset_container_t *)c2);
+    }
+    return container_get_cardinality(c1, type1) -
+           container_and_cardinality(c1, type1, c2, type2);
+}
+
 /**
  * Check whether two containers intersect.
  */
@@ -970,6 +1073,96 @@ static inline void *container_iand(void *c1, uint8_t type1, const void *c2,
     }
 }
 
+/**
+ * Compute intersection between two containers, generate a new container (having
+ * type result_type), requires a typecode. This allocates new memory, caller
+ * is responsible for deallocation.
+ *
+ * This lazy version delays some operations such as the maintenance of the
+ * cardinality. It requires repair later on the generated containers.
+ * Only the bitset-bitset and run-run cases actually differ from container_and:
+ * the other type combinations need the cardinality anyway to pick the result
+ * type, so they share the eager code path and come out already repaired.
+ */
+static inline void *container_lazy_and(const void *c1, uint8_t type1,
+                                       const void *c2, uint8_t type2,
+                                       uint8_t *result_type) {
+    c1 = container_unwrap_shared(c1, &type1);
+    c2 = container_unwrap_shared(c2, &type2);
+    void *result = NULL;
+    switch (CONTAINER_PAIR(type1, type2)) {
+        case CONTAINER_PAIR(BITSET_CONTAINER_TYPE_CODE,
+                            BITSET_CONTAINER_TYPE_CODE):
+            result = bitset_container_create();
+            bitset_container_and_nocard((const bitset_container_t *)c1,
+                                        (const bitset_container_t *)c2,
+                                        (bitset_container_t *)result);
+            *result_type = BITSET_CONTAINER_TYPE_CODE;  // is lazy
+            return result;
+        case CONTAINER_PAIR(RUN_CONTAINER_TYPE_CODE, RUN_CONTAINER_TYPE_CODE):
+            result = run_container_create();
+            run_container_intersection((const run_container_t *)c1,
+                                       (const run_container_t *)c2,
+                                       (run_container_t *)result);
+            *result_type = RUN_CONTAINER_TYPE_CODE;
+            // next line skipped since we are lazy
+            // result = convert_run_to_efficient_container_and_free(result,
+            //                                                      result_type);
+            return result;
+        default:
+            return container_and(c1, type1, c2, type2, result_type);
+    }
+}
+
+/**
+ * Compute intersection between two containers, with result in the first
+ * container if possible. If the returned pointer is identical to c1,
+ * then the container has been modified. If the returned pointer is different
+ * from c1, then a new container has been created and the caller is responsible
+ * for freeing it.
+ * The type of the first container may change. Returns the modified
+ * (and possibly new) container.
+ *
+ * This lazy version delays some operations such as the maintenance of the
+ * cardinality. It requires repair later on the generated containers.
+ */
+static inline void *container_lazy_iand(void *c1, uint8_t type1, const void *c2,
+                                        uint8_t type2, uint8_t *result_type) {
+    c1 = get_writable_copy_if_shared(c1, &type1);
+    c2 = container_unwrap_shared(c2, &type2);
+    void *result = NULL;
+    switch (CONTAINER_PAIR(type1, type2)) {
+        case CONTAINER_PAIR(BITSET_CONTAINER_TYPE_CODE,
+                            BITSET_CONTAINER_TYPE_CODE):
+            bitset_container_and_nocard((const bitset_container_t *)c1,
+                                        (const bitset_container_t *)c2,
+                                        (bitset_container_t *)c1);
+            *result_type = BITSET_CONTAINER_TYPE_CODE;  // is lazy
+            return c1;
+        case CONTAINER_PAIR(RUN_CONTAINER_TYPE_CODE, RUN_CONTAINER_TYPE_CODE):
+            result = run_container_create();
+            run_container_intersection((const run_container_t *)c1,
+                                       (const run_container_t *)c2,
+                                       (run_container_t *)result);
+            *result_type = RUN_CONTAINER_TYPE_CODE;
+            // next line skipped since we are lazy
+            // result = convert_run_to_efficient_container_and_free(result,
+            //                                                      result_type);
+            return result;
+        default:
+            // c1 may come from an earlier lazy operation and the eager
+            // kernels trust the cardinality of their inputs
+            if (type1 == BITSET_CONTAINER_TYPE_CODE &&
+                ((bitset_container_t *)c1)->cardinality ==
+                    BITSET_UNKNOWN_CARDINALITY) {
+                ((bitset_container_t *)c1)->cardinality =
+                    bitset_container_compute_cardinality(
+                        (const bitset_container_t *)c1);
+            }
+            return container_iand(c1, type1, c2, type2, result_type);
+    }
+}
+
 /**
  * Compute union between two containers, generate a new container (having type
  * result_type), requires a typecode. This allocates new memory, caller
@@ -1026,11 +1219,8 @@ static inline void *container_or(const void *c1, uint8_t type1, const void *c2,
         case CONTAINER_PAIR(BITSET_CONTAINER_TYPE_CODE,
                             RUN_CONTAINER_TYPE_CODE):
             if (run_container_is_full((const run_container_t *)c2)) {
-                result = run_container_create();
                 *result_type = RUN_CONTAINER_TYPE_CODE;
-                run_container_copy((const run_container_t *)c2,
-                                   (run_container_t *)result);
-                return result;
+                return run_container_full();
             }
             result = bitset_container_create();
             run_bitset_container_union((const run_container_t *)c2,
@@ -1041,11 +1231,8 @@ static inline void *container_or(const void *c1, uint8_t type1, const void *c2,
         case CONTAINER_PAIR(RUN_CONTAINER_TYPE_CODE,
                             BITSET_CONTAINER_TYPE_CODE):
             if (run_container_is_full((const run_container_t *)c1)) {
-                result = run_container_create();
                 *result_type = RUN_CONTAINER_TYPE_CODE;
-                run_container_copy((const run_container_t *)c1,
-                                   (run_container_t *)result);
-                return result;
+                return run_container_full();
             }
             result = bitset_container_create();
             run_bitset_container_union((const run_container_t *)c1,
@@ -1113,8 +1300,10 @@ static inline void *container_lazy_or(const void *c1, uint8_t type1,
                                 (const run_container_t *)c2,
                                 (run_container_t *)result);
             *result_type = RUN_CONTAINER_TYPE_CODE;
-            // we are being lazy
-            result = convert_run_to_efficient_container(
+            // we are being lazy. The _and_free variant disposes of the
+            // fresh union when the conversion replaces it — including the
+            // full case, which collapses onto the shared singleton
+            result = convert_run_to_efficient_container_and_free(
                 (run_container_t *)result, result_type);
             return result;
         case CONTAINER_PAIR(BITSET_CONTAINER_TYPE_CODE,
@@ -1136,11 +1325,8 @@ static inline void *container_lazy_or(const void *c1, uint8_t type1,
         case CONTAINER_PAIR(BITSET_CONTAINER_TYPE_CODE,
                             RUN_CONTAINER_TYPE_CODE):
             if (run_container_is_full((const run_container_t *)c2)) {
-                result = run_container_create();
                 *result_type = RUN_CONTAINER_TYPE_CODE;
-                run_container_copy((const run_container_t *)c2,
-                                   (run_container_t *)result);
-                return result;
+                return run_container_full();
             }
             result = bitset_container_create();
             run_bitset_container_lazy_union(
@@ -1151,11 +1337,8 @@ static inline void *container_lazy_or(const void *c1, uint8_t type1,
         case CONTAINER_PAIR(RUN_CONTAINER_TYPE_CODE,
                             BITSET_CONTAINER_TYPE_CODE):
             if (run_container_is_full((const run_container_t *)c1)) {
-                result = run_container_create();
                 *result_type = RUN_CONTAINER_TYPE_CODE;
-                run_container_copy((const run_container_t *)c1,
-                                   (run_container_t *)result);
-                return result;
+                return run_container_full();
             }
             result = bitset_container_create();
             run_bitset_container_lazy_union(
@@ -1254,11 +1437,8 @@ static inline void *container_ior(void *c1, uint8_t type1, const void *c2,
         case CONTAINER_PAIR(BITSET_CONTAINER_TYPE_CODE,
                             RUN_CONTAINER_TYPE_CODE):
             if (run_container_is_full((const run_container_t *)c2)) {
-                result = run_container_create();
                 *result_type = RUN_CONTAINER_TYPE_CODE;
-                run_container_copy((const run_container_t *)c2,
-                                   (run_container_t *)result);
-                return result;
+                return run_container_full();
             }
             run_bitset_container_union((const run_container_t *)c2,
                                        (const bitset_container_t *)c1,
@@ -1377,11 +1557,8 @@ static inline void *container_lazy_ior(void *c1, uint8_t type1, const void *c2,
         case CONTAINER_PAIR(BITSET_CONTAINER_TYPE_CODE,
                             RUN_CONTAINER_TYPE_CODE):
             if (run_container_is_full((const run_container_t *)c2)) {
-                result = run_container_create();
                 *result_type = RUN_CONTAINER_TYPE_CODE;
-                run_container_copy((const run_container_t *)c2,
-                                   (run_container_t *)result);
-                return result;
+                return run_container_full();
             }
             run_bitset_container_lazy_union(
                 (const run_container_t *)c2, (const bitset_container_t *)c1,
@@ -1927,6 +2104,78 @@ static inline void *container_iandnot(void *c1, uint8_t type1, const void *c2,
     }
 }
 
+/**
+ * Compute the andnot of two containers, generate a new container (having type
+ * result_type), requires a typecode. This allocates new memory, caller
+ * is responsible for deallocation.
+ *
+ * This lazy version delays some operations such as the maintenance of the
+ * cardinality. It requires repair later on the generated containers.
+ * Only the bitset-bitset case actually differs from container_andnot: the
+ * other type combinations compute the cardinality as a byproduct of choosing
+ * the result type, so they share the eager code path and come out already
+ * repaired.
+ */
+static inline void *container_lazy_andnot(const void *c1, uint8_t type1,
+                                          const void *c2, uint8_t type2,
+                                          uint8_t *result_type) {
+    c1 = container_unwrap_shared(c1, &type1);
+    c2 = container_unwrap_shared(c2, &type2);
+    void *result = NULL;
+    switch (CONTAINER_PAIR(type1, type2)) {
+        case CONTAINER_PAIR(BITSET_CONTAINER_TYPE_CODE,
+                            BITSET_CONTAINER_TYPE_CODE):
+            result = bitset_container_create();
+            bitset_container_andnot_nocard((const bitset_container_t *)c1,
+                                           (const bitset_container_t *)c2,
+                                           (bitset_container_t *)result);
+            *result_type = BITSET_CONTAINER_TYPE_CODE;  // is lazy
+            return result;
+        default:
+            return container_andnot(c1, type1, c2, type2, result_type);
+    }
+}
+
+/**
+ * Compute the andnot between two containers, with result in the first
+ * container.
+ * If the returned pointer is identical to c1, then the container has been
+ * modified.
+ * If the returned pointer is different from c1, then a new container has been
+ * created and the caller is responsible for freeing it.
+ * The type of the first container may change. Returns the modified
+ * (and possibly new) container.
+ *
+ * This lazy version delays some operations such as the maintenance of the
+ * cardinality. It requires repair later on the generated containers.
+ */
+static inline void *container_lazy_iandnot(void *c1, uint8_t type1,
+                                           const void *c2, uint8_t type2,
+                                           uint8_t *result_type) {
+    c1 = get_writable_copy_if_shared(c1, &type1);
+    c2 = container_unwrap_shared(c2, &type2);
+    switch (CONTAINER_PAIR(type1, type2)) {
+        case CONTAINER_PAIR(BITSET_CONTAINER_TYPE_CODE,
+                            BITSET_CONTAINER_TYPE_CODE):
+            bitset_container_andnot_nocard((const bitset_container_t *)c1,
+                                           (const bitset_container_t *)c2,
+                                           (bitset_container_t *)c1);
+            *result_type = BITSET_CONTAINER_TYPE_CODE;  // is lazy
+            return c1;
+        default:
+            // c1 may come from an earlier lazy operation and the eager
+            // kernels trust the cardinality of their inputs
+            if (type1 == BITSET_CONTAINER_TYPE_CODE &&
+                ((bitset_container_t *)c1)->cardinality ==
+                    BITSET_UNKNOWN_CARDINALITY) {
+                ((bitset_container_t *)c1)->cardinality =
+                    bitset_container_compute_cardinality(
+                        (const bitset_container_t *)c1);
+            }
+            return container_iandnot(c1, type1, c2, type2, result_type);
+    }
+}
+
 /**
  * Visit all values x of the container once, passing (base+x,ptr)
  * to iterator. You need to specify a container and its type.
@@ -1981,6 +2230,30 @@ static inline bool container_iterate64(const void *container, uint8_t typecode,
     return false;
 }
 
+static inline bool container_iterate_ranges(const void *container,
+                                            uint8_t typecode, uint32_t base,
+                                            roaring_range_iterator iterator,
+                                            void *ptr) {
+    container = container_unwrap_shared(container, &typecode);
+    switch (typecode) {
+        case BITSET_CONTAINER_TYPE_CODE:
+            return bitset_container_iterate_ranges(
+                (const bitset_container_t *)container, base, iterator, ptr);
+        case ARRAY_CONTAINER_TYPE_CODE:
+            return array_container_iterate_ranges(
+                (const array_container_t *)container, base, iterator, ptr);
+        case RUN_CONTAINER_TYPE_CODE:
+            return run_container_iterate_ranges(
+                (const run_container_t *)container, base, iterator, ptr);
+        default:
+            assert(false);
+            __builtin_unreachable();
+    }
+    assert(false);
+    __builtin_unreachable();
+    return false;
+}
+
 static inline void *container_not(const void *c, uint8_t typ,
                                   uint8_t *result_type) {
     c = container_unwrap_shared(c, &typ);
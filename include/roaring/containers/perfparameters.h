@@ -34,4 +34,108 @@ enum { ARRAY_DEFAULT_INIT_SIZE = 0 };
 #define OR_BITSET_CONVERSION_TO_FULL true
 #endif
 
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Runtime-tunable counterparts of the compile-time conversion knobs, so that
+ * the thresholds can be adjusted without rebuilding the library. The values
+ * are global: every bitmap consults the same tuning, and changing it while
+ * other threads operate on bitmaps gives no guarantee about which value they
+ * observe. Bitmaps built under one tuning remain valid under another.
+ */
+typedef struct roaring_tuning_s {
+    /* point inserts convert an array container to a bitset once it would
+       exceed this many values (default DEFAULT_MAX_SIZE = 4096). Note that
+       values above 4096 produce array containers larger than the portable
+       format convention, which other Roaring implementations may reject */
+    int32_t array_bitset_threshold;
+    /* point removals convert a bitset container back to an array once its
+       cardinality drops to this many values (default DEFAULT_MAX_SIZE) */
+    int32_t bitset_array_threshold;
+    /* lazy unions and xors of two array containers may produce a bitset once
+       the combined cardinality exceeds this (default ARRAY_LAZY_LOWERBOUND) */
+    int32_t lazy_arrays_lowerbound;
+    /* whether many-way unions eagerly upgrade containers to bitsets
+       (default LAZY_OR_BITSET_CONVERSION) */
+    bool lazy_or_bitset_conversion;
+    /* growth policy for array and run container buffers. When
+       growth_denominator is positive a reallocation multiplies the old
+       capacity by growth_numerator/growth_denominator (which must exceed
+       one); with the default of zero the built-in staged ladder applies
+       (doubling under 64 entries, 1.5x under 1024, 1.25x beyond). Under
+       incremental ingest a larger factor trades slack memory for fewer
+       realloc copies on the way to the conversion threshold */
+    int32_t container_growth_numerator;
+    int32_t container_growth_denominator;
+    /* floor for a container's first buffer allocation, in entries
+       (default 0: allocate exactly what the triggering insert needs).
+       Setting it to array_bitset_threshold pre-sizes array containers to
+       their final pre-conversion capacity in one allocation, for ingest
+       paths whose expected per-container cardinality is known */
+    int32_t container_initial_capacity;
+    /* round each buffer's byte size up to the next power of two, the size
+       classes of common allocators, so that successive grows land on class
+       boundaries instead of copying at every odd size (default false) */
+    bool container_growth_round_to_size_class;
+} roaring_tuning_t;
+
+extern roaring_tuning_t roaring_runtime_tuning;
+
+/**
+ * Next capacity for a container buffer of `capacity` entries of
+ * `entry_bytes` bytes each, honoring the growth policy above: at least
+ * `min`, at most `max` entries.
+ */
+static inline int32_t roaring_container_next_capacity(int32_t capacity,
+                                                      int32_t min, int32_t max,
+                                                      int32_t entry_bytes) {
+    const roaring_tuning_t *tuning = &roaring_runtime_tuning;
+    int32_t next;
+    if (capacity <= 0) {
+        next = tuning->container_initial_capacity;
+    } else if (tuning->container_growth_denominator > 0) {
+        next = (int32_t)((int64_t)capacity *
+                         tuning->container_growth_numerator /
+                         tuning->container_growth_denominator);
+    } else {
+        next = capacity < 64 ? capacity * 2
+                             : capacity < 1024 ? capacity * 3 / 2
+                                               : capacity * 5 / 4;
+    }
+    if (next < min) next = min;
+    if (next > max) next = max;
+    if (tuning->container_growth_round_to_size_class && next < max) {
+        int64_t bytes = (int64_t)next * entry_bytes;
+        int64_t rounded = 64;
+        while (rounded < bytes) rounded <<= 1;
+        next = (int32_t)(rounded / entry_bytes);
+        if (next > max) next = max;
+    }
+    return next;
+}
+
+/**
+ * Copy the current tuning to *out.
+ */
+void roaring_tuning_get(roaring_tuning_t *out);
+
+/**
+ * Install a new tuning. Returns false (leaving the tuning unchanged) if a
+ * threshold is outside [0, 65536] or array_bitset_threshold is not positive.
+ */
+bool roaring_tuning_set(const roaring_tuning_t *tuning);
+
+/**
+ * Restore the compile-time defaults.
+ */
+void roaring_tuning_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -34,7 +34,11 @@ typedef struct rle16_s rle16_t;
 /* struct run_container_s - run container bitmap
  *
  * @n_runs:   number of rle_t pairs in `runs`.
- * @capacity: capacity in rle_t pairs `runs` can hold.
+ * @capacity: capacity in rle_t pairs `runs` can hold; a negative value
+ *            marks a borrowed payload (see roaring_bitmap_compact):
+ *            `runs` then points into an arena holding exactly -capacity
+ *            pairs and must never be freed or reallocated, growth falls
+ *            back to an owned heap copy.
  * @runs:     pairs of rle_t.
  *
  */
@@ -94,6 +98,77 @@ inline int32_t interleavedBinarySearch(const rle16_t *array, int32_t lenarray,
     return -(low + 1);
 }
 
+/**
+ * Like interleavedBinarySearch, but tuned for point probes into containers
+ * with many runs: one interpolation step first -- run starts from
+ * timestamp-like data are spread near-uniformly, so the guess usually lands
+ * within a few runs of the target -- then a branchless binary narrowing, and
+ * a vectorized count over the final block when SIMD is available.
+ */
+inline int32_t interleavedInterpolationSearch(const rle16_t *array,
+                                              int32_t lenarray,
+                                              uint16_t ikey) {
+    if (lenarray == 0 || ikey < array[0].value) return -1;
+    int32_t low = 0;
+    int32_t high = lenarray - 1;
+    if (ikey >= array[high].value) {
+        low = high;
+    } else {
+        // ikey sits strictly between the first and last run start, so the
+        // divisor cannot be zero
+        const uint32_t lowval = array[0].value;
+        const uint32_t highval = array[high].value;
+        const int32_t guess = (int32_t)(((uint64_t)(ikey - lowval) *
+                                         (uint32_t)high) /
+                                        (highval - lowval));
+        if (array[guess].value <= ikey) {
+            low = guess;
+        } else {
+            high = guess - 1;
+        }
+        // invariants: array[low].value <= ikey, array[i].value > ikey for
+        // all i > high; the ternaries compile to conditional moves
+        while (high - low >= 8) {
+            const int32_t middle = (low + high + 1) >> 1;
+            const bool below = (array[middle].value <= ikey);
+            low = below ? middle : low;
+            high = below ? high : middle - 1;
+        }
+#ifdef USEAVX
+        if (high > low && low + 9 <= lenarray) {
+            // count how many of the next eight run starts are <= ikey; the
+            // unsigned comparison is done in the signed domain by flipping
+            // the sign bits, and the length lanes are masked out of the
+            // byte-level movemask (value lanes cover mask bits 0x3333)
+            const __m128i bias = _mm_set1_epi16((int16_t)0x8000);
+            const __m128i key =
+                _mm_set1_epi16((int16_t)(ikey ^ UINT16_C(0x8000)));
+            const __m128i a = _mm_xor_si128(
+                _mm_lddqu_si128((const __m128i *)(array + low + 1)), bias);
+            const __m128i b = _mm_xor_si128(
+                _mm_lddqu_si128((const __m128i *)(array + low + 5)), bias);
+            const uint32_t gtmask =
+                (uint32_t)(_mm_movemask_epi8(_mm_cmpgt_epi16(a, key)) &
+                           0x3333) |
+                ((uint32_t)(_mm_movemask_epi8(_mm_cmpgt_epi16(b, key)) &
+                            0x3333)
+                 << 16);
+            low += 8 - (__builtin_popcountll(gtmask) >> 1);
+        } else
+#endif
+        {
+            while (high > low) {
+                const int32_t middle = (low + high + 1) >> 1;
+                const bool below = (array[middle].value <= ikey);
+                low = below ? middle : low;
+                high = below ? high : middle - 1;
+            }
+        }
+    }
+    if (array[low].value == ikey) return low;
+    return -low - 2;  // same convention as interleavedBinarySearch
+}
+
 /*
  * Returns index of the run which contains $ikey
  */
@@ -225,7 +300,8 @@ static inline bool run_container_remove(run_container_t *run, uint16_t pos) {
 
 /* Check whether `pos' is present in `run'.  */
 inline bool run_container_contains(const run_container_t *run, uint16_t pos) {
-    int32_t index = interleavedBinarySearch(run->runs, run->n_runs, pos);
+    int32_t index =
+        interleavedInterpolationSearch(run->runs, run->n_runs, pos);
     if (index >= 0) return true;
     index = -index - 2;  // points to preceding value, possibly -1
     if (index != -1) {   // possible match
@@ -418,6 +494,26 @@ static inline bool run_container_is_full(const run_container_t *run) {
     return (run->n_runs == 1) && (vl.value == 0) && (vl.length == 0xFFFF);
 }
 
+/* The process-wide immutable all-ones run container. Operations that produce
+ * a full container hand out this shared instance instead of allocating, so a
+ * bitmap made of full chunks costs no heap memory at all. It is never freed
+ * (run_container_free ignores it) and must never be mutated: every in-place
+ * code path goes through get_writable_copy_if_shared, which swaps it for a
+ * private copy first. Defined in run.c. */
+extern run_container_t run_container_full_singleton;
+
+/* Returns the shared full container (see above). */
+static inline run_container_t *run_container_full(void) {
+    return &run_container_full_singleton;
+}
+
+/* Check whether this pointer is the shared full container. Distinct from
+ * run_container_is_full: an owned container can hold all-ones content
+ * without being the singleton. */
+static inline bool run_container_is_full_singleton(const run_container_t *run) {
+    return run == &run_container_full_singleton;
+}
+
 /* Compute the union of `src_1' and `src_2' and write the result to `dst'
  * It is assumed that `dst' is distinct from both `src_1' and `src_2'. */
 void run_container_union(const run_container_t *src_1,
@@ -483,6 +579,8 @@ bool run_container_iterate(const run_container_t *cont, uint32_t base,
 bool run_container_iterate64(const run_container_t *cont, uint32_t base,
                              roaring_iterator64 iterator, uint64_t high_bits,
                              void *ptr);
+bool run_container_iterate_ranges(const run_container_t *cont, uint32_t base,
+                                  roaring_range_iterator iterator, void *ptr);
 
 /**
  * Writes the underlying array to buf, outputs how many bytes were written.
@@ -548,6 +646,9 @@ void run_container_smart_append_exclusive(run_container_t *src,
 */
 static inline run_container_t *run_container_create_range(uint32_t start,
                                                           uint32_t stop) {
+    if (start == 0 && stop >= (1 << 16)) {
+        return run_container_full();  // all-ones: no allocation needed
+    }
     run_container_t *rc = run_container_create_given_capacity(1);
     if (rc) {
         rle16_t r;
@@ -0,0 +1,67 @@
+/*
+ * instrumentation.h
+ *
+ * Optional compiled-in counters describing what the library is doing at
+ * runtime: container-type conversions, array reallocations, lazy repairs
+ * and set-operation kernel choices. roaring_bitmap_statistics only reports
+ * the static shape of a bitmap; these counters attribute CPU to the churn
+ * that produced that shape.
+ */
+#ifndef INCLUDE_ROARING_INSTRUMENTATION_H
+#define INCLUDE_ROARING_INSTRUMENTATION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Counters accumulated since the last reset. They are only maintained when
+ * the library is compiled with ROARING_INSTRUMENTATION defined (e.g. with
+ * -DROARING_INSTRUMENTATION); in a regular build every counter stays at
+ * zero and the hooks compile away entirely. The counters are plain global
+ * integers: updates are cheap but not atomic, so totals are approximate
+ * when several threads mutate bitmaps concurrently.
+ */
+typedef struct roaring_instrumentation_s {
+    uint64_t array_to_bitset_conversions;  // array containers upgraded
+    uint64_t bitset_to_array_conversions;  // bitset containers downgraded
+    uint64_t run_to_other_conversions;     // run containers expanded
+    uint64_t other_to_run_conversions;     // containers run-compressed
+    uint64_t array_grows;                  // array container reallocations
+    uint64_t lazy_bitset_conversions;      // lazy unions upgrading to bitset
+    uint64_t lazy_repairs;                 // containers fixed after lazy ops
+    uint64_t vector_kernel_calls;          // vectorized kernel selections
+    uint64_t scalar_kernel_calls;          // scalar kernel selections
+} roaring_instrumentation_t;
+
+/**
+ * Copy the current counter values to *out. All zero when the library was
+ * built without ROARING_INSTRUMENTATION.
+ */
+void roaring_instrumentation_snapshot(roaring_instrumentation_t *out);
+
+/**
+ * Reset every counter to zero.
+ */
+void roaring_instrumentation_reset(void);
+
+/**
+ * Whether the library was compiled with the counters enabled.
+ */
+bool roaring_instrumentation_is_enabled(void);
+
+#ifdef ROARING_INSTRUMENTATION
+extern roaring_instrumentation_t roaring_instrumentation_counters;
+#define ROARING_INSTRUMENT(field) (roaring_instrumentation_counters.field++)
+#else
+#define ROARING_INSTRUMENT(field)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDE_ROARING_INSTRUMENTATION_H */
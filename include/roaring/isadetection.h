@@ -0,0 +1,176 @@
+/*
+ * isadetection.h
+ *
+ * Runtime detection of the instruction sets supported by the host, for
+ * diagnostics and for deployment-time checks (e.g. refusing to load an
+ * AVX2-enabled build on a host without AVX2). Note that it cannot make
+ * such a build safe on lesser hosts from the inside: once the compiler
+ * is allowed to use an instruction set, it may do so anywhere in the
+ * library, not just in the kernels a runtime branch could guard.
+ */
+
+#ifndef INCLUDE_ISADETECTION_H_
+#define INCLUDE_ISADETECTION_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+enum croaring_instruction_set {
+    CROARING_DEFAULT = 0x0,
+    CROARING_NEON = 0x1,
+    CROARING_AVX2 = 0x4,
+    CROARING_SSE42 = 0x8,
+    CROARING_PCLMULQDQ = 0x10,
+    CROARING_BMI1 = 0x20,
+    CROARING_BMI2 = 0x40,
+    CROARING_ALTIVEC = 0x80,
+    CROARING_AVX512F = 0x100,
+    CROARING_AVX512DQ = 0x200,
+    CROARING_AVX512BW = 0x400,
+    CROARING_AVX512VPOPCNTDQ = 0x800,
+    CROARING_UNINITIALIZED = 0x8000
+};
+
+// the AVX-512 subsets that our AVX-512 kernels require
+#define CROARING_AVX512_REQUIRED                                 \
+    (CROARING_AVX512F | CROARING_AVX512DQ | CROARING_AVX512BW | \
+     CROARING_AVX512VPOPCNTDQ)
+
+#if defined(__PPC64__)
+
+static inline uint32_t croaring_detect_supported_architectures(void) {
+    return CROARING_ALTIVEC;
+}
+
+#elif defined(__arm__) || defined(__aarch64__)
+
+static inline uint32_t croaring_detect_supported_architectures(void) {
+#if defined(__ARM_NEON)
+    return CROARING_NEON;
+#else
+    return CROARING_DEFAULT;
+#endif
+}
+
+#elif defined(__x86_64__) || defined(__i386__) || defined(_M_AMD64) || \
+    defined(_M_IX86)
+
+// cpuid leaves of interest
+enum { CROARING_CPUID_EXT_FEATURES = 0x7, CROARING_CPUID_FEATURES = 0x1 };
+
+// ecx bits of leaf 1
+enum {
+    CROARING_CPUID_BIT_PCLMULQDQ = UINT32_C(1) << 1,
+    CROARING_CPUID_BIT_SSE42 = UINT32_C(1) << 20
+};
+
+// ebx bits of leaf 7
+enum {
+    CROARING_CPUID_BIT_BMI1 = UINT32_C(1) << 3,
+    CROARING_CPUID_BIT_AVX2 = UINT32_C(1) << 5,
+    CROARING_CPUID_BIT_BMI2 = UINT32_C(1) << 8,
+    CROARING_CPUID_BIT_AVX512F = UINT32_C(1) << 16,
+    CROARING_CPUID_BIT_AVX512DQ = UINT32_C(1) << 17,
+    CROARING_CPUID_BIT_AVX512BW = UINT32_C(1) << 30
+};
+
+// ecx bits of leaf 7
+enum { CROARING_CPUID_BIT_AVX512VPOPCNTDQ = UINT32_C(1) << 14 };
+
+static inline void croaring_cpuid(uint32_t *eax, uint32_t *ebx, uint32_t *ecx,
+                                  uint32_t *edx) {
+#if defined(_MSC_VER)
+    int cpu_info[4];
+    __cpuidex(cpu_info, *eax, *ecx);
+    *eax = cpu_info[0];
+    *ebx = cpu_info[1];
+    *ecx = cpu_info[2];
+    *edx = cpu_info[3];
+#else
+    uint32_t level = *eax;
+    __get_cpuid_count(level, *ecx, eax, ebx, ecx, edx);
+#endif
+}
+
+static inline uint32_t croaring_detect_supported_architectures(void) {
+    uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+    uint32_t host_isa = 0x0;
+
+    // ECX for EAX=0x7
+    eax = CROARING_CPUID_EXT_FEATURES;
+    ecx = 0x0;
+    croaring_cpuid(&eax, &ebx, &ecx, &edx);
+    if (ebx & CROARING_CPUID_BIT_AVX2) {
+        host_isa |= CROARING_AVX2;
+    }
+    if (ebx & CROARING_CPUID_BIT_BMI1) {
+        host_isa |= CROARING_BMI1;
+    }
+    if (ebx & CROARING_CPUID_BIT_BMI2) {
+        host_isa |= CROARING_BMI2;
+    }
+    if (ebx & CROARING_CPUID_BIT_AVX512F) {
+        host_isa |= CROARING_AVX512F;
+    }
+    if (ebx & CROARING_CPUID_BIT_AVX512DQ) {
+        host_isa |= CROARING_AVX512DQ;
+    }
+    if (ebx & CROARING_CPUID_BIT_AVX512BW) {
+        host_isa |= CROARING_AVX512BW;
+    }
+    if (ecx & CROARING_CPUID_BIT_AVX512VPOPCNTDQ) {
+        host_isa |= CROARING_AVX512VPOPCNTDQ;
+    }
+
+    // EBX for EAX=0x1
+    eax = CROARING_CPUID_FEATURES;
+    croaring_cpuid(&eax, &ebx, &ecx, &edx);
+    if (ecx & CROARING_CPUID_BIT_SSE42) {
+        host_isa |= CROARING_SSE42;
+    }
+    if (ecx & CROARING_CPUID_BIT_PCLMULQDQ) {
+        host_isa |= CROARING_PCLMULQDQ;
+    }
+    return host_isa;
+}
+
+#else  // unknown hardware, fall back to portable code
+
+static inline uint32_t croaring_detect_supported_architectures(void) {
+    return CROARING_DEFAULT;
+}
+
+#endif  // end of hardware-specific detection code
+
+/*
+ * The detection is cheap but not free: cache it.
+ * (A race merely causes the detection to run more than once.)
+ */
+static inline uint32_t croaring_hardware_support(void) {
+    static uint32_t buffer = CROARING_UNINITIALIZED;
+    if (buffer == CROARING_UNINITIALIZED) {
+        buffer = croaring_detect_supported_architectures();
+    }
+    return buffer;
+}
+
+static inline bool croaring_avx2(void) {
+    return (croaring_hardware_support() & CROARING_AVX2) == CROARING_AVX2;
+}
+
+static inline bool croaring_sse42(void) {
+    return (croaring_hardware_support() & CROARING_SSE42) == CROARING_SSE42;
+}
+
+static inline bool croaring_avx512(void) {
+    return (croaring_hardware_support() & CROARING_AVX512_REQUIRED) ==
+           CROARING_AVX512_REQUIRED;
+}
+
+#endif /* INCLUDE_ISADETECTION_H_ */
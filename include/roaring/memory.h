@@ -0,0 +1,80 @@
+#ifndef INCLUDE_ROARING_MEMORY_H_
+#define INCLUDE_ROARING_MEMORY_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>  // for size_t
+
+typedef void* (*roaring_malloc_p)(size_t);
+typedef void* (*roaring_realloc_p)(void*, size_t);
+typedef void* (*roaring_calloc_p)(size_t, size_t);
+typedef void (*roaring_free_p)(void*);
+typedef void* (*roaring_aligned_malloc_p)(size_t, size_t);
+typedef void (*roaring_aligned_free_p)(void*);
+
+typedef struct roaring_memory_s {
+    roaring_malloc_p malloc;
+    roaring_realloc_p realloc;
+    roaring_calloc_p calloc;
+    roaring_free_p free;
+    roaring_aligned_malloc_p aligned_malloc;
+    roaring_aligned_free_p aligned_free;
+} roaring_memory_t;
+
+/**
+ * Installs a global set of allocation hooks. Every allocation made by the
+ * library (containers, roaring_array_t backing arrays, scratch buffers)
+ * goes through these hooks, so bitmaps can be placed in an arena or a
+ * dedicated allocator. All fields must be non-NULL. The hooks must be set
+ * before any bitmap is created and must not be changed while bitmaps
+ * allocated through the previous hooks are alive.
+ */
+void roaring_init_memory_hook(roaring_memory_t memory_hook);
+
+void* roaring_malloc(size_t);
+void* roaring_realloc(void*, size_t);
+void* roaring_calloc(size_t, size_t);
+void roaring_free(void*);
+void* roaring_aligned_malloc(size_t, size_t);
+void roaring_aligned_free(void*);
+
+typedef struct roaring_memory_budget_s {
+    size_t limit;       // caps live bytes; 0 accounts but never fails
+    size_t used;        // live bytes still held when the operation returned
+    size_t high_water;  // peak live bytes observed during the operation
+    bool exceeded;      // the operation was abandoned and rolled back
+} roaring_memory_budget_t;
+
+/**
+ * Runs 'operation(context)' with every library allocation made on the
+ * calling thread charged against a byte budget. When an allocation would
+ * push the live total past 'limit' bytes, or the underlying allocator
+ * returns NULL, the operation is abandoned: everything it allocated and
+ * had not yet freed is released, 'budget->exceeded' is set and false is
+ * returned. On success the function returns true and 'budget->used'
+ * reports the bytes still held by whatever the operation built, so results
+ * can be charged against tenant quotas; 'budget->high_water' reports the
+ * transient peak either way. A limit of zero only accounts, it never fails
+ * the operation.
+ *
+ * The rollback frees memory, it does not undo pointer updates: the
+ * operation should build new bitmaps from inputs it does not modify (e.g.
+ * roaring_bitmap_or_many); an in-place operation abandoned halfway leaves
+ * its target unusable. On failure the calling thread's container pool is
+ * drained and disabled, since the abandoned operation may have parked
+ * recycled shells there. Budgets do not nest: allocations made under an
+ * inner budget are not charged to the outer one. Memory touched by threads
+ * the operation itself spawns is not accounted, and the operation must not
+ * longjmp out on its own.
+ */
+bool roaring_budget_run(roaring_memory_budget_t* budget, size_t limit,
+                        void (*operation)(void*), void* context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // INCLUDE_ROARING_MEMORY_H_
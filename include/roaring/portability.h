@@ -37,6 +37,14 @@
 #error This code assumes  64-bit long longs (by use of the GCC intrinsics). Your system is not currently supported.
 #endif
 
+// big-endian targets need byte swaps to read/write the endian-stable
+// serialization formats; every other target we support is little-endian
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define CROARING_IS_BIG_ENDIAN 1
+#else
+#define CROARING_IS_BIG_ENDIAN 0
+#endif
+
 #if defined(_MSC_VER)
 #define __restrict__ __restrict
 #endif
@@ -66,6 +74,15 @@
 #define USEAVX
 #endif
 
+// if we have all of the AVX-512 subsets we rely upon (including VPOPCNTDQ,
+// available on Ice Lake and better), we enable the AVX-512 kernels
+#if (!defined(USEAVX512)) && (!defined(DISABLEAVX)) &&              \
+    (!defined(DISABLEAVX512)) && (defined(__AVX512F__)) &&          \
+    (defined(__AVX512BW__)) && (defined(__AVX512DQ__)) &&           \
+    (defined(__AVX512VPOPCNTDQ__))
+#define USEAVX512
+#endif
+
 // if we have __SSE4_2__, we enable SSE4
 #if (defined(__POPCNT__)) && (defined(__SSE4_2__))
 #define USESSE4
@@ -223,6 +240,15 @@ static inline void roaring_bitmap_aligned_free(void *memblock) {
 #define WARN_UNUSED
 #endif
 
+// best-effort software prefetch hint; expands to nothing when unsupported
+#if defined(__GNUC__)
+#define croaring_prefetch(p) __builtin_prefetch(p)
+#elif defined(USESSE4)
+#define croaring_prefetch(p) _mm_prefetch((const char *)(p), _MM_HINT_T0)
+#else
+#define croaring_prefetch(p)
+#endif
+
 #define IS_BIG_ENDIAN (*(uint16_t *)"\0\xff" < 0x100)
 
 static inline int hamming(uint64_t x) {
@@ -40,6 +40,69 @@ roaring_bitmap_t *roaring_bitmap_create_with_capacity(uint32_t cap);
  */
 roaring_bitmap_t *roaring_bitmap_of_ptr(size_t n_args, const uint32_t *vals);
 
+/**
+ * Creates a new bitmap from a pointer of uint32_t integers which must be
+ * sorted in increasing order (duplicates are allowed).  This is much faster
+ * than roaring_bitmap_of_ptr on large inputs: the values are sliced by their
+ * high 16 bits in a single pass and each container is built directly from
+ * its slice with its final type, instead of growing through incremental
+ * insertions and conversions.
+ */
+roaring_bitmap_t *roaring_bitmap_of_sorted(size_t n_args,
+                                           const uint32_t *vals);
+
+/**
+ * An append-only builder for sorted, run-heavy input streams. Values and
+ * ranges must be appended in strictly increasing order; the builder keeps
+ * only the open tail container (as a buffer of runs) and seals it with the
+ * cheapest representation (array, run or bitset) each time the high 16 bits
+ * advance, so ingestion never searches the key array and never converts a
+ * container it already built.
+ *
+ *     roaring_builder_t *b = roaring_builder_create();
+ *     roaring_builder_add_range_closed(b, 10, 500);
+ *     roaring_builder_add(b, 1000);
+ *     roaring_bitmap_t *r = roaring_builder_finalize(b);
+ */
+typedef struct roaring_builder_s {
+    roaring_bitmap_t *r;
+    struct rle16_s *runs;  // runs of the open tail container
+    int32_t n_runs;
+    int32_t run_capacity;
+    uint32_t last_value;  // appends must be strictly greater than this
+    uint16_t key;         // high 16 bits of the open tail container
+    bool has_tail;
+    bool has_last;
+} roaring_builder_t;
+
+roaring_builder_t *roaring_builder_create(void);
+
+/**
+ * Append a single value; it must be strictly greater than every value
+ * appended before. Returns false (and appends nothing) when it is not.
+ */
+bool roaring_builder_add(roaring_builder_t *b, uint32_t val);
+
+/**
+ * Append all the values from min to max (both included); min must be
+ * strictly greater than every value appended before. Returns false (and
+ * appends nothing) when it is not, or when min > max.
+ */
+bool roaring_builder_add_range_closed(roaring_builder_t *b, uint32_t min,
+                                      uint32_t max);
+
+/**
+ * Seal the tail container and return the finished bitmap. The builder is
+ * freed and must not be used afterwards.
+ */
+roaring_bitmap_t *roaring_builder_finalize(roaring_builder_t *b);
+
+/**
+ * Free a builder without finalizing it, discarding the bitmap under
+ * construction.
+ */
+void roaring_builder_free(roaring_builder_t *b);
+
 /*
  * Whether you want to use copy-on-write.
  * Saves memory and avoids copies but needs more care in a threaded context.
@@ -118,6 +181,14 @@ uint64_t roaring_bitmap_and_cardinality(const roaring_bitmap_t *x1,
 bool roaring_bitmap_intersect(const roaring_bitmap_t *x1,
                                      const roaring_bitmap_t *x2);
 
+/**
+ * Check whether a bitmap and an interval of values [x, y) intersect,
+ * without materializing the interval: nothing is allocated and the scan
+ * stops at the first value found.
+ */
+bool roaring_bitmap_intersect_with_range(const roaring_bitmap_t *bm,
+                                         uint64_t x, uint64_t y);
+
 /**
  * Computes the Jaccard index between two bitmaps. (Also known as the Tanimoto
  * distance,
@@ -129,6 +200,34 @@ bool roaring_bitmap_intersect(const roaring_bitmap_t *x1,
 double roaring_bitmap_jaccard_index(const roaring_bitmap_t *x1,
                                     const roaring_bitmap_t *x2);
 
+/**
+ * Computes the size of the intersection between one query bitmap and each
+ * of `number` candidate bitmaps; answers[i] receives the intersection
+ * cardinality with candidates[i]. The query is prepared once (its large
+ * array containers are promoted to bitsets) so that scoring many
+ * candidates is cheaper than `number` calls to
+ * roaring_bitmap_and_cardinality. The candidates are scored by up to
+ * num_threads worker threads; with num_threads <= 1, or on platforms
+ * without POSIX threads, they are scored serially on the calling thread.
+ */
+void roaring_bitmap_and_cardinality_many(const roaring_bitmap_t *query,
+                                         size_t number,
+                                         const roaring_bitmap_t **candidates,
+                                         uint64_t *answers,
+                                         unsigned int num_threads);
+
+/**
+ * Computes the Jaccard index between one query bitmap and each of `number`
+ * candidate bitmaps; answers[i] receives the index against candidates[i]
+ * (undefined when both bitmaps are empty). Same batched preparation and
+ * threading behavior as roaring_bitmap_and_cardinality_many.
+ */
+void roaring_bitmap_jaccard_index_many(const roaring_bitmap_t *query,
+                                       size_t number,
+                                       const roaring_bitmap_t **candidates,
+                                       double *answers,
+                                       unsigned int num_threads);
+
 /**
  * Computes the size of the union between two bitmaps.
  *
@@ -156,6 +255,31 @@ uint64_t roaring_bitmap_xor_cardinality(const roaring_bitmap_t *x1,
 void roaring_bitmap_and_inplace(roaring_bitmap_t *x1,
                                 const roaring_bitmap_t *x2);
 
+/**
+ * Computes the intersection of x1 and x2 into a caller-owned result
+ * bitmap, replacing its previous content. The result's internal arrays
+ * keep their capacity and its old containers are recycled as write
+ * targets, so a loop that evaluates many intersections into the same
+ * result bitmap stops allocating once the result has warmed up to the
+ * working shapes (pairs involving run containers still take the
+ * allocating path). result must be distinct from x1 and x2. Returns false
+ * on allocation failure, in which case the result content is unspecified
+ * but still safe to free.
+ */
+bool roaring_bitmap_and_into(roaring_bitmap_t *result,
+                             const roaring_bitmap_t *x1,
+                             const roaring_bitmap_t *x2);
+
+/**
+ * Union counterpart of roaring_bitmap_and_into: matched bitset pairs are
+ * united directly into recycled bitsets and containers present on only one
+ * side are copied into recycled storage where layouts allow; other matched
+ * pairs take the allocating path.
+ */
+bool roaring_bitmap_or_into(roaring_bitmap_t *result,
+                            const roaring_bitmap_t *x1,
+                            const roaring_bitmap_t *x2);
+
 /**
  * Computes the union between two bitmaps and returns new bitmap. The caller is
  * responsible for memory management.
@@ -190,6 +314,31 @@ roaring_bitmap_t *roaring_bitmap_or_many(size_t number,
 roaring_bitmap_t *roaring_bitmap_or_many_heap(uint32_t number,
                                               const roaring_bitmap_t **x);
 
+/**
+ * Compute the union of 'number' bitmaps with a k-way merge: the key arrays
+ * of all the inputs are iterated in lockstep (via a heap of cursors) and
+ * all the containers sharing a key are unioned directly into the output.
+ * Unlike roaring_bitmap_or_many_heap, no intermediate bitmap is ever
+ * allocated, which matters when aggregating thousands of inputs.
+ * Caller is responsible for freeing the result.
+ */
+roaring_bitmap_t *roaring_bitmap_or_many_kway(size_t number,
+                                              const roaring_bitmap_t **x);
+
+/**
+ * Compute the union of 'number' bitmaps using up to 'num_threads' threads.
+ * Containers with distinct high 16 bits are independent, so the key space
+ * is partitioned across threads and each shard is merged with the lazy
+ * union kernels (including the repair pass).  Worthwhile when unioning many
+ * bitmaps spanning a wide key range; with num_threads <= 1, or on platforms
+ * without thread support, this falls back to roaring_bitmap_or_many.
+ * The input bitmaps must not be modified while the call is in flight.
+ * Caller is responsible for freeing the result.
+ */
+roaring_bitmap_t *roaring_bitmap_or_many_parallel(size_t number,
+                                                  const roaring_bitmap_t **x,
+                                                  unsigned int num_threads);
+
 /**
  * Computes the symmetric difference (xor) between two bitmaps
  * and returns new bitmap. The caller is responsible for memory management.
@@ -228,15 +377,71 @@ void roaring_bitmap_andnot_inplace(roaring_bitmap_t *x1,
                                    const roaring_bitmap_t *x2);
 
 /**
- * TODO: consider implementing:
  * Compute the xor of 'number' bitmaps using a heap. This can
  * sometimes be faster than roaring_bitmap_xor_many which uses
- * a naive algorithm. Caller is responsible for freeing the
- * result.
+ * a naive algorithm. Containers that cancel out are dropped as
+ * they are produced, so peak memory usage is bounded by the
+ * final result. Caller is responsible for freeing the result.
+ */
+roaring_bitmap_t *roaring_bitmap_xor_many_heap(uint32_t number,
+                                               const roaring_bitmap_t **x);
+
+/**
+ * Compute the intersection of 'number' bitmaps. The inputs are
+ * processed smallest-first so that the working set shrinks as fast
+ * as possible, and the computation stops early if the intersection
+ * becomes empty. Caller is responsible for freeing the result.
+ */
+roaring_bitmap_t *roaring_bitmap_and_many(size_t number,
+                                          const roaring_bitmap_t **x);
+
+/**
+ * A boolean expression over bitmaps, evaluated container-at-a-time.
  *
- * roaring_bitmap_t *roaring_bitmap_xor_many_heap(uint32_t number,
- *                                              const roaring_bitmap_t **x);
+ * Composing the binary operations directly, as in
+ * roaring_bitmap_andnot(roaring_bitmap_and(a, b), c), materializes a full
+ * intermediate bitmap at every operator. An expression tree instead advances
+ * through the 16-bit key space once and evaluates the whole expression per
+ * container, so the intermediates never exceed a single container.
+ */
+typedef enum roaring_expression_op_e {
+    ROARING_EXPR_AND = 0,
+    ROARING_EXPR_OR = 1,
+    ROARING_EXPR_XOR = 2,
+    ROARING_EXPR_ANDNOT = 3,
+    ROARING_EXPR_INPUT = 4  // leaf node, reserved for internal use
+} roaring_expression_op_t;
+
+typedef struct roaring_expression_s roaring_expression_t;
+
+/**
+ * Create a leaf node referring to an input bitmap. The bitmap is not copied:
+ * it must outlive the expression and must not be modified before the
+ * expression is evaluated. Returns NULL on allocation failure.
+ */
+roaring_expression_t *roaring_expression_input(const roaring_bitmap_t *bm);
+
+/**
+ * Create an operation node combining two subexpressions. The node takes
+ * ownership of both children (they are freed with the root). On allocation
+ * failure, or if either child is NULL, both children are freed and NULL is
+ * returned, so nested constructions do not leak.
+ */
+roaring_expression_t *roaring_expression_operation(roaring_expression_op_t op,
+                                                   roaring_expression_t *left,
+                                                   roaring_expression_t *right);
+
+/**
+ * Evaluate the expression and return the result as a new bitmap; the caller
+ * is responsible for freeing it. The expression remains valid and can be
+ * evaluated again. Returns NULL on allocation failure.
+ */
+roaring_bitmap_t *roaring_expression_evaluate(const roaring_expression_t *expr);
+
+/**
+ * Free an expression tree (the input bitmaps are left untouched).
  */
+void roaring_expression_free(roaring_expression_t *expr);
 
 /**
  * Frees the memory.
@@ -251,6 +456,47 @@ void roaring_bitmap_free(const roaring_bitmap_t *r);
 void roaring_bitmap_add_many(roaring_bitmap_t *r, size_t n_args,
                              const uint32_t *vals);
 
+/**
+ * A bulk context is used with the `roaring_bitmap_*_bulk()` functions: it
+ * caches the container touched by the previous call so that consecutive
+ * values sharing their high 16 bits skip the binary search over the keys
+ * entirely.
+ *
+ * An instance should be zero-initialized (`roaring_bulk_context_t context =
+ * {0};`) before the first call.  A context may only be used with the bitmap
+ * it was first passed to, and becomes invalid as soon as the bitmap is
+ * modified through any function that does not take this context.
+ */
+typedef struct roaring_bulk_context_s {
+    void *container;
+    int32_t idx;
+    uint16_t key;
+    uint8_t typecode;
+} roaring_bulk_context_t;
+
+/**
+ * Add value val, having a bulk context cache the last-touched container.
+ * On a sequence of locally-clustered (or sorted) values this is O(1)
+ * amortized per value instead of a binary search per value:
+ *
+ *     roaring_bulk_context_t context = {0};
+ *     for (size_t i = 0; i < n; i++) {
+ *         roaring_bitmap_add_bulk(r, &context, values[i]);
+ *     }
+ */
+void roaring_bitmap_add_bulk(roaring_bitmap_t *r,
+                             roaring_bulk_context_t *context, uint32_t val);
+
+/**
+ * Check if value val is present, having a bulk context cache the
+ * last-queried container.  The same validity rules as for
+ * roaring_bitmap_add_bulk apply; in particular the bitmap must not be
+ * modified while the context is in use.
+ */
+bool roaring_bitmap_contains_bulk(const roaring_bitmap_t *r,
+                                  roaring_bulk_context_t *context,
+                                  uint32_t val);
+
 /**
  * Add value x
  *
@@ -291,6 +537,15 @@ inline void roaring_bitmap_remove_range(roaring_bitmap_t *ra, uint64_t min, uint
     roaring_bitmap_remove_range_closed(ra, (uint32_t)min, (uint32_t)(max - 1));
 }
 
+/**
+ * Remove value val, having a bulk context cache the last-touched
+ * container, mirroring roaring_bitmap_add_bulk.  Removing sorted values
+ * walks the container array once instead of doing a binary search per
+ * value.  The same validity rules as for roaring_bitmap_add_bulk apply.
+ */
+void roaring_bitmap_remove_bulk(roaring_bitmap_t *r,
+                                roaring_bulk_context_t *context, uint32_t val);
+
 /** Remove multiple values */
 void roaring_bitmap_remove_many(roaring_bitmap_t *r, size_t n_args,
                                 const uint32_t *vals);
@@ -325,8 +580,43 @@ inline bool roaring_bitmap_contains(const roaring_bitmap_t *r, uint32_t val) {
  */
 bool roaring_bitmap_contains_range(const roaring_bitmap_t *r, uint64_t range_start, uint64_t range_end);
 
+/**
+ * Answer n_args membership queries at once: results[i] is set to whether
+ * vals[i] is present. Consecutive values sharing their high 16 bits are
+ * answered against the same container with a single key search, and array
+ * containers resolve the probes several at a time, so this is much faster
+ * than repeated roaring_bitmap_contains calls when the values are sorted
+ * or clustered.
+ */
+void roaring_bitmap_contains_many(const roaring_bitmap_t *r, size_t n_args,
+                                  const uint32_t *vals, bool *results);
+
+/**
+ * Intersect the bitmap with a plain sorted array of values, without
+ * materializing the array as a bitmap: the values present in the bitmap are
+ * written to out (in increasing order) and their number is returned.
+ * sorted_vals must be sorted in increasing order; duplicates are permitted
+ * and appear once in the output. out must have room for n_args values and
+ * may alias sorted_vals to filter in place.
+ */
+size_t roaring_bitmap_and_array(const roaring_bitmap_t *r, size_t n_args,
+                                const uint32_t *sorted_vals, uint32_t *out);
+
+/**
+ * Add all the values of a plain sorted array to the bitmap, bucketing them
+ * by high 16 bits and running one container union per bucket rather than
+ * one insertion per value. sorted_vals must be sorted in increasing order;
+ * duplicates are permitted. Faster than roaring_bitmap_add_many on sorted
+ * input, and than building a temporary bitmap to roaring_bitmap_or_inplace.
+ */
+void roaring_bitmap_or_array_inplace(roaring_bitmap_t *r, size_t n_args,
+                                     const uint32_t *sorted_vals);
+
 /**
  * Get the cardinality of the bitmap (number of elements).
+ *
+ * The total is cached inside the bitmap, so repeated calls on an unmodified
+ * bitmap cost O(1); the first call after a modification recomputes it.
  */
 uint64_t roaring_bitmap_get_cardinality(const roaring_bitmap_t *ra);
 
@@ -356,6 +646,20 @@ void roaring_bitmap_clear(roaring_bitmap_t *ra);
  */
 void roaring_bitmap_to_uint32_array(const roaring_bitmap_t *ra, uint32_t *ans);
 
+/**
+ * Convert the bitmap to an array using up to 'num_threads' threads. Each
+ * container decodes into a disjoint output range known in advance (a prefix
+ * sum of the container cardinalities), so the workers write directly into
+ * "ans" with no synchronization. Worthwhile for results of hundreds of
+ * millions of values; with num_threads <= 1, or on platforms without thread
+ * support, this falls back to roaring_bitmap_to_uint32_array. The bitmap
+ * must not be modified while the call is in flight. Caller is responsible
+ * to ensure that there is enough memory allocated, as with
+ * roaring_bitmap_to_uint32_array.
+ */
+void roaring_bitmap_to_uint32_array_parallel(const roaring_bitmap_t *ra,
+                                             uint32_t *ans,
+                                             unsigned int num_threads);
 
 /**
  * Convert the bitmap to an array from "offset" by "limit". Write the output to "ans".
@@ -368,6 +672,30 @@ void roaring_bitmap_to_uint32_array(const roaring_bitmap_t *ra, uint32_t *ans);
  */
 bool roaring_bitmap_range_uint32_array(const roaring_bitmap_t *ra, size_t offset, size_t limit, uint32_t *ans);
 
+/**
+ * Write the bitmap out as a flat bitset: bit v of "words" (word v/64, bit
+ * v%64) is set for every value v in the bitmap. All "maxwords" words are
+ * written (cleared first), using the per-container kernels: a straight
+ * memcpy for bitset containers, a vectorized scatter for arrays and word
+ * fills for runs. Returns false, with the buffer cleared, when the
+ * bitmap holds a value >= maxwords * 64. Useful for dense accumulation
+ * phases over a bounded range of values, where a flat bitset beats the
+ * container machinery; convert back with roaring_bitmap_from_bitset.
+ */
+bool roaring_bitmap_to_bitset(const roaring_bitmap_t *r, uint64_t *words,
+                              size_t maxwords);
+
+/**
+ * Build a bitmap from a flat bitset of "nwords" 64-bit words, the inverse
+ * of roaring_bitmap_to_bitset. Each group of 1024 words becomes at most
+ * one container of the best-fitting type (array, bitset, or the shared
+ * full-run container for all-ones groups), and the total cardinality is
+ * cached on the way. Words past 2^26 would describe values beyond 32 bits
+ * and are ignored.
+ */
+roaring_bitmap_t *roaring_bitmap_from_bitset(const uint64_t *words,
+                                             size_t nwords);
+
 /**
  *  Remove run-length encoding even when it is more space efficient
  *  return whether a change was applied
@@ -388,6 +716,53 @@ bool roaring_bitmap_run_optimize(roaring_bitmap_t *r);
 */
 size_t roaring_bitmap_shrink_to_fit(roaring_bitmap_t *r);
 
+/**
+ * Workload profiles for the advisory optimizer below: what a bitmap is
+ * mostly used for decides which container mix is preferable.
+ */
+typedef enum roaring_workload_profile_e {
+    ROARING_WORKLOAD_READ_HEAVY = 0,   // point queries and scans dominate
+    ROARING_WORKLOAD_WRITE_HEAVY = 1,  // point inserts and removals dominate
+    ROARING_WORKLOAD_MEMORY_TIGHT = 2  // smallest footprint wins
+} roaring_workload_profile_t;
+
+typedef struct roaring_optimization_advice_s {
+    bool run_optimize;            // roaring_bitmap_run_optimize would help
+    bool remove_run_compression;  // expanding run containers would help
+    bool shrink_to_fit;           // trimming slack capacity would help
+} roaring_optimization_advice_t;
+
+/**
+ * Given a statistics snapshot (from roaring_bitmap_statistics) and a
+ * workload profile, fills *advice with the maintenance calls worth making,
+ * so callers no longer guess when roaring_bitmap_run_optimize or
+ * roaring_bitmap_shrink_to_fit pay off. The decisions are heuristics over
+ * whole-bitmap statistics:
+ *
+ *  - memory-tight asks for run compression whenever there are containers
+ *    it could shrink, and for trimming slack capacity;
+ *  - read-heavy keeps bitsets even when runs would be smaller (a point
+ *    query probes one word in a bitset but searches the run list in a run
+ *    container) and asks for run expansion once run containers average
+ *    more than 4096 values, i.e. would expand back into bitsets;
+ *  - write-heavy avoids run containers entirely, since point mutations
+ *    split runs and shift the run list, and keeps array slack for growth.
+ *
+ * The snapshot reports serialized sizes, not allocated capacities, so the
+ * byte savings of following the advice cannot be quantified here.
+ */
+void roaring_bitmap_advise_optimization(const roaring_statistics_t *stat,
+                                        roaring_workload_profile_t profile,
+                                        roaring_optimization_advice_t *advice);
+
+/**
+ * Takes a statistics snapshot of r, derives the advice above and applies
+ * it in one call. Returns true when the bitmap was changed. Conversions
+ * performed here show up in the instrumentation counters like any others.
+ */
+bool roaring_bitmap_optimize_for(roaring_bitmap_t *r,
+                                 roaring_workload_profile_t profile);
+
 /**
 * write the bitmap to an output pointer, this output buffer should refer to
 * at least roaring_bitmap_size_in_bytes(ra) allocated bytes.
@@ -437,6 +812,62 @@ roaring_bitmap_t *roaring_bitmap_portable_deserialize(const char *buf);
  */
 roaring_bitmap_t *roaring_bitmap_portable_deserialize_safe(const char *buf, size_t maxbytes);
 
+/**
+ * Like roaring_bitmap_portable_deserialize_safe, but run-optimizes the bitmap
+ * while decoding: each container is emitted directly in the representation
+ * roaring_bitmap_run_optimize would pick for it, decided from the serialized
+ * payload, so the rejected representation is never allocated. Produces the
+ * same bitmap as roaring_bitmap_portable_deserialize_safe followed by
+ * roaring_bitmap_run_optimize in a single pass over the buffer, with one
+ * allocation per container instead of two. Useful when bitmaps are stored
+ * un-optimized by a latency-bound writer and optimized on the read side.
+ * In case of failure, a null pointer is returned.
+ */
+roaring_bitmap_t *roaring_bitmap_portable_deserialize_run_optimized(const char *buf, size_t maxbytes);
+
+/**
+ * Maximally fast deserialization for trusted buffers: no per-container
+ * bounds or sanity checks are performed, and all container payloads are
+ * bulk-copied into one contiguous arena (the layout roaring_bitmap_compact
+ * produces), so the decode costs one allocation for the payload bytes plus
+ * one small shell per container. The buffer MUST hold a complete, valid
+ * serialized bitmap — typically one whose integrity the storage layer has
+ * already established, e.g. through a checksum. Feeding it anything else
+ * is a buffer overflow. For audits of sampled reads, pair it with
+ * roaring_bitmap_internal_validate. In case of allocation failure, a null
+ * pointer is returned.
+ */
+roaring_bitmap_t *roaring_bitmap_portable_deserialize_trusted(const char *buf);
+
+/**
+ * Deep structural validation of a bitmap, for auditing bitmaps obtained
+ * through roaring_bitmap_portable_deserialize_trusted or suspected of
+ * corruption: checks key ordering, typecodes, per-container invariants
+ * (sortedness of array values, coalescing and bounds of runs, bitset
+ * cardinality against its words) and the cached total cardinality.
+ * Returns true when the bitmap is structurally sound; otherwise returns
+ * false and, when "reason" is not NULL, points *reason at a static string
+ * describing the first problem found (left NULL on success).
+ */
+bool roaring_bitmap_internal_validate(const roaring_bitmap_t *r,
+                                      const char **reason);
+
+/**
+ * Deserialize 'number' independent portable-format bitmaps, splitting the
+ * work over up to num_threads threads (each item goes through
+ * roaring_bitmap_portable_deserialize_safe). bufs[i] and sizes[i] describe
+ * the i-th serialized bitmap; answers[i] receives the result, or NULL if
+ * that buffer did not hold a valid bitmap or an allocation failed. Returns
+ * the number of successfully deserialized bitmaps. With num_threads <= 1,
+ * or on platforms without POSIX threads, the buffers are processed serially
+ * on the calling thread.
+ */
+size_t roaring_bitmap_portable_deserialize_many(size_t number,
+                                                const char **bufs,
+                                                const size_t *sizes,
+                                                roaring_bitmap_t **answers,
+                                                unsigned int num_threads);
+
 /**
  * Check how many bytes would be read (up to maxbytes) at this pointer if there
  * is a bitmap, returns zero if there is no valid bitmap.
@@ -465,6 +896,45 @@ size_t roaring_bitmap_portable_size_in_bytes(const roaring_bitmap_t *ra);
  */
 size_t roaring_bitmap_portable_serialize(const roaring_bitmap_t *ra, char *buf);
 
+/**
+ * Stream a bitmap in the portable format to a writer callback, in a single
+ * pass: no call to roaring_bitmap_portable_size_in_bytes and no contiguous
+ * output buffer are needed. Container payloads are passed to the writer
+ * directly from container memory, so a gathering sink can write them with
+ * no extra copy. The writer may be invoked with small lengths (header
+ * fields) and should be buffered.
+ *
+ * Returns how many bytes were written (equal to
+ * roaring_bitmap_portable_size_in_bytes(ra)), or 0 if the writer returned
+ * false. The output is byte-identical to roaring_bitmap_portable_serialize.
+ */
+size_t roaring_bitmap_portable_serialize_to(const roaring_bitmap_t *ra,
+                                            roaring_writer_t writer,
+                                            void *arg);
+
+/**
+ * How many bytes roaring_bitmap_portable_serialize_compressed will write
+ * for this bitmap.
+ */
+size_t roaring_bitmap_portable_size_in_bytes_compressed(
+    const roaring_bitmap_t *r);
+
+/**
+ * Write the bitmap in an opt-in compressed frame: array container payloads
+ * and run containers are delta-encoded and bitpacked instead of stored as
+ * raw uint16 lists, which typically shrinks sparse bitmaps well beyond what
+ * a generic compressor recovers on the portable format. The output buffer
+ * should refer to at least
+ * roaring_bitmap_portable_size_in_bytes_compressed(r) bytes of allocated
+ * memory; returns how many bytes were written.
+ *
+ * The frame carries its own cookie and is detected automatically by
+ * roaring_bitmap_portable_deserialize_safe, but it is NOT compatible with
+ * the Java and Go implementations of the portable format.
+ */
+size_t roaring_bitmap_portable_serialize_compressed(const roaring_bitmap_t *r,
+                                                    char *buf);
+
 /*
  * "Frozen" serialization format imitates memory layout of roaring_bitmap_t.
  * Deserialized bitmap is a constant view of the underlying buffer.
@@ -482,6 +952,13 @@ size_t roaring_bitmap_portable_serialize(const roaring_bitmap_t *ra, char *buf);
  * Note that because frozen serialization format imitates C memory layout
  * of roaring_bitmap_t, it is not fixed. It is different on big/little endian
  * platforms and can be changed in future.
+ *
+ * Read-only operations with a frozen operand (roaring_bitmap_and,
+ * roaring_bitmap_and_cardinality, roaring_bitmap_intersect, iteration, ...)
+ * stream from the frozen memory and place their results in freshly
+ * allocated memory: they never write to, clone from, or take references
+ * into the underlying buffer, so it is safe to map it PROT_READ and share
+ * it between processes and threads.
  */
 
 /**
@@ -509,6 +986,58 @@ void roaring_bitmap_frozen_serialize(const roaring_bitmap_t *ra, char *buf);
  */
 const roaring_bitmap_t *roaring_bitmap_frozen_view(const char *buf, size_t length);
 
+/**
+ * Returns number of bytes required to serialize bitmap using the frozen
+ * format v2.
+ */
+size_t roaring_bitmap_frozen_size_in_bytes_v2(const roaring_bitmap_t *ra);
+
+/**
+ * Serializes bitmap using the frozen format v2. Unlike the original frozen
+ * format, v2 is endian-stable (always little endian), starts with a
+ * version header and keeps the bitset words 32-byte aligned, so a file
+ * written on one architecture can be mapped on another.
+ * Buffer size must be at least roaring_bitmap_frozen_size_in_bytes_v2().
+ */
+void roaring_bitmap_frozen_serialize_v2(const roaring_bitmap_t *ra, char *buf);
+
+/**
+ * Creates a constant bitmap that is a view of a given buffer written by
+ * roaring_bitmap_frozen_serialize_v2(), with the same O(1) instantiation
+ * and the same requirements as roaring_bitmap_frozen_view(): the buffer
+ * beginning must be aligned by 32 bytes, length must be exactly
+ * roaring_bitmap_frozen_size_in_bytes_v2(), and the buffer must outlive
+ * the bitmap. Files are readable across architectures; on a big-endian
+ * host this function returns NULL (the zero-copy view cannot byte-swap)
+ * and the portable format must be used instead.
+ *
+ * On error, NULL is returned.
+ */
+const roaring_bitmap_t *roaring_bitmap_frozen_view_v2(const char *buf,
+                                                      size_t length);
+
+/**
+ * Creates a constant bitmap from a buffer in the standard portable format
+ * (as written by roaring_bitmap_portable_serialize), using one allocation
+ * for the bitmap and its container shells plus one aligned arena for the
+ * payloads. The portable format offers no alignment guarantee while the
+ * container kernels assume naturally aligned payloads (32-byte aligned in
+ * the bitset case), so payloads are copied into the arena rather than
+ * aliased in place; the buffer is not referenced once this function
+ * returns and may then be freed or modified.
+ *
+ * The buffer is trusted to hold a well-formed bitmap (like
+ * roaring_bitmap_portable_deserialize); do not use this on untrusted
+ * inputs.
+ *
+ * On error, NULL is returned.
+ *
+ * Bitmap returned by this function can be used in all readonly contexts.
+ * Bitmap must be freed as usual, by calling roaring_bitmap_free().
+ */
+const roaring_bitmap_t *
+roaring_bitmap_portable_deserialize_frozen(const char *buf);
+
 
 /**
  * Iterate over the bitmap elements. The function iterator is called once for
@@ -528,12 +1057,58 @@ bool roaring_iterate(const roaring_bitmap_t *ra, roaring_iterator iterator,
 bool roaring_iterate64(const roaring_bitmap_t *ra, roaring_iterator64 iterator,
                        uint64_t high_bits, void *ptr);
 
+/**
+ * Iterate over the bitmap as maximal ranges of consecutive values rather than
+ * one value at a time: the iterator is called once per range with its start
+ * and length. Ranges are visited in increasing order and never abut, so a
+ * 60000-value run costs one call instead of 60000. Runs, dense bitset words
+ * and consecutive array values all coalesce, including across container
+ * boundaries. As with roaring_iterate, a false return from the iterator stops
+ * the scan and makes this function return false.
+ */
+bool roaring_iterate_ranges(const roaring_bitmap_t *ra,
+                            roaring_range_iterator iterator, void *ptr);
+
+/**
+ * Visit the values common to x1 and x2 in increasing order, without
+ * materializing the intersection. The two sides are walked as a leapfrog
+ * join built on iterator seeks, so when densities differ widely the cost
+ * is driven by the sparser bitmap. As with roaring_iterate, a false
+ * return from the iterator stops the iteration; returns true if the
+ * iterator returned true throughout.
+ */
+bool roaring_iterate_and(const roaring_bitmap_t *x1,
+                         const roaring_bitmap_t *x2,
+                         roaring_iterator iterator, void *ptr);
+
 /**
  * Return true if the two bitmaps contain the same elements.
  */
 bool roaring_bitmap_equals(const roaring_bitmap_t *ra1,
                            const roaring_bitmap_t *ra2);
 
+/**
+ * Compute a 64-bit hash of the bitmap's content. The hash depends only on
+ * the stored values, never on the internal representation, so two bitmaps
+ * that compare equal always hash identically. The result is cached on the
+ * bitmap and invalidated by mutations, which lets roaring_bitmap_equals
+ * refute equality in O(1) when both operands carry a valid cached hash.
+ * Distinct bitmaps may collide, so a matching hash proves nothing.
+ */
+uint64_t roaring_bitmap_hash(const roaring_bitmap_t *ra);
+
+/**
+ * Fill keys[i] and fingerprints[i] with the high 16 bits and a 64-bit
+ * content fingerprint of the i-th container, for i up to the lesser of
+ * 'capacity' and the number of containers. Returns the number of containers;
+ * call with capacity 0 (keys and fingerprints may then be NULL) to size the
+ * buffers. Snapshot diffing can compare fingerprints of matching keys and
+ * deep-compare only the containers whose fingerprints changed.
+ */
+int32_t roaring_bitmap_container_fingerprints(const roaring_bitmap_t *ra,
+                                              int32_t capacity, uint16_t *keys,
+                                              uint64_t *fingerprints);
+
 /**
  * Return true if all the elements of ra1 are also in ra2.
  */
@@ -606,6 +1181,56 @@ roaring_bitmap_t *roaring_bitmap_lazy_xor(const roaring_bitmap_t *x1,
 void roaring_bitmap_lazy_xor_inplace(roaring_bitmap_t *x1,
                                      const roaring_bitmap_t *x2);
 
+/**
+ * (For expert users who seek high performance.)
+ *
+ * Computes the intersection between two bitmaps and returns new bitmap. The
+ * caller is responsible for memory management.
+ *
+ * The lazy version defers some computations such as the maintenance of the
+ * cardinality counts. Thus you need
+ * to call roaring_bitmap_repair_after_lazy after executing "lazy" computations.
+ * It is safe to repeatedly call roaring_bitmap_lazy_and_inplace on the result.
+ **/
+roaring_bitmap_t *roaring_bitmap_lazy_and(const roaring_bitmap_t *x1,
+                                          const roaring_bitmap_t *x2);
+
+/**
+ * (For expert users who seek high performance.)
+ * Inplace version of roaring_bitmap_lazy_and, modifies x1
+ */
+void roaring_bitmap_lazy_and_inplace(roaring_bitmap_t *x1,
+                                     const roaring_bitmap_t *x2);
+
+/**
+ * (For expert users who seek high performance.)
+ *
+ * Computes the difference (andnot) between two bitmaps and returns new bitmap.
+ * The caller is responsible for memory management.
+ *
+ * The lazy version defers some computations such as the maintenance of the
+ * cardinality counts. Thus you need
+ * to call roaring_bitmap_repair_after_lazy after executing "lazy" computations.
+ **/
+roaring_bitmap_t *roaring_bitmap_lazy_andnot(const roaring_bitmap_t *x1,
+                                             const roaring_bitmap_t *x2);
+
+/**
+ * (For expert users who seek high performance.)
+ * Inplace version of roaring_bitmap_lazy_andnot, modifies x1. x1 != x2
+ */
+void roaring_bitmap_lazy_andnot_inplace(roaring_bitmap_t *x1,
+                                        const roaring_bitmap_t *x2);
+
+/**
+ * Creates a new bitmap containing v + offset for each value v in bm; values
+ * shifted outside of [0, 2^32) are dropped. The shift is applied per
+ * container so the input is never expanded to individual values. The caller
+ * is responsible for freeing the result.
+ */
+roaring_bitmap_t *roaring_bitmap_add_offset(const roaring_bitmap_t *bm,
+                                            int64_t offset);
+
 /**
  * compute the negation of the roaring bitmap within a specified
  * interval: [range_start, range_end). The number of negated values is
@@ -634,6 +1259,17 @@ void roaring_bitmap_flip_inplace(roaring_bitmap_t *x1, uint64_t range_start,
  */
 bool roaring_bitmap_select(const roaring_bitmap_t *ra, uint32_t rank,
                            uint32_t *element);
+
+/**
+ * Selects the elements at the ranks in [begin, end), which must be sorted in
+ * increasing order, writing them to ans in a single pass over the bitmap.
+ * Returns false (leaving ans partially filled) if some rank is greater than
+ * or equal to the cardinality of the bitmap.
+ */
+bool roaring_bitmap_select_many(const roaring_bitmap_t *ra,
+                                const uint32_t *begin, const uint32_t *end,
+                                uint32_t *ans);
+
 /**
 * roaring_bitmap_rank returns the number of integers that are smaller or equal
 * to x. Thus if x is the first element, this function will return 1. If
@@ -646,6 +1282,41 @@ bool roaring_bitmap_select(const roaring_bitmap_t *ra, uint32_t rank,
 */
 uint64_t roaring_bitmap_rank(const roaring_bitmap_t *bm, uint32_t x);
 
+/**
+ * roaring_bitmap_rank_many ranks all the values in [begin, end), which must
+ * be sorted in increasing order, in a single pass over the bitmap; the ranks
+ * are written to ans. It uses the same indexing convention as
+ * roaring_bitmap_rank.
+ */
+void roaring_bitmap_rank_many(const roaring_bitmap_t *bm,
+                              const uint32_t *begin, const uint32_t *end,
+                              uint64_t *ans);
+
+/**
+ * roaring_bitmap_rank_transform maps 'input' from value space into the rank
+ * space of 'base': the result holds, for every value of 'input' that is
+ * present in 'base', the number of base values strictly smaller than it.
+ * These ranks are 0-based, matching the indexing convention of
+ * roaring_bitmap_select (not roaring_bitmap_rank); values absent from 'base'
+ * are dropped. The transform runs container-at-a-time over both bitmaps and
+ * shares the cached prefix-cardinality index of 'base', so mapping a filter
+ * bitmap through a dictionary bitmap costs a single pass rather than one
+ * rank query per value. Returns NULL on allocation failure.
+ */
+roaring_bitmap_t *roaring_bitmap_rank_transform(const roaring_bitmap_t *base,
+                                                const roaring_bitmap_t *input);
+
+/**
+ * The inverse of roaring_bitmap_rank_transform: every value of 'ranks' is
+ * treated as a 0-based rank and the result holds the base values at those
+ * ranks, computed with a single forward pass over 'base' (batched select).
+ * Ranks at or beyond the cardinality of 'base' are dropped. For any input,
+ * select_transform(base, rank_transform(base, input)) equals
+ * and(base, input). Returns NULL on allocation failure.
+ */
+roaring_bitmap_t *roaring_bitmap_select_transform(
+    const roaring_bitmap_t *base, const roaring_bitmap_t *ranks);
+
 /**
 * roaring_bitmap_smallest returns the smallest value in the set.
 * Returns UINT32_MAX if the set is empty.
@@ -666,6 +1337,91 @@ uint32_t roaring_bitmap_maximum(const roaring_bitmap_t *bm);
 void roaring_bitmap_statistics(const roaring_bitmap_t *ra,
                                roaring_statistics_t *stat);
 
+/**
+ * Warm the caches for an upcoming operation over this bitmap: walks the
+ * container array issuing software prefetches for each container and one
+ * touch per page of its payload. On frozen views (outside Windows) the
+ * whole arena is advised to the OS with madvise(MADV_WILLNEED) instead,
+ * which also covers memory-mapped buffers. Purely a hint; never changes
+ * the bitmap.
+ */
+void roaring_bitmap_prefetch(const roaring_bitmap_t *r);
+
+/**
+ * (For advanced users.)
+ * Report how contiguous the container payload allocations are: the
+ * fraction of consecutive container pairs whose payloads sit within a
+ * page of each other, between 0.0 (fully scattered) and 1.0 (packed, as
+ * in a frozen view). Bitmaps with fewer than two containers report 1.0.
+ */
+double roaring_bitmap_memory_contiguity(const roaring_bitmap_t *r);
+
+/**
+ * Relocate all container payloads into one contiguous 32-byte-aligned
+ * block owned by the bitmap, giving frozen-view-like cache and TLB
+ * locality to read-heavy walks (roaring_bitmap_and_cardinality and
+ * friends) while the bitmap stays fully mutable: a relocated container
+ * that later needs to grow falls back to an owned heap allocation,
+ * leaving its arena bytes behind until the next compact or until the
+ * bitmap is freed. Compacting again reclaims any such waste.
+ *
+ * Returns true on success (including when there is nothing to relocate),
+ * false on allocation failure or when called on a frozen view or on a
+ * bitmap with copy_on_write set: under copy-on-write another bitmap
+ * could still reference a payload after the arena is gone, so the two
+ * must not be combined.
+ */
+bool roaring_bitmap_compact(roaring_bitmap_t *r);
+
+/**
+ * (For advanced users.)
+ * Number of containers backing the bitmap. Together with
+ * roaring_bitmap_container_range, roaring_bitmap_container_slice and
+ * roaring_bitmap_concatenate this lets an external task scheduler split a
+ * bitmap into independent work units at container granularity.
+ */
+int32_t roaring_bitmap_num_containers(const roaring_bitmap_t *r);
+
+/**
+ * (For advanced users.)
+ * Store in *min and *max the smallest and largest value held by the
+ * container at index i (0 <= i < roaring_bitmap_num_containers). Returns
+ * false (leaving *min and *max untouched) when i is out of range.
+ */
+bool roaring_bitmap_container_range(const roaring_bitmap_t *r, int32_t i,
+                                    uint32_t *min, uint32_t *max);
+
+/**
+ * (For advanced users.)
+ * Return a new bitmap holding the containers with indexes in [start, end)
+ * without copying their payloads: the containers are shared with r
+ * through the same refcounting used by copy-on-write, so taking a slice
+ * is cheap and both bitmaps remain usable — a mutation on either side
+ * copies the affected container first. To run a binary operation
+ * restricted to a container range, slice one operand and apply the
+ * ordinary operation to the slice; combine the per-range results with
+ * roaring_bitmap_concatenate.
+ *
+ * Returns NULL on allocation failure or when the range is invalid.
+ * The slice must be freed with roaring_bitmap_free as usual.
+ */
+roaring_bitmap_t *roaring_bitmap_container_slice(const roaring_bitmap_t *r,
+                                                 int32_t start, int32_t end);
+
+/**
+ * (For advanced users.)
+ * Recombine per-range results: return a new bitmap taking ownership of
+ * the containers of the given pieces, which must be in increasing order
+ * with non-overlapping key ranges (as produced by operating on disjoint
+ * slices of the same bitmap). On success the pieces are consumed — freed
+ * and their pointers set to NULL — so only the returned bitmap needs
+ * freeing. On failure (overlapping or out-of-order pieces, a NULL or
+ * frozen piece, or allocation failure) NULL is returned and the pieces
+ * are left untouched.
+ */
+roaring_bitmap_t *roaring_bitmap_concatenate(size_t number,
+                                             roaring_bitmap_t **pieces);
+
 /*********************
 * What follows is code use to iterate through values in a roaring bitmap
 
@@ -700,6 +1456,9 @@ typedef struct roaring_uint32_iterator_s {
                         // parent->high_low_container.keys[container_index]) <<
                         // 16;
 
+    uint32_t range_last;  // inclusive upper bound enforced when advancing;
+                          // UINT32_MAX for ordinary (unbounded) iterators
+
 } roaring_uint32_iterator_t;
 
 /**
@@ -718,6 +1477,19 @@ void roaring_init_iterator(const roaring_bitmap_t *ra,
 void roaring_init_iterator_last(const roaring_bitmap_t *ra,
                                 roaring_uint32_iterator_t *newit);
 
+/**
+* Initialize an iterator object bounded to the values in
+* [range_start, range_end). If the bitmap holds a value in that range, the
+* iterator points to the first such value, it->has_value is true and the
+* value is in it->current_value; advancing past the last in-range value sets
+* it->has_value to false. For convenience, returns it->has_value. The bound
+* only applies to forward iteration: do not mix this constructor with
+* roaring_previous_uint32_iterator. Nothing is allocated.
+*/
+bool roaring_init_iterator_range(const roaring_bitmap_t *ra,
+                                 roaring_uint32_iterator_t *newit,
+                                 uint64_t range_start, uint64_t range_end);
+
 /**
 * Create an iterator object that can be used to iterate through the
 * values. Caller is responsible for calling roaring_free_iterator.
@@ -772,6 +1544,71 @@ void roaring_free_uint32_iterator(roaring_uint32_iterator_t *it);
  */
 uint32_t roaring_read_uint32_iterator(roaring_uint32_iterator_t *it, uint32_t* buf, uint32_t count);
 
+/*
+ * Descending counterpart of roaring_read_uint32_iterator: reads up to
+ * ${count} values into ${buf} in decreasing order and returns the number of
+ * read elements (smaller than ${count} means the iterator is drained). The
+ * iterator should come from roaring_init_iterator_last, or be positioned
+ * with roaring_previous_uint32_iterator, with which this function composes:
+ *  - first value is copied from ${it}->current_value
+ *  - after the function returns, the iterator is positioned at the element
+ *    preceding the last one read
+ * Much faster than stepping roaring_previous_uint32_iterator one value at
+ * a time when streaming newest-first results.
+ */
+uint32_t roaring_read_uint32_iterator_reverse(roaring_uint32_iterator_t *it, uint32_t* buf, uint32_t count);
+
+/**
+ * An iterator that walks a portable-format serialization buffer in place,
+ * producing the values in increasing order without deserializing the
+ * bitmap: only the descriptive header is parsed up front, and container
+ * payloads are decoded on the fly as the iterator passes over them. No
+ * heap allocation is performed; the struct lives wherever the caller puts
+ * it and nothing has to be freed.
+ */
+typedef struct roaring_portable_iterator_s {
+    const char *buf;        // start of the serialization buffer
+    size_t maxbytes;        // bytes available in the buffer
+    int32_t num_containers;
+    const char *run_bitmap;  // NULL when the buffer has no run containers
+    const char *keyscards;   // interleaved key/cardinality pairs
+
+    int32_t container_index;  // current container
+    const char *payload;      // current container payload in the buffer
+    size_t payload_bytes;     // size of that payload
+    uint32_t highbits;        // key of the current container, shifted
+    uint8_t typecode;
+    uint32_t cardinality;  // values in the current container (n_runs for
+                           // run containers)
+
+    int32_t in_container_index;  // array: next element; bitset: word index;
+                                 // run: offset within the current run
+    int32_t run_index;           // run: current rle element
+    uint64_t word;               // bitset: pending bits of the current word
+
+    uint32_t current_value;
+    bool has_value;
+} roaring_portable_iterator_t;
+
+/**
+* Initialize an iterator over a portable serialization buffer (as written
+* by roaring_bitmap_portable_serialize), reading no more than maxbytes.
+* Returns false if a valid header cannot be found. Otherwise the iterator
+* points to the first value if there is one (it->has_value is true and the
+* value is in it->current_value). The buffer is otherwise trusted, like
+* roaring_bitmap_portable_deserialize; a payload that would run past
+* maxbytes ends the iteration.
+*/
+bool roaring_init_portable_iterator(const char *buf, size_t maxbytes,
+                                    roaring_portable_iterator_t *newit);
+
+/**
+* Advance the iterator. If there is a new value, then it->has_value is
+* true. The new value is in it->current_value. Values are traversed in
+* increasing order. For convenience, returns it->has_value.
+*/
+bool roaring_advance_portable_iterator(roaring_portable_iterator_t *it);
+
 #ifdef __cplusplus
 }
 #endif
@@ -7,6 +7,8 @@ extern "C" {
 #include <assert.h>
 #include <roaring/array_util.h>
 #include <roaring/containers/containers.h>
+#include <roaring/memory.h>
+#include <roaring/roaring_types.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -17,11 +19,15 @@ extern "C" {
 
 #define ROARING_FLAG_COW UINT8_C(0x1)
 #define ROARING_FLAG_FROZEN UINT8_C(0x2)
+#define ROARING_FLAG_CARD_VALID UINT8_C(0x4)
+#define ROARING_FLAG_HASH_VALID UINT8_C(0x8)
 
 enum {
     SERIAL_COOKIE_NO_RUNCONTAINER = 12346,
     SERIAL_COOKIE = 12347,
+    COMPRESSED_SERIAL_COOKIE = 12348,
     FROZEN_COOKIE = 13766,
+    FROZEN_COOKIE_V2 = 13767,
     NO_OFFSET_THRESHOLD = 4
 };
 
@@ -35,6 +41,14 @@ enum {
 // of structs.  Which would have better
 // cache performance through binary searches?
 
+// Number of key/container/typecode slots stored inside roaring_array_t
+// itself. Workloads with many tiny bitmaps (one or two containers) never
+// pay for the heap-allocated parallel arrays: keys, containers and
+// typecodes point at the inline slots until the array outgrows them, in
+// the same delayed-allocation spirit as RUN_DEFAULT_INIT_SIZE in
+// perfparameters.h.
+enum { ROARING_ARRAY_INLINE_SLOTS = 2 };
+
 typedef struct roaring_array_s {
     int32_t size;
     int32_t allocation_size;
@@ -42,8 +56,81 @@ typedef struct roaring_array_s {
     uint16_t *keys;
     uint8_t *typecodes;
     uint8_t flags;
+    // total number of values over all containers; only meaningful when
+    // ROARING_FLAG_CARD_VALID is set in flags
+    uint64_t cached_cardinality;
+    // content fingerprint as computed by roaring_bitmap_hash; only meaningful
+    // when ROARING_FLAG_HASH_VALID is set in flags
+    uint64_t cached_hash;
+    // lazily built prefix sums of the container cardinalities:
+    // prefix_cardinality[i] counts the values held by containers [0, i].
+    // NULL until ra_get_prefix_index builds it; freed on any mutation.
+    uint64_t *prefix_cardinality;
+    // single block holding the relocated container payloads after
+    // roaring_bitmap_compact; NULL otherwise. Allocated with 32-byte
+    // alignment (bitset payloads) and freed when the containers go away.
+    char *arena;
+    // small-size optimization: keys, containers and typecodes point at
+    // these slots until the array grows past ROARING_ARRAY_INLINE_SLOTS,
+    // at which point they spill to a single heap block
+    void *inline_containers[ROARING_ARRAY_INLINE_SLOTS];
+    uint16_t inline_keys[ROARING_ARRAY_INLINE_SLOTS];
+    uint8_t inline_typecodes[ROARING_ARRAY_INLINE_SLOTS];
 } roaring_array_t;
 
+/**
+ * True when the array is still backed by its inline slots (no heap block
+ * to free).
+ */
+static inline bool ra_is_inline(const roaring_array_t *ra) {
+    return ra->containers == (void **)ra->inline_containers;
+}
+
+/**
+ * An array backed by its inline slots cannot be relocated by a plain
+ * struct copy: the keys/containers/typecodes pointers in the copy still
+ * reference the struct it was copied from. Call this on the copy, passing
+ * the source, to repoint them; the slot contents travelled with the
+ * struct. A no-op for heap-backed arrays.
+ */
+static inline void ra_rebase_inline(roaring_array_t *ra,
+                                    const roaring_array_t *source) {
+    if (ra->containers == (void **)source->inline_containers) {
+        ra->containers = ra->inline_containers;
+        ra->keys = ra->inline_keys;
+        ra->typecodes = ra->inline_typecodes;
+    }
+}
+
+/**
+ * Free the lazily built prefix-cardinality index, if any.
+ */
+static inline void ra_invalidate_prefix_index(roaring_array_t *ra) {
+    if (ra->prefix_cardinality != NULL) {
+        roaring_free(ra->prefix_cardinality);
+        ra->prefix_cardinality = NULL;
+    }
+}
+
+/**
+ * Invalidate the cached total cardinality, the cached hash and the
+ * prefix-cardinality index. Every operation that may change the content of
+ * the array (lazy operations included) must call this; the caches are
+ * refilled by roaring_bitmap_get_cardinality, roaring_bitmap_hash and
+ * roaring_bitmap_repair_after_lazy.
+ */
+static inline void ra_invalidate_cached_cardinality(roaring_array_t *ra) {
+    ra->flags &= ~(ROARING_FLAG_CARD_VALID | ROARING_FLAG_HASH_VALID);
+    ra_invalidate_prefix_index(ra);
+}
+
+/**
+ * Return the prefix-cardinality index, building and caching it on first use.
+ * Returns NULL if the array is empty or if the allocation failed. Building
+ * the index also refreshes the cached total cardinality.
+ */
+const uint64_t *ra_get_prefix_index(roaring_array_t *ra);
+
 /**
  * Create a new roaring array
  */
@@ -97,6 +184,11 @@ void ra_clear_containers(roaring_array_t *ra);
  */
 inline int32_t ra_get_index(const roaring_array_t *ra, uint16_t x) {
     if ((ra->size == 0) || ra->keys[ra->size - 1] == x) return ra->size - 1;
+    if (ra->size > 64) {
+        // with thousands of containers a plain binary search costs
+        // log2(size) dependent cache misses; the large variant overlaps them
+        return binarySearchLarge(ra->keys, (int32_t)ra->size, x);
+    }
     return binarySearch(ra->keys, (int32_t)ra->size, x);
 }
 
@@ -221,6 +313,15 @@ bool ra_range_uint32_array(const roaring_array_t *ra, size_t offset, size_t limi
  */
 size_t ra_portable_serialize(const roaring_array_t *ra, char *buf);
 
+/**
+ * stream a bitmap to a writer callback in the portable format, in a single
+ * pass and without staging the output in a buffer. Container payloads are
+ * handed to the writer straight from container memory. Returns the number
+ * of bytes written, or 0 if the writer reported a failure.
+ */
+size_t ra_portable_serialize_to(const roaring_array_t *ra,
+                                roaring_writer_t writer, void *arg);
+
 /**
  * read a bitmap from a serialized version. This is meant to be compatible
  * with the Java and Go versions.
@@ -231,6 +332,23 @@ size_t ra_portable_serialize(const roaring_array_t *ra, char *buf);
  */
 bool ra_portable_deserialize(roaring_array_t *ra, const char *buf, const size_t maxbytes, size_t * readbytes);
 
+/**
+ * Like ra_portable_deserialize, but applies the convert_run_optimize decision
+ * per container while decoding: each container is built directly in the
+ * representation roaring_bitmap_run_optimize would pick, the rejected
+ * representation is never allocated.
+ */
+bool ra_portable_deserialize_run_optimized(roaring_array_t *ra, const char *buf, const size_t maxbytes, size_t * readbytes);
+
+/**
+ * Like ra_portable_deserialize but without any bounds or sanity checks:
+ * the buffer must hold a complete, valid serialized bitmap (e.g. verified
+ * by a storage-layer checksum). Container payloads are bulk-copied into a
+ * single arena that the containers borrow from, as after
+ * roaring_bitmap_compact. Returns false only on allocation failure.
+ */
+bool ra_portable_deserialize_trusted(roaring_array_t *ra, const char *buf);
+
 /**
  * Quickly checks whether there is a serialized bitmap at the pointer,
  * not exceeding size "maxbytes" in bytes. This function does not allocate
@@ -0,0 +1,91 @@
+/*
+ * An atomic reference to a published bitmap, for the read-mostly pattern
+ * where many query threads serve from a bitmap that a single writer thread
+ * replaces every so often.
+ *
+ * Readers call roaring_atomic_ref_acquire to pin the currently published
+ * version and roaring_atomic_ref_release when done; both are lock-free (two
+ * atomic counter updates each), so a write burst never stalls a query
+ * thread. The writer prepares the next version — typically starting from
+ * roaring_atomic_ref_checkout, whose copy-on-write copy shares every
+ * container with the published version, so only the containers actually
+ * changed cost anything — and installs it with roaring_atomic_ref_publish.
+ * Displaced versions are reclaimed through an epoch scheme plus a per-version
+ * reference count: publish waits only for readers caught mid-acquire at the
+ * instant of the swap (a handful of instructions), after which each retired
+ * version is freed by whichever reader releases it last.
+ *
+ * One writer at a time: concurrent publish/checkout/free calls require
+ * external synchronization among themselves (not with readers). Acquired
+ * bitmaps are read-only. Without C11 atomics (see ROARING_ATOMIC_REFCOUNT in
+ * containers/containers.h) the functions still work but every concurrency
+ * guarantee is lost, and all calls must be externally synchronized.
+ *
+ * Publish primes the version's cardinality cache and prefix-cardinality
+ * index, so that the first get_cardinality, rank or select does not write
+ * to a shared bitmap; if readers will call roaring_bitmap_hash, compute it
+ * once before publishing for the same reason.
+ */
+#ifndef ROARING_ATOMIC_REF_H
+#define ROARING_ATOMIC_REF_H
+
+#include <roaring/roaring.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct roaring_atomic_ref_s roaring_atomic_ref_t;
+
+/**
+ * Creates a reference publishing 'initial' as the first version, taking
+ * ownership of it (do not free or mutate it afterwards). Returns NULL on
+ * allocation failure, in which case 'initial' remains caller-owned.
+ */
+roaring_atomic_ref_t *roaring_atomic_ref_create(roaring_bitmap_t *initial);
+
+/**
+ * Pins and returns the currently published version. The returned bitmap is
+ * valid — and unchanging — until the matching roaring_atomic_ref_release,
+ * no matter how many versions are published in between. Lock-free; safe to
+ * call from any number of threads.
+ */
+const roaring_bitmap_t *roaring_atomic_ref_acquire(roaring_atomic_ref_t *ref);
+
+/**
+ * Releases a bitmap obtained from roaring_atomic_ref_acquire. The last
+ * release of a displaced version frees it.
+ */
+void roaring_atomic_ref_release(const roaring_bitmap_t *snapshot);
+
+/**
+ * Returns a mutable copy-on-write copy of the currently published version,
+ * for the writer to apply its updates to. Containers are shared with the
+ * published version until mutated, so the writer pays only for what it
+ * changes. Writer-only. Returns NULL on allocation failure.
+ */
+roaring_bitmap_t *roaring_atomic_ref_checkout(roaring_atomic_ref_t *ref);
+
+/**
+ * Publishes 'updated' as the new current version, taking ownership of it,
+ * and drops the reference's own pin on the previous version (readers that
+ * acquired it keep it alive until they release it). Waits only for readers
+ * caught between loading the old version and pinning it. Writer-only.
+ * Returns false on allocation failure, in which case nothing is published
+ * and 'updated' remains caller-owned.
+ */
+bool roaring_atomic_ref_publish(roaring_atomic_ref_t *ref,
+                                roaring_bitmap_t *updated);
+
+/**
+ * Frees the reference and drops its pin on the current version. The caller
+ * must ensure no reader or writer is still using the reference; bitmaps
+ * already acquired stay valid until released.
+ */
+void roaring_atomic_ref_free(roaring_atomic_ref_t *ref);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * A single-file, memory-mappable collection of frozen bitmaps.
+ *
+ * The file starts with a small header and a sorted key -> (offset, size)
+ * index, followed by the concatenated bitmaps in the frozen v2 format, each
+ * starting on a 32-byte boundary:
+ *
+ *   uint32  cookie
+ *   uint32  version
+ *   uint64  count
+ *   uint64  keys[count]       sorted, unique
+ *   uint64  offsets[count]    absolute byte offsets, multiples of 32
+ *   uint64  sizes[count]      frozen v2 blob sizes in bytes
+ *   ...     zero padding and the frozen v2 blobs
+ *
+ * A collection opened over an mmap'ed file hands out zero-copy read-only
+ * bitmap views without any per-bitmap deserialization, which replaces
+ * storing millions of individually serialized blobs in a key-value store.
+ * Like the frozen formats, the buffer must be 32-byte aligned (mmap
+ * guarantees page alignment) and must outlive every view taken from it.
+ */
+#ifndef ROARING_COLLECTION_H
+#define ROARING_COLLECTION_H
+
+#include <roaring/roaring.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct roaring_collection_s roaring_collection_t;
+
+/**
+ * Returns the number of bytes required to serialize 'number' bitmaps as a
+ * collection, padding included.
+ */
+size_t roaring_collection_size_in_bytes(size_t number,
+                                        const roaring_bitmap_t **bitmaps);
+
+/**
+ * Serializes the bitmaps and their keys as a collection into buf, whose size
+ * must be at least roaring_collection_size_in_bytes(). The keys must be
+ * sorted and unique; returns the number of bytes written, or 0 if they are
+ * not. Call roaring_bitmap_run_optimize on the bitmaps beforehand if a
+ * compact file matters.
+ */
+size_t roaring_collection_serialize(size_t number, const uint64_t *keys,
+                                    const roaring_bitmap_t **bitmaps,
+                                    char *buf);
+
+/**
+ * Opens a read-only view of a serialized collection. The buffer must be
+ * 32-byte aligned and hold 'length' bytes previously produced by
+ * roaring_collection_serialize; it must not be freed or modified while the
+ * collection or any bitmap obtained from it is in use. The index is
+ * validated, but the bitmaps themselves are not touched until they are
+ * requested. Returns NULL if the buffer does not hold a valid collection.
+ * Free with roaring_collection_free (the buffer itself stays caller-owned).
+ */
+const roaring_collection_t *roaring_collection_frozen_view(const char *buf,
+                                                           size_t length);
+
+/**
+ * Frees the collection handle. Outstanding bitmap views remain valid: they
+ * depend only on the underlying buffer.
+ */
+void roaring_collection_free(const roaring_collection_t *collection);
+
+/**
+ * Returns the number of bitmaps in the collection.
+ */
+size_t roaring_collection_count(const roaring_collection_t *collection);
+
+/**
+ * Returns the key of the i-th bitmap (keys are sorted); i must be less than
+ * roaring_collection_count().
+ */
+uint64_t roaring_collection_key_at(const roaring_collection_t *collection,
+                                   size_t i);
+
+/**
+ * Returns a zero-copy read-only view of the i-th bitmap, or NULL on
+ * allocation failure; i must be less than roaring_collection_count().
+ * The view is freed with roaring_bitmap_free and is usable in all readonly
+ * contexts, like any frozen view.
+ */
+const roaring_bitmap_t *roaring_collection_get_at(
+    const roaring_collection_t *collection, size_t i);
+
+/**
+ * Looks up a key in the sorted index and returns a zero-copy read-only view
+ * of its bitmap, or NULL if the key is absent (or on allocation failure).
+ * The view is freed with roaring_bitmap_free.
+ */
+const roaring_bitmap_t *roaring_collection_get(
+    const roaring_collection_t *collection, uint64_t key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ROARING_COLLECTION_H */
@@ -0,0 +1,102 @@
+/*
+ * A sharded facade over one logical bitmap, for scaling mutations across
+ * writer threads.
+ *
+ * A single hot roaring_bitmap_t serializes every mutation through whatever
+ * lock its owner wraps around it. A roaring_sharded_t splits the value
+ * space over N internal bitmaps, each behind its own lock: values are
+ * routed by their container key (the high 16 bits), so a 64K chunk lives
+ * wholly in one shard and writers touching different chunks never contend.
+ * Two routing policies are offered — contiguous key ranges, which keeps
+ * related keys together and makes merging a straight append, or a
+ * multiplicative hash of the key, which spreads sequential key ranges
+ * evenly over the shards when the workload is concentrated in one region
+ * of the value space.
+ *
+ * All operations take only the locks of the shards they touch: point
+ * operations lock one shard, the aggregate operations visit the shards one
+ * at a time. Aggregates over a sharded bitmap that other threads are
+ * mutating are therefore consistent per shard, not across shards — the
+ * usual contract for striped data structures. Without POSIX threads the
+ * facade compiles without locks and must be externally synchronized.
+ */
+#ifndef ROARING_SHARDED_H
+#define ROARING_SHARDED_H
+
+#include <roaring/roaring.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum roaring_shard_policy_e {
+    // shard k owns the k-th contiguous slice of the container-key space
+    ROARING_SHARD_BY_RANGE = 0,
+    // shards are assigned by a multiplicative hash of the container key
+    ROARING_SHARD_BY_HASH = 1,
+} roaring_shard_policy_t;
+
+typedef struct roaring_sharded_s roaring_sharded_t;
+
+/**
+ * Creates an empty sharded bitmap with 'num_shards' internal bitmaps
+ * (clamped to at least 1; a sensible value is the number of writer
+ * threads). Returns NULL on allocation failure.
+ */
+roaring_sharded_t *roaring_sharded_create(uint32_t num_shards,
+                                          roaring_shard_policy_t policy);
+
+/**
+ * Frees a sharded bitmap. The caller must ensure no other thread is still
+ * using it.
+ */
+void roaring_sharded_free(roaring_sharded_t *rs);
+
+/**
+ * Adds value x, locking only the owning shard.
+ */
+void roaring_sharded_add(roaring_sharded_t *rs, uint32_t x);
+
+/**
+ * Adds n_args values from vals. The values are bucketed by shard first, so
+ * each shard is locked once per call rather than once per value; values
+ * need not be sorted.
+ */
+void roaring_sharded_add_bulk(roaring_sharded_t *rs, size_t n_args,
+                              const uint32_t *vals);
+
+/**
+ * Removes value x, locking only the owning shard.
+ */
+void roaring_sharded_remove(roaring_sharded_t *rs, uint32_t x);
+
+/**
+ * Returns true if value x is present, locking only the owning shard.
+ */
+bool roaring_sharded_contains(const roaring_sharded_t *rs, uint32_t x);
+
+/**
+ * Returns the total cardinality, visiting the shards one at a time.
+ */
+uint64_t roaring_sharded_get_cardinality(const roaring_sharded_t *rs);
+
+/**
+ * Unions an ordinary bitmap into the sharded one. Each container of x2 is
+ * routed to its owning shard, so concurrent writers to other shards are
+ * not blocked for the duration of the whole union.
+ */
+void roaring_sharded_or_inplace(roaring_sharded_t *rs,
+                                const roaring_bitmap_t *x2);
+
+/**
+ * Merges the shards into an ordinary bitmap, for serialization or for the
+ * single-threaded operations the facade does not offer. The sharded bitmap
+ * is unchanged. Returns NULL on allocation failure.
+ */
+roaring_bitmap_t *roaring_sharded_merge(const roaring_sharded_t *rs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
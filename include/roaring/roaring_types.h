@@ -8,6 +8,22 @@
 typedef bool (*roaring_iterator)(uint32_t value, void *param);
 typedef bool (*roaring_iterator64)(uint64_t value, void *param);
 
+// receives a maximal range of consecutive values [range_start,
+// range_start + range_length); the length is 64-bit because a single range
+// can cover the whole 32-bit space
+typedef bool (*roaring_range_iterator)(uint32_t range_start,
+                                       uint64_t range_length, void *param);
+
+/**
+ * Writer callback for streaming serialization. Receives 'len' bytes at
+ * 'data'; 'arg' is the opaque pointer supplied by the caller. Returns true
+ * on success; returning false aborts the serialization. The data pointer
+ * may alias internal container memory and is only valid for the duration
+ * of the call. Writes can be small (a few bytes), so the sink should be
+ * buffered (e.g. fwrite or a writev batcher).
+ */
+typedef bool (*roaring_writer_t)(const char *data, size_t len, void *arg);
+
 /**
 *  (For advanced users.)
 * The roaring_statistics_t can be used to collect detailed statistics about
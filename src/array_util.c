@@ -10,8 +10,58 @@
 #include <roaring/utilasm.h>
 extern inline int32_t binarySearch(const uint16_t *array, int32_t lenarray,
                                    uint16_t ikey);
+extern inline int32_t lower_bound_uint16(const uint16_t *array,
+                                         int32_t lenarray, uint16_t ikey);
 
+/**
+ * Like binarySearch, but tuned for long arrays such as the keys of a
+ * roaring_array_t holding tens of thousands of containers. Each step
+ * prefetches both candidate follow-up probes so that successive cache
+ * misses overlap, and the last couple of cache lines are resolved with
+ * vector comparisons instead of further dependent loads.
+ */
+int32_t binarySearchLarge(const uint16_t *array, int32_t lenarray,
+                          uint16_t ikey) {
 #ifdef USESSE4
+    int32_t low = 0;
+    int32_t high = lenarray;  // half-open: find the first key >= ikey
+    while (high - low > 32) {
+        const int32_t middleIndex = (low + high) >> 1;
+        _mm_prefetch((const char *)(array + ((low + middleIndex) >> 1)),
+                     _MM_HINT_T0);
+        _mm_prefetch((const char *)(array + ((middleIndex + high) >> 1)),
+                     _MM_HINT_T0);
+        if (array[middleIndex] < ikey) {
+            low = middleIndex + 1;
+        } else {
+            high = middleIndex;
+        }
+    }
+    // count how many of the remaining keys are smaller, eight per comparison
+    const __m128i conv = _mm_set1_epi16((int16_t)0x8000);
+    const __m128i key = _mm_set1_epi16((int16_t)(ikey ^ 0x8000));
+    int32_t pos = low;
+    int32_t count = 0;
+    while (pos + 8 <= high) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(array + pos));
+        v = _mm_xor_si128(v, conv);  // order the unsigned keys as signed
+        const __m128i lt = _mm_cmpgt_epi16(key, v);
+        count += _mm_popcnt_u32((uint32_t)_mm_movemask_epi8(lt)) / 2;
+        pos += 8;
+    }
+    while (pos < high) {
+        count += (array[pos] < ikey) ? 1 : 0;
+        pos++;
+    }
+    pos = low + count;
+    if (pos < lenarray && array[pos] == ikey) return pos;
+    return -(pos + 1);
+#else
+    return binarySearch(array, lenarray, ikey);
+#endif
+}
+
+#if defined(USESSE4) || (defined(USENEON) && defined(__aarch64__))
 // used by intersect_vector16
 ALIGNED(0x1000)
 static const uint8_t shuffle_mask16[] = {
@@ -653,6 +703,137 @@ int32_t difference_vector16(const uint16_t *__restrict__ A, size_t s_a,
 
 #endif  // USESSE4
 
+#if !defined(USESSE4) && defined(USENEON) && defined(__aarch64__)
+
+/**
+ * Flag the lanes of v_a that match any lane of v_b.
+ * This plays the role of _mm_cmpistrm with _SIDD_CMP_EQUAL_ANY: we compare
+ * v_a against every rotation of v_b and OR the equality masks together.
+ */
+static inline uint16x8_t neon_match_any_epu16(uint16x8_t v_a, uint16x8_t v_b) {
+    uint16x8_t m = vceqq_u16(v_a, v_b);
+    m = vorrq_u16(m, vceqq_u16(v_a, vextq_u16(v_b, v_b, 1)));
+    m = vorrq_u16(m, vceqq_u16(v_a, vextq_u16(v_b, v_b, 2)));
+    m = vorrq_u16(m, vceqq_u16(v_a, vextq_u16(v_b, v_b, 3)));
+    m = vorrq_u16(m, vceqq_u16(v_a, vextq_u16(v_b, v_b, 4)));
+    m = vorrq_u16(m, vceqq_u16(v_a, vextq_u16(v_b, v_b, 5)));
+    m = vorrq_u16(m, vceqq_u16(v_a, vextq_u16(v_b, v_b, 6)));
+    m = vorrq_u16(m, vceqq_u16(v_a, vextq_u16(v_b, v_b, 7)));
+    return m;
+}
+
+/**
+ * Condense an 8x16-bit comparison mask into an 8-bit movemask
+ * (bit k is set when lane k is all ones).
+ */
+static inline int neon_movemask_epu16(uint16x8_t m) {
+    static const uint16_t bits_arr[8] = {1, 2, 4, 8, 16, 32, 64, 128};
+    return (int)vaddvq_u16(vandq_u16(m, vld1q_u16(bits_arr)));
+}
+
+/**
+ * NEON port of the Schlegel et al. sorted-set intersection, for aarch64
+ * (e.g. Graviton).  Reuses the SSE shuffle_mask16 table: vqtbl1q_u8 maps
+ * out-of-range (0xFF) indexes to zero just as PSHUFB does.
+ */
+int32_t intersect_vector16(const uint16_t *__restrict__ A, size_t s_a,
+                           const uint16_t *__restrict__ B, size_t s_b,
+                           uint16_t *C) {
+    size_t count = 0;
+    size_t i_a = 0, i_b = 0;
+    const int vectorlength = sizeof(uint16x8_t) / sizeof(uint16_t);
+    const size_t st_a = (s_a / vectorlength) * vectorlength;
+    const size_t st_b = (s_b / vectorlength) * vectorlength;
+    if ((i_a < st_a) && (i_b < st_b)) {
+        uint16x8_t v_a = vld1q_u16(&A[i_a]);
+        uint16x8_t v_b = vld1q_u16(&B[i_b]);
+        while (true) {
+            const int r = neon_movemask_epu16(neon_match_any_epu16(v_a, v_b));
+            const uint8x16_t sm16 =
+                vld1q_u8(shuffle_mask16 + 16 * (size_t)r);
+            const uint8x16_t p = vqtbl1q_u8(vreinterpretq_u8_u16(v_a), sm16);
+            vst1q_u8((uint8_t *)&C[count], p);  // can overflow
+            count += (size_t)__builtin_popcount((unsigned int)r);
+            const uint16_t a_max = A[i_a + vectorlength - 1];
+            const uint16_t b_max = B[i_b + vectorlength - 1];
+            if (a_max <= b_max) {
+                i_a += vectorlength;
+                if (i_a == st_a) break;
+                v_a = vld1q_u16(&A[i_a]);
+            }
+            if (b_max <= a_max) {
+                i_b += vectorlength;
+                if (i_b == st_b) break;
+                v_b = vld1q_u16(&B[i_b]);
+            }
+        }
+    }
+    // intersect the tail using scalar intersection
+    while (i_a < s_a && i_b < s_b) {
+        uint16_t a = A[i_a];
+        uint16_t b = B[i_b];
+        if (a < b) {
+            i_a++;
+        } else if (b < a) {
+            i_b++;
+        } else {
+            C[count] = a;  //==b;
+            count++;
+            i_a++;
+            i_b++;
+        }
+    }
+    return (int32_t)count;
+}
+
+int32_t intersect_vector16_cardinality(const uint16_t *__restrict__ A,
+                                       size_t s_a,
+                                       const uint16_t *__restrict__ B,
+                                       size_t s_b) {
+    size_t count = 0;
+    size_t i_a = 0, i_b = 0;
+    const int vectorlength = sizeof(uint16x8_t) / sizeof(uint16_t);
+    const size_t st_a = (s_a / vectorlength) * vectorlength;
+    const size_t st_b = (s_b / vectorlength) * vectorlength;
+    if ((i_a < st_a) && (i_b < st_b)) {
+        uint16x8_t v_a = vld1q_u16(&A[i_a]);
+        uint16x8_t v_b = vld1q_u16(&B[i_b]);
+        while (true) {
+            const int r = neon_movemask_epu16(neon_match_any_epu16(v_a, v_b));
+            count += (size_t)__builtin_popcount((unsigned int)r);
+            const uint16_t a_max = A[i_a + vectorlength - 1];
+            const uint16_t b_max = B[i_b + vectorlength - 1];
+            if (a_max <= b_max) {
+                i_a += vectorlength;
+                if (i_a == st_a) break;
+                v_a = vld1q_u16(&A[i_a]);
+            }
+            if (b_max <= a_max) {
+                i_b += vectorlength;
+                if (i_b == st_b) break;
+                v_b = vld1q_u16(&B[i_b]);
+            }
+        }
+    }
+    // intersect the tail using scalar intersection
+    while (i_a < s_a && i_b < s_b) {
+        uint16_t a = A[i_a];
+        uint16_t b = B[i_b];
+        if (a < b) {
+            i_a++;
+        } else if (b < a) {
+            i_b++;
+        } else {
+            count++;
+            i_a++;
+            i_b++;
+        }
+    }
+    return (int32_t)count;
+}
+
+#endif  // !defined(USESSE4) && defined(USENEON) && defined(__aarch64__)
+
 
 
 #ifdef USE_OLD_SKEW_INTERSECT
@@ -729,6 +910,50 @@ static void binarySearch4(const uint16_t *array, int32_t n, uint16_t target1,
   *index4 = (int32_t)((*base4 < target4) + base4 - array);
 }
 
+/**
+* Branchless binary search going after 8 values at once.
+* Assumes that array is sorted.
+* You have that array[*index1] >= target1, array[*index2] >= target2, ...
+* except when *index1 = n, in which case you know that all values in array are
+* smaller than target1, and so forth.
+* The eight searches are fully independent, so the compiler is free to keep
+* all eight comparisons in flight at once (vectorizing them where profitable).
+* It has logarithmic complexity.
+*/
+static void binarySearch8(const uint16_t *array, int32_t n,
+                          const uint16_t *targets, int32_t *indexes) {
+  const uint16_t *base1 = array;
+  const uint16_t *base2 = array;
+  const uint16_t *base3 = array;
+  const uint16_t *base4 = array;
+  const uint16_t *base5 = array;
+  const uint16_t *base6 = array;
+  const uint16_t *base7 = array;
+  const uint16_t *base8 = array;
+  if (n == 0)
+    return;
+  while (n > 1) {
+    int32_t half = n >> 1;
+    base1 = (base1[half] < targets[0]) ? &base1[half] : base1;
+    base2 = (base2[half] < targets[1]) ? &base2[half] : base2;
+    base3 = (base3[half] < targets[2]) ? &base3[half] : base3;
+    base4 = (base4[half] < targets[3]) ? &base4[half] : base4;
+    base5 = (base5[half] < targets[4]) ? &base5[half] : base5;
+    base6 = (base6[half] < targets[5]) ? &base6[half] : base6;
+    base7 = (base7[half] < targets[6]) ? &base7[half] : base7;
+    base8 = (base8[half] < targets[7]) ? &base8[half] : base8;
+    n -= half;
+  }
+  indexes[0] = (int32_t)((*base1 < targets[0]) + base1 - array);
+  indexes[1] = (int32_t)((*base2 < targets[1]) + base2 - array);
+  indexes[2] = (int32_t)((*base3 < targets[2]) + base3 - array);
+  indexes[3] = (int32_t)((*base4 < targets[3]) + base4 - array);
+  indexes[4] = (int32_t)((*base5 < targets[4]) + base5 - array);
+  indexes[5] = (int32_t)((*base6 < targets[5]) + base6 - array);
+  indexes[6] = (int32_t)((*base7 < targets[6]) + base7 - array);
+  indexes[7] = (int32_t)((*base8 < targets[7]) + base8 - array);
+}
+
 /**
 * Branchless binary search going after 2 values at once.
 * Assumes that array is sorted.
@@ -767,6 +992,19 @@ int32_t intersect_skewed_uint16(const uint16_t *small, size_t size_s,
   if (0 == size_s) {
     return 0;
   }
+  int32_t indexes[8];
+  while ((idx_s + 8 <= size_s) && (idx_l < size_l)) {
+    binarySearch8(large + idx_l, (int32_t)(size_l - idx_l), small + idx_s,
+                  indexes);
+    for (int k = 0; k < 8; k++) {
+      if ((indexes[k] + idx_l < size_l) &&
+          (large[idx_l + indexes[k]] == small[idx_s + k])) {
+        buffer[pos++] = small[idx_s + k];
+      }
+    }
+    idx_s += 8;
+    idx_l += indexes[7];
+  }
   int32_t index1 = 0, index2 = 0, index3 = 0, index4 = 0;
   while ((idx_s + 4 <= size_s) && (idx_l < size_l)) {
     uint16_t target1 = small[idx_s];
@@ -806,8 +1044,9 @@ int32_t intersect_skewed_uint16(const uint16_t *small, size_t size_s,
   }
   if ((idx_s < size_s) && (idx_l < size_l)) {
     uint16_t val_s = small[idx_s];
-    int32_t index = binarySearch(large + idx_l, (int32_t)(size_l - idx_l), val_s);
-    if (index >= 0)
+    int32_t index =
+        lower_bound_uint16(large + idx_l, (int32_t)(size_l - idx_l), val_s);
+    if ((index + idx_l < size_l) && (large[idx_l + index] == val_s))
       buffer[pos++] = val_s;
   }
   return (int32_t)pos;
@@ -817,7 +1056,7 @@ int32_t intersect_skewed_uint16(const uint16_t *small, size_t size_s,
 #endif //USE_OLD_SKEW_INTERSECT
 
 
-// TODO: this could be accelerated, possibly, by using binarySearch4 as above.
+#ifdef USE_OLD_SKEW_INTERSECT
 int32_t intersect_skewed_uint16_cardinality(const uint16_t *small,
                                             size_t size_s,
                                             const uint16_t *large,
@@ -853,6 +1092,106 @@ int32_t intersect_skewed_uint16_cardinality(const uint16_t *small,
     return (int32_t)pos;
 }
 
+void contains_many_uint16(const uint16_t *array, int32_t length,
+                          const uint16_t *targets, size_t n, bool *out) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = binarySearch(array, length, targets[i]) >= 0;
+    }
+}
+#else // USE_OLD_SKEW_INTERSECT
+
+/* Answers membership queries in blocks of 8 through the branchless
+ * multi-target binary search: the eight probes need not be sorted, they are
+ * simply resolved together so that their comparisons overlap. */
+void contains_many_uint16(const uint16_t *array, int32_t length,
+                          const uint16_t *targets, size_t n, bool *out) {
+  size_t i = 0;
+  int32_t indexes[8];
+  for (; i + 8 <= n; i += 8) {
+    binarySearch8(array, length, targets + i, indexes);
+    for (int k = 0; k < 8; k++) {
+      out[i + k] =
+          (indexes[k] < length) && (array[indexes[k]] == targets[i + k]);
+    }
+  }
+  for (; i < n; i++) {
+    out[i] = binarySearch(array, length, targets[i]) >= 0;
+  }
+}
+
+/* Counting variant of intersect_skewed_uint16, processing the small set in
+ * blocks of 8, 4 and 2 values through the branchless multi-target binary
+ * searches above. */
+int32_t intersect_skewed_uint16_cardinality(const uint16_t *small,
+                                            size_t size_s,
+                                            const uint16_t *large,
+                                            size_t size_l) {
+  size_t pos = 0, idx_l = 0, idx_s = 0;
+
+  if (0 == size_s) {
+    return 0;
+  }
+  int32_t indexes[8];
+  while ((idx_s + 8 <= size_s) && (idx_l < size_l)) {
+    binarySearch8(large + idx_l, (int32_t)(size_l - idx_l), small + idx_s,
+                  indexes);
+    for (int k = 0; k < 8; k++) {
+      if ((indexes[k] + idx_l < size_l) &&
+          (large[idx_l + indexes[k]] == small[idx_s + k])) {
+        pos++;
+      }
+    }
+    idx_s += 8;
+    idx_l += indexes[7];
+  }
+  int32_t index1 = 0, index2 = 0, index3 = 0, index4 = 0;
+  while ((idx_s + 4 <= size_s) && (idx_l < size_l)) {
+    uint16_t target1 = small[idx_s];
+    uint16_t target2 = small[idx_s + 1];
+    uint16_t target3 = small[idx_s + 2];
+    uint16_t target4 = small[idx_s + 3];
+    binarySearch4(large + idx_l, (int32_t)(size_l - idx_l), target1, target2,
+                  target3, target4, &index1, &index2, &index3, &index4);
+    if ((index1 + idx_l < size_l) && (large[idx_l + index1] == target1)) {
+      pos++;
+    }
+    if ((index2 + idx_l < size_l) && (large[idx_l + index2] == target2)) {
+      pos++;
+    }
+    if ((index3 + idx_l < size_l) && (large[idx_l + index3] == target3)) {
+      pos++;
+    }
+    if ((index4 + idx_l < size_l) && (large[idx_l + index4] == target4)) {
+      pos++;
+    }
+    idx_s += 4;
+    idx_l += index4;
+  }
+  if ((idx_s + 2 <= size_s) && (idx_l < size_l)) {
+    uint16_t target1 = small[idx_s];
+    uint16_t target2 = small[idx_s + 1];
+    binarySearch2(large + idx_l, (int32_t)(size_l - idx_l), target1, target2,
+                  &index1, &index2);
+    if ((index1 + idx_l < size_l) && (large[idx_l + index1] == target1)) {
+      pos++;
+    }
+    if ((index2 + idx_l < size_l) && (large[idx_l + index2] == target2)) {
+      pos++;
+    }
+    idx_s += 2;
+    idx_l += index2;
+  }
+  if ((idx_s < size_s) && (idx_l < size_l)) {
+    uint16_t val_s = small[idx_s];
+    int32_t index =
+        lower_bound_uint16(large + idx_l, (int32_t)(size_l - idx_l), val_s);
+    if ((index + idx_l < size_l) && (large[idx_l + index] == val_s))
+      pos++;
+  }
+  return (int32_t)pos;
+}
+#endif //USE_OLD_SKEW_INTERSECT
+
 bool intersect_skewed_uint16_nonempty(const uint16_t *small, size_t size_s,
                                 const uint16_t *large, size_t size_l) {
     size_t idx_l = 0, idx_s = 0;
@@ -1909,6 +2248,32 @@ size_t fast_union_uint16(const uint16_t *set_1, size_t size_1, const uint16_t *s
 #endif
 }
 
+void prefix_sum_deltas_uint16(uint16_t *buf, int32_t length) {
+    int32_t i = 1;
+#ifdef USEAVX
+    // running prefix sum, eight values per step: each register gets its
+    // intra-register prefix through shift-and-add, then the total so far
+    // is broadcast onto it
+    if (length > 8) {
+        const __m128i ones = _mm_set1_epi16(1);
+        __m128i running = _mm_set1_epi16((short)buf[0]);
+        for (; i + 8 <= length; i += 8) {
+            __m128i v = _mm_lddqu_si128((const __m128i *)(buf + i));
+            v = _mm_add_epi16(v, ones);
+            v = _mm_add_epi16(v, _mm_slli_si128(v, 2));
+            v = _mm_add_epi16(v, _mm_slli_si128(v, 4));
+            v = _mm_add_epi16(v, _mm_slli_si128(v, 8));
+            v = _mm_add_epi16(v, running);
+            _mm_storeu_si128((__m128i *)(buf + i), v);
+            running = _mm_set1_epi16((short)_mm_extract_epi16(v, 7));
+        }
+    }
+#endif
+    for (; i < length; i++) {
+        buf[i] = (uint16_t)(buf[i] + buf[i - 1] + 1);
+    }
+}
+
 bool memequals(const void *s1, const void *s2, size_t n) {
     if (n == 0) {
         return true;
@@ -1932,8 +2297,11 @@ bool memequals(const void *s1, const void *s2, size_t n) {
     }
 
     while (ptr1 < end8) {
-        uint64_t v1 = *((const uint64_t*)ptr1);
-        uint64_t v2 = *((const uint64_t*)ptr2);
+        // memcpy rather than a direct load: the inputs are only guaranteed
+        // byte-aligned (e.g. uint16_t payloads packed into an arena)
+        uint64_t v1, v2;
+        memcpy(&v1, ptr1, sizeof(v1));
+        memcpy(&v2, ptr2, sizeof(v2));
         if (v1 != v2) {
             return false;
         }
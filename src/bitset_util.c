@@ -623,6 +623,46 @@ size_t bitset_extract_setbits(uint64_t *bitset, size_t length, void *vout,
     return outpos;
 }
 
+size_t bitset_extract_setbits_partial(uint64_t *words, size_t length,
+                                      uint32_t *out, size_t outcapacity,
+                                      uint32_t base, size_t *words_consumed) {
+    size_t outpos = 0;
+    size_t consumed = 0;
+    // as long as the next block of words cannot overflow the output even if
+    // every one of its bits is set, decode whole blocks at full speed
+    while ((length > consumed) && (outcapacity - outpos >= 64)) {
+        size_t safelength = (outcapacity - outpos) / 64;
+        if (safelength > length - consumed) safelength = length - consumed;
+#ifdef USEAVX2FORDECODING
+        outpos += bitset_extract_setbits_avx2(
+            words + consumed, safelength, out + outpos, outcapacity - outpos,
+            base + 64 * (uint32_t)consumed);
+#else
+        outpos += bitset_extract_setbits(words + consumed, safelength,
+                                         out + outpos,
+                                         base + 64 * (uint32_t)consumed);
+#endif
+        consumed += safelength;
+    }
+    // fewer than 64 output slots left: go word by word, stopping before any
+    // word whose set bits do not all fit
+    for (; consumed < length; consumed++) {
+        uint64_t w = words[consumed];
+        if ((size_t)hamming(w) > outcapacity - outpos) break;
+        uint32_t wordbase = base + 64 * (uint32_t)consumed;
+        while (w != 0) {
+            uint64_t t = w & (~w + 1);
+            int r = __builtin_ctzll(w);
+            uint32_t val = r + wordbase;
+            memcpy(out + outpos, &val, sizeof(uint32_t));
+            outpos++;
+            w ^= t;
+        }
+    }
+    *words_consumed = consumed;
+    return outpos;
+}
+
 size_t bitset_extract_intersection_setbits_uint16(const uint64_t * __restrict__ bitset1,
                                                   const uint64_t * __restrict__ bitset2,
                                                   size_t length, uint16_t *out,
@@ -5,6 +5,9 @@
 
 #include <assert.h>
 #include <roaring/containers/array.h>
+#include <roaring/containers/container_pool.h>
+#include <roaring/instrumentation.h>
+#include <roaring/memory.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -25,18 +28,33 @@ extern inline bool array_container_full(const array_container_t *array);
 
 /* Create a new array with capacity size. Return NULL in case of failure. */
 array_container_t *array_container_create_given_capacity(int32_t size) {
-    array_container_t *container;
+    array_container_t *container = container_pool_get_array();
+    if (container != NULL) {  // recycled shell, grow its buffer if needed
+        if (container->capacity < size) {
+            uint16_t *newarray = (uint16_t *)roaring_realloc(
+                container->array, sizeof(uint16_t) * size);
+            if (newarray == NULL) {
+                roaring_free(container->array);
+                roaring_free(container);
+                return NULL;
+            }
+            container->array = newarray;
+            container->capacity = size;
+        }
+        container->cardinality = 0;
+        return container;
+    }
 
-    if ((container = (array_container_t *)malloc(sizeof(array_container_t))) ==
+    if ((container = (array_container_t *)roaring_malloc(sizeof(array_container_t))) ==
         NULL) {
         return NULL;
     }
 
-    if( size <= 0 ) { // we don't want to rely on malloc(0)
+    if( size <= 0 ) { // we don't want to rely on roaring_malloc(0)
         container->array = NULL;
-    } else if ((container->array = (uint16_t *)malloc(sizeof(uint16_t) * size)) ==
+    } else if ((container->array = (uint16_t *)roaring_malloc(sizeof(uint16_t) * size)) ==
         NULL) {
-        free(container);
+        roaring_free(container);
         return NULL;
     }
 
@@ -64,8 +82,11 @@ array_container_t * array_container_create_range(uint32_t min, uint32_t max) {
 
 /* Duplicate container */
 array_container_t *array_container_clone(const array_container_t *src) {
+    // clones own their payload: a borrowed source yields an exact-size copy
+    const int32_t capacity =
+        (src->capacity < 0) ? src->cardinality : src->capacity;
     array_container_t *newcontainer =
-        array_container_create_given_capacity(src->capacity);
+        array_container_create_given_capacity(capacity);
     if (newcontainer == NULL) return NULL;
 
     newcontainer->cardinality = src->cardinality;
@@ -77,60 +98,83 @@ array_container_t *array_container_clone(const array_container_t *src) {
 }
 
 int array_container_shrink_to_fit(array_container_t *src) {
+    if (src->capacity < 0) return 0;  // borrowed payload, nothing is ours
     if (src->cardinality == src->capacity) return 0;  // nothing to do
     int savings = src->capacity - src->cardinality;
     src->capacity = src->cardinality;
     if( src->capacity == 0) { // we do not want to rely on realloc for zero allocs
-      free(src->array);
+      roaring_free(src->array);
       src->array = NULL;
     } else {
       uint16_t *oldarray = src->array;
       src->array =
-        (uint16_t *)realloc(oldarray, src->capacity * sizeof(uint16_t));
-      if (src->array == NULL) free(oldarray);  // should never happen?
+        (uint16_t *)roaring_realloc(oldarray, src->capacity * sizeof(uint16_t));
+      if (src->array == NULL) roaring_free(oldarray);  // should never happen?
     }
     return savings;
 }
 
 /* Free memory. */
 void array_container_free(array_container_t *arr) {
+    if (arr->capacity < 0) {
+        // borrowed payload: the arena owns the bytes, only the shell is
+        // ours, and it must not enter the pool with a buffer attached
+        roaring_free(arr);
+        return;
+    }
+    if (container_pool_put_array(arr)) {
+        return;  // parked for reuse, with its buffer attached
+    }
     if(arr->array != NULL) {// Jon Strabala reports that some tools complain otherwise
-      free(arr->array);
+      roaring_free(arr->array);
       arr->array = NULL; // pedantic
     }
-    free(arr);
-}
-
-static inline int32_t grow_capacity(int32_t capacity) {
-    return (capacity <= 0) ? ARRAY_DEFAULT_INIT_SIZE
-                           : capacity < 64 ? capacity * 2
-                                           : capacity < 1024 ? capacity * 3 / 2
-                                                             : capacity * 5 / 4;
-}
-
-static inline int32_t clamp(int32_t val, int32_t min, int32_t max) {
-    return ((val < min) ? min : (val > max) ? max : val);
+    roaring_free(arr);
 }
 
 void array_container_grow(array_container_t *container, int32_t min,
                           bool preserve) {
+    ROARING_INSTRUMENT(array_grows);
 
     int32_t max = (min <= DEFAULT_MAX_SIZE ? DEFAULT_MAX_SIZE : 65536);
-    int32_t new_capacity = clamp(grow_capacity(container->capacity), min, max);
+
+    if (container->capacity < 0) {
+        // borrowed payload: fall back to an owned heap copy, leaving the
+        // arena bytes untouched
+        int32_t new_capacity = roaring_container_next_capacity(
+            -container->capacity, min, max, sizeof(uint16_t));
+        uint16_t *array =
+            (uint16_t *)roaring_malloc(new_capacity * sizeof(uint16_t));
+        if (array == NULL) {
+            fprintf(stderr, "could not allocate memory\n");
+            assert(array != NULL);
+            return;
+        }
+        if (preserve) {
+            memcpy(array, container->array,
+                   container->cardinality * sizeof(uint16_t));
+        }
+        container->array = array;
+        container->capacity = new_capacity;
+        return;
+    }
+
+    int32_t new_capacity = roaring_container_next_capacity(
+        container->capacity, min, max, sizeof(uint16_t));
 
     container->capacity = new_capacity;
     uint16_t *array = container->array;
 
     if (preserve) {
         container->array =
-            (uint16_t *)realloc(array, new_capacity * sizeof(uint16_t));
-        if (container->array == NULL) free(array);
+            (uint16_t *)roaring_realloc(array, new_capacity * sizeof(uint16_t));
+        if (container->array == NULL) roaring_free(array);
     } else {
         // Jon Strabala reports that some tools complain otherwise
         if (array != NULL) {
-          free(array);
+          roaring_free(array);
         }
-        container->array = (uint16_t *)malloc(new_capacity * sizeof(uint16_t));
+        container->array = (uint16_t *)roaring_malloc(new_capacity * sizeof(uint16_t));
     }
 
     //  handle the case where realloc fails
@@ -241,11 +285,16 @@ void array_container_intersection(const array_container_t *array1,
     int32_t card_1 = array1->cardinality, card_2 = array2->cardinality,
             min_card = minimum_int32(card_1, card_2);
     const int threshold = 64;  // subject to tuning
-#ifdef USEAVX
+#if defined(USEAVX)
     if (out->capacity < min_card) {
       array_container_grow(out, min_card + sizeof(__m128i) / sizeof(uint16_t),
         false);
     }
+#elif defined(USENEON) && defined(__aarch64__)
+    if (out->capacity < min_card) {
+      array_container_grow(out, min_card + sizeof(uint16x8_t) / sizeof(uint16_t),
+        false);
+    }
 #else
     if (out->capacity < min_card) {
       array_container_grow(out, min_card, false);
@@ -259,10 +308,12 @@ void array_container_intersection(const array_container_t *array1,
         out->cardinality = intersect_skewed_uint16(
             array2->array, card_2, array1->array, card_1, out->array);
     } else {
-#ifdef USEAVX
+#if defined(USEAVX) || (defined(USENEON) && defined(__aarch64__))
+        ROARING_INSTRUMENT(vector_kernel_calls);
         out->cardinality = intersect_vector16(
             array1->array, card_1, array2->array, card_2, out->array);
 #else
+        ROARING_INSTRUMENT(scalar_kernel_calls);
         out->cardinality = intersect_uint16(array1->array, card_1,
                                             array2->array, card_2, out->array);
 #endif
@@ -282,7 +333,7 @@ int array_container_intersection_cardinality(const array_container_t *array1,
         return intersect_skewed_uint16_cardinality(array2->array, card_2,
                                                    array1->array, card_1);
     } else {
-#ifdef USEAVX
+#if defined(USEAVX) || (defined(USENEON) && defined(__aarch64__))
         return intersect_vector16_cardinality(array1->array, card_1,
                                               array2->array, card_2);
 #else
@@ -394,6 +445,20 @@ bool array_container_is_subset(const array_container_t *container1,
     if (container1->cardinality > container2->cardinality) {
         return false;
     }
+    const int threshold = 64;  // subject to tuning
+    if (container1->cardinality * threshold < container2->cardinality) {
+        // skewed case: gallop through the large array instead of scanning it
+        int32_t pos = -1;
+        for (int i = 0; i < container1->cardinality; ++i) {
+            pos = advanceUntil(container2->array, pos, container2->cardinality,
+                               container1->array[i]);
+            if (pos == container2->cardinality ||
+                container2->array[pos] != container1->array[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
     int i1 = 0, i2 = 0;
     while (i1 < container1->cardinality && i2 < container2->cardinality) {
         if (container1->array[i1] == container2->array[i2]) {
@@ -438,3 +503,20 @@ bool array_container_iterate64(const array_container_t *cont, uint32_t base,
             return false;
     return true;
 }
+
+bool array_container_iterate_ranges(const array_container_t *cont,
+                                    uint32_t base,
+                                    roaring_range_iterator iterator,
+                                    void *ptr) {
+    int i = 0;
+    while (i < cont->cardinality) {
+        int j = i + 1;
+        while (j < cont->cardinality &&
+               cont->array[j] == cont->array[j - 1] + 1)
+            j++;
+        if (!iterator(base + cont->array[i], (uint64_t)(j - i), ptr))
+            return false;
+        i = j;
+    }
+    return true;
+}
@@ -12,6 +12,8 @@
 
 #include <roaring/bitset_util.h>
 #include <roaring/containers/bitset.h>
+#include <roaring/containers/container_pool.h>
+#include <roaring/memory.h>
 #include <roaring/portability.h>
 #include <roaring/utilasm.h>
 
@@ -42,19 +44,25 @@ void bitset_container_set_all(bitset_container_t *bitset) {
 
 /* Create a new bitset. Return NULL in case of failure. */
 bitset_container_t *bitset_container_create(void) {
-    bitset_container_t *bitset =
-        (bitset_container_t *)malloc(sizeof(bitset_container_t));
+    bitset_container_t *bitset = container_pool_get_bitset();
+    if (bitset != NULL) {  // recycled shell, fully allocated already
+        bitset->borrowed = 0;
+        bitset_container_clear(bitset);
+        return bitset;
+    }
+    bitset = (bitset_container_t *)roaring_malloc(sizeof(bitset_container_t));
 
     if (!bitset) {
         return NULL;
     }
     // sizeof(__m256i) == 32
-    bitset->array = (uint64_t *)roaring_bitmap_aligned_malloc(
+    bitset->array = (uint64_t *)roaring_aligned_malloc(
         32, sizeof(uint64_t) * BITSET_CONTAINER_SIZE_IN_WORDS);
     if (!bitset->array) {
-        free(bitset);
+        roaring_free(bitset);
         return NULL;
     }
+    bitset->borrowed = 0;
     bitset_container_clear(bitset);
     return bitset;
 }
@@ -97,28 +105,38 @@ void bitset_container_add_from_range(bitset_container_t *bitset, uint32_t min,
 
 /* Free memory. */
 void bitset_container_free(bitset_container_t *bitset) {
+    if (bitset->borrowed) {
+        // borrowed payload: the arena owns the bytes, only the shell is
+        // ours, and it must not enter the pool with a buffer attached
+        roaring_free(bitset);
+        return;
+    }
+    if (bitset->array != NULL && container_pool_put_bitset(bitset)) {
+        return;  // parked for reuse, with its array attached
+    }
     if(bitset->array != NULL) {// Jon Strabala reports that some tools complain otherwise
-      roaring_bitmap_aligned_free(bitset->array);
+      roaring_aligned_free(bitset->array);
       bitset->array = NULL; // pedantic
     }
-    free(bitset);
+    roaring_free(bitset);
 }
 
 /* duplicate container. */
 bitset_container_t *bitset_container_clone(const bitset_container_t *src) {
     bitset_container_t *bitset =
-        (bitset_container_t *)malloc(sizeof(bitset_container_t));
+        (bitset_container_t *)roaring_malloc(sizeof(bitset_container_t));
 
     if (!bitset) {
         return NULL;
     }
     // sizeof(__m256i) == 32
-    bitset->array = (uint64_t *)roaring_bitmap_aligned_malloc(
+    bitset->array = (uint64_t *)roaring_aligned_malloc(
         32, sizeof(uint64_t) * BITSET_CONTAINER_SIZE_IN_WORDS);
     if (!bitset->array) {
-        free(bitset);
+        roaring_free(bitset);
         return NULL;
     }
+    bitset->borrowed = 0;
     bitset->cardinality = src->cardinality;
     memcpy(bitset->array, src->array,
            sizeof(uint64_t) * BITSET_CONTAINER_SIZE_IN_WORDS);
@@ -149,11 +167,32 @@ bool bitset_container_intersect(const bitset_container_t *src_1,
 #ifndef WORDS_IN_AVX2_REG
 #define WORDS_IN_AVX2_REG sizeof(__m256i) / sizeof(uint64_t)
 #endif
+#ifdef USEAVX512
+#ifndef WORDS_IN_AVX512_REG
+#define WORDS_IN_AVX512_REG sizeof(__m512i) / sizeof(uint64_t)
+#endif
+#endif
 /* Get the number of bits set (force computation) */
 int bitset_container_compute_cardinality(const bitset_container_t *bitset) {
+#ifdef USEAVX512
+#if defined(__GNUC__) && !defined(__clang__)
+// avx512_vpopcount is inlined here, beyond the reach of the pragma around
+// its definition (GCC bug 105593)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#endif
+    return (int) avx512_vpopcount(
+        (const __m512i *)bitset->array,
+        BITSET_CONTAINER_SIZE_IN_WORDS / (WORDS_IN_AVX512_REG));
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#else
     return (int) avx2_harley_seal_popcount256(
         (const __m256i *)bitset->array,
         BITSET_CONTAINER_SIZE_IN_WORDS / (WORDS_IN_AVX2_REG));
+#endif
 }
 
 #elif defined(USENEON)
@@ -197,6 +236,41 @@ int bitset_container_compute_cardinality(const bitset_container_t *bitset) {
 
 #endif
 
+/* Flip every bit of the container. The new cardinality is derived from the
+ * old one when it is known, so no popcount pass is needed. */
+void bitset_container_negate(bitset_container_t *bitset) {
+    uint64_t *array = bitset->array;
+#ifdef USEAVX
+    const __m256i ones = _mm256_set1_epi64x(-1);
+    __m256i *data = (__m256i *)array;
+    for (int i = 0;
+         i < BITSET_CONTAINER_SIZE_IN_WORDS / (int)(WORDS_IN_AVX2_REG);
+         i += 4) {
+        _mm256_store_si256(data + i,
+                           _mm256_xor_si256(_mm256_load_si256(data + i),
+                                            ones));
+        _mm256_store_si256(
+            data + i + 1,
+            _mm256_xor_si256(_mm256_load_si256(data + i + 1), ones));
+        _mm256_store_si256(
+            data + i + 2,
+            _mm256_xor_si256(_mm256_load_si256(data + i + 2), ones));
+        _mm256_store_si256(
+            data + i + 3,
+            _mm256_xor_si256(_mm256_load_si256(data + i + 3), ones));
+    }
+#else
+    for (int i = 0; i < BITSET_CONTAINER_SIZE_IN_WORDS; i++) {
+        array[i] = ~array[i];
+    }
+#endif
+    if (bitset->cardinality == BITSET_UNKNOWN_CARDINALITY) {
+        bitset->cardinality = bitset_container_compute_cardinality(bitset);
+    } else {
+        bitset->cardinality = (1 << 16) - bitset->cardinality;
+    }
+}
+
 #ifdef USEAVX
 
 #define BITSET_CONTAINER_FN_REPEAT 8
@@ -207,11 +281,76 @@ int bitset_container_compute_cardinality(const bitset_container_t *bitset) {
     BITSET_CONTAINER_SIZE_IN_WORDS / \
         ((WORDS_IN_AVX2_REG)*BITSET_CONTAINER_FN_REPEAT)
 
+#ifdef USEAVX512
+#if defined(__GNUC__) && !defined(__clang__)
+// see the matching pragma in bitset_util.h (GCC bug 105593)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+/* AVX-512 (VPOPCNTDQ) tier, used when the host supports it */
+#define BITSET_CONTAINER_FN_AVX512(opname, avx512_intrinsic)            \
+static inline int _avx512_bitset_container_##opname##_nocard(           \
+                                       const bitset_container_t *src_1, \
+                                       const bitset_container_t *src_2, \
+                                       bitset_container_t *dst) {       \
+    const __m512i * __restrict__ array_1 = (const __m512i *) src_1->array; \
+    const __m512i * __restrict__ array_2 = (const __m512i *) src_2->array; \
+    __m512i *out = (__m512i *) dst->array;                              \
+    for (size_t i = 0;                                                  \
+        i < BITSET_CONTAINER_SIZE_IN_WORDS / (WORDS_IN_AVX512_REG); i++) { \
+        _mm512_storeu_si512(out + i,                                    \
+            avx512_intrinsic(_mm512_loadu_si512(array_2 + i),           \
+                             _mm512_loadu_si512(array_1 + i)));         \
+    }                                                                   \
+    dst->cardinality = BITSET_UNKNOWN_CARDINALITY;                      \
+    return dst->cardinality;                                            \
+}                                                                       \
+static inline int _avx512_bitset_container_##opname(                    \
+                              const bitset_container_t *src_1,          \
+                              const bitset_container_t *src_2,          \
+                              bitset_container_t *dst) {                \
+    const __m512i * __restrict__ array_1 = (const __m512i *) src_1->array; \
+    const __m512i * __restrict__ array_2 = (const __m512i *) src_2->array; \
+    __m512i *out = (__m512i *) dst->array;                              \
+    dst->cardinality = (int32_t)avx512_popcountandstore_##opname(array_2,\
+            array_1, out,                                               \
+            BITSET_CONTAINER_SIZE_IN_WORDS / (WORDS_IN_AVX512_REG));    \
+    return dst->cardinality;                                            \
+}                                                                       \
+static inline int _avx512_bitset_container_##opname##_justcard(         \
+                              const bitset_container_t *src_1,          \
+                              const bitset_container_t *src_2) {        \
+    const __m512i * __restrict__ data1 = (const __m512i *) src_1->array; \
+    const __m512i * __restrict__ data2 = (const __m512i *) src_2->array; \
+    return (int)avx512_popcount_##opname(data2, data1,                  \
+            BITSET_CONTAINER_SIZE_IN_WORDS / (WORDS_IN_AVX512_REG));    \
+}
+
+BITSET_CONTAINER_FN_AVX512(or,           _mm512_or_si512)
+BITSET_CONTAINER_FN_AVX512(union,        _mm512_or_si512)
+BITSET_CONTAINER_FN_AVX512(and,          _mm512_and_si512)
+BITSET_CONTAINER_FN_AVX512(intersection, _mm512_and_si512)
+BITSET_CONTAINER_FN_AVX512(xor,          _mm512_xor_si512)
+BITSET_CONTAINER_FN_AVX512(andnot,       _mm512_andnot_si512)
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// the AVX-512 tier is selected at compile time: a build that enables the
+// AVX-512 flags may use those instructions anywhere, so there is no
+// safe-on-lesser-hosts binary to preserve with a runtime check
+#define AVX512_DISPATCH(expr) return (expr);
+#else
+#define AVX512_DISPATCH(expr)
+#endif  // USEAVX512
+
 /* Computes a binary operation (eg union) on bitset1 and bitset2 and write the
    result to bitsetout */
 // clang-format off
 #define BITSET_CONTAINER_FN(opname, opsymbol, avx_intrinsic, neon_intrinsic)  \
-int bitset_container_##opname##_nocard(const bitset_container_t *src_1, \
+static inline int _avx2_bitset_container_##opname##_nocard(             \
+                                       const bitset_container_t *src_1, \
                                        const bitset_container_t *src_2, \
                                        bitset_container_t *dst) {       \
     const uint8_t * __restrict__ array_1 = (const uint8_t *)src_1->array; \
@@ -263,7 +402,8 @@ int bitset_container_##opname##_nocard(const bitset_container_t *src_1, \
     return dst->cardinality;                                            \
 }                                                                       \
 /* next, a version that updates cardinality*/                           \
-int bitset_container_##opname(const bitset_container_t *src_1,          \
+static inline int _avx2_bitset_container_##opname(                      \
+                              const bitset_container_t *src_1,          \
                               const bitset_container_t *src_2,          \
                               bitset_container_t *dst) {                \
     const __m256i * __restrict__ array_1 = (const __m256i *) src_1->array; \
@@ -274,12 +414,31 @@ int bitset_container_##opname(const bitset_container_t *src_1,          \
     return dst->cardinality;                                            \
 }                                                                       \
 /* next, a version that just computes the cardinality*/                 \
-int bitset_container_##opname##_justcard(const bitset_container_t *src_1, \
+static inline int _avx2_bitset_container_##opname##_justcard(           \
+                              const bitset_container_t *src_1,          \
                               const bitset_container_t *src_2) {        \
     const __m256i * __restrict__ data1 = (const __m256i *) src_1->array; \
     const __m256i * __restrict__ data2 = (const __m256i *) src_2->array; \
     return (int)avx2_harley_seal_popcount256_##opname(data2,                \
     		data1, BITSET_CONTAINER_SIZE_IN_WORDS / (WORDS_IN_AVX2_REG));\
+}                                                                       \
+/* the public entry points, on the best tier the build enables */       \
+int bitset_container_##opname(const bitset_container_t *src_1,          \
+                              const bitset_container_t *src_2,          \
+                              bitset_container_t *dst) {                \
+    AVX512_DISPATCH(_avx512_bitset_container_##opname(src_1, src_2, dst)) \
+    return _avx2_bitset_container_##opname(src_1, src_2, dst);          \
+}                                                                       \
+int bitset_container_##opname##_nocard(const bitset_container_t *src_1, \
+                                       const bitset_container_t *src_2, \
+                                       bitset_container_t *dst) {       \
+    AVX512_DISPATCH(_avx512_bitset_container_##opname##_nocard(src_1, src_2, dst)) \
+    return _avx2_bitset_container_##opname##_nocard(src_1, src_2, dst); \
+}                                                                       \
+int bitset_container_##opname##_justcard(const bitset_container_t *src_1, \
+                              const bitset_container_t *src_2) {        \
+    AVX512_DISPATCH(_avx512_bitset_container_##opname##_justcard(src_1, src_2)) \
+    return _avx2_bitset_container_##opname##_justcard(src_1, src_2);    \
 }
 
 #elif defined(USENEON)
@@ -419,6 +578,14 @@ int bitset_container_##opname##_justcard(const bitset_container_t *src_1, \
 
 #endif
 
+#if defined(USEAVX512) && defined(__GNUC__) && !defined(__clang__)
+// the AVX-512 kernels are inlined into these entry points, so the pragma
+// around their definitions does not cover them here (GCC bug 105593)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#endif
+
 // we duplicate the function because other containers use the "or" term, makes API more consistent
 BITSET_CONTAINER_FN(or,    |, _mm256_or_si256, vorrq_u64)
 BITSET_CONTAINER_FN(union, |, _mm256_or_si256, vorrq_u64)
@@ -431,6 +598,10 @@ BITSET_CONTAINER_FN(xor,    ^,  _mm256_xor_si256,    veorq_u64)
 BITSET_CONTAINER_FN(andnot, &~, _mm256_andnot_si256, vbicq_u64)
 // clang-format On
 
+#if defined(USEAVX512) && defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
 
 
 int bitset_container_to_uint32_array( void *vout, const bitset_container_t *cont, uint32_t base) {
@@ -554,6 +725,44 @@ bool bitset_container_iterate64(const bitset_container_t *cont, uint32_t base, r
   return true;
 }
 
+bool bitset_container_iterate_ranges(const bitset_container_t *cont,
+                                     uint32_t base,
+                                     roaring_range_iterator iterator,
+                                     void *ptr) {
+    int32_t run_start = -1;  // bit index of the range in progress, -1 if none
+    for (int32_t i = 0; i < BITSET_CONTAINER_SIZE_IN_WORDS; ++i) {
+        uint64_t w = cont->array[i];
+        if (run_start >= 0) {
+            if (w == UINT64_C(0xFFFFFFFFFFFFFFFF)) continue;
+            // the range in progress ends at the first clear bit
+            int32_t stop = (int32_t)__builtin_ctzll(~w);
+            if (!iterator(base + run_start,
+                          (uint64_t)(i * 64 + stop - run_start), ptr))
+                return false;
+            run_start = -1;
+            w &= ~((UINT64_C(1) << stop) - 1);
+        }
+        while (w != 0) {
+            int32_t start = (int32_t)__builtin_ctzll(w);
+            uint64_t ones = w >> start;
+            int32_t len = (ones == UINT64_C(0xFFFFFFFFFFFFFFFF))
+                              ? 64
+                              : (int32_t)__builtin_ctzll(~ones);
+            if (start + len == 64) {  // range may continue in the next word
+                run_start = i * 64 + start;
+                break;
+            }
+            if (!iterator(base + i * 64 + start, (uint64_t)len, ptr))
+                return false;
+            w &= ~(((UINT64_C(1) << len) - 1) << start);
+        }
+    }
+    if (run_start >= 0) {
+        if (!iterator(base + run_start, (uint64_t)(65536 - run_start), ptr))
+            return false;
+    }
+    return true;
+}
 
 bool bitset_container_equals(const bitset_container_t *container1, const bitset_container_t *container2) {
 	if((container1->cardinality != BITSET_UNKNOWN_CARDINALITY) && (container2->cardinality != BITSET_UNKNOWN_CARDINALITY)) {
@@ -575,12 +784,12 @@ bool bitset_container_equals(const bitset_container_t *container1, const bitset_
           return false;
       }
   }
+	return true;
 #else
   return memcmp(container1->array,
                 container2->array,
                 BITSET_CONTAINER_SIZE_IN_WORDS*sizeof(uint64_t)) == 0;
 #endif
-	return true;
 }
 
 bool bitset_container_is_subset(const bitset_container_t *container1,
@@ -605,6 +814,29 @@ bool bitset_container_select(const bitset_container_t *container, uint32_t *star
         return false;
     }
     const uint64_t *array = container->array;
+#if defined(USEAVX) && defined(USE_BMI)
+    // Skip ahead over blocks of 64 words counted with the Harley-Seal kernel,
+    // narrow down to a word with scalar popcounts, then select within the word
+    // with PDEP: depositing a lone bit at the sought in-word rank moves it onto
+    // the sought set bit, and TZCNT reads off its position.
+    int i = 0;
+    for (; i + 64 <= BITSET_CONTAINER_SIZE_IN_WORDS; i += 64) {
+        uint32_t size = (uint32_t)avx2_harley_seal_popcount256(
+            (const __m256i *)(array + i), 16);
+        if (rank - *start_rank < size) break;
+        *start_rank += size;
+    }
+    for (; i < BITSET_CONTAINER_SIZE_IN_WORDS; i += 1) {
+        uint32_t size = (uint32_t)hamming(array[i]);
+        if (rank - *start_rank < size) {
+            uint64_t bit =
+                _pdep_u64(UINT64_C(1) << (rank - *start_rank), array[i]);
+            *element = i * 64 + (uint32_t)_tzcnt_u64(bit);
+            return true;
+        }
+        *start_rank += size;
+    }
+#else
     int32_t size;
     for (int i = 0; i < BITSET_CONTAINER_SIZE_IN_WORDS; i += 1) {
         size = hamming(array[i]);
@@ -625,6 +857,7 @@ bool bitset_container_select(const bitset_container_t *container, uint32_t *star
         else
             *start_rank += size;
     }
+#endif
     assert(false);
     __builtin_unreachable();
 }
@@ -659,7 +892,16 @@ int bitset_container_rank(const bitset_container_t *container, uint16_t x) {
   // credit: aqrit
   int sum = 0;
   int i = 0;
-  for (int end = x / 64; i < end; i++){
+  int end = x / 64;
+#ifdef USEAVX
+  // count the bulk of the word prefix with the Harley-Seal kernel
+  if (end >= 32) {
+      sum += (int)avx2_harley_seal_popcount256(
+          (const __m256i *)container->array, (uint64_t)(end / 4));
+      i = (end / 4) * 4;
+  }
+#endif
+  for (; i < end; i++){
     sum += hamming(container->array[i]);
   }
   uint64_t lastword = container->array[i];
@@ -0,0 +1,123 @@
+/*
+ * container_pool.c
+ *
+ */
+
+#include <roaring/containers/array.h>
+#include <roaring/containers/bitset.h>
+#include <roaring/containers/container_pool.h>
+#include <roaring/containers/run.h>
+#include <roaring/memory.h>
+
+#if defined(_MSC_VER)
+#define ROARING_THREAD_LOCAL __declspec(thread)
+#else
+#define ROARING_THREAD_LOCAL __thread
+#endif
+
+enum { POOL_BITSET = 0, POOL_ARRAY = 1, POOL_RUN = 2, POOL_TYPES = 3 };
+
+typedef struct container_pool_s {
+    uint32_t capacity;           // max cached shells per type, 0 = disabled
+    uint32_t count[POOL_TYPES];  // cached shells per type
+    void **cache[POOL_TYPES];    // slabs of 'capacity' pointers each
+} container_pool_t;
+
+static ROARING_THREAD_LOCAL container_pool_t pool = {0, {0, 0, 0},
+                                                     {NULL, NULL, NULL}};
+
+// frees a cached shell for real, bypassing the pool
+static void pool_free_shell(int which, void *shell) {
+    switch (which) {
+        case POOL_BITSET: {
+            bitset_container_t *bitset = (bitset_container_t *)shell;
+            roaring_aligned_free(bitset->array);
+            roaring_free(bitset);
+        } break;
+        case POOL_ARRAY: {
+            array_container_t *arr = (array_container_t *)shell;
+            roaring_free(arr->array);
+            roaring_free(arr);
+        } break;
+        case POOL_RUN: {
+            run_container_t *run = (run_container_t *)shell;
+            roaring_free(run->runs);
+            roaring_free(run);
+        } break;
+    }
+}
+
+void roaring_container_pool_drain(void) {
+    for (int which = 0; which < POOL_TYPES; which++) {
+        for (uint32_t i = 0; i < pool.count[which]; i++) {
+            pool_free_shell(which, pool.cache[which][i]);
+        }
+        pool.count[which] = 0;
+    }
+}
+
+void roaring_container_pool_set_capacity(uint32_t shells_per_type) {
+    roaring_container_pool_drain();
+    for (int which = 0; which < POOL_TYPES; which++) {
+        roaring_free(pool.cache[which]);
+        pool.cache[which] = NULL;
+    }
+    pool.capacity = 0;
+    if (shells_per_type == 0) {
+        return;
+    }
+    for (int which = 0; which < POOL_TYPES; which++) {
+        pool.cache[which] =
+            (void **)roaring_malloc(shells_per_type * sizeof(void *));
+        if (pool.cache[which] == NULL) {
+            // out of memory: leave the pool disabled
+            for (int j = 0; j < which; j++) {
+                roaring_free(pool.cache[j]);
+                pool.cache[j] = NULL;
+            }
+            return;
+        }
+    }
+    pool.capacity = shells_per_type;
+}
+
+static inline void *pool_get(int which) {
+    if (pool.count[which] == 0) {
+        return NULL;
+    }
+    return pool.cache[which][--pool.count[which]];
+}
+
+static inline bool pool_put(int which, void *shell) {
+    if (pool.count[which] >= pool.capacity) {
+        return false;
+    }
+    pool.cache[which][pool.count[which]++] = shell;
+    return true;
+}
+
+uint32_t roaring_container_pool_capacity(void) { return pool.capacity; }
+
+struct bitset_container_s *container_pool_get_bitset(void) {
+    return (struct bitset_container_s *)pool_get(POOL_BITSET);
+}
+
+struct array_container_s *container_pool_get_array(void) {
+    return (struct array_container_s *)pool_get(POOL_ARRAY);
+}
+
+struct run_container_s *container_pool_get_run(void) {
+    return (struct run_container_s *)pool_get(POOL_RUN);
+}
+
+bool container_pool_put_bitset(struct bitset_container_s *bitset) {
+    return pool_put(POOL_BITSET, bitset);
+}
+
+bool container_pool_put_array(struct array_container_s *arr) {
+    return pool_put(POOL_ARRAY, arr);
+}
+
+bool container_pool_put_run(struct run_container_s *run) {
+    return pool_put(POOL_RUN, run);
+}
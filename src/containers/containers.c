@@ -1,5 +1,9 @@
 
+#include <assert.h>
+#include <string.h>
+
 #include <roaring/containers/containers.h>
+#include <roaring/memory.h>
 
 extern inline const void *container_unwrap_shared(
     const void *candidate_shared_container, uint8_t *type);
@@ -20,6 +24,44 @@ extern inline void *container_ixor(void *c1, uint8_t type1, const void *c2,
 extern inline void *container_iandnot(void *c1, uint8_t type1, const void *c2,
                                uint8_t type2, uint8_t *result_type);
 
+static inline uint32_t croaring_refcount_get(const croaring_refcount_t *counter) {
+#ifdef ROARING_ATOMIC_REFCOUNT
+    return atomic_load_explicit((croaring_refcount_t *)counter,
+                                memory_order_acquire);
+#else
+    return *counter;
+#endif
+}
+
+static inline void croaring_refcount_inc(croaring_refcount_t *counter) {
+#ifdef ROARING_ATOMIC_REFCOUNT
+    // incrementing a live reference needs no ordering with other accesses
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+#else
+    *counter += 1;
+#endif
+}
+
+// decrements the count; returns true when it reaches zero and the
+// wrapped container may be torn down
+static inline bool croaring_refcount_dec(croaring_refcount_t *counter) {
+#ifdef ROARING_ATOMIC_REFCOUNT
+    // the release/acquire pair makes every prior access to the wrapped
+    // container visible to the thread that performs the teardown
+    uint32_t old = atomic_fetch_sub_explicit(counter, 1, memory_order_release);
+    assert(old > 0);
+    if (old == 1) {
+        atomic_thread_fence(memory_order_acquire);
+        return true;
+    }
+    return false;
+#else
+    assert(*counter > 0);
+    *counter -= 1;
+    return *counter == 0;
+#endif
+}
+
 void container_free(void *container, uint8_t typecode) {
     switch (typecode) {
         case BITSET_CONTAINER_TYPE_CODE:
@@ -105,16 +147,21 @@ extern inline void *container_xor(const void *c1, uint8_t type1, const void *c2,
 
 void *get_copy_of_container(void *container, uint8_t *typecode,
                             bool copy_on_write) {
+    if (*typecode == RUN_CONTAINER_TYPE_CODE &&
+        run_container_is_full_singleton((run_container_t *)container)) {
+        // already shareable as-is: no clone, and no shared wrapper either
+        return container;
+    }
     if (copy_on_write) {
         shared_container_t *shared_container;
         if (*typecode == SHARED_CONTAINER_TYPE_CODE) {
             shared_container = (shared_container_t *)container;
-            shared_container->counter += 1;
+            croaring_refcount_inc(&shared_container->counter);
             return shared_container;
         }
         assert(*typecode != SHARED_CONTAINER_TYPE_CODE);
 
-        if ((shared_container = (shared_container_t *)malloc(
+        if ((shared_container = (shared_container_t *)roaring_malloc(
                  sizeof(shared_container_t))) == NULL) {
             return NULL;
         }
@@ -145,6 +192,9 @@ void *container_clone(const void *container, uint8_t typecode) {
         case ARRAY_CONTAINER_TYPE_CODE:
             return array_container_clone((const array_container_t *)container);
         case RUN_CONTAINER_TYPE_CODE:
+            if (run_container_is_full((const run_container_t *)container)) {
+                return run_container_full();  // all clones of full are equal
+            }
             return run_container_clone((const run_container_t *)container);
         case SHARED_CONTAINER_TYPE_CODE:
             printf("shared containers are not cloneable\n");
@@ -157,32 +207,110 @@ void *container_clone(const void *container, uint8_t typecode) {
     }
 }
 
+void *container_overwrite(void *dst, uint8_t dst_typecode, const void *src,
+                          uint8_t src_typecode, uint8_t *result_typecode) {
+    src = container_unwrap_shared(src, &src_typecode);
+    *result_typecode = src_typecode;
+    if (src_typecode == RUN_CONTAINER_TYPE_CODE &&
+        run_container_is_full((const run_container_t *)src)) {
+        container_free(dst, dst_typecode);
+        return run_container_full();  // a full copy needs no storage at all
+    }
+    // a shared destination cannot be rewritten in place (dst_typecode is then
+    // SHARED_CONTAINER_TYPE_CODE and never matches the unwrapped source type)
+    if (dst_typecode == src_typecode) {
+        switch (dst_typecode) {
+            case BITSET_CONTAINER_TYPE_CODE: {
+                bitset_container_t *d = (bitset_container_t *)dst;
+                const bitset_container_t *s = (const bitset_container_t *)src;
+                memcpy(d->array, s->array,
+                       BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t));
+                d->cardinality = s->cardinality;
+                return d;
+            }
+            case ARRAY_CONTAINER_TYPE_CODE: {
+                array_container_t *d = (array_container_t *)dst;
+                const array_container_t *s = (const array_container_t *)src;
+                if (d->capacity >= s->cardinality) {
+                    memcpy(d->array, s->array,
+                           s->cardinality * sizeof(uint16_t));
+                    d->cardinality = s->cardinality;
+                    return d;
+                }
+                break;
+            }
+            case RUN_CONTAINER_TYPE_CODE: {
+                run_container_t *d = (run_container_t *)dst;
+                const run_container_t *s = (const run_container_t *)src;
+                if (!run_container_is_full_singleton(d) &&
+                    d->capacity >= s->n_runs) {
+                    memcpy(d->runs, s->runs, s->n_runs * sizeof(rle16_t));
+                    d->n_runs = s->n_runs;
+                    return d;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    container_free(dst, dst_typecode);
+    return container_clone(src, src_typecode);
+}
+
+// 64-bit finalizer of MurmurHash3; a good cheap bit mixer
+static inline uint64_t fingerprint_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64_C(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    return h;
+}
+
+static bool fingerprint_range(uint32_t start, uint64_t length, void *arg) {
+    uint64_t *hash = (uint64_t *)arg;
+    // ranges are maximal, so start fits in 16 bits and length in 17
+    *hash = fingerprint_mix(*hash ^ (((uint64_t)start << 32) | length));
+    return true;
+}
+
+uint64_t container_fingerprint(const void *container, uint8_t typecode) {
+    uint64_t hash = UINT64_C(0x9E3779B97F4A7C15);
+    container_iterate_ranges(container, typecode, 0, fingerprint_range, &hash);
+    return hash;
+}
+
 void *shared_container_extract_copy(shared_container_t *container,
                                     uint8_t *typecode) {
-    assert(container->counter > 0);
     assert(container->typecode != SHARED_CONTAINER_TYPE_CODE);
-    container->counter--;
     *typecode = container->typecode;
     void *answer;
-    if (container->counter == 0) {
+    if (croaring_refcount_get(&container->counter) == 1) {
+        // sole owner: nobody else can acquire a reference, steal the payload
         answer = container->container;
         container->container = NULL;  // paranoid
-        free(container);
+        roaring_free(container);
     } else {
+        // clone while we still hold our reference (the payload cannot be
+        // freed under us), then release; we may turn out to be the last
+        // owner if other threads released theirs in the meantime
         answer = container_clone(container->container, *typecode);
+        if (croaring_refcount_dec(&container->counter)) {
+            container_free(container->container, *typecode);
+            roaring_free(container);
+        }
     }
     assert(*typecode != SHARED_CONTAINER_TYPE_CODE);
     return answer;
 }
 
 void shared_container_free(shared_container_t *container) {
-    assert(container->counter > 0);
-    container->counter--;
-    if (container->counter == 0) {
+    if (croaring_refcount_dec(&container->counter)) {
         assert(container->typecode != SHARED_CONTAINER_TYPE_CODE);
         container_free(container->container, container->typecode);
         container->container = NULL;  // paranoid
-        free(container);
+        roaring_free(container);
     }
 }
 
@@ -209,3 +337,135 @@ extern inline void *container_lazy_ixor(void *c1, uint8_t type1, const void *c2,
 
 extern inline void *container_andnot(const void *c1, uint8_t type1, const void *c2,
                               uint8_t type2, uint8_t *result_type);
+
+// split an array container shifted by 'offset' into its low and high parts
+static void array_container_add_offset(const array_container_t *c, void **loc,
+                                       void **hic, uint16_t offset) {
+    const int32_t card = c->cardinality;
+    // values below the wrap point stay in the low container
+    const int32_t lo_card =
+        (offset == 0) ? card
+                      : count_less(c->array, card, (uint16_t)(0x10000 - offset));
+    if (lo_card > 0) {
+        array_container_t *lo = array_container_create_given_capacity(lo_card);
+        for (int32_t i = 0; i < lo_card; i++) {
+            lo->array[i] = (uint16_t)(c->array[i] + offset);
+        }
+        lo->cardinality = lo_card;
+        *loc = lo;
+    }
+    if (lo_card < card) {
+        array_container_t *hi =
+            array_container_create_given_capacity(card - lo_card);
+        for (int32_t i = lo_card; i < card; i++) {
+            // wraps into the next 16-bit block
+            hi->array[i - lo_card] = (uint16_t)(c->array[i] + offset);
+        }
+        hi->cardinality = card - lo_card;
+        *hic = hi;
+    }
+}
+
+// split a bitset container shifted by 'offset' into its low and high parts
+static void bitset_container_add_offset(const bitset_container_t *c,
+                                        void **loc, void **hic,
+                                        uint16_t offset) {
+    bitset_container_t *lo = bitset_container_create();
+    bitset_container_t *hi = bitset_container_create();
+    const int32_t b = offset >> 6;  // whole-word part of the shift
+    const int32_t i = offset & 63;  // bit part of the shift
+    if (i == 0) {
+        memcpy(lo->array + b, c->array,
+               (BITSET_CONTAINER_SIZE_IN_WORDS - b) * sizeof(uint64_t));
+        memcpy(hi->array, c->array + (BITSET_CONTAINER_SIZE_IN_WORDS - b),
+               b * sizeof(uint64_t));
+    } else {
+        for (int32_t k = 0; k < BITSET_CONTAINER_SIZE_IN_WORDS; k++) {
+            const uint64_t w = (c->array[k] << i) |
+                               ((k > 0) ? (c->array[k - 1] >> (64 - i)) : 0);
+            if (k + b < BITSET_CONTAINER_SIZE_IN_WORDS) {
+                lo->array[k + b] = w;
+            } else {
+                hi->array[k + b - BITSET_CONTAINER_SIZE_IN_WORDS] = w;
+            }
+        }
+        // the bits carried out of the very last word
+        hi->array[b] = c->array[BITSET_CONTAINER_SIZE_IN_WORDS - 1] >> (64 - i);
+    }
+    lo->cardinality = bitset_container_compute_cardinality(lo);
+    hi->cardinality = bitset_container_compute_cardinality(hi);
+    if (lo->cardinality > 0) {
+        *loc = lo;
+    } else {
+        bitset_container_free(lo);
+    }
+    if (hi->cardinality > 0) {
+        *hic = hi;
+    } else {
+        bitset_container_free(hi);
+    }
+}
+
+// split a run container shifted by 'offset' into its low and high parts
+static void run_container_add_offset(const run_container_t *c, void **loc,
+                                     void **hic, uint16_t offset) {
+    int32_t lo_runs = 0, hi_runs = 0;
+    for (int32_t k = 0; k < c->n_runs; k++) {
+        const uint32_t s = (uint32_t)c->runs[k].value + offset;
+        const uint32_t e = s + c->runs[k].length;  // inclusive
+        if (s < 0x10000) lo_runs++;
+        if (e >= 0x10000) hi_runs++;  // a run crossing the wrap feeds both
+    }
+    run_container_t *lo =
+        (lo_runs > 0) ? run_container_create_given_capacity(lo_runs) : NULL;
+    run_container_t *hi =
+        (hi_runs > 0) ? run_container_create_given_capacity(hi_runs) : NULL;
+    for (int32_t k = 0; k < c->n_runs; k++) {
+        const uint32_t s = (uint32_t)c->runs[k].value + offset;
+        const uint32_t e = s + c->runs[k].length;  // inclusive
+        if (s < 0x10000) {
+            const uint32_t le = ((e < 0x10000) ? e : 0xFFFF) - s;
+            lo->runs[lo->n_runs].value = (uint16_t)s;
+            lo->runs[lo->n_runs].length = (uint16_t)le;
+            lo->n_runs++;
+        }
+        if (e >= 0x10000) {
+            const uint32_t hs = (s >= 0x10000) ? (s - 0x10000) : 0;
+            hi->runs[hi->n_runs].value = (uint16_t)hs;
+            hi->runs[hi->n_runs].length = (uint16_t)(e - 0x10000 - hs);
+            hi->n_runs++;
+        }
+    }
+    *loc = lo;
+    *hic = hi;
+}
+
+void container_add_offset(const void *container, uint8_t typecode, void **loc,
+                          void **hic, uint8_t *result_type, uint16_t offset) {
+    *loc = NULL;
+    *hic = NULL;
+    container = container_unwrap_shared(container, &typecode);
+    *result_type = typecode;
+    if (offset == 0) {
+        // a block-aligned shift only renames the key
+        *loc = container_clone(container, typecode);
+        return;
+    }
+    switch (typecode) {
+        case BITSET_CONTAINER_TYPE_CODE:
+            bitset_container_add_offset((const bitset_container_t *)container,
+                                        loc, hic, offset);
+            break;
+        case ARRAY_CONTAINER_TYPE_CODE:
+            array_container_add_offset((const array_container_t *)container,
+                                       loc, hic, offset);
+            break;
+        case RUN_CONTAINER_TYPE_CODE:
+            run_container_add_offset((const run_container_t *)container, loc,
+                                     hic, offset);
+            break;
+        default:
+            assert(false);
+            __builtin_unreachable();
+    }
+}
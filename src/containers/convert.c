@@ -4,17 +4,47 @@
 #include <roaring/containers/containers.h>
 #include <roaring/containers/convert.h>
 #include <roaring/containers/perfparameters.h>
+#include <roaring/instrumentation.h>
 
 // file contains grubby stuff that must know impl. details of all container
 // types.
 bitset_container_t *bitset_container_from_array(const array_container_t *a) {
+    ROARING_INSTRUMENT(array_to_bitset_conversions);
     bitset_container_t *ans = bitset_container_create();
     int limit = array_container_cardinality(a);
-    for (int i = 0; i < limit; ++i) bitset_container_set(ans, a->array[i]);
+    bitset_set_list(ans->array, a->array, (uint64_t)limit);
+    ans->cardinality = limit;
     return ans;
 }
 
+/* Write the values [start, start+length] (inclusive) to out, returning the
+ * new write position; the workhorse of the run->array conversions. */
+static inline uint16_t *write_run_values(uint16_t *out, uint32_t start,
+                                         uint32_t length) {
+    uint32_t run_value = start;
+    const uint32_t run_end = start + length;  // inclusive
+#ifdef USEAVX
+    if (length >= 15) {
+        const __m256i increment = _mm256_set1_epi16(16);
+        __m256i base = _mm256_add_epi16(
+            _mm256_set1_epi16((int16_t)start),
+            _mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13,
+                              14, 15));
+        for (; run_value + 15 <= run_end; run_value += 16) {
+            _mm256_storeu_si256((__m256i *)out, base);
+            base = _mm256_add_epi16(base, increment);
+            out += 16;
+        }
+    }
+#endif
+    for (; run_value <= run_end; ++run_value) {
+        *out++ = (uint16_t)run_value;
+    }
+    return out;
+}
+
 bitset_container_t *bitset_container_from_run(const run_container_t *arr) {
+    ROARING_INSTRUMENT(run_to_other_conversions);
     int card = run_container_cardinality(arr);
     bitset_container_t *answer = bitset_container_create();
     for (int rlepos = 0; rlepos < arr->n_runs; ++rlepos) {
@@ -26,21 +56,20 @@ bitset_container_t *bitset_container_from_run(const run_container_t *arr) {
 }
 
 array_container_t *array_container_from_run(const run_container_t *arr) {
+    ROARING_INSTRUMENT(run_to_other_conversions);
     array_container_t *answer =
         array_container_create_given_capacity(run_container_cardinality(arr));
-    answer->cardinality = 0;
+    uint16_t *out = answer->array;
     for (int rlepos = 0; rlepos < arr->n_runs; ++rlepos) {
-        int run_start = arr->runs[rlepos].value;
-        int run_end = run_start + arr->runs[rlepos].length;
-
-        for (int run_value = run_start; run_value <= run_end; ++run_value) {
-            answer->array[answer->cardinality++] = (uint16_t)run_value;
-        }
+        out = write_run_values(out, arr->runs[rlepos].value,
+                               arr->runs[rlepos].length);
     }
+    answer->cardinality = (int32_t)(out - answer->array);
     return answer;
 }
 
 array_container_t *array_container_from_bitset(const bitset_container_t *bits) {
+    ROARING_INSTRUMENT(bitset_to_array_conversions);
     array_container_t *result =
         array_container_create_given_capacity(bits->cardinality);
     result->cardinality = bits->cardinality;
@@ -60,6 +89,7 @@ static void add_run(run_container_t *r, int s, int e) {
 }
 
 run_container_t *run_container_from_array(const array_container_t *c) {
+    ROARING_INSTRUMENT(other_to_run_conversions);
     int32_t n_runs = array_container_number_of_runs(c);
     run_container_t *answer = run_container_create_given_capacity(n_runs);
     int prev = -2;
@@ -92,15 +122,12 @@ void *convert_to_bitset_or_array_container(run_container_t *r, int32_t card,
                                            uint8_t *resulttype) {
     if (card <= DEFAULT_MAX_SIZE) {
         array_container_t *answer = array_container_create_given_capacity(card);
-        answer->cardinality = 0;
+        uint16_t *out = answer->array;
         for (int rlepos = 0; rlepos < r->n_runs; ++rlepos) {
-            uint16_t run_start = r->runs[rlepos].value;
-            uint16_t run_end = run_start + r->runs[rlepos].length;
-            for (uint16_t run_value = run_start; run_value <= run_end;
-                 ++run_value) {
-                answer->array[answer->cardinality++] = run_value;
-            }
+            out = write_run_values(out, r->runs[rlepos].value,
+                                   r->runs[rlepos].length);
         }
+        answer->cardinality = (int32_t)(out - answer->array);
         assert(card == answer->cardinality);
         *resulttype = ARRAY_CONTAINER_TYPE_CODE;
         //run_container_free(r);
@@ -124,6 +151,12 @@ void *convert_to_bitset_or_array_container(run_container_t *r, int32_t card,
  * he becomes responsible to free the new one. */
 void *convert_run_to_efficient_container(run_container_t *c,
                                          uint8_t *typecode_after) {
+    if (run_container_is_full(c)) {
+        *typecode_after = RUN_CONTAINER_TYPE_CODE;
+        // collapse owned all-ones containers onto the shared instance (a
+        // no-op when c already is the singleton: same pointer comes back)
+        return run_container_full();
+    }
     int32_t size_as_run_container =
         run_container_serialized_size_in_bytes(c->n_runs);
 
@@ -144,15 +177,12 @@ void *convert_run_to_efficient_container(run_container_t *c,
     if (card <= DEFAULT_MAX_SIZE) {
         // to array
         array_container_t *answer = array_container_create_given_capacity(card);
-        answer->cardinality = 0;
+        uint16_t *out = answer->array;
         for (int rlepos = 0; rlepos < c->n_runs; ++rlepos) {
-            int run_start = c->runs[rlepos].value;
-            int run_end = run_start + c->runs[rlepos].length;
-
-            for (int run_value = run_start; run_value <= run_end; ++run_value) {
-                answer->array[answer->cardinality++] = (uint16_t)run_value;
-            }
+            out = write_run_values(out, c->runs[rlepos].value,
+                                   c->runs[rlepos].length);
         }
+        answer->cardinality = (int32_t)(out - answer->array);
         *typecode_after = ARRAY_CONTAINER_TYPE_CODE;
         return answer;
     }
@@ -233,6 +263,11 @@ void *convert_run_optimize(void *c, uint8_t typecode_original,
                BITSET_CONTAINER_TYPE_CODE) {  // run conversions on bitset
         // does bitset need conversion to run?
         bitset_container_t *c_qua_bitset = (bitset_container_t *)c;
+        if (c_qua_bitset->cardinality == (1 << 16)) {
+            bitset_container_free(c_qua_bitset);
+            *typecode_after = RUN_CONTAINER_TYPE_CODE;
+            return run_container_full();
+        }
         int32_t n_runs = bitset_container_number_of_runs(c_qua_bitset);
         int32_t size_as_run_container =
             run_container_serialized_size_in_bytes(n_runs);
@@ -253,6 +288,16 @@ void *convert_run_optimize(void *c, uint8_t typecode_original,
         uint64_t cur_word = c_qua_bitset->array[0];
         int run_count = 0;
         while (true) {
+#ifdef USEAVX
+            // fast-forward over all-zero words four at a time
+            while (cur_word == UINT64_C(0) &&
+                   long_ctr + 4 < BITSET_CONTAINER_SIZE_IN_WORDS) {
+                const __m256i v = _mm256_lddqu_si256(
+                    (const __m256i *)(c_qua_bitset->array + long_ctr + 1));
+                if (!_mm256_testz_si256(v, v)) break;
+                long_ctr += 4;
+            }
+#endif
             while (cur_word == UINT64_C(0) &&
                    long_ctr < BITSET_CONTAINER_SIZE_IN_WORDS - 1)
                 cur_word = c_qua_bitset->array[++long_ctr];
@@ -268,6 +313,16 @@ void *convert_run_optimize(void *c, uint8_t typecode_original,
             uint64_t cur_word_with_1s = cur_word | (cur_word - 1);
 
             int run_end = 0;
+#ifdef USEAVX
+            // fast-forward over all-ones words four at a time
+            while (cur_word_with_1s == UINT64_C(0xFFFFFFFFFFFFFFFF) &&
+                   long_ctr + 4 < BITSET_CONTAINER_SIZE_IN_WORDS) {
+                const __m256i v = _mm256_lddqu_si256(
+                    (const __m256i *)(c_qua_bitset->array + long_ctr + 1));
+                if (!_mm256_testc_si256(v, _mm256_set1_epi32(-1))) break;
+                long_ctr += 4;
+            }
+#endif
             while (cur_word_with_1s == UINT64_C(0xFFFFFFFFFFFFFFFF) &&
                    long_ctr < BITSET_CONTAINER_SIZE_IN_WORDS - 1)
                 cur_word_with_1s = c_qua_bitset->array[++long_ctr];
@@ -11,6 +11,7 @@
 #include <roaring/containers/containers.h>
 #include <roaring/containers/convert.h>
 #include <roaring/containers/mixed_negation.h>
+#include <roaring/memory.h>
 #include <roaring/containers/run.h>
 
 // TODO: make simplified and optimized negation code across
@@ -176,8 +177,13 @@ bool bitset_container_negation_range(const bitset_container_t *src,
 
     // keep computation using bitsets as long as possible.
     bitset_container_t *t = bitset_container_clone(src);
-    bitset_flip_range(t->array, (uint32_t)range_start, (uint32_t)range_end);
-    t->cardinality = bitset_container_compute_cardinality(t);
+    if (range_start == 0 && range_end == (1 << 16)) {
+        bitset_container_negate(t);  // vectorized, reuses the cardinality
+    } else {
+        bitset_flip_range(t->array, (uint32_t)range_start,
+                          (uint32_t)range_end);
+        t->cardinality = bitset_container_compute_cardinality(t);
+    }
 
     if (t->cardinality > DEFAULT_MAX_SIZE) {
         *dst = t;
@@ -201,8 +207,13 @@ bool bitset_container_negation_range(const bitset_container_t *src,
 bool bitset_container_negation_range_inplace(bitset_container_t *src,
                                              const int range_start,
                                              const int range_end, void **dst) {
-    bitset_flip_range(src->array, (uint32_t)range_start, (uint32_t)range_end);
-    src->cardinality = bitset_container_compute_cardinality(src);
+    if (range_start == 0 && range_end == (1 << 16)) {
+        bitset_container_negate(src);  // vectorized, reuses the cardinality
+    } else {
+        bitset_flip_range(src->array, (uint32_t)range_start,
+                          (uint32_t)range_end);
+        src->cardinality = bitset_container_compute_cardinality(src);
+    }
     if (src->cardinality > DEFAULT_MAX_SIZE) {
         *dst = src;
         return true;
@@ -246,7 +257,9 @@ int run_container_negation_range(const run_container_t *src,
     }
 
     *dst = convert_run_to_efficient_container(ans, &return_typecode);
-    if (return_typecode != RUN_CONTAINER_TYPE_CODE) run_container_free(ans);
+    // pointer comparison, not typecode: a full result converts to the
+    // shared run singleton and ans must still be disposed of
+    if (*dst != ans) run_container_free(ans);
 
     return return_typecode;
 }
@@ -270,7 +283,8 @@ int run_container_negation_range_inplace(run_container_t *src,
 
     // TODO: efficient special case when range is 0 to 65535 inclusive
 
-    if (src->capacity == src->n_runs) {
+    // <= so that borrowed payloads (negative capacity) take the careful path
+    if (src->capacity <= src->n_runs) {
         // no excess room.  More checking to see if result can fit
         bool last_val_before_range = false;
         bool first_val_in_range = false;
@@ -327,7 +341,9 @@ int run_container_negation_range_inplace(run_container_t *src,
     }
 
     *dst = convert_run_to_efficient_container(ans, &return_typecode);
-    if (return_typecode != RUN_CONTAINER_TYPE_CODE) run_container_free(ans);
+    // pointer comparison, not typecode: a full result converts to the
+    // shared run singleton and ans must still be disposed of
+    if (*dst != ans) run_container_free(ans);
 
     return return_typecode;
 }
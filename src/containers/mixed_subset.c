@@ -43,6 +43,17 @@ bool array_container_is_subset_run(const array_container_t* container1,
                                    const run_container_t* container2) {
     if (container1->cardinality > run_container_cardinality(container2))
         return false;
+    const int threshold = 64;  // subject to tuning
+    if (container1->cardinality * threshold < container2->n_runs) {
+        // skewed case: binary search the runs per value rather than
+        // scanning all of them
+        for (int i = 0; i < container1->cardinality; ++i) {
+            if (!run_container_contains(container2, container1->array[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
     int i_array = 0, i_run = 0;
     while (i_array < container1->cardinality && i_run < container2->n_runs) {
         uint32_t start = container2->runs[i_run].value;
@@ -233,7 +233,7 @@ bool array_array_container_lazy_union(const array_container_t *src_1,
                                       const array_container_t *src_2,
                                       void **dst) {
     int totalCardinality = src_1->cardinality + src_2->cardinality;
-    if (totalCardinality <= ARRAY_LAZY_LOWERBOUND) {
+    if (totalCardinality <= roaring_runtime_tuning.lazy_arrays_lowerbound) {
         *dst = array_container_create_given_capacity(totalCardinality);
         if (*dst != NULL) {
             array_container_union(src_1, src_2, (array_container_t *)*dst);
@@ -259,7 +259,7 @@ bool array_array_container_lazy_inplace_union(array_container_t *src_1,
                                       void **dst) {
     int totalCardinality = src_1->cardinality + src_2->cardinality;
     *dst = NULL;
-    if (totalCardinality <= ARRAY_LAZY_LOWERBOUND) {
+    if (totalCardinality <= roaring_runtime_tuning.lazy_arrays_lowerbound) {
         if(src_1->capacity < totalCardinality) {
           *dst = array_container_create_given_capacity(2  * totalCardinality); // be purposefully generous
           if (*dst != NULL) {
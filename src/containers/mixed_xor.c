@@ -216,7 +216,7 @@ bool array_array_container_lazy_xor(const array_container_t *src_1,
                                     void **dst) {
     int totalCardinality = src_1->cardinality + src_2->cardinality;
     // upper bound, but probably poor estimate for xor
-    if (totalCardinality <= ARRAY_LAZY_LOWERBOUND) {
+    if (totalCardinality <= roaring_runtime_tuning.lazy_arrays_lowerbound) {
         *dst = array_container_create_given_capacity(totalCardinality);
         if (*dst != NULL)
             array_container_xor(src_1, src_2, (array_container_t *)*dst);
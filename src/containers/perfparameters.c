@@ -0,0 +1,62 @@
+/*
+ * perfparameters.c
+ *
+ * Runtime-tunable conversion thresholds; see perfparameters.h.
+ */
+
+#include <roaring/containers/array.h>
+#include <roaring/containers/perfparameters.h>
+
+#define ROARING_TUNING_DEFAULTS                               \
+    {                                                         \
+        DEFAULT_MAX_SIZE,      /* array_bitset_threshold */   \
+        DEFAULT_MAX_SIZE,      /* bitset_array_threshold */   \
+        ARRAY_LAZY_LOWERBOUND, /* lazy_arrays_lowerbound */   \
+        LAZY_OR_BITSET_CONVERSION, /* lazy_or_bitset_conversion */ \
+        0,     /* container_growth_numerator: staged ladder */ \
+        0,     /* container_growth_denominator */              \
+        0,     /* container_initial_capacity */                \
+        false  /* container_growth_round_to_size_class */      \
+    }
+
+roaring_tuning_t roaring_runtime_tuning = ROARING_TUNING_DEFAULTS;
+
+void roaring_tuning_get(roaring_tuning_t *out) {
+    *out = roaring_runtime_tuning;
+}
+
+bool roaring_tuning_set(const roaring_tuning_t *tuning) {
+    if (tuning->array_bitset_threshold < 1 ||
+        tuning->array_bitset_threshold > (1 << 16)) {
+        return false;
+    }
+    if (tuning->bitset_array_threshold < 0 ||
+        tuning->bitset_array_threshold > (1 << 16)) {
+        return false;
+    }
+    if (tuning->lazy_arrays_lowerbound < 0 ||
+        tuning->lazy_arrays_lowerbound > (1 << 16)) {
+        return false;
+    }
+    if (tuning->container_growth_denominator < 0 ||
+        tuning->container_growth_numerator < 0) {
+        return false;
+    }
+    // a configured factor must actually grow the buffer, or grows loop
+    if (tuning->container_growth_denominator > 0 &&
+        tuning->container_growth_numerator <=
+            tuning->container_growth_denominator) {
+        return false;
+    }
+    if (tuning->container_initial_capacity < 0 ||
+        tuning->container_initial_capacity > (1 << 16)) {
+        return false;
+    }
+    roaring_runtime_tuning = *tuning;
+    return true;
+}
+
+void roaring_tuning_reset(void) {
+    const roaring_tuning_t defaults = ROARING_TUNING_DEFAULTS;
+    roaring_runtime_tuning = defaults;
+}
@@ -1,13 +1,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <roaring/containers/container_pool.h>
 #include <roaring/containers/run.h>
+#include <roaring/memory.h>
 #include <roaring/portability.h>
 
 extern inline uint16_t run_container_minimum(const run_container_t *run);
 extern inline uint16_t run_container_maximum(const run_container_t *run);
 extern inline int32_t interleavedBinarySearch(const rle16_t *array,
                                               int32_t lenarray, uint16_t ikey);
+extern inline int32_t interleavedInterpolationSearch(const rle16_t *array,
+                                                     int32_t lenarray,
+                                                     uint16_t ikey);
 extern inline bool run_container_contains(const run_container_t *run,
                                           uint16_t pos);
 extern inline int run_container_index_equalorlarger(const run_container_t *arr, uint16_t x);
@@ -18,6 +23,11 @@ extern inline int32_t run_container_serialized_size_in_bytes(int32_t num_runs);
 extern inline run_container_t *run_container_create_range(uint32_t start,
                                                    uint32_t stop);
 
+/* backing storage for the shared immutable full container (see run.h) */
+static rle16_t full_singleton_run[1] = {{.value = 0, .length = 0xFFFF}};
+run_container_t run_container_full_singleton = {
+    .n_runs = 1, .capacity = 1, .runs = full_singleton_run};
+
 bool run_container_add(run_container_t *run, uint16_t pos) {
     int32_t index = interleavedBinarySearch(run->runs, run->n_runs, pos);
     if (index >= 0) return false;  // already there
@@ -69,15 +79,30 @@ bool run_container_add(run_container_t *run, uint16_t pos) {
 
 /* Create a new run container. Return NULL in case of failure. */
 run_container_t *run_container_create_given_capacity(int32_t size) {
-    run_container_t *run;
+    run_container_t *run = container_pool_get_run();
+    if (run != NULL) {  // recycled shell, grow its buffer if needed
+        if (run->capacity < size) {
+            rle16_t *newruns =
+                (rle16_t *)roaring_realloc(run->runs, sizeof(rle16_t) * size);
+            if (newruns == NULL) {
+                roaring_free(run->runs);
+                roaring_free(run);
+                return NULL;
+            }
+            run->runs = newruns;
+            run->capacity = size;
+        }
+        run->n_runs = 0;
+        return run;
+    }
     /* Allocate the run container itself. */
-    if ((run = (run_container_t *)malloc(sizeof(run_container_t))) == NULL) {
+    if ((run = (run_container_t *)roaring_malloc(sizeof(run_container_t))) == NULL) {
         return NULL;
     }
-    if (size <= 0 ) { // we don't want to rely on malloc(0)
+    if (size <= 0 ) { // we don't want to rely on roaring_malloc(0)
         run->runs = NULL;
-    } else if ((run->runs = (rle16_t *)malloc(sizeof(rle16_t) * size)) == NULL) {
-        free(run);
+    } else if ((run->runs = (rle16_t *)roaring_malloc(sizeof(rle16_t) * size)) == NULL) {
+        roaring_free(run);
         return NULL;
     }
     run->capacity = size;
@@ -86,12 +111,13 @@ run_container_t *run_container_create_given_capacity(int32_t size) {
 }
 
 int run_container_shrink_to_fit(run_container_t *src) {
+    if (src->capacity < 0) return 0;  // borrowed payload, nothing is ours
     if (src->n_runs == src->capacity) return 0;  // nothing to do
     int savings = src->capacity - src->n_runs;
     src->capacity = src->n_runs;
     rle16_t *oldruns = src->runs;
-    src->runs = (rle16_t *)realloc(oldruns, src->capacity * sizeof(rle16_t));
-    if (src->runs == NULL) free(oldruns);  // should never happen?
+    src->runs = (rle16_t *)roaring_realloc(oldruns, src->capacity * sizeof(rle16_t));
+    if (src->runs == NULL) roaring_free(oldruns);  // should never happen?
     return savings;
 }
 /* Create a new run container. Return NULL in case of failure. */
@@ -100,9 +126,12 @@ run_container_t *run_container_create(void) {
 }
 
 run_container_t *run_container_clone(const run_container_t *src) {
-    run_container_t *run = run_container_create_given_capacity(src->capacity);
+    // clones own their payload: a borrowed source yields an exact-size copy
+    const int32_t capacity =
+        (src->capacity < 0) ? src->n_runs : src->capacity;
+    run_container_t *run = run_container_create_given_capacity(capacity);
     if (run == NULL) return NULL;
-    run->capacity = src->capacity;
+    run->capacity = capacity;
     run->n_runs = src->n_runs;
     memcpy(run->runs, src->runs, src->n_runs * sizeof(rle16_t));
     return run;
@@ -110,34 +139,59 @@ run_container_t *run_container_clone(const run_container_t *src) {
 
 /* Free memory. */
 void run_container_free(run_container_t *run) {
+    if (run_container_is_full_singleton(run)) {
+        return;  // shared instance, in particular it must not enter the pool
+    }
+    if (run->capacity < 0) {
+        // borrowed payload: the arena owns the bytes, only the shell is
+        // ours, and it must not enter the pool with a buffer attached
+        roaring_free(run);
+        return;
+    }
+    if (container_pool_put_run(run)) {
+        return;  // parked for reuse, with its buffer attached
+    }
     if(run->runs != NULL) {// Jon Strabala reports that some tools complain otherwise
-      free(run->runs);
+      roaring_free(run->runs);
       run->runs = NULL;  // pedantic
     }
-    free(run);
+    roaring_free(run);
 }
 
 void run_container_grow(run_container_t *run, int32_t min, bool copy) {
-    int32_t newCapacity =
-        (run->capacity == 0)
-            ? RUN_DEFAULT_INIT_SIZE
-            : run->capacity < 64 ? run->capacity * 2
-                                 : run->capacity < 1024 ? run->capacity * 3 / 2
-                                                        : run->capacity * 5 / 4;
-    if (newCapacity < min) newCapacity = min;
-    run->capacity = newCapacity;
+    if (run->capacity < 0) {
+        // borrowed payload: fall back to an owned heap copy, leaving the
+        // arena bytes untouched
+        int32_t newCapacity = roaring_container_next_capacity(
+            -run->capacity, min, INT32_MAX, sizeof(rle16_t));
+        rle16_t *newruns =
+            (rle16_t *)roaring_malloc(newCapacity * sizeof(rle16_t));
+        if (newruns == NULL) {
+            fprintf(stderr, "could not allocate memory\n");
+            assert(newruns != NULL);
+            return;
+        }
+        if (copy) {
+            memcpy(newruns, run->runs, run->n_runs * sizeof(rle16_t));
+        }
+        run->runs = newruns;
+        run->capacity = newCapacity;
+        return;
+    }
+    run->capacity = roaring_container_next_capacity(run->capacity, min,
+                                                    INT32_MAX, sizeof(rle16_t));
     assert(run->capacity >= min);
     if (copy) {
         rle16_t *oldruns = run->runs;
         run->runs =
-            (rle16_t *)realloc(oldruns, run->capacity * sizeof(rle16_t));
-        if (run->runs == NULL) free(oldruns);
+            (rle16_t *)roaring_realloc(oldruns, run->capacity * sizeof(rle16_t));
+        if (run->runs == NULL) roaring_free(oldruns);
     } else {
         // Jon Strabala reports that some tools complain otherwise
         if (run->runs != NULL) {
-          free(run->runs);
+          roaring_free(run->runs);
         }
-        run->runs = (rle16_t *)malloc(run->capacity * sizeof(rle16_t));
+        run->runs = (rle16_t *)roaring_malloc(run->capacity * sizeof(rle16_t));
     }
     // handle the case where realloc fails
     if (run->runs == NULL) {
@@ -570,6 +624,31 @@ int run_container_to_uint32_array(void *vout, const run_container_t *cont,
                                   uint32_t base) {
     int outpos = 0;
     uint32_t *out = (uint32_t *)vout;
+#ifdef USEAVX
+    // a run decodes to consecutive integers, which we can emit eight at a
+    // time; no store may reach past the run since the output buffer is
+    // sized exactly and, in parallel extraction, abuts another thread's
+    const __m256i inc = _mm256_set1_epi32(8);
+    for (int i = 0; i < cont->n_runs; ++i) {
+        const uint32_t run_start = base + cont->runs[i].value;
+        const int n = (int)cont->runs[i].length + 1;
+        __m256i v = _mm256_add_epi32(_mm256_set1_epi32((int)run_start),
+                                     _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        int j = 0;
+        for (; j + 8 <= n; j += 8) {
+            _mm256_storeu_si256((__m256i *)(out + outpos + j), v);
+            v = _mm256_add_epi32(v, inc);
+        }
+        for (; j < n; ++j) {
+            uint32_t val = run_start + (uint32_t)j;
+            // the output may be misaligned (serialization aims it into a
+            // byte buffer); the unaligned vector stores above tolerate
+            // that, and so must the tail
+            memcpy(out + outpos + j, &val, sizeof(uint32_t));
+        }
+        outpos += n;
+    }
+#else
     for (int i = 0; i < cont->n_runs; ++i) {
         uint32_t run_start = base + cont->runs[i].value;
         uint16_t le = cont->runs[i].length;
@@ -580,6 +659,7 @@ int run_container_to_uint32_array(void *vout, const run_container_t *cont,
             outpos++;
         }
     }
+#endif
     return outpos;
 }
 
@@ -660,6 +740,16 @@ bool run_container_iterate64(const run_container_t *cont, uint32_t base,
     return true;
 }
 
+bool run_container_iterate_ranges(const run_container_t *cont, uint32_t base,
+                                  roaring_range_iterator iterator, void *ptr) {
+    for (int i = 0; i < cont->n_runs; ++i) {
+        if (!iterator(base + cont->runs[i].value,
+                      (uint64_t)cont->runs[i].length + 1, ptr))
+            return false;
+    }
+    return true;
+}
+
 bool run_container_is_subset(const run_container_t *container1,
                              const run_container_t *container2) {
     int i1 = 0, i2 = 0;
@@ -757,19 +847,45 @@ bool run_container_select(const run_container_t *container,
     return false;
 }
 
-int run_container_rank(const run_container_t *container, uint16_t x) {
-    int sum = 0;
-    uint32_t x32 = x;
-    for (int i = 0; i < container->n_runs; i++) {
-        uint32_t startpoint = container->runs[i].value;
-        uint32_t length = container->runs[i].length;
-        uint32_t endpoint = length + startpoint;
-        if (x <= endpoint) {
-            if (x < startpoint) break;
-            return sum + (x32 - startpoint) + 1;
-        } else {
-            sum += length + 1;
+/* Sum of the lengths of the first n runs, in the style of
+ * run_container_cardinality. */
+static int32_t rle16_sum_lengths(const rle16_t *runs, int32_t n) {
+    int32_t sum = 0;
+    int32_t k = 0;
+#ifdef USEAVX
+    const int32_t step = sizeof(__m256i) / sizeof(rle16_t);
+    if (n > step) {
+        __m256i total = _mm256_setzero_si256();
+        for (; k + step <= n; k += step) {
+            __m256i ymm1 = _mm256_lddqu_si256((const __m256i *)(runs + k));
+            __m256i justlengths = _mm256_srli_epi32(ymm1, 16);
+            total = _mm256_add_epi32(total, justlengths);
         }
+        uint32_t buffer[sizeof(__m256i) / sizeof(rle16_t)];
+        _mm256_storeu_si256((__m256i *)buffer, total);
+        sum += (buffer[0] + buffer[1]) + (buffer[2] + buffer[3]) +
+               (buffer[4] + buffer[5]) + (buffer[6] + buffer[7]);
+    }
+#endif
+    for (; k < n; ++k) {
+        sum += runs[k].length;
     }
     return sum;
 }
+
+int run_container_rank(const run_container_t *container, uint16_t x) {
+    int32_t index =
+        interleavedInterpolationSearch(container->runs, container->n_runs, x);
+    if (index < 0) index = -index - 2;
+    if (index < 0) return 0;  // x precedes the first run
+    // runs before `index' contribute length + 1 values each
+    const int sum =
+        index + rle16_sum_lengths(container->runs, index);
+    const uint32_t startpoint = container->runs[index].value;
+    const uint32_t length = container->runs[index].length;
+    const uint32_t x32 = x;
+    if (x32 <= startpoint + length) {
+        return sum + (int)(x32 - startpoint) + 1;
+    }
+    return sum + (int)length + 1;
+}
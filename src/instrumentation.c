@@ -0,0 +1,37 @@
+/*
+ * instrumentation.c
+ *
+ */
+
+#include <string.h>
+
+#include <roaring/instrumentation.h>
+
+#ifdef ROARING_INSTRUMENTATION
+
+roaring_instrumentation_t roaring_instrumentation_counters;
+
+void roaring_instrumentation_snapshot(roaring_instrumentation_t *out) {
+    *out = roaring_instrumentation_counters;
+}
+
+void roaring_instrumentation_reset(void) {
+    memset(&roaring_instrumentation_counters, 0,
+           sizeof(roaring_instrumentation_counters));
+}
+
+bool roaring_instrumentation_is_enabled(void) { return true; }
+
+#else  // ROARING_INSTRUMENTATION
+
+// the hooks compile away, but the API stays so that callers need not care
+// how the library was built
+void roaring_instrumentation_snapshot(roaring_instrumentation_t *out) {
+    memset(out, 0, sizeof(*out));
+}
+
+void roaring_instrumentation_reset(void) {}
+
+bool roaring_instrumentation_is_enabled(void) { return false; }
+
+#endif  // ROARING_INSTRUMENTATION
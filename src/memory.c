@@ -0,0 +1,263 @@
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <roaring/containers/container_pool.h>
+#include <roaring/memory.h>
+#include <roaring/portability.h>
+
+#if defined(_MSC_VER)
+#define ROARING_THREAD_LOCAL __declspec(thread)
+#else
+#define ROARING_THREAD_LOCAL __thread
+#endif
+
+// without this, we get lots of warnings about posix_memalign
+#ifndef __cplusplus
+extern int posix_memalign(void **__memptr, size_t __alignment, size_t __size);
+#endif  //__cplusplus
+
+static void *default_aligned_malloc(size_t alignment, size_t size) {
+    return roaring_bitmap_aligned_malloc(alignment, size);
+}
+
+static void default_aligned_free(void *memblock) {
+    roaring_bitmap_aligned_free(memblock);
+}
+
+static roaring_memory_t global_memory_hook = {
+    .malloc = malloc,
+    .realloc = realloc,
+    .calloc = calloc,
+    .free = free,
+    .aligned_malloc = default_aligned_malloc,
+    .aligned_free = default_aligned_free,
+};
+
+void roaring_init_memory_hook(roaring_memory_t memory_hook) {
+    global_memory_hook = memory_hook;
+}
+
+// Budget accounting sits between the wrappers below and the hooks: while a
+// budget is active on the calling thread, every live allocation is recorded
+// in an open-addressing table keyed by pointer, so frees and reallocs can be
+// debited by size and an abandoned operation can be swept clean.
+
+typedef struct budget_entry_s {
+    void *ptr;     // NULL marks an empty slot
+    size_t size;   // bytes charged to the budget
+    bool aligned;  // must be released through the aligned hook
+} budget_entry_t;
+
+typedef struct budget_state_s {
+    roaring_memory_budget_t *report;
+    budget_entry_t *entries;  // power-of-two table, grown at half load
+    size_t mask;              // table length minus one
+    size_t count;
+    jmp_buf abort_target;
+} budget_state_t;
+
+static ROARING_THREAD_LOCAL budget_state_t *current_budget = NULL;
+
+// Fibonacci hashing on the address bits above the typical alignment
+static inline size_t budget_hash(const budget_state_t *state, void *p) {
+    return (size_t)(((uintptr_t)p >> 4) * UINT64_C(0x9E3779B97F4A7C15)) &
+           state->mask;
+}
+
+// abandons the running operation: control resumes in roaring_budget_run
+static void budget_abort(budget_state_t *state) {
+    state->report->exceeded = true;
+    longjmp(state->abort_target, 1);
+}
+
+static void budget_charge(budget_state_t *state, size_t size) {
+    const roaring_memory_budget_t *report = state->report;
+    if (report->limit != 0 && size > report->limit - report->used) {
+        budget_abort(state);
+    }
+}
+
+static void budget_grow(budget_state_t *state) {
+    const size_t new_length = (state->mask + 1) * 2;
+    budget_entry_t *fresh = (budget_entry_t *)global_memory_hook.calloc(
+        new_length, sizeof(budget_entry_t));
+    if (fresh == NULL) budget_abort(state);
+    budget_entry_t *old = state->entries;
+    const size_t old_length = state->mask + 1;
+    state->entries = fresh;
+    state->mask = new_length - 1;
+    for (size_t i = 0; i < old_length; i++) {
+        if (old[i].ptr == NULL) continue;
+        size_t slot = budget_hash(state, old[i].ptr);
+        while (fresh[slot].ptr != NULL) slot = (slot + 1) & state->mask;
+        fresh[slot] = old[i];
+    }
+    global_memory_hook.free(old);
+}
+
+static void budget_track(budget_state_t *state, void *p, size_t size,
+                         bool aligned) {
+    if (state->count * 2 >= state->mask + 1) budget_grow(state);
+    size_t slot = budget_hash(state, p);
+    while (state->entries[slot].ptr != NULL) slot = (slot + 1) & state->mask;
+    state->entries[slot].ptr = p;
+    state->entries[slot].size = size;
+    state->entries[slot].aligned = aligned;
+    state->count++;
+    state->report->used += size;
+    if (state->report->used > state->report->high_water) {
+        state->report->high_water = state->report->used;
+    }
+}
+
+static budget_entry_t *budget_find(budget_state_t *state, void *p) {
+    size_t slot = budget_hash(state, p);
+    while (state->entries[slot].ptr != NULL) {
+        if (state->entries[slot].ptr == p) return &state->entries[slot];
+        slot = (slot + 1) & state->mask;
+    }
+    return NULL;
+}
+
+static void budget_remove(budget_state_t *state, budget_entry_t *entry) {
+    state->report->used -= entry->size;
+    state->count--;
+    // backward-shift deletion keeps probe chains tombstone free
+    size_t hole = (size_t)(entry - state->entries);
+    size_t slot = (hole + 1) & state->mask;
+    while (state->entries[slot].ptr != NULL) {
+        const size_t home = budget_hash(state, state->entries[slot].ptr);
+        if (((slot - home) & state->mask) >= ((slot - hole) & state->mask)) {
+            state->entries[hole] = state->entries[slot];
+            hole = slot;
+        }
+        slot = (slot + 1) & state->mask;
+    }
+    state->entries[hole].ptr = NULL;
+}
+
+bool roaring_budget_run(roaring_memory_budget_t *budget, size_t limit,
+                        void (*operation)(void *), void *context) {
+    budget->limit = limit;
+    budget->used = 0;
+    budget->high_water = 0;
+    budget->exceeded = false;
+    // the tracking state itself stays off the books
+    budget_state_t *state =
+        (budget_state_t *)global_memory_hook.malloc(sizeof(budget_state_t));
+    if (state == NULL) return false;
+    state->report = budget;
+    state->mask = 63;
+    state->count = 0;
+    state->entries = (budget_entry_t *)global_memory_hook.calloc(
+        state->mask + 1, sizeof(budget_entry_t));
+    if (state->entries == NULL) {
+        global_memory_hook.free(state);
+        return false;
+    }
+    budget_state_t *previous = current_budget;
+    current_budget = state;
+    if (setjmp(state->abort_target) != 0) {
+        // The operation was abandoned mid-flight. It may have parked shells
+        // it allocated in the per-thread container pool; draining the pool
+        // while the budget is still active routes those frees through the
+        // accounting above, so the sweep below cannot double free them.
+        roaring_container_pool_set_capacity(0);
+        for (size_t i = 0; i <= state->mask; i++) {
+            if (state->entries[i].ptr == NULL) continue;
+            if (state->entries[i].aligned) {
+                global_memory_hook.aligned_free(state->entries[i].ptr);
+            } else {
+                global_memory_hook.free(state->entries[i].ptr);
+            }
+        }
+        current_budget = previous;
+        budget->used = 0;
+        global_memory_hook.free(state->entries);
+        global_memory_hook.free(state);
+        return false;
+    }
+    operation(context);
+    current_budget = previous;
+    global_memory_hook.free(state->entries);
+    global_memory_hook.free(state);
+    return true;
+}
+
+void *roaring_malloc(size_t n) {
+    budget_state_t *state = current_budget;
+    if (state == NULL) return global_memory_hook.malloc(n);
+    budget_charge(state, n);
+    void *p = global_memory_hook.malloc(n);
+    if (p == NULL) {
+        if (n == 0) return NULL;
+        budget_abort(state);
+    }
+    budget_track(state, p, n, false);
+    return p;
+}
+
+void *roaring_realloc(void *p, size_t new_sz) {
+    budget_state_t *state = current_budget;
+    if (state == NULL) return global_memory_hook.realloc(p, new_sz);
+    if (p == NULL) return roaring_malloc(new_sz);
+    budget_entry_t *entry = budget_find(state, p);
+    if (entry == NULL) {
+        // the block predates the operation: resize it off the books
+        return global_memory_hook.realloc(p, new_sz);
+    }
+    if (new_sz > entry->size) budget_charge(state, new_sz - entry->size);
+    void *q = global_memory_hook.realloc(p, new_sz);
+    if (q == NULL && new_sz > 0) budget_abort(state);
+    budget_remove(state, entry);
+    if (q != NULL) budget_track(state, q, new_sz, false);
+    return q;
+}
+
+void *roaring_calloc(size_t n_elements, size_t element_size) {
+    budget_state_t *state = current_budget;
+    if (state == NULL) {
+        return global_memory_hook.calloc(n_elements, element_size);
+    }
+    const size_t total = n_elements * element_size;
+    budget_charge(state, total);
+    void *p = global_memory_hook.calloc(n_elements, element_size);
+    if (p == NULL) {
+        if (total == 0) return NULL;
+        budget_abort(state);
+    }
+    budget_track(state, p, total, false);
+    return p;
+}
+
+void roaring_free(void *p) {
+    budget_state_t *state = current_budget;
+    if (state != NULL && p != NULL) {
+        budget_entry_t *entry = budget_find(state, p);
+        if (entry != NULL) budget_remove(state, entry);
+    }
+    global_memory_hook.free(p);
+}
+
+void *roaring_aligned_malloc(size_t alignment, size_t size) {
+    budget_state_t *state = current_budget;
+    if (state == NULL) return global_memory_hook.aligned_malloc(alignment, size);
+    budget_charge(state, size);
+    void *p = global_memory_hook.aligned_malloc(alignment, size);
+    if (p == NULL) {
+        if (size == 0) return NULL;
+        budget_abort(state);
+    }
+    budget_track(state, p, size, true);
+    return p;
+}
+
+void roaring_aligned_free(void *p) {
+    budget_state_t *state = current_budget;
+    if (state != NULL && p != NULL) {
+        budget_entry_t *entry = budget_find(state, p);
+        if (entry != NULL) budget_remove(state, entry);
+    }
+    global_memory_hook.aligned_free(p);
+}
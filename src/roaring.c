@@ -3,11 +3,18 @@
 #include <roaring/roaring.h>
 #include <roaring/roaring_array.h>
 #include <roaring/bitset_util.h>
+#include <roaring/containers/container_pool.h>
+#include <roaring/instrumentation.h>
+#include <roaring/memory.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
 
 extern inline bool roaring_bitmap_contains(const roaring_bitmap_t *r,
                                            uint32_t val);
@@ -63,7 +70,7 @@ static inline void *containerptr_roaring_bitmap_add(roaring_bitmap_t *r,
 
 roaring_bitmap_t *roaring_bitmap_create() {
     roaring_bitmap_t *ans =
-        (roaring_bitmap_t *)malloc(sizeof(roaring_bitmap_t));
+        (roaring_bitmap_t *)roaring_malloc(sizeof(roaring_bitmap_t));
     if (!ans) {
         return NULL;
     }
@@ -73,13 +80,13 @@ roaring_bitmap_t *roaring_bitmap_create() {
 
 roaring_bitmap_t *roaring_bitmap_create_with_capacity(uint32_t cap) {
     roaring_bitmap_t *ans =
-        (roaring_bitmap_t *)malloc(sizeof(roaring_bitmap_t));
+        (roaring_bitmap_t *)roaring_malloc(sizeof(roaring_bitmap_t));
     if (!ans) {
         return NULL;
     }
     bool is_ok = ra_init_with_capacity(&ans->high_low_container, cap);
     if (!is_ok) {
-        free(ans);
+        roaring_free(ans);
         return NULL;
     }
     return ans;
@@ -93,6 +100,7 @@ void roaring_bitmap_add_many(roaring_bitmap_t *r, size_t n_args,
     size_t i = 0;            // index of value
     int containerindex = 0;
     if (n_args == 0) return;
+    ra_invalidate_cached_cardinality(&r->high_low_container);
     uint32_t val;
     memcpy(&val, vals + i, sizeof(val));
     container =
@@ -132,6 +140,175 @@ roaring_bitmap_t *roaring_bitmap_of_ptr(size_t n_args, const uint32_t *vals) {
     return answer;
 }
 
+roaring_bitmap_t *roaring_bitmap_of_sorted(size_t n_args,
+                                           const uint32_t *vals) {
+    roaring_bitmap_t *answer = roaring_bitmap_create();
+    size_t i = 0;
+    uint32_t val = 0;
+    if (i < n_args) {
+        memcpy(&val, vals + i, sizeof(val));
+    }
+    while (i < n_args) {
+        const uint16_t key = (uint16_t)(val >> 16);
+        // delimit the slice of values sharing the high 16 bits: since the
+        // input is sorted it is contiguous
+        const size_t start = i;
+        uint32_t next = val;
+        do {
+            assert(next >= val);  // the input must be sorted
+            val = next;
+            i++;
+            if (i == n_args) break;
+            memcpy(&next, vals + i, sizeof(next));
+        } while ((next >> 16) == key);
+        const size_t slice_length = i - start;
+        void *container;
+        uint8_t typecode;
+        if (slice_length <= DEFAULT_MAX_SIZE) {
+            // small slice: build the array container directly, removing
+            // duplicates as we copy (the input is sorted)
+            array_container_t *ac =
+                array_container_create_given_capacity((int32_t)slice_length);
+            int32_t pos = 0;
+            uint16_t prev_low = 0;
+            for (size_t j = start; j < i; j++) {
+                uint32_t v;
+                memcpy(&v, vals + j, sizeof(v));
+                const uint16_t low = (uint16_t)v;
+                if (pos == 0 || low != prev_low) {
+                    ac->array[pos++] = low;
+                    prev_low = low;
+                }
+            }
+            ac->cardinality = pos;
+            container = ac;
+            typecode = ARRAY_CONTAINER_TYPE_CODE;
+        } else {
+            // large slice: set the bits of a bitset container in one pass
+            bitset_container_t *bc = bitset_container_create();
+            uint64_t *words = bc->array;
+            for (size_t j = start; j < i; j++) {
+                uint32_t v;
+                memcpy(&v, vals + j, sizeof(v));
+                const uint16_t low = (uint16_t)v;
+                words[low >> 6] |= UINT64_C(1) << (low & 63);
+            }
+            // the input may contain duplicates, so recount
+            bc->cardinality = bitset_container_compute_cardinality(bc);
+            if (bc->cardinality <= DEFAULT_MAX_SIZE) {
+                // only possible when there were many duplicates
+                container = array_container_from_bitset(bc);
+                typecode = ARRAY_CONTAINER_TYPE_CODE;
+                bitset_container_free(bc);
+            } else {
+                container = bc;
+                typecode = BITSET_CONTAINER_TYPE_CODE;
+            }
+        }
+        // keys arrive in increasing order: append, do not insert
+        ra_append(&answer->high_low_container, key, container, typecode);
+        val = next;
+    }
+    return answer;
+}
+
+roaring_builder_t *roaring_builder_create(void) {
+    roaring_builder_t *b =
+        (roaring_builder_t *)roaring_malloc(sizeof(roaring_builder_t));
+    if (b == NULL) return NULL;
+    b->r = roaring_bitmap_create();
+    b->runs = NULL;
+    b->n_runs = 0;
+    b->run_capacity = 0;
+    b->last_value = 0;
+    b->key = 0;
+    b->has_tail = false;
+    b->has_last = false;
+    return b;
+}
+
+// seal the open tail container with its cheapest representation and append
+// it; keys only ever advance, so this is a plain ra_append
+static void roaring_builder_seal_tail(roaring_builder_t *b) {
+    if (!b->has_tail || b->n_runs == 0) {
+        b->has_tail = false;
+        b->n_runs = 0;
+        return;
+    }
+    run_container_t *run = run_container_create_given_capacity(b->n_runs);
+    memcpy(run->runs, b->runs, b->n_runs * sizeof(rle16_t));
+    run->n_runs = b->n_runs;
+    uint8_t typecode;
+    void *container = convert_run_to_efficient_container_and_free(
+        run, &typecode);
+    ra_append(&b->r->high_low_container, b->key, container, typecode);
+    b->has_tail = false;
+    b->n_runs = 0;
+}
+
+// append the run [min,max] (low 16 bits, within the tail container's key),
+// merging with the previous run when contiguous
+static void roaring_builder_push_run(roaring_builder_t *b, uint16_t min,
+                                     uint16_t max) {
+    if (b->n_runs > 0) {
+        rle16_t *last = b->runs + b->n_runs - 1;
+        const uint32_t previous_end = (uint32_t)last->value + last->length;
+        if ((uint32_t)min == previous_end + 1) {
+            last->length = (uint16_t)(max - last->value);
+            return;
+        }
+    }
+    if (b->n_runs == b->run_capacity) {
+        const int32_t new_capacity =
+            b->run_capacity == 0 ? 64 : b->run_capacity * 2;
+        rle16_t *new_runs = (rle16_t *)roaring_realloc(
+            b->runs, new_capacity * sizeof(rle16_t));
+        b->runs = new_runs;
+        b->run_capacity = new_capacity;
+    }
+    b->runs[b->n_runs].value = min;
+    b->runs[b->n_runs].length = (uint16_t)(max - min);
+    b->n_runs++;
+}
+
+bool roaring_builder_add_range_closed(roaring_builder_t *b, uint32_t min,
+                                      uint32_t max) {
+    if (min > max) return false;
+    if (b->has_last && min <= b->last_value) return false;
+    for (uint32_t key = min >> 16; key <= (max >> 16); key++) {
+        const uint16_t lo = (key == (min >> 16)) ? (uint16_t)min : 0;
+        const uint16_t hi = (key == (max >> 16)) ? (uint16_t)max : 0xFFFF;
+        if (!b->has_tail || b->key != (uint16_t)key) {
+            roaring_builder_seal_tail(b);
+            b->key = (uint16_t)key;
+            b->has_tail = true;
+        }
+        roaring_builder_push_run(b, lo, hi);
+    }
+    b->last_value = max;
+    b->has_last = true;
+    return true;
+}
+
+bool roaring_builder_add(roaring_builder_t *b, uint32_t val) {
+    return roaring_builder_add_range_closed(b, val, val);
+}
+
+roaring_bitmap_t *roaring_builder_finalize(roaring_builder_t *b) {
+    roaring_builder_seal_tail(b);
+    roaring_bitmap_t *r = b->r;
+    roaring_free(b->runs);
+    roaring_free(b);
+    return r;
+}
+
+void roaring_builder_free(roaring_builder_t *b) {
+    if (b == NULL) return;
+    roaring_bitmap_free(b->r);
+    roaring_free(b->runs);
+    roaring_free(b);
+}
+
 roaring_bitmap_t *roaring_bitmap_of(size_t n_args, ...) {
     // todo: could be greatly optimized but we do not expect this call to ever
     // include long lists
@@ -188,6 +365,7 @@ void roaring_bitmap_add_range_closed(roaring_bitmap_t *ra, uint32_t min, uint32_
     if (min > max) {
         return;
     }
+    ra_invalidate_cached_cardinality(&ra->high_low_container);
 
     uint32_t min_key = min >> 16;
     uint32_t max_key = max >> 16;
@@ -238,6 +416,7 @@ void roaring_bitmap_remove_range_closed(roaring_bitmap_t *ra, uint32_t min, uint
     if (min > max) {
         return;
     }
+    ra_invalidate_cached_cardinality(&ra->high_low_container);
 
     uint32_t min_key = min >> 16;
     uint32_t max_key = max >> 16;
@@ -247,6 +426,15 @@ void roaring_bitmap_remove_range_closed(roaring_bitmap_t *ra, uint32_t min, uint
     while (src < ra->high_low_container.size && ra->high_low_container.keys[src] <= max_key) {
         uint32_t container_min = (min_key == ra->high_low_container.keys[src]) ? (min & 0xffff) : 0;
         uint32_t container_max = (max_key == ra->high_low_container.keys[src]) ? (max & 0xffff) : 0xffff;
+        if (container_min == 0 && container_max == 0xffff) {
+            // fully covered container: drop it without touching its
+            // contents (container_free handles shared containers); the
+            // surviving tail is shifted down in one memmove below
+            container_free(ra->high_low_container.containers[src],
+                           ra->high_low_container.typecodes[src]);
+            src++;
+            continue;
+        }
         ra_unshare_container_at_index(&ra->high_low_container, src);
         void *new_container;
         uint8_t new_type;
@@ -371,16 +559,342 @@ void roaring_bitmap_statistics(const roaring_bitmap_t *ra,
     }
 }
 
+bool roaring_bitmap_internal_validate(const roaring_bitmap_t *r,
+                                      const char **reason) {
+    const char *why = NULL;
+    const roaring_array_t *ra = &r->high_low_container;
+    if (ra->size < 0 || ra->size > (1 << 16)) {
+        why = "container count out of range";
+    }
+    uint64_t total_card = 0;
+    for (int i = 0; why == NULL && i < ra->size; ++i) {
+        if (i > 0 && ra->keys[i] <= ra->keys[i - 1]) {
+            why = "keys not strictly increasing";
+            break;
+        }
+        uint8_t typecode = ra->typecodes[i];
+        const void *c = ra->containers[i];
+        if (c == NULL) {
+            why = "NULL container";
+            break;
+        }
+        if (typecode == SHARED_CONTAINER_TYPE_CODE) {
+            const shared_container_t *shared = (const shared_container_t *)c;
+            if (shared->counter == 0) {
+                why = "shared container with a dead refcount";
+                break;
+            }
+            typecode = shared->typecode;
+            c = shared->container;
+            if (c == NULL || typecode == SHARED_CONTAINER_TYPE_CODE) {
+                why = "shared container wrapping garbage";
+                break;
+            }
+        }
+        switch (typecode) {
+            case BITSET_CONTAINER_TYPE_CODE: {
+                const bitset_container_t *bitset =
+                    (const bitset_container_t *)c;
+                if (bitset->array == NULL) {
+                    why = "bitset container without a payload";
+                    break;
+                }
+                int32_t card = 0;
+                for (int32_t j = 0; j < BITSET_CONTAINER_SIZE_IN_WORDS; ++j) {
+                    card += hamming(bitset->array[j]);
+                }
+                if (card == 0) {
+                    why = "empty container";
+                } else if (bitset->cardinality != BITSET_UNKNOWN_CARDINALITY &&
+                           bitset->cardinality != card) {
+                    why = "bitset cardinality disagrees with its words";
+                } else {
+                    total_card += card;
+                }
+                break;
+            }
+            case ARRAY_CONTAINER_TYPE_CODE: {
+                const array_container_t *array =
+                    (const array_container_t *)c;
+                const int32_t capacity = (array->capacity < 0)
+                                             ? -array->capacity
+                                             : array->capacity;
+                if (array->cardinality <= 0) {
+                    why = "empty container";
+                } else if (array->cardinality > capacity ||
+                           array->cardinality > (1 << 16)) {
+                    why = "array cardinality exceeds its capacity";
+                } else if (array->array == NULL) {
+                    why = "array container without a payload";
+                } else {
+                    for (int32_t j = 1; j < array->cardinality; ++j) {
+                        if (array->array[j] <= array->array[j - 1]) {
+                            why = "array values not strictly increasing";
+                            break;
+                        }
+                    }
+                    total_card += array->cardinality;
+                }
+                break;
+            }
+            case RUN_CONTAINER_TYPE_CODE: {
+                const run_container_t *run = (const run_container_t *)c;
+                const int32_t capacity = (run->capacity < 0)
+                                             ? -run->capacity
+                                             : run->capacity;
+                if (run->n_runs <= 0) {
+                    why = "empty container";
+                    break;
+                }
+                if (run->n_runs > capacity &&
+                    !run_container_is_full_singleton(run)) {
+                    why = "run count exceeds the container's capacity";
+                    break;
+                }
+                if (run->runs == NULL) {
+                    why = "run container without a payload";
+                    break;
+                }
+                uint32_t previous_end = 0;
+                for (int32_t j = 0; j < run->n_runs; ++j) {
+                    const uint32_t start = run->runs[j].value;
+                    const uint32_t end = start + run->runs[j].length;
+                    if (end > 0xFFFF) {
+                        why = "run extends past the container";
+                        break;
+                    }
+                    // adjacent runs must be merged, else cardinality math
+                    // and run-aware kernels go wrong
+                    if (j > 0 && start <= previous_end + 1) {
+                        why = "runs overlapping or not coalesced";
+                        break;
+                    }
+                    previous_end = end;
+                    total_card += run->runs[j].length + 1;
+                }
+                break;
+            }
+            default:
+                why = "invalid typecode";
+                break;
+        }
+    }
+    if (why == NULL && (ra->flags & ROARING_FLAG_CARD_VALID) &&
+        ra->cached_cardinality != total_card) {
+        why = "cached cardinality disagrees with the containers";
+    }
+    if (reason != NULL) {
+        *reason = why;
+    }
+    return why == NULL;
+}
+
+// start and byte length of a container's payload allocation
+static void container_payload_extent(const void *c, uint8_t typecode,
+                                     const char **start, size_t *bytes) {
+    c = container_unwrap_shared(c, &typecode);
+    switch (typecode) {
+        case BITSET_CONTAINER_TYPE_CODE:
+            *start = (const char *)((const bitset_container_t *)c)->array;
+            *bytes = BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
+            break;
+        case ARRAY_CONTAINER_TYPE_CODE:
+            *start = (const char *)((const array_container_t *)c)->array;
+            *bytes = ((const array_container_t *)c)->cardinality *
+                     sizeof(uint16_t);
+            break;
+        case RUN_CONTAINER_TYPE_CODE:
+            *start = (const char *)((const run_container_t *)c)->runs;
+            *bytes = ((const run_container_t *)c)->n_runs * sizeof(rle16_t);
+            break;
+        default:
+            assert(false);
+            __builtin_unreachable();
+    }
+}
+
+void roaring_bitmap_prefetch(const roaring_bitmap_t *r) {
+    const roaring_array_t *ra = &r->high_low_container;
+#if !defined(_WIN32) && defined(MADV_WILLNEED)
+    if (is_frozen(r) && ra->size > 0) {
+        // a frozen view lives in one arena, often memory-mapped: ask the
+        // OS to fault the whole payload span in ahead of time
+        const char *lo = (const char *)ra->containers;
+        const char *hi = lo;
+        for (int32_t i = 0; i < ra->size; ++i) {
+            const char *start;
+            size_t bytes;
+            container_payload_extent(ra->containers[i], ra->typecodes[i],
+                                     &start, &bytes);
+            if (start < lo) lo = start;
+            if (start + bytes > hi) hi = start + bytes;
+        }
+        const size_t page = 4096;
+        const char *base = (const char *)((uintptr_t)lo & ~(uintptr_t)(page - 1));
+        madvise((void *)base, (size_t)(hi - base), MADV_WILLNEED);
+        return;
+    }
+#endif
+    for (int32_t i = 0; i < ra->size; ++i) {
+        const char *start;
+        size_t bytes;
+        croaring_prefetch(ra->containers[i]);
+        container_payload_extent(ra->containers[i], ra->typecodes[i], &start,
+                                 &bytes);
+        // one touch per page warms the TLB entries; the first lines of the
+        // payload cover the common small containers entirely
+        for (size_t offset = 0; offset < bytes; offset += 4096) {
+            croaring_prefetch(start + offset);
+        }
+    }
+}
+
+double roaring_bitmap_memory_contiguity(const roaring_bitmap_t *r) {
+    const roaring_array_t *ra = &r->high_low_container;
+    if (ra->size < 2) {
+        return 1.0;
+    }
+    const char *prev_start;
+    size_t prev_bytes;
+    container_payload_extent(ra->containers[0], ra->typecodes[0], &prev_start,
+                             &prev_bytes);
+    int32_t adjacent = 0;
+    for (int32_t i = 1; i < ra->size; ++i) {
+        const char *start;
+        size_t bytes;
+        container_payload_extent(ra->containers[i], ra->typecodes[i], &start,
+                                 &bytes);
+        // count a pair as adjacent when the next payload begins within a
+        // page of the previous one's end, in either direction
+        const ptrdiff_t gap = (start >= prev_start + prev_bytes)
+                                  ? start - (prev_start + prev_bytes)
+                                  : (prev_start + prev_bytes) - start;
+        if (gap <= 4096) {
+            adjacent++;
+        }
+        prev_start = start;
+        prev_bytes = bytes;
+    }
+    return (double)adjacent / (double)(ra->size - 1);
+}
+
+bool roaring_bitmap_compact(roaring_bitmap_t *r) {
+    roaring_array_t *ra = &r->high_low_container;
+    if (is_frozen(r) || is_cow(r)) {
+        // a frozen view is already contiguous; under copy-on-write another
+        // bitmap could keep referencing a payload after our arena is gone
+        return false;
+    }
+    // materialize private copies of containers still shared from an earlier
+    // copy-on-write phase
+    for (int32_t i = 0; i < ra->size; ++i) {
+        if (ra->typecodes[i] == SHARED_CONTAINER_TYPE_CODE) {
+            ra_unshare_container_at_index(ra, i);
+        }
+    }
+    // size the arena: payloads are laid out in container order so that a
+    // key-ordered walk streams through the block; bitset payloads are
+    // padded up to 32-byte alignment, run and array payloads only need the
+    // two-byte alignment every payload size already guarantees. The shared
+    // full-run instance and empty shells stay where they are.
+    size_t total = 0;
+    for (int32_t i = 0; i < ra->size; ++i) {
+        switch (ra->typecodes[i]) {
+            case BITSET_CONTAINER_TYPE_CODE:
+                total = (total + 31) & ~(size_t)31;
+                total += BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
+                break;
+            case RUN_CONTAINER_TYPE_CODE: {
+                const run_container_t *c =
+                    (const run_container_t *)ra->containers[i];
+                if (!run_container_is_full_singleton(c)) {
+                    total += c->n_runs * sizeof(rle16_t);
+                }
+                break;
+            }
+            case ARRAY_CONTAINER_TYPE_CODE:
+                total += ((const array_container_t *)ra->containers[i])
+                             ->cardinality * sizeof(uint16_t);
+                break;
+            default:
+                return false;  // cannot happen: everything was unshared
+        }
+    }
+    if (total == 0) {  // nothing to relocate
+        return true;
+    }
+    char *arena = (char *)roaring_aligned_malloc(32, total);
+    if (arena == NULL) {
+        return false;
+    }
+    char *cursor = arena;
+    for (int32_t i = 0; i < ra->size; ++i) {
+        switch (ra->typecodes[i]) {
+            case BITSET_CONTAINER_TYPE_CODE: {
+                bitset_container_t *c =
+                    (bitset_container_t *)ra->containers[i];
+                cursor = arena + (((cursor - arena) + 31) & ~(ptrdiff_t)31);
+                memcpy(cursor, c->array,
+                       BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t));
+                if (!c->borrowed) {
+                    roaring_aligned_free(c->array);
+                }
+                c->array = (uint64_t *)cursor;
+                c->borrowed = 1;
+                cursor += BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
+                break;
+            }
+            case RUN_CONTAINER_TYPE_CODE: {
+                run_container_t *c = (run_container_t *)ra->containers[i];
+                if (run_container_is_full_singleton(c) || c->n_runs == 0) {
+                    break;
+                }
+                memcpy(cursor, c->runs, c->n_runs * sizeof(rle16_t));
+                if (c->capacity >= 0 && c->runs != NULL) {
+                    roaring_free(c->runs);
+                }
+                c->runs = (rle16_t *)cursor;
+                c->capacity = -c->n_runs;
+                cursor += c->n_runs * sizeof(rle16_t);
+                break;
+            }
+            case ARRAY_CONTAINER_TYPE_CODE: {
+                array_container_t *c = (array_container_t *)ra->containers[i];
+                if (c->cardinality == 0) {
+                    break;
+                }
+                memcpy(cursor, c->array, c->cardinality * sizeof(uint16_t));
+                if (c->capacity >= 0 && c->array != NULL) {
+                    roaring_free(c->array);
+                }
+                c->array = (uint16_t *)cursor;
+                c->capacity = -c->cardinality;
+                cursor += c->cardinality * sizeof(uint16_t);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    // old payloads may have been borrowed from a previous arena: replace it
+    // only once nothing points into it anymore
+    if (ra->arena != NULL) {
+        roaring_aligned_free(ra->arena);
+    }
+    ra->arena = arena;
+    return true;
+}
+
 roaring_bitmap_t *roaring_bitmap_copy(const roaring_bitmap_t *r) {
     roaring_bitmap_t *ans =
-        (roaring_bitmap_t *)malloc(sizeof(roaring_bitmap_t));
+        (roaring_bitmap_t *)roaring_malloc(sizeof(roaring_bitmap_t));
     if (!ans) {
         return NULL;
     }
     bool is_ok = ra_copy(&r->high_low_container, &ans->high_low_container,
                          is_cow(r));
     if (!is_ok) {
-        free(ans);
+        roaring_free(ans);
         return NULL;
     }
     roaring_bitmap_set_copy_on_write(ans, is_cow(r));
@@ -396,15 +910,301 @@ bool roaring_bitmap_overwrite(roaring_bitmap_t *dest,
 void roaring_bitmap_free(const roaring_bitmap_t *r) {
     if (!is_frozen(r)) {
       ra_clear((roaring_array_t*)&r->high_low_container);
+    } else {
+      // frozen views share one allocation, but the prefix-cardinality index
+      // (if one was built) and the aligned payload arena (if the view had
+      // to realign bitset payloads) live on the heap
+      ra_invalidate_prefix_index((roaring_array_t*)&r->high_low_container);
+      if (r->high_low_container.arena != NULL) {
+        roaring_aligned_free(r->high_low_container.arena);
+      }
     }
-    free((roaring_bitmap_t*)r);
+    roaring_free((roaring_bitmap_t*)r);
 }
 
 void roaring_bitmap_clear(roaring_bitmap_t *r) {
   ra_reset(&r->high_low_container);
 }
 
+void roaring_bitmap_add_bulk(roaring_bitmap_t *r,
+                             roaring_bulk_context_t *context, uint32_t val) {
+    ra_invalidate_cached_cardinality(&r->high_low_container);
+    uint16_t key = val >> 16;
+    if (context->container == NULL || context->key != key) {
+        uint8_t typecode;
+        int32_t i = ra_get_index(&r->high_low_container, key);
+        void *container;
+        if (i >= 0) {
+            ra_unshare_container_at_index(&r->high_low_container, i);
+            container =
+                ra_get_container_at_index(&r->high_low_container, i, &typecode);
+            uint8_t newtypecode = typecode;
+            void *container2 =
+                container_add(container, val & 0xFFFF, typecode, &newtypecode);
+            if (container2 != container) {
+                container_free(container, typecode);
+                ra_set_container_at_index(&r->high_low_container, i, container2,
+                                          newtypecode);
+            }
+            container = container2;
+            typecode = newtypecode;
+        } else {
+            array_container_t *newac = array_container_create();
+            container = container_add(newac, val & 0xFFFF,
+                                      ARRAY_CONTAINER_TYPE_CODE, &typecode);
+            // we could just assume that it stays an array container
+            ra_insert_new_key_value_at(&r->high_low_container, -i - 1, key,
+                                       container, typecode);
+            i = -i - 1;
+        }
+        context->container = container;
+        context->idx = i;
+        context->key = key;
+        context->typecode = typecode;
+    } else {
+        // no search needed: the high bits match the cached container
+        uint8_t newtypecode = context->typecode;
+        void *container2 = container_add(context->container, val & 0xFFFF,
+                                         context->typecode, &newtypecode);
+        if (container2 != context->container) {
+            // the container type changed (eg array became bitset)
+            container_free(context->container, context->typecode);
+            ra_set_container_at_index(&r->high_low_container, context->idx,
+                                      container2, newtypecode);
+            context->container = container2;
+            context->typecode = newtypecode;
+        }
+    }
+}
+
+bool roaring_bitmap_contains_bulk(const roaring_bitmap_t *r,
+                                  roaring_bulk_context_t *context,
+                                  uint32_t val) {
+    uint16_t key = val >> 16;
+    if (context->container == NULL || context->key != key) {
+        int32_t i = ra_get_index(&r->high_low_container, key);
+        if (i < 0) {
+            // a miss leaves the context untouched: there is nothing to cache
+            return false;
+        }
+        context->container = ra_get_container_at_index(&r->high_low_container,
+                                                       i, &context->typecode);
+        context->idx = i;
+        context->key = key;
+    }
+    return container_contains(context->container, val & 0xFFFF,
+                              context->typecode);
+}
+
+void roaring_bitmap_contains_many(const roaring_bitmap_t *r, size_t n_args,
+                                  const uint32_t *vals, bool *results) {
+    size_t i = 0;
+    while (i < n_args) {
+        // answer every consecutive probe sharing its high 16 bits against
+        // the same container, resolved with a single key search
+        const uint16_t key = (uint16_t)(vals[i] >> 16);
+        size_t run_end = i + 1;
+        while (run_end < n_args && (uint16_t)(vals[run_end] >> 16) == key) {
+            run_end++;
+        }
+        const int32_t idx = ra_get_index(&r->high_low_container, key);
+        if (idx < 0) {
+            for (; i < run_end; i++) {
+                results[i] = false;
+            }
+            continue;
+        }
+        uint8_t typecode;
+        const void *container = ra_get_container_at_index(
+            &r->high_low_container, idx, &typecode);
+        container = container_unwrap_shared(container, &typecode);
+        switch (typecode) {
+            case BITSET_CONTAINER_TYPE_CODE: {
+                const bitset_container_t *bc =
+                    (const bitset_container_t *)container;
+                for (; i < run_end; i++) {
+                    results[i] = bitset_container_get(bc, vals[i] & 0xFFFF);
+                }
+                break;
+            }
+            case ARRAY_CONTAINER_TYPE_CODE: {
+                const array_container_t *ac =
+                    (const array_container_t *)container;
+                uint16_t lows[256];
+                while (i < run_end) {
+                    size_t chunk = run_end - i;
+                    if (chunk > 256) chunk = 256;
+                    for (size_t k = 0; k < chunk; k++) {
+                        lows[k] = (uint16_t)vals[i + k];
+                    }
+                    contains_many_uint16(ac->array, ac->cardinality, lows,
+                                         chunk, results + i);
+                    i += chunk;
+                }
+                break;
+            }
+            default: {
+                for (; i < run_end; i++) {
+                    results[i] =
+                        container_contains(container, vals[i] & 0xFFFF,
+                                           typecode);
+                }
+                break;
+            }
+        }
+    }
+}
+
+size_t roaring_bitmap_and_array(const roaring_bitmap_t *r, size_t n_args,
+                                const uint32_t *sorted_vals, uint32_t *out) {
+    if (n_args == 0) return 0;
+    // one scratch for the low 16 bits of a bucket, one for the kernel output
+    size_t scratch_len = n_args < 65536 ? n_args : 65536;
+    uint16_t *lows =
+        (uint16_t *)roaring_malloc(2 * scratch_len * sizeof(uint16_t));
+    uint16_t *matches = lows + scratch_len;
+    size_t count = 0;
+    size_t i = 0;
+    while (i < n_args) {
+        // bucket the values by their high 16 bits: each bucket intersects
+        // with at most one container
+        const uint16_t key = (uint16_t)(sorted_vals[i] >> 16);
+        size_t run_end = i + 1;
+        while (run_end < n_args &&
+               (uint16_t)(sorted_vals[run_end] >> 16) == key) {
+            run_end++;
+        }
+        const int32_t idx = ra_get_index(&r->high_low_container, key);
+        if (idx < 0) {
+            i = run_end;
+            continue;
+        }
+        uint8_t typecode;
+        const void *container = ra_get_container_at_index(
+            &r->high_low_container, idx, &typecode);
+        container = container_unwrap_shared(container, &typecode);
+        switch (typecode) {
+            case ARRAY_CONTAINER_TYPE_CODE: {
+                const array_container_t *ac =
+                    (const array_container_t *)container;
+                size_t len = 0;  // copy the low bits, dropping duplicates
+                for (size_t k = i; k < run_end; k++) {
+                    const uint16_t low = (uint16_t)sorted_vals[k];
+                    if (len == 0 || lows[len - 1] != low) lows[len++] = low;
+                }
+                const int threshold = 64;  // as in array_container_intersection
+                int32_t n_matches;
+                if ((int64_t)len * threshold < ac->cardinality) {
+                    n_matches = intersect_skewed_uint16(
+                        lows, len, ac->array, ac->cardinality, matches);
+                } else if ((int64_t)ac->cardinality * threshold <
+                           (int64_t)len) {
+                    n_matches = intersect_skewed_uint16(
+                        ac->array, ac->cardinality, lows, len, matches);
+                } else {
+                    n_matches = intersect_uint16(lows, len, ac->array,
+                                                 ac->cardinality, matches);
+                }
+                for (int32_t k = 0; k < n_matches; k++) {
+                    out[count++] = ((uint32_t)key << 16) | matches[k];
+                }
+                i = run_end;
+                break;
+            }
+            case BITSET_CONTAINER_TYPE_CODE: {
+                const bitset_container_t *bc =
+                    (const bitset_container_t *)container;
+                for (; i < run_end; i++) {
+                    if (count > 0 && out[count - 1] == sorted_vals[i]) continue;
+                    if (bitset_container_get(bc, (uint16_t)sorted_vals[i])) {
+                        out[count++] = sorted_vals[i];
+                    }
+                }
+                break;
+            }
+            default: {
+                for (; i < run_end; i++) {
+                    if (count > 0 && out[count - 1] == sorted_vals[i]) continue;
+                    if (container_contains(container, sorted_vals[i] & 0xFFFF,
+                                           typecode)) {
+                        out[count++] = sorted_vals[i];
+                    }
+                }
+                break;
+            }
+        }
+    }
+    roaring_free(lows);
+    return count;
+}
+
+void roaring_bitmap_or_array_inplace(roaring_bitmap_t *r, size_t n_args,
+                                     const uint32_t *sorted_vals) {
+    if (n_args == 0) return;
+    ra_invalidate_cached_cardinality(&r->high_low_container);
+    size_t scratch_len = n_args < 65536 ? n_args : 65536;
+    uint16_t *lows =
+        (uint16_t *)roaring_malloc(scratch_len * sizeof(uint16_t));
+    size_t i = 0;
+    while (i < n_args) {
+        const uint16_t key = (uint16_t)(sorted_vals[i] >> 16);
+        size_t run_end = i + 1;
+        while (run_end < n_args &&
+               (uint16_t)(sorted_vals[run_end] >> 16) == key) {
+            run_end++;
+        }
+        size_t len = 0;  // copy the low bits, dropping duplicates
+        for (size_t k = i; k < run_end; k++) {
+            const uint16_t low = (uint16_t)sorted_vals[k];
+            if (len == 0 || lows[len - 1] != low) lows[len++] = low;
+        }
+        i = run_end;
+        const int32_t idx = ra_get_index(&r->high_low_container, key);
+        if (idx < 0) {
+            void *container;
+            uint8_t typecode;
+            if (len > DEFAULT_MAX_SIZE) {
+                bitset_container_t *bc = bitset_container_create();
+                bitset_set_list(bc->array, lows, len);
+                bc->cardinality = (int32_t)len;
+                container = bc;
+                typecode = BITSET_CONTAINER_TYPE_CODE;
+            } else {
+                array_container_t *ac =
+                    array_container_create_given_capacity((int32_t)len);
+                memcpy(ac->array, lows, len * sizeof(uint16_t));
+                ac->cardinality = (int32_t)len;
+                container = ac;
+                typecode = ARRAY_CONTAINER_TYPE_CODE;
+            }
+            ra_insert_new_key_value_at(&r->high_low_container, -idx - 1, key,
+                                       container, typecode);
+            continue;
+        }
+        uint8_t typecode;
+        void *c1 =
+            ra_get_container_at_index(&r->high_low_container, idx, &typecode);
+        if (container_is_full(c1, typecode)) continue;
+        c1 = get_writable_copy_if_shared(c1, &typecode);
+        // present the bucket as a borrowed array container so that the
+        // regular union kernels apply, without building a bitmap operand
+        array_container_t bucket;
+        bucket.cardinality = (int32_t)len;
+        bucket.capacity = (int32_t)len;
+        bucket.array = lows;
+        uint8_t result_type = 0;
+        void *c = container_ior(c1, typecode, &bucket,
+                                ARRAY_CONTAINER_TYPE_CODE, &result_type);
+        if (c != c1) {
+            container_free(c1, typecode);
+        }
+        ra_set_container_at_index(&r->high_low_container, idx, c, result_type);
+    }
+    roaring_free(lows);
+}
+
 void roaring_bitmap_add(roaring_bitmap_t *r, uint32_t val) {
+    ra_invalidate_cached_cardinality(&r->high_low_container);
     const uint16_t hb = val >> 16;
     const int i = ra_get_index(&r->high_low_container, hb);
     uint8_t typecode;
@@ -467,10 +1267,20 @@ bool roaring_bitmap_add_checked(roaring_bitmap_t *r, uint32_t val) {
         result = true;
     }
 
+    // we know the delta, so the cached cardinality can be kept in sync; the
+    // prefix index and the cached hash cannot and go stale
+    if (result) {
+        ra_invalidate_prefix_index(&r->high_low_container);
+        r->high_low_container.flags &= ~ROARING_FLAG_HASH_VALID;
+        if (r->high_low_container.flags & ROARING_FLAG_CARD_VALID) {
+            r->high_low_container.cached_cardinality++;
+        }
+    }
     return result;
 }
 
 void roaring_bitmap_remove(roaring_bitmap_t *r, uint32_t val) {
+    ra_invalidate_cached_cardinality(&r->high_low_container);
     const uint16_t hb = val >> 16;
     const int i = ra_get_index(&r->high_low_container, hb);
     uint8_t typecode;
@@ -529,77 +1339,112 @@ bool roaring_bitmap_remove_checked(roaring_bitmap_t *r, uint32_t val) {
 
         result = oldCardinality != newCardinality;
     }
+    // we know the delta, so the cached cardinality can be kept in sync; the
+    // prefix index and the cached hash cannot and go stale
+    if (result) {
+        ra_invalidate_prefix_index(&r->high_low_container);
+        r->high_low_container.flags &= ~ROARING_FLAG_HASH_VALID;
+        if (r->high_low_container.flags & ROARING_FLAG_CARD_VALID) {
+            r->high_low_container.cached_cardinality--;
+        }
+    }
     return result;
 }
 
+void roaring_bitmap_remove_bulk(roaring_bitmap_t *r,
+                                roaring_bulk_context_t *context,
+                                uint32_t val) {
+    ra_invalidate_cached_cardinality(&r->high_low_container);
+    uint16_t key = val >> 16;
+    if (context->container == NULL || context->key != key) {
+        int32_t i = ra_get_index(&r->high_low_container, key);
+        if (i < 0) {
+            // a miss leaves the context untouched: there is nothing to cache
+            return;
+        }
+        ra_unshare_container_at_index(&r->high_low_container, i);
+        uint8_t typecode;
+        void *container =
+            ra_get_container_at_index(&r->high_low_container, i, &typecode);
+        context->container = container;
+        context->idx = i;
+        context->key = key;
+        context->typecode = typecode;
+    }
+    // no search needed: the high bits match the cached container
+    uint8_t newtypecode = context->typecode;
+    void *container2 = container_remove(context->container, val & 0xFFFF,
+                                        context->typecode, &newtypecode);
+    if (container2 != context->container) {
+        // the container type changed (eg bitset became array)
+        container_free(context->container, context->typecode);
+        ra_set_container_at_index(&r->high_low_container, context->idx,
+                                  container2, newtypecode);
+        context->container = container2;
+        context->typecode = newtypecode;
+    }
+    if (!container_nonzero_cardinality(container2, newtypecode)) {
+        container_free(container2, newtypecode);
+        ra_remove_at_index(&r->high_low_container, context->idx);
+        context->container = NULL;  // force a fresh search, indices shifted
+    }
+}
+
 void roaring_bitmap_remove_many(roaring_bitmap_t *r, size_t n_args,
                                 const uint32_t *vals) {
     if (n_args == 0 || r->high_low_container.size == 0) {
         return;
     }
-    int32_t pos = -1; // position of the container used in the previous iteration
+    roaring_bulk_context_t context = {0};
     for (size_t i = 0; i < n_args; i++) {
-        uint16_t key = (uint16_t)(vals[i] >> 16);
-        if (pos < 0 || key != r->high_low_container.keys[pos]) {
-            pos = ra_get_index(&r->high_low_container, key);
-        }
-        if (pos >= 0) {
-            uint8_t new_typecode;
-            void *new_container;
-            new_container = container_remove(r->high_low_container.containers[pos],
-                                             vals[i] & 0xffff,
-                                             r->high_low_container.typecodes[pos],
-                                             &new_typecode);
-            if (new_container != r->high_low_container.containers[pos]) {
-                container_free(r->high_low_container.containers[pos],
-                               r->high_low_container.typecodes[pos]);
-                ra_replace_key_and_container_at_index(&r->high_low_container,
-                                                      pos, key, new_container,
-                                                      new_typecode);
-            }
-            if (!container_nonzero_cardinality(new_container, new_typecode)) {
-                container_free(new_container, new_typecode);
-                ra_remove_at_index(&r->high_low_container, pos);
-                pos = -1;
-            }
-        }
+        roaring_bitmap_remove_bulk(r, &context, vals[i]);
     }
 }
 
-// there should be some SIMD optimizations possible here
-roaring_bitmap_t *roaring_bitmap_and(const roaring_bitmap_t *x1,
-                                     const roaring_bitmap_t *x2) {
-    uint8_t container_result_type = 0;
+// true when every container is a plain bitset (no shared wrappers): one
+// scan of the typecodes lets the binary operations below run monomorphic
+// loops that skip the per-pair dispatch switch and shared unwrapping
+static bool ra_all_bitsets(const roaring_array_t *ra) {
+    for (int32_t i = 0; i < ra->size; i++) {
+        if (ra->typecodes[i] != BITSET_CONTAINER_TYPE_CODE) return false;
+    }
+    return true;
+}
+
+// monomorphic intersection for the common aggregation case where both
+// operands consist entirely of bitset containers
+static roaring_bitmap_t *roaring_bitmap_and_bitsets(
+    const roaring_bitmap_t *x1, const roaring_bitmap_t *x2) {
     const int length1 = x1->high_low_container.size,
               length2 = x2->high_low_container.size;
     uint32_t neededcap = length1 > length2 ? length2 : length1;
     roaring_bitmap_t *answer = roaring_bitmap_create_with_capacity(neededcap);
     roaring_bitmap_set_copy_on_write(answer, is_cow(x1) && is_cow(x2));
-
     int pos1 = 0, pos2 = 0;
-
     while (pos1 < length1 && pos2 < length2) {
-        const uint16_t s1 = ra_get_key_at_index(&x1->high_low_container, pos1);
-        const uint16_t s2 = ra_get_key_at_index(&x2->high_low_container, pos2);
-
+        const uint16_t s1 = x1->high_low_container.keys[pos1];
+        const uint16_t s2 = x2->high_low_container.keys[pos2];
         if (s1 == s2) {
-            uint8_t container_type_1, container_type_2;
-            void *c1 = ra_get_container_at_index(&x1->high_low_container, pos1,
-                                                 &container_type_1);
-            void *c2 = ra_get_container_at_index(&x2->high_low_container, pos2,
-                                                 &container_type_2);
-            void *c = container_and(c1, container_type_1, c2, container_type_2,
-                                    &container_result_type);
-            if (container_nonzero_cardinality(c, container_result_type)) {
-                ra_append(&answer->high_low_container, s1, c,
-                          container_result_type);
+            const bitset_container_t *c1 =
+                (const bitset_container_t *)
+                    x1->high_low_container.containers[pos1];
+            const bitset_container_t *c2 =
+                (const bitset_container_t *)
+                    x2->high_low_container.containers[pos2];
+            void *c = NULL;
+            // converts to an array container below the threshold
+            const uint8_t result_type =
+                bitset_bitset_container_intersection(c1, c2, &c)
+                    ? BITSET_CONTAINER_TYPE_CODE
+                    : ARRAY_CONTAINER_TYPE_CODE;
+            if (container_nonzero_cardinality(c, result_type)) {
+                ra_append(&answer->high_low_container, s1, c, result_type);
             } else {
-                container_free(
-                    c, container_result_type);  // otherwise:memory leak!
+                container_free(c, result_type);
             }
             ++pos1;
             ++pos2;
-        } else if (s1 < s2) {  // s1 < s2
+        } else if (s1 < s2) {
             pos1 = ra_advance_until(&x1->high_low_container, s2, pos1);
         } else {  // s1 > s2
             pos2 = ra_advance_until(&x2->high_low_container, s1, pos2);
@@ -608,6 +1453,411 @@ roaring_bitmap_t *roaring_bitmap_and(const roaring_bitmap_t *x1,
     return answer;
 }
 
+// there should be some SIMD optimizations possible here
+roaring_bitmap_t *roaring_bitmap_and(const roaring_bitmap_t *x1,
+                                     const roaring_bitmap_t *x2) {
+    if (ra_all_bitsets(&x1->high_low_container) &&
+        ra_all_bitsets(&x2->high_low_container)) {
+        return roaring_bitmap_and_bitsets(x1, x2);
+    }
+    uint8_t container_result_type = 0;
+    const int length1 = x1->high_low_container.size,
+              length2 = x2->high_low_container.size;
+    uint32_t neededcap = length1 > length2 ? length2 : length1;
+    roaring_bitmap_t *answer = roaring_bitmap_create_with_capacity(neededcap);
+    roaring_bitmap_set_copy_on_write(answer, is_cow(x1) && is_cow(x2));
+
+    // selective-filter case: when one side has vastly fewer containers,
+    // walk its keys and gallop through the other side only, mirroring
+    // the intersect_skewed_uint16 strategy used inside array containers
+    const int threshold = 64;  // subject to tuning
+    if (length1 * threshold < length2 || length2 * threshold < length1) {
+        const roaring_array_t *small = (length1 < length2)
+                                           ? &x1->high_low_container
+                                           : &x2->high_low_container;
+        const roaring_array_t *big = (length1 < length2)
+                                         ? &x2->high_low_container
+                                         : &x1->high_low_container;
+        int pos_big = 0;
+        for (int i = 0; i < small->size; ++i) {
+            const uint16_t s = small->keys[i];
+            pos_big = ra_advance_until(big, s, pos_big - 1);
+            if (pos_big == big->size) break;
+            if (big->keys[pos_big] != s) continue;
+            void *c = container_and(small->containers[i], small->typecodes[i],
+                                    big->containers[pos_big],
+                                    big->typecodes[pos_big],
+                                    &container_result_type);
+            if (container_nonzero_cardinality(c, container_result_type)) {
+                ra_append(&answer->high_low_container, s, c,
+                          container_result_type);
+            } else {
+                container_free(c, container_result_type);
+            }
+            ++pos_big;
+        }
+        return answer;
+    }
+
+    int pos1 = 0, pos2 = 0;
+
+    while (pos1 < length1 && pos2 < length2) {
+        const uint16_t s1 = ra_get_key_at_index(&x1->high_low_container, pos1);
+        const uint16_t s2 = ra_get_key_at_index(&x2->high_low_container, pos2);
+
+        if (s1 == s2) {
+            uint8_t container_type_1, container_type_2;
+            void *c1 = ra_get_container_at_index(&x1->high_low_container, pos1,
+                                                 &container_type_1);
+            void *c2 = ra_get_container_at_index(&x2->high_low_container, pos2,
+                                                 &container_type_2);
+            void *c = container_and(c1, container_type_1, c2, container_type_2,
+                                    &container_result_type);
+            if (container_nonzero_cardinality(c, container_result_type)) {
+                ra_append(&answer->high_low_container, s1, c,
+                          container_result_type);
+            } else {
+                container_free(
+                    c, container_result_type);  // otherwise:memory leak!
+            }
+            ++pos1;
+            ++pos2;
+        } else if (s1 < s2) {  // s1 < s2
+            pos1 = ra_advance_until(&x1->high_low_container, s2, pos1);
+        } else {  // s1 > s2
+            pos2 = ra_advance_until(&x2->high_low_container, s1, pos2);
+        }
+    }
+    return answer;
+}
+
+// ---- result reuse ('_into' variants) ---------------------------------
+//
+// The _into operations recycle a caller-owned result bitmap: the
+// roaring_array_t keeps its capacity and the old containers are consumed,
+// in key order, as write targets for the new result. At most one candidate
+// container is outstanding at a time, and a candidate is taken before each
+// slot is written, so the emission at slot j never clobbers an old
+// container that has not been consumed yet.
+
+// turns the candidate into an array container with at least mincap
+// capacity, allocating only when the candidate cannot be reshaped. The
+// vectorized intersection kernels store a full vector past the match
+// count, so the buffer carries the same slack array_container_intersection
+// reserves when it grows the target itself (see src/containers/array.c)
+static array_container_t *into_array_target(void **candidate,
+                                            uint8_t *candidate_type,
+                                            int32_t mincap) {
+#if defined(USEAVX)
+    mincap += (int32_t)(sizeof(__m128i) / sizeof(uint16_t));
+#elif defined(USENEON) && defined(__aarch64__)
+    mincap += (int32_t)(sizeof(uint16x8_t) / sizeof(uint16_t));
+#endif
+    if (*candidate != NULL && *candidate_type == ARRAY_CONTAINER_TYPE_CODE) {
+        array_container_t *arr = (array_container_t *)*candidate;
+        if (arr->capacity < mincap) {
+            array_container_grow(arr, mincap, false);
+        }
+        return arr;
+    }
+    if (*candidate != NULL) {
+        container_free(*candidate, *candidate_type);
+    }
+    array_container_t *arr = array_container_create_given_capacity(mincap);
+    *candidate = arr;
+    *candidate_type = ARRAY_CONTAINER_TYPE_CODE;
+    return arr;
+}
+
+static bitset_container_t *into_bitset_target(void **candidate,
+                                              uint8_t *candidate_type) {
+    if (*candidate != NULL && *candidate_type == BITSET_CONTAINER_TYPE_CODE) {
+        return (bitset_container_t *)*candidate;
+    }
+    if (*candidate != NULL) {
+        container_free(*candidate, *candidate_type);
+    }
+    bitset_container_t *bitset = bitset_container_create();
+    *candidate = bitset;
+    *candidate_type = BITSET_CONTAINER_TYPE_CODE;
+    return bitset;
+}
+
+// copies (c, type) into the candidate's storage where the layout allows
+static void *copy_into_candidate(const void *c, uint8_t type, void **candidate,
+                                 uint8_t *candidate_type,
+                                 uint8_t *result_type) {
+    if (*candidate != NULL) {
+        void *res = container_overwrite(*candidate, *candidate_type, c, type,
+                                        result_type);
+        *candidate = NULL;
+        return res;
+    }
+    c = container_unwrap_shared((void *)c, &type);
+    *result_type = type;
+    return container_clone(c, type);
+}
+
+// intersects (c1, type1) with (c2, type2), writing into the candidate's
+// storage where its layout allows. Returns the result container (consuming
+// the candidate) with its typecode in *result_type, or NULL when the
+// intersection is empty, in which case the candidate is kept for the next
+// pair.
+static void *and_into_container(const void *c1, uint8_t type1, const void *c2,
+                                uint8_t type2, void **candidate,
+                                uint8_t *candidate_type,
+                                uint8_t *result_type) {
+    c1 = container_unwrap_shared((void *)c1, &type1);
+    c2 = container_unwrap_shared((void *)c2, &type2);
+    // order the pair so that an array operand, if any, comes first
+    if (type2 == ARRAY_CONTAINER_TYPE_CODE &&
+        type1 != ARRAY_CONTAINER_TYPE_CODE) {
+        const void *tmp = c1;
+        c1 = c2;
+        c2 = tmp;
+        const uint8_t tmptype = type1;
+        type1 = type2;
+        type2 = tmptype;
+    }
+    if (type1 == BITSET_CONTAINER_TYPE_CODE &&
+        type2 == BITSET_CONTAINER_TYPE_CODE) {
+        const bitset_container_t *b1 = (const bitset_container_t *)c1;
+        const bitset_container_t *b2 = (const bitset_container_t *)c2;
+        const int32_t card = bitset_container_and_justcard(b1, b2);
+        if (card == 0) return NULL;
+        if (card > DEFAULT_MAX_SIZE) {
+            bitset_container_t *dst =
+                into_bitset_target(candidate, candidate_type);
+            bitset_container_and_nocard(b1, b2, dst);
+            dst->cardinality = card;
+            *result_type = BITSET_CONTAINER_TYPE_CODE;
+        } else {
+            array_container_t *dst =
+                into_array_target(candidate, candidate_type, card);
+            dst->cardinality = (int32_t)bitset_extract_intersection_setbits_uint16(
+                b1->array, b2->array, BITSET_CONTAINER_SIZE_IN_WORDS,
+                dst->array, 0);
+            *result_type = ARRAY_CONTAINER_TYPE_CODE;
+        }
+    } else if (type1 == ARRAY_CONTAINER_TYPE_CODE &&
+               type2 == ARRAY_CONTAINER_TYPE_CODE) {
+        const array_container_t *a1 = (const array_container_t *)c1;
+        const array_container_t *a2 = (const array_container_t *)c2;
+        const int32_t mincap = a1->cardinality < a2->cardinality
+                                   ? a1->cardinality
+                                   : a2->cardinality;
+        array_container_t *dst =
+            into_array_target(candidate, candidate_type, mincap);
+        array_container_intersection(a1, a2, dst);
+        if (dst->cardinality == 0) return NULL;
+        *result_type = ARRAY_CONTAINER_TYPE_CODE;
+    } else if (type1 == ARRAY_CONTAINER_TYPE_CODE &&
+               type2 == BITSET_CONTAINER_TYPE_CODE) {
+        const array_container_t *a1 = (const array_container_t *)c1;
+        array_container_t *dst =
+            into_array_target(candidate, candidate_type, a1->cardinality);
+        array_bitset_container_intersection(a1, (const bitset_container_t *)c2,
+                                            dst);
+        if (dst->cardinality == 0) return NULL;
+        *result_type = ARRAY_CONTAINER_TYPE_CODE;
+    } else {
+        // a run container is involved: no in-place kernel covers every
+        // possible result layout, so fall back to the allocating path
+        uint8_t t;
+        void *c = container_and((void *)c1, type1, (void *)c2, type2, &t);
+        if (!container_nonzero_cardinality(c, t)) {
+            container_free(c, t);
+            return NULL;
+        }
+        if (*candidate != NULL) {
+            container_free(*candidate, *candidate_type);
+            *candidate = NULL;
+        }
+        *result_type = t;
+        return c;
+    }
+    void *c = *candidate;
+    *candidate = NULL;
+    return c;
+}
+
+// unites (c1, type1) with (c2, type2): matched bitset pairs or into the
+// candidate's storage, anything else takes the allocating path
+static void *or_into_container(const void *c1, uint8_t type1, const void *c2,
+                               uint8_t type2, void **candidate,
+                               uint8_t *candidate_type, uint8_t *result_type) {
+    c1 = container_unwrap_shared((void *)c1, &type1);
+    c2 = container_unwrap_shared((void *)c2, &type2);
+    if (type1 == BITSET_CONTAINER_TYPE_CODE &&
+        type2 == BITSET_CONTAINER_TYPE_CODE) {
+        bitset_container_t *dst = into_bitset_target(candidate, candidate_type);
+        bitset_container_or((const bitset_container_t *)c1,
+                            (const bitset_container_t *)c2, dst);
+        *candidate = NULL;
+        *result_type = BITSET_CONTAINER_TYPE_CODE;
+        return dst;
+    }
+    if (type1 == ARRAY_CONTAINER_TYPE_CODE &&
+        type2 == ARRAY_CONTAINER_TYPE_CODE) {
+        const array_container_t *a1 = (const array_container_t *)c1;
+        const array_container_t *a2 = (const array_container_t *)c2;
+        const int32_t sum = a1->cardinality + a2->cardinality;
+        if (sum <= DEFAULT_MAX_SIZE) {  // the union cannot outgrow an array
+            array_container_t *dst =
+                into_array_target(candidate, candidate_type, sum);
+            array_container_union(a1, a2, dst);
+            *candidate = NULL;
+            *result_type = ARRAY_CONTAINER_TYPE_CODE;
+            return dst;
+        }
+    }
+    uint8_t t;
+    void *c = container_or((void *)c1, type1, (void *)c2, type2, &t);
+    if (*candidate != NULL) {
+        container_free(*candidate, *candidate_type);
+        *candidate = NULL;
+    }
+    *result_type = t;
+    return c;
+}
+
+bool roaring_bitmap_and_into(roaring_bitmap_t *result,
+                             const roaring_bitmap_t *x1,
+                             const roaring_bitmap_t *x2) {
+    assert(result != x1 && result != x2);
+    roaring_array_t *ra = &result->high_low_container;
+    const int length1 = x1->high_low_container.size,
+              length2 = x2->high_low_container.size;
+    const int32_t needed = length1 > length2 ? length2 : length1;
+    if (ra->allocation_size < needed &&
+        !extend_array(ra, needed - ra->size)) {
+        return false;
+    }
+    const int32_t old_size = ra->size;
+    int32_t j = 0;     // result slots written
+    int32_t take = 0;  // old containers consumed as candidates
+    void *candidate = NULL;
+    uint8_t candidate_type = 0;
+    int pos1 = 0, pos2 = 0;
+    while (pos1 < length1 && pos2 < length2) {
+        const uint16_t s1 = ra_get_key_at_index(&x1->high_low_container, pos1);
+        const uint16_t s2 = ra_get_key_at_index(&x2->high_low_container, pos2);
+        if (s1 == s2) {
+            if (candidate == NULL && take < old_size) {
+                candidate = ra->containers[take];
+                candidate_type = ra->typecodes[take];
+                take++;
+            }
+            uint8_t type1, type2, result_type;
+            void *c1 = ra_get_container_at_index(&x1->high_low_container, pos1,
+                                                 &type1);
+            void *c2 = ra_get_container_at_index(&x2->high_low_container, pos2,
+                                                 &type2);
+            void *c = and_into_container(c1, type1, c2, type2, &candidate,
+                                         &candidate_type, &result_type);
+            if (c != NULL) {
+                ra->keys[j] = s1;
+                ra->containers[j] = c;
+                ra->typecodes[j] = result_type;
+                j++;
+            }
+            ++pos1;
+            ++pos2;
+        } else if (s1 < s2) {
+            pos1 = ra_advance_until(&x1->high_low_container, s2, pos1);
+        } else {  // s1 > s2
+            pos2 = ra_advance_until(&x2->high_low_container, s1, pos2);
+        }
+    }
+    if (candidate != NULL) {
+        container_free(candidate, candidate_type);
+    }
+    for (int32_t i = take; i < old_size; i++) {
+        container_free(ra->containers[i], ra->typecodes[i]);
+    }
+    ra->size = j;
+    ra_invalidate_prefix_index(ra);
+    ra->flags &= ~(ROARING_FLAG_CARD_VALID | ROARING_FLAG_HASH_VALID);
+    return true;
+}
+
+bool roaring_bitmap_or_into(roaring_bitmap_t *result,
+                            const roaring_bitmap_t *x1,
+                            const roaring_bitmap_t *x2) {
+    assert(result != x1 && result != x2);
+    roaring_array_t *ra = &result->high_low_container;
+    const int length1 = x1->high_low_container.size,
+              length2 = x2->high_low_container.size;
+    const int32_t needed = length1 + length2;
+    if (ra->allocation_size < needed &&
+        !extend_array(ra, needed - ra->size)) {
+        return false;
+    }
+    const int32_t old_size = ra->size;
+    int32_t j = 0;
+    int32_t take = 0;
+    void *candidate = NULL;
+    uint8_t candidate_type = 0;
+    int pos1 = 0, pos2 = 0;
+    while (pos1 < length1 || pos2 < length2) {
+        if (candidate == NULL && take < old_size) {
+            candidate = ra->containers[take];
+            candidate_type = ra->typecodes[take];
+            take++;
+        }
+        uint16_t key;
+        uint8_t type1, type2, result_type;
+        void *c;
+        const uint16_t s1 =
+            (pos1 < length1)
+                ? ra_get_key_at_index(&x1->high_low_container, pos1)
+                : 0;
+        const uint16_t s2 =
+            (pos2 < length2)
+                ? ra_get_key_at_index(&x2->high_low_container, pos2)
+                : 0;
+        if (pos2 == length2 || (pos1 < length1 && s1 < s2)) {
+            void *c1 = ra_get_container_at_index(&x1->high_low_container, pos1,
+                                                 &type1);
+            c = copy_into_candidate(c1, type1, &candidate, &candidate_type,
+                                    &result_type);
+            key = s1;
+            ++pos1;
+        } else if (pos1 == length1 || s1 > s2) {
+            void *c2 = ra_get_container_at_index(&x2->high_low_container, pos2,
+                                                 &type2);
+            c = copy_into_candidate(c2, type2, &candidate, &candidate_type,
+                                    &result_type);
+            key = s2;
+            ++pos2;
+        } else {  // s1 == s2
+            void *c1 = ra_get_container_at_index(&x1->high_low_container, pos1,
+                                                 &type1);
+            void *c2 = ra_get_container_at_index(&x2->high_low_container, pos2,
+                                                 &type2);
+            c = or_into_container(c1, type1, c2, type2, &candidate,
+                                  &candidate_type, &result_type);
+            key = s1;
+            ++pos1;
+            ++pos2;
+        }
+        ra->keys[j] = key;
+        ra->containers[j] = c;
+        ra->typecodes[j] = result_type;
+        j++;
+    }
+    if (candidate != NULL) {
+        container_free(candidate, candidate_type);
+    }
+    for (int32_t i = take; i < old_size; i++) {
+        container_free(ra->containers[i], ra->typecodes[i]);
+    }
+    ra->size = j;
+    ra_invalidate_prefix_index(ra);
+    ra->flags &= ~(ROARING_FLAG_CARD_VALID | ROARING_FLAG_HASH_VALID);
+    return true;
+}
+
 /**
  * Compute the union of 'number' bitmaps.
  */
@@ -619,12 +1869,20 @@ roaring_bitmap_t *roaring_bitmap_or_many(size_t number,
     if (number == 1) {
         return roaring_bitmap_copy(x[0]);
     }
+    const bool bitsetconversion =
+        roaring_runtime_tuning.lazy_or_bitset_conversion;
+    // the lazy loop churns through promotion bitsets: recycle their shells
+    // through the per-thread pool for the length of the fold, unless the
+    // caller already configured a pool
+    const bool scratch_pool = (roaring_container_pool_capacity() == 0);
+    if (scratch_pool) roaring_container_pool_set_capacity(8);
     roaring_bitmap_t *answer =
-        roaring_bitmap_lazy_or(x[0], x[1], LAZY_OR_BITSET_CONVERSION);
+        roaring_bitmap_lazy_or(x[0], x[1], bitsetconversion);
     for (size_t i = 2; i < number; i++) {
-        roaring_bitmap_lazy_or_inplace(answer, x[i], LAZY_OR_BITSET_CONVERSION);
+        roaring_bitmap_lazy_or_inplace(answer, x[i], bitsetconversion);
     }
     roaring_bitmap_repair_after_lazy(answer);
+    if (scratch_pool) roaring_container_pool_set_capacity(0);
     return answer;
 }
 
@@ -639,17 +1897,296 @@ roaring_bitmap_t *roaring_bitmap_xor_many(size_t number,
     if (number == 1) {
         return roaring_bitmap_copy(x[0]);
     }
+    // same scratch-pool arrangement as roaring_bitmap_or_many
+    const bool scratch_pool = (roaring_container_pool_capacity() == 0);
+    if (scratch_pool) roaring_container_pool_set_capacity(8);
     roaring_bitmap_t *answer = roaring_bitmap_lazy_xor(x[0], x[1]);
     for (size_t i = 2; i < number; i++) {
         roaring_bitmap_lazy_xor_inplace(answer, x[i]);
     }
     roaring_bitmap_repair_after_lazy(answer);
+    if (scratch_pool) roaring_container_pool_set_capacity(0);
+    return answer;
+}
+
+// used by roaring_bitmap_and_many to order the inputs smallest-first
+typedef struct and_many_input_s {
+    uint64_t size;
+    const roaring_bitmap_t *bitmap;
+} and_many_input_t;
+
+static int and_many_input_compare(const void *e1, const void *e2) {
+    const and_many_input_t *i1 = (const and_many_input_t *)e1;
+    const and_many_input_t *i2 = (const and_many_input_t *)e2;
+    return (i1->size > i2->size) - (i1->size < i2->size);
+}
+
+/**
+ * Compute the intersection of 'number' bitmaps, smallest inputs first so
+ * that the working set shrinks as quickly as possible.
+ */
+roaring_bitmap_t *roaring_bitmap_and_many(size_t number,
+                                          const roaring_bitmap_t **x) {
+    if (number == 0) {
+        return roaring_bitmap_create();
+    }
+    if (number == 1) {
+        return roaring_bitmap_copy(x[0]);
+    }
+    and_many_input_t *inputs =
+        (and_many_input_t *)roaring_malloc(number * sizeof(and_many_input_t));
+    if (inputs == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < number; i++) {
+        inputs[i].size = roaring_bitmap_portable_size_in_bytes(x[i]);
+        inputs[i].bitmap = x[i];
+    }
+    qsort(inputs, number, sizeof(and_many_input_t), and_many_input_compare);
+    roaring_bitmap_t *answer =
+        roaring_bitmap_and(inputs[0].bitmap, inputs[1].bitmap);
+    for (size_t i = 2; i < number; i++) {
+        if (answer->high_low_container.size == 0) {
+            break;  // the intersection cannot grow back
+        }
+        roaring_bitmap_and_inplace(answer, inputs[i].bitmap);
+    }
+    roaring_free(inputs);
+    return answer;
+}
+
+struct roaring_expression_s {
+    roaring_expression_op_t op;
+    const roaring_bitmap_t *bitmap;  // leaves only, not owned
+    roaring_expression_t *left;      // owned
+    roaring_expression_t *right;     // owned
+};
+
+roaring_expression_t *roaring_expression_input(const roaring_bitmap_t *bm) {
+    if (bm == NULL) {
+        return NULL;
+    }
+    roaring_expression_t *node =
+        (roaring_expression_t *)roaring_malloc(sizeof(roaring_expression_t));
+    if (node == NULL) {
+        return NULL;
+    }
+    node->op = ROARING_EXPR_INPUT;
+    node->bitmap = bm;
+    node->left = NULL;
+    node->right = NULL;
+    return node;
+}
+
+roaring_expression_t *roaring_expression_operation(roaring_expression_op_t op,
+                                                   roaring_expression_t *left,
+                                                   roaring_expression_t *right) {
+    roaring_expression_t *node = NULL;
+    if (left != NULL && right != NULL && op != ROARING_EXPR_INPUT) {
+        node = (roaring_expression_t *)roaring_malloc(
+            sizeof(roaring_expression_t));
+    }
+    if (node == NULL) {
+        // so that a failure deep inside a nested construction does not leak
+        roaring_expression_free(left);
+        roaring_expression_free(right);
+        return NULL;
+    }
+    node->op = op;
+    node->bitmap = NULL;
+    node->left = left;
+    node->right = right;
+    return node;
+}
+
+void roaring_expression_free(roaring_expression_t *expr) {
+    if (expr == NULL) {
+        return;
+    }
+    roaring_expression_free(expr->left);
+    roaring_expression_free(expr->right);
+    roaring_free(expr);
+}
+
+// number of 64-bit words needed for one bit per 16-bit key
+#define EXPRESSION_KEY_WORDS (MAX_CONTAINERS / 64)
+
+/**
+ * Compute the set of keys where the expression may produce a nonempty
+ * container, as a 65536-bit scratch bitset: intersecting narrows the support
+ * to the common keys, or/xor widen it to the union and andnot keeps the
+ * left-hand support. Keys outside this set need not be visited at all.
+ * Returns false if a scratch allocation failed.
+ */
+static bool expression_key_support(const roaring_expression_t *e,
+                                   uint64_t *out) {
+    if (e->op == ROARING_EXPR_INPUT) {
+        const roaring_array_t *ra = &e->bitmap->high_low_container;
+        memset(out, 0, EXPRESSION_KEY_WORDS * sizeof(uint64_t));
+        for (int32_t i = 0; i < ra->size; i++) {
+            out[ra->keys[i] >> 6] |= UINT64_C(1) << (ra->keys[i] & 63);
+        }
+        return true;
+    }
+    if (!expression_key_support(e->left, out)) {
+        return false;
+    }
+    if (e->op == ROARING_EXPR_ANDNOT) {
+        return true;  // the right-hand side can only remove values
+    }
+    uint64_t *scratch = (uint64_t *)roaring_malloc(EXPRESSION_KEY_WORDS *
+                                                   sizeof(uint64_t));
+    if (scratch == NULL) {
+        return false;
+    }
+    bool ok = expression_key_support(e->right, scratch);
+    if (ok) {
+        if (e->op == ROARING_EXPR_AND) {
+            for (int i = 0; i < EXPRESSION_KEY_WORDS; i++) out[i] &= scratch[i];
+        } else {  // or, xor
+            for (int i = 0; i < EXPRESSION_KEY_WORDS; i++) out[i] |= scratch[i];
+        }
+    }
+    roaring_free(scratch);
+    return ok;
+}
+
+/**
+ * Evaluate the expression for a single 16-bit key. Returns the resulting
+ * container (possibly empty) and its typecode, or NULL when the result is
+ * known to be empty. Leaf containers are returned as borrowed pointers
+ * (*owned == false); combined containers are freshly allocated.
+ */
+static void *expression_evaluate_at(const roaring_expression_t *e, uint16_t key,
+                                    uint8_t *type, bool *owned) {
+    if (e->op == ROARING_EXPR_INPUT) {
+        *owned = false;
+        int32_t i = ra_get_index(&e->bitmap->high_low_container, key);
+        if (i < 0) {
+            return NULL;
+        }
+        return ra_get_container_at_index(&e->bitmap->high_low_container, i,
+                                         type);
+    }
+    uint8_t left_type = 0, right_type = 0;
+    bool left_owned = false, right_owned = false;
+    void *left = expression_evaluate_at(e->left, key, &left_type, &left_owned);
+    void *right =
+        expression_evaluate_at(e->right, key, &right_type, &right_owned);
+    void *result = NULL;
+    switch (e->op) {
+        case ROARING_EXPR_AND:
+            if (left != NULL && right != NULL) {
+                result = container_and(left, left_type, right, right_type,
+                                       type);
+                *owned = true;
+            }
+            break;
+        case ROARING_EXPR_OR:
+        case ROARING_EXPR_XOR:
+            if (left == NULL) {  // pass the other side through unchanged
+                result = right;
+                *type = right_type;
+                *owned = right_owned;
+                right = NULL;
+            } else if (right == NULL) {
+                result = left;
+                *type = left_type;
+                *owned = left_owned;
+                left = NULL;
+            } else if (e->op == ROARING_EXPR_OR) {
+                result = container_or(left, left_type, right, right_type,
+                                      type);
+                *owned = true;
+            } else {
+                result = container_xor(left, left_type, right, right_type,
+                                       type);
+                *owned = true;
+            }
+            break;
+        case ROARING_EXPR_ANDNOT:
+            if (left != NULL) {
+                if (right == NULL) {
+                    result = left;
+                    *type = left_type;
+                    *owned = left_owned;
+                    left = NULL;
+                } else {
+                    result = container_andnot(left, left_type, right,
+                                              right_type, type);
+                    *owned = true;
+                }
+            }
+            break;
+        default:
+            assert(false);
+            __builtin_unreachable();
+    }
+    // temporaries from the subexpressions are dead as soon as they have
+    // been combined
+    if (left_owned && left != NULL) {
+        container_free(left, left_type);
+    }
+    if (right_owned && right != NULL) {
+        container_free(right, right_type);
+    }
+    return result;
+}
+
+roaring_bitmap_t *roaring_expression_evaluate(const roaring_expression_t *expr) {
+    if (expr == NULL) {
+        return NULL;
+    }
+    roaring_bitmap_t *answer = roaring_bitmap_create();
+    if (answer == NULL) {
+        return NULL;
+    }
+    uint64_t *support = (uint64_t *)roaring_malloc(EXPRESSION_KEY_WORDS *
+                                                   sizeof(uint64_t));
+    if (support == NULL) {
+        roaring_bitmap_free(answer);
+        return NULL;
+    }
+    if (!expression_key_support(expr, support)) {
+        roaring_free(support);
+        roaring_bitmap_free(answer);
+        return NULL;
+    }
+    // advance through the key space once, in order, so that the final
+    // containers can simply be appended
+    for (int word = 0; word < EXPRESSION_KEY_WORDS; word++) {
+        uint64_t w = support[word];
+        while (w != 0) {
+            uint64_t t = w & (~w + 1);
+            int r = __builtin_ctzll(w);
+            uint16_t key = (uint16_t)(64 * word + r);
+            uint8_t result_type = 0;
+            bool owned = false;
+            void *c = expression_evaluate_at(expr, key, &result_type, &owned);
+            if (c != NULL) {
+                if (container_nonzero_cardinality(c, result_type)) {
+                    if (!owned) {  // borrowed straight from an input bitmap
+                        c = (void *)container_unwrap_shared(c, &result_type);
+                        c = container_clone(c, result_type);
+                    }
+                    ra_append(&answer->high_low_container, key, c, result_type);
+                } else if (owned) {
+                    container_free(c, result_type);
+                }
+            }
+            w ^= t;
+        }
+    }
+    roaring_free(support);
     return answer;
 }
 
+#undef EXPRESSION_KEY_WORDS
+
 // inplace and (modifies its first argument).
 void roaring_bitmap_and_inplace(roaring_bitmap_t *x1,
                                 const roaring_bitmap_t *x2) {
+    ra_invalidate_cached_cardinality(&x1->high_low_container);
     if (x1 == x2) return;
     int pos1 = 0, pos2 = 0, intersection_size = 0;
     const int length1 = ra_get_size(&x1->high_low_container);
@@ -703,6 +2240,63 @@ void roaring_bitmap_and_inplace(roaring_bitmap_t *x1,
     ra_downsize(&x1->high_low_container, intersection_size);
 }
 
+// monomorphic union over two all-bitset operands: every matched pair ors
+// into a fresh bitset with no dispatch, and stray containers clone
+// directly since neither input is copy-on-write
+static roaring_bitmap_t *roaring_bitmap_or_bitsets(const roaring_bitmap_t *x1,
+                                                   const roaring_bitmap_t *x2) {
+    const int length1 = x1->high_low_container.size,
+              length2 = x2->high_low_container.size;
+    roaring_bitmap_t *answer =
+        roaring_bitmap_create_with_capacity(length1 + length2);
+    int pos1 = 0, pos2 = 0;
+    while (pos1 < length1 && pos2 < length2) {
+        const uint16_t s1 = x1->high_low_container.keys[pos1];
+        const uint16_t s2 = x2->high_low_container.keys[pos2];
+        if (s1 == s2) {
+            bitset_container_t *dst = bitset_container_create();
+            bitset_container_or(
+                (const bitset_container_t *)
+                    x1->high_low_container.containers[pos1],
+                (const bitset_container_t *)
+                    x2->high_low_container.containers[pos2],
+                dst);
+            if (dst->cardinality == (1 << 16)) {  // all-ones: share, not store
+                bitset_container_free(dst);
+                ra_append(&answer->high_low_container, s1,
+                          run_container_full(), RUN_CONTAINER_TYPE_CODE);
+            } else {
+                ra_append(&answer->high_low_container, s1, dst,
+                          BITSET_CONTAINER_TYPE_CODE);
+            }
+            ++pos1;
+            ++pos2;
+        } else if (s1 < s2) {
+            ra_append(&answer->high_low_container, s1,
+                      bitset_container_clone(
+                          (const bitset_container_t *)
+                              x1->high_low_container.containers[pos1]),
+                      BITSET_CONTAINER_TYPE_CODE);
+            ++pos1;
+        } else {  // s1 > s2
+            ra_append(&answer->high_low_container, s2,
+                      bitset_container_clone(
+                          (const bitset_container_t *)
+                              x2->high_low_container.containers[pos2]),
+                      BITSET_CONTAINER_TYPE_CODE);
+            ++pos2;
+        }
+    }
+    if (pos1 == length1) {
+        ra_append_copy_range(&answer->high_low_container,
+                             &x2->high_low_container, pos2, length2, false);
+    } else {
+        ra_append_copy_range(&answer->high_low_container,
+                             &x1->high_low_container, pos1, length1, false);
+    }
+    return answer;
+}
+
 roaring_bitmap_t *roaring_bitmap_or(const roaring_bitmap_t *x1,
                                     const roaring_bitmap_t *x2) {
     uint8_t container_result_type = 0;
@@ -714,6 +2308,13 @@ roaring_bitmap_t *roaring_bitmap_or(const roaring_bitmap_t *x1,
     if (0 == length2) {
         return roaring_bitmap_copy(x1);
     }
+    // copy-on-write unions prefer sharing containers over cloning them,
+    // which the monomorphic path does not do
+    if (!is_cow(x1) && !is_cow(x2) &&
+        ra_all_bitsets(&x1->high_low_container) &&
+        ra_all_bitsets(&x2->high_low_container)) {
+        return roaring_bitmap_or_bitsets(x1, x2);
+    }
     roaring_bitmap_t *answer =
         roaring_bitmap_create_with_capacity(length1 + length2);
     roaring_bitmap_set_copy_on_write(answer, is_cow(x1) && is_cow(x2));
@@ -787,6 +2388,7 @@ roaring_bitmap_t *roaring_bitmap_or(const roaring_bitmap_t *x1,
 // inplace or (modifies its first argument).
 void roaring_bitmap_or_inplace(roaring_bitmap_t *x1,
                                const roaring_bitmap_t *x2) {
+    ra_invalidate_cached_cardinality(&x1->high_low_container);
     uint8_t container_result_type = 0;
     int length1 = x1->high_low_container.size;
     const int length2 = x2->high_low_container.size;
@@ -945,6 +2547,7 @@ roaring_bitmap_t *roaring_bitmap_xor(const roaring_bitmap_t *x1,
 
 void roaring_bitmap_xor_inplace(roaring_bitmap_t *x1,
                                 const roaring_bitmap_t *x2) {
+    ra_invalidate_cached_cardinality(&x1->high_low_container);
     assert(x1 != x2);
     uint8_t container_result_type = 0;
     int length1 = x1->high_low_container.size;
@@ -1091,6 +2694,7 @@ roaring_bitmap_t *roaring_bitmap_andnot(const roaring_bitmap_t *x1,
 
 void roaring_bitmap_andnot_inplace(roaring_bitmap_t *x1,
                                    const roaring_bitmap_t *x2) {
+    ra_invalidate_cached_cardinality(&x1->high_low_container);
     assert(x1 != x2);
 
     uint8_t container_result_type = 0;
@@ -1176,10 +2780,18 @@ void roaring_bitmap_andnot_inplace(roaring_bitmap_t *x1,
 }
 
 uint64_t roaring_bitmap_get_cardinality(const roaring_bitmap_t *ra) {
+    if (ra->high_low_container.flags & ROARING_FLAG_CARD_VALID) {
+        return ra->high_low_container.cached_cardinality;
+    }
     uint64_t card = 0;
     for (int i = 0; i < ra->high_low_container.size; ++i)
         card += container_get_cardinality(ra->high_low_container.containers[i],
                                           ra->high_low_container.typecodes[i]);
+    // the bitmap is logically unchanged, so we allow ourselves to refresh
+    // the cache through the const pointer: subsequent calls are O(1)
+    roaring_array_t *hlc = (roaring_array_t *)&ra->high_low_container;
+    hlc->cached_cardinality = card;
+    hlc->flags |= ROARING_FLAG_CARD_VALID;
     return card;
 }
 
@@ -1251,22 +2863,123 @@ bool roaring_bitmap_range_uint32_array(const roaring_bitmap_t *ra, size_t offset
     return ra_range_uint32_array(&ra->high_low_container, offset, limit, ans);
 }
 
-/** convert array and bitmap containers to run containers when it is more
- * efficient;
- * also convert from run containers when more space efficient.  Returns
- * true if the result has at least one run container.
-*/
-bool roaring_bitmap_run_optimize(roaring_bitmap_t *r) {
-    bool answer = false;
-    for (int i = 0; i < r->high_low_container.size; i++) {
-        uint8_t typecode_original, typecode_after;
-        ra_unshare_container_at_index(
-            &r->high_low_container, i);  // TODO: this introduces extra cloning!
-        void *c = ra_get_container_at_index(&r->high_low_container, i,
-                                            &typecode_original);
-        void *c1 = convert_run_optimize(c, typecode_original, &typecode_after);
-        if (typecode_after == RUN_CONTAINER_TYPE_CODE) answer = true;
-        ra_set_container_at_index(&r->high_low_container, i, c1,
+bool roaring_bitmap_to_bitset(const roaring_bitmap_t *r, uint64_t *words,
+                              size_t maxwords) {
+    memset(words, 0, maxwords * sizeof(uint64_t));
+    if (r->high_low_container.size == 0) return true;
+    if ((size_t)(roaring_bitmap_maximum(r) >> 6) >= maxwords) {
+        return false;  // the buffer cannot hold the largest value
+    }
+    const roaring_array_t *ra = &r->high_low_container;
+    for (int i = 0; i < ra->size; ++i) {
+        uint8_t typecode = ra->typecodes[i];
+        const void *c = container_unwrap_shared(ra->containers[i], &typecode);
+        uint64_t *chunk =
+            words + ((size_t)ra->keys[i] * BITSET_CONTAINER_SIZE_IN_WORDS);
+        switch (typecode) {
+            case BITSET_CONTAINER_TYPE_CODE: {
+                const bitset_container_t *bitset =
+                    (const bitset_container_t *)c;
+                // the tail words past maxwords hold no set bits (the
+                // maximum fits), so dropping them loses nothing
+                size_t avail = maxwords - (size_t)(chunk - words);
+                if (avail > BITSET_CONTAINER_SIZE_IN_WORDS) {
+                    avail = BITSET_CONTAINER_SIZE_IN_WORDS;
+                }
+                memcpy(chunk, bitset->array, avail * sizeof(uint64_t));
+                break;
+            }
+            case ARRAY_CONTAINER_TYPE_CODE: {
+                const array_container_t *array =
+                    (const array_container_t *)c;
+                bitset_set_list(chunk, array->array, array->cardinality);
+                break;
+            }
+            case RUN_CONTAINER_TYPE_CODE: {
+                const run_container_t *run = (const run_container_t *)c;
+                for (int32_t j = 0; j < run->n_runs; ++j) {
+                    bitset_set_lenrange(chunk, run->runs[j].value,
+                                        run->runs[j].length);
+                }
+                break;
+            }
+            default:
+                assert(false);
+                __builtin_unreachable();
+        }
+    }
+    return true;
+}
+
+roaring_bitmap_t *roaring_bitmap_from_bitset(const uint64_t *words,
+                                             size_t nwords) {
+    size_t n_chunks = (nwords + BITSET_CONTAINER_SIZE_IN_WORDS - 1) /
+                      BITSET_CONTAINER_SIZE_IN_WORDS;
+    if (n_chunks > (1 << 16)) {
+        n_chunks = 1 << 16;  // words past 2^26 describe values beyond 32 bits
+    }
+    roaring_bitmap_t *ans =
+        roaring_bitmap_create_with_capacity((uint32_t)n_chunks);
+    uint64_t total = 0;
+    for (size_t key = 0; key < n_chunks; ++key) {
+        const uint64_t *chunk =
+            words + ((size_t)key * BITSET_CONTAINER_SIZE_IN_WORDS);
+        size_t chunk_words =
+            nwords - ((size_t)key * BITSET_CONTAINER_SIZE_IN_WORDS);
+        if (chunk_words > BITSET_CONTAINER_SIZE_IN_WORDS) {
+            chunk_words = BITSET_CONTAINER_SIZE_IN_WORDS;
+        }
+        int32_t card = 0;
+        for (size_t j = 0; j < chunk_words; ++j) {
+            card += hamming(chunk[j]);
+        }
+        if (card == 0) continue;
+        total += card;
+        if (card == (1 << 16)) {  // all-ones chunk: share, not store
+            ra_append(&ans->high_low_container, (uint16_t)key,
+                      run_container_full(), RUN_CONTAINER_TYPE_CODE);
+        } else if (card > DEFAULT_MAX_SIZE) {
+            bitset_container_t *bitset = bitset_container_create();
+            memcpy(bitset->array, chunk, chunk_words * sizeof(uint64_t));
+            if (chunk_words < BITSET_CONTAINER_SIZE_IN_WORDS) {
+                memset(bitset->array + chunk_words, 0,
+                       (BITSET_CONTAINER_SIZE_IN_WORDS - chunk_words) *
+                           sizeof(uint64_t));
+            }
+            bitset->cardinality = card;
+            ra_append(&ans->high_low_container, (uint16_t)key, bitset,
+                      BITSET_CONTAINER_TYPE_CODE);
+        } else {
+            array_container_t *array =
+                array_container_create_given_capacity(card);
+            array->cardinality = (int32_t)bitset_extract_setbits_uint16(
+                chunk, chunk_words, array->array, 0);
+            ra_append(&ans->high_low_container, (uint16_t)key, array,
+                      ARRAY_CONTAINER_TYPE_CODE);
+        }
+    }
+    // every chunk was just counted, so the total cardinality comes free
+    ans->high_low_container.cached_cardinality = total;
+    ans->high_low_container.flags |= ROARING_FLAG_CARD_VALID;
+    return ans;
+}
+
+/** convert array and bitmap containers to run containers when it is more
+ * efficient;
+ * also convert from run containers when more space efficient.  Returns
+ * true if the result has at least one run container.
+*/
+bool roaring_bitmap_run_optimize(roaring_bitmap_t *r) {
+    bool answer = false;
+    for (int i = 0; i < r->high_low_container.size; i++) {
+        uint8_t typecode_original, typecode_after;
+        ra_unshare_container_at_index(
+            &r->high_low_container, i);  // TODO: this introduces extra cloning!
+        void *c = ra_get_container_at_index(&r->high_low_container, i,
+                                            &typecode_original);
+        void *c1 = convert_run_optimize(c, typecode_original, &typecode_after);
+        if (typecode_after == RUN_CONTAINER_TYPE_CODE) answer = true;
+        ra_set_container_at_index(&r->high_low_container, i, c1,
                                   typecode_after);
     }
     return answer;
@@ -1320,6 +3033,64 @@ bool roaring_bitmap_remove_run_compression(roaring_bitmap_t *r) {
     return answer;
 }
 
+/**
+ * Heuristic cost model over a statistics snapshot: decides which of the
+ * maintenance passes above are worth running for a declared workload.
+ */
+void roaring_bitmap_advise_optimization(const roaring_statistics_t *stat,
+                                        roaring_workload_profile_t profile,
+                                        roaring_optimization_advice_t *advice) {
+    advice->run_optimize = false;
+    advice->remove_run_compression = false;
+    advice->shrink_to_fit = false;
+    switch (profile) {
+        case ROARING_WORKLOAD_MEMORY_TIGHT:
+            // run compression only ever shrinks containers, and slack
+            // capacity is pure waste once the bitmap stops changing
+            advice->run_optimize =
+                stat->n_array_containers + stat->n_bitset_containers > 0;
+            advice->shrink_to_fit = true;
+            break;
+        case ROARING_WORKLOAD_READ_HEAVY:
+            // keep bitsets even when runs would be smaller: a point query
+            // probes one word in a bitset but searches the run list in a
+            // run container. Once run containers average more than
+            // DEFAULT_MAX_SIZE values they expand into bitsets, so asking
+            // for the expansion buys single-probe lookups
+            advice->remove_run_compression =
+                stat->n_run_containers > 0 &&
+                stat->n_values_run_containers / stat->n_run_containers >
+                    DEFAULT_MAX_SIZE;
+            advice->shrink_to_fit = true;  // tighter arrays scan better
+            break;
+        case ROARING_WORKLOAD_WRITE_HEAVY:
+            // point mutations split runs and shift the run list, so run
+            // containers do not pay for themselves; array slack stays,
+            // those containers are still growing
+            advice->remove_run_compression = stat->n_run_containers > 0;
+            break;
+    }
+}
+
+bool roaring_bitmap_optimize_for(roaring_bitmap_t *r,
+                                 roaring_workload_profile_t profile) {
+    roaring_statistics_t stats;
+    roaring_bitmap_statistics(r, &stats);
+    roaring_optimization_advice_t advice;
+    roaring_bitmap_advise_optimization(&stats, profile, &advice);
+    bool changed = false;
+    if (advice.remove_run_compression) {
+        changed |= roaring_bitmap_remove_run_compression(r);
+    }
+    if (advice.run_optimize) {
+        changed |= roaring_bitmap_run_optimize(r);
+    }
+    if (advice.shrink_to_fit) {
+        changed |= roaring_bitmap_shrink_to_fit(r) > 0;
+    }
+    return changed;
+}
+
 size_t roaring_bitmap_serialize(const roaring_bitmap_t *ra, char *buf) {
     size_t portablesize = roaring_bitmap_portable_size_in_bytes(ra);
     uint64_t cardinality = roaring_bitmap_get_cardinality(ra);
@@ -1348,9 +3119,428 @@ size_t roaring_bitmap_portable_size_in_bytes(const roaring_bitmap_t *ra) {
 }
 
 
+/*
+ * Compressed serialization frame (opt-in, cookie COMPRESSED_SERIAL_COOKIE).
+ * Array container payloads and run containers are delta-encoded and
+ * bitpacked instead of stored as raw uint16 lists, which the portable
+ * format cannot exploit. Layout, all fields little-endian:
+ *
+ *   uint32 cookie, uint32 container count, then per container:
+ *     uint16 key, uint16 n, uint8 typecode
+ *     bitset (n = cardinality - 1): the 8192 payload bytes, verbatim
+ *     array  (n = cardinality - 1):
+ *       uint16 first value, uint8 width,
+ *       n values of `width` bits: gap to the previous value, minus one
+ *     run    (n = n_runs - 1):
+ *       uint16 first start, uint8 swidth, uint8 lwidth,
+ *       n values of `swidth` bits: gap between consecutive starts, minus one
+ *       n + 1 values of `lwidth` bits: the run lengths
+ *
+ * Both packed streams start byte-aligned. Gaps are stored minus one, so any
+ * decoded array is strictly increasing by construction; the reader only has
+ * to bound-check the byte stream and the final value.
+ */
+
+static inline uint32_t compressed_bit_width(uint32_t maxval) {
+    uint32_t bits = 0;
+    while (maxval > 0) {
+        bits++;
+        maxval >>= 1;
+    }
+    return bits;
+}
+
+typedef struct compressed_bitwriter_s {
+    char *buf;
+    size_t pos;
+    uint64_t acc;
+    uint32_t bits;
+} compressed_bitwriter_t;
+
+static inline void compressed_bitwriter_put(compressed_bitwriter_t *w,
+                                            uint32_t value, uint32_t width) {
+    w->acc |= (uint64_t)value << w->bits;
+    w->bits += width;
+    while (w->bits >= 8) {
+        w->buf[w->pos++] = (char)(w->acc & 0xFF);
+        w->acc >>= 8;
+        w->bits -= 8;
+    }
+}
+
+static inline void compressed_bitwriter_flush(compressed_bitwriter_t *w) {
+    if (w->bits > 0) {
+        w->buf[w->pos++] = (char)(w->acc & 0xFF);
+        w->acc = 0;
+        w->bits = 0;
+    }
+}
+
+typedef struct compressed_bitreader_s {
+    const unsigned char *buf;
+    size_t pos;
+    size_t len;
+    uint64_t acc;
+    uint32_t bits;
+} compressed_bitreader_t;
+
+static inline bool compressed_bitreader_get(compressed_bitreader_t *r,
+                                            uint32_t width, uint32_t *value) {
+    while (r->bits < width) {
+        if (r->pos == r->len) {
+            return false;
+        }
+        r->acc |= (uint64_t)r->buf[r->pos++] << r->bits;
+        r->bits += 8;
+    }
+    *value = (uint32_t)(r->acc & ((UINT64_C(1) << width) - 1));
+    r->acc >>= width;
+    r->bits -= width;
+    return true;
+}
+
+// the next stream starts byte-aligned: discard buffered bits
+static inline void compressed_bitreader_align(compressed_bitreader_t *r) {
+    r->acc = 0;
+    r->bits = 0;
+}
+
+static uint32_t compressed_array_width(const array_container_t *ac) {
+    uint16_t maxgap = 0;
+    for (int32_t i = 1; i < ac->cardinality; i++) {
+        const uint16_t gap = (uint16_t)(ac->array[i] - ac->array[i - 1] - 1);
+        if (gap > maxgap) maxgap = gap;
+    }
+    return compressed_bit_width(maxgap);
+}
+
+static void compressed_run_widths(const run_container_t *run, uint32_t *swidth,
+                                  uint32_t *lwidth) {
+    uint16_t maxgap = 0, maxlen = 0;
+    for (int32_t i = 0; i < run->n_runs; i++) {
+        if (run->runs[i].length > maxlen) maxlen = run->runs[i].length;
+        if (i > 0) {
+            const uint16_t gap = (uint16_t)(run->runs[i].value -
+                                            run->runs[i - 1].value - 1);
+            if (gap > maxgap) maxgap = gap;
+        }
+    }
+    *swidth = compressed_bit_width(maxgap);
+    *lwidth = compressed_bit_width(maxlen);
+}
+
+size_t roaring_bitmap_portable_size_in_bytes_compressed(
+    const roaring_bitmap_t *r) {
+    const roaring_array_t *ra = &r->high_low_container;
+    size_t count = 2 * sizeof(uint32_t);
+    for (int32_t k = 0; k < ra->size; ++k) {
+        uint8_t typecode = ra->typecodes[k];
+        const void *c = container_unwrap_shared(ra->containers[k], &typecode);
+        count += 2 * sizeof(uint16_t) + 1;
+        switch (typecode) {
+            case BITSET_CONTAINER_TYPE_CODE:
+                count += BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
+                break;
+            case ARRAY_CONTAINER_TYPE_CODE: {
+                const array_container_t *ac = (const array_container_t *)c;
+                const uint32_t width = compressed_array_width(ac);
+                count += sizeof(uint16_t) + 1 +
+                         ((size_t)(ac->cardinality - 1) * width + 7) / 8;
+                break;
+            }
+            case RUN_CONTAINER_TYPE_CODE: {
+                const run_container_t *run = (const run_container_t *)c;
+                uint32_t swidth, lwidth;
+                compressed_run_widths(run, &swidth, &lwidth);
+                count += sizeof(uint16_t) + 2 +
+                         ((size_t)(run->n_runs - 1) * swidth + 7) / 8 +
+                         ((size_t)run->n_runs * lwidth + 7) / 8;
+                break;
+            }
+            default:
+                assert(false);
+                __builtin_unreachable();
+        }
+    }
+    return count;
+}
+
+size_t roaring_bitmap_portable_serialize_compressed(const roaring_bitmap_t *r,
+                                                    char *buf) {
+    const roaring_array_t *ra = &r->high_low_container;
+    char *initbuf = buf;
+    const uint32_t cookie = COMPRESSED_SERIAL_COOKIE;
+    memcpy(buf, &cookie, sizeof(cookie));
+    buf += sizeof(cookie);
+    const uint32_t count = (uint32_t)ra->size;
+    memcpy(buf, &count, sizeof(count));
+    buf += sizeof(count);
+    for (int32_t k = 0; k < ra->size; ++k) {
+        uint8_t typecode = ra->typecodes[k];
+        const void *c = container_unwrap_shared(ra->containers[k], &typecode);
+        memcpy(buf, &ra->keys[k], sizeof(uint16_t));
+        buf += sizeof(uint16_t);
+        switch (typecode) {
+            case BITSET_CONTAINER_TYPE_CODE: {
+                const bitset_container_t *bc = (const bitset_container_t *)c;
+                const uint16_t n =
+                    (uint16_t)(bitset_container_cardinality(bc) - 1);
+                memcpy(buf, &n, sizeof(n));
+                buf += sizeof(n);
+                *buf++ = (char)BITSET_CONTAINER_TYPE_CODE;
+                memcpy(buf, bc->array,
+                       BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t));
+                buf += BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
+                break;
+            }
+            case ARRAY_CONTAINER_TYPE_CODE: {
+                const array_container_t *ac = (const array_container_t *)c;
+                const uint16_t n = (uint16_t)(ac->cardinality - 1);
+                memcpy(buf, &n, sizeof(n));
+                buf += sizeof(n);
+                *buf++ = (char)ARRAY_CONTAINER_TYPE_CODE;
+                memcpy(buf, &ac->array[0], sizeof(uint16_t));
+                buf += sizeof(uint16_t);
+                const uint32_t width = compressed_array_width(ac);
+                *buf++ = (char)width;
+                compressed_bitwriter_t w = {buf, 0, 0, 0};
+                for (int32_t i = 1; i < ac->cardinality; i++) {
+                    compressed_bitwriter_put(
+                        &w, (uint16_t)(ac->array[i] - ac->array[i - 1] - 1),
+                        width);
+                }
+                compressed_bitwriter_flush(&w);
+                buf += w.pos;
+                break;
+            }
+            case RUN_CONTAINER_TYPE_CODE: {
+                const run_container_t *run = (const run_container_t *)c;
+                const uint16_t n = (uint16_t)(run->n_runs - 1);
+                memcpy(buf, &n, sizeof(n));
+                buf += sizeof(n);
+                *buf++ = (char)RUN_CONTAINER_TYPE_CODE;
+                memcpy(buf, &run->runs[0].value, sizeof(uint16_t));
+                buf += sizeof(uint16_t);
+                uint32_t swidth, lwidth;
+                compressed_run_widths(run, &swidth, &lwidth);
+                *buf++ = (char)swidth;
+                *buf++ = (char)lwidth;
+                compressed_bitwriter_t w = {buf, 0, 0, 0};
+                for (int32_t i = 1; i < run->n_runs; i++) {
+                    compressed_bitwriter_put(
+                        &w,
+                        (uint16_t)(run->runs[i].value -
+                                   run->runs[i - 1].value - 1),
+                        swidth);
+                }
+                compressed_bitwriter_flush(&w);
+                for (int32_t i = 0; i < run->n_runs; i++) {
+                    compressed_bitwriter_put(&w, run->runs[i].length, lwidth);
+                }
+                compressed_bitwriter_flush(&w);
+                buf += w.pos;
+                break;
+            }
+            default:
+                assert(false);
+                __builtin_unreachable();
+        }
+    }
+    return buf - initbuf;
+}
+
+static roaring_bitmap_t *roaring_bitmap_compressed_deserialize(
+    const char *cbuf, size_t maxbytes) {
+    const unsigned char *buf = (const unsigned char *)cbuf;
+    size_t read = 2 * sizeof(uint32_t);
+    if (read > maxbytes) {
+        fprintf(stderr, "Ran out of bytes while reading the header.\n");
+        return NULL;
+    }
+    uint32_t count;
+    memcpy(&count, buf + sizeof(uint32_t), sizeof(count));
+    if (count > (1 << 16)) {
+        fprintf(stderr, "You cannot have so many containers, the data must "
+                        "be corrupted: %" PRIu32 "\n", count);
+        return NULL;
+    }
+    buf += 2 * sizeof(uint32_t);
+    roaring_bitmap_t *ans = roaring_bitmap_create_with_capacity(count);
+    if (ans == NULL) {
+        return NULL;
+    }
+    for (uint32_t k = 0; k < count; ++k) {
+        read += 2 * sizeof(uint16_t) + 1;
+        if (read > maxbytes) {
+            fprintf(stderr,
+                    "Ran out of bytes while reading a container header.\n");
+            roaring_bitmap_free(ans);
+            return NULL;
+        }
+        uint16_t key, n;
+        memcpy(&key, buf, sizeof(key));
+        memcpy(&n, buf + sizeof(key), sizeof(n));
+        const uint8_t typecode = (uint8_t)buf[2 * sizeof(uint16_t)];
+        buf += 2 * sizeof(uint16_t) + 1;
+        switch (typecode) {
+            case BITSET_CONTAINER_TYPE_CODE: {
+                read += BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
+                if (read > maxbytes) {
+                    fprintf(stderr,
+                            "Ran out of bytes while reading a bitset.\n");
+                    roaring_bitmap_free(ans);
+                    return NULL;
+                }
+                bitset_container_t *bc = bitset_container_create();
+                if (bc == NULL) {
+                    roaring_bitmap_free(ans);
+                    return NULL;
+                }
+                memcpy(bc->array, buf,
+                       BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t));
+                buf += BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
+                bc->cardinality = n + 1;
+                ra_append(&ans->high_low_container, key, bc,
+                          BITSET_CONTAINER_TYPE_CODE);
+                break;
+            }
+            case ARRAY_CONTAINER_TYPE_CODE: {
+                read += sizeof(uint16_t) + 1;
+                if (read > maxbytes) {
+                    fprintf(stderr,
+                            "Ran out of bytes while reading an array.\n");
+                    roaring_bitmap_free(ans);
+                    return NULL;
+                }
+                uint16_t first;
+                memcpy(&first, buf, sizeof(first));
+                const uint32_t width = (uint8_t)buf[sizeof(uint16_t)];
+                buf += sizeof(uint16_t) + 1;
+                const int32_t card = n + 1;
+                if (width > 16) {
+                    fprintf(stderr, "Invalid bit width, the data must be "
+                                    "corrupted: %" PRIu32 "\n", width);
+                    roaring_bitmap_free(ans);
+                    return NULL;
+                }
+                array_container_t *ac =
+                    array_container_create_given_capacity(card);
+                if (ac == NULL) {
+                    roaring_bitmap_free(ans);
+                    return NULL;
+                }
+                ac->array[0] = first;
+                ac->cardinality = card;
+                compressed_bitreader_t r = {buf, 0, maxbytes - read, 0, 0};
+                uint32_t total = first;
+                bool ok = true;
+                for (int32_t i = 1; i < card; i++) {
+                    uint32_t gap;
+                    if (!compressed_bitreader_get(&r, width, &gap)) {
+                        ok = false;
+                        break;
+                    }
+                    ac->array[i] = (uint16_t)gap;  // reconstructed below
+                    total += gap + 1;
+                }
+                if (!ok || total > 0xFFFF) {
+                    fprintf(stderr, "Invalid packed array, the data must be "
+                                    "corrupted.\n");
+                    array_container_free(ac);
+                    roaring_bitmap_free(ans);
+                    return NULL;
+                }
+                prefix_sum_deltas_uint16(ac->array, card);
+                read += r.pos;
+                buf += r.pos;
+                ra_append(&ans->high_low_container, key, ac,
+                          ARRAY_CONTAINER_TYPE_CODE);
+                break;
+            }
+            case RUN_CONTAINER_TYPE_CODE: {
+                read += sizeof(uint16_t) + 2;
+                if (read > maxbytes) {
+                    fprintf(stderr,
+                            "Ran out of bytes while reading runs.\n");
+                    roaring_bitmap_free(ans);
+                    return NULL;
+                }
+                uint16_t first;
+                memcpy(&first, buf, sizeof(first));
+                const uint32_t swidth = (uint8_t)buf[sizeof(uint16_t)];
+                const uint32_t lwidth = (uint8_t)buf[sizeof(uint16_t) + 1];
+                buf += sizeof(uint16_t) + 2;
+                const int32_t n_runs = n + 1;
+                if (swidth > 16 || lwidth > 16) {
+                    fprintf(stderr, "Invalid bit width, the data must be "
+                                    "corrupted.\n");
+                    roaring_bitmap_free(ans);
+                    return NULL;
+                }
+                run_container_t *run =
+                    run_container_create_given_capacity(n_runs);
+                if (run == NULL) {
+                    roaring_bitmap_free(ans);
+                    return NULL;
+                }
+                run->n_runs = n_runs;
+                run->runs[0].value = first;
+                compressed_bitreader_t r = {buf, 0, maxbytes - read, 0, 0};
+                uint32_t cur = first;
+                bool ok = true;
+                for (int32_t i = 1; i < n_runs; i++) {
+                    uint32_t gap;
+                    if (!compressed_bitreader_get(&r, swidth, &gap)) {
+                        ok = false;
+                        break;
+                    }
+                    cur += gap + 1;
+                    run->runs[i].value = (uint16_t)cur;
+                }
+                compressed_bitreader_align(&r);
+                uint32_t last_end = 0;
+                for (int32_t i = 0; ok && i < n_runs; i++) {
+                    uint32_t len;
+                    if (!compressed_bitreader_get(&r, lwidth, &len)) {
+                        ok = false;
+                        break;
+                    }
+                    run->runs[i].length = (uint16_t)len;
+                    last_end = run->runs[i].value + len;
+                }
+                if (!ok || cur > 0xFFFF || last_end > 0xFFFF) {
+                    fprintf(stderr, "Invalid packed runs, the data must be "
+                                    "corrupted.\n");
+                    run_container_free(run);
+                    roaring_bitmap_free(ans);
+                    return NULL;
+                }
+                read += r.pos;
+                buf += r.pos;
+                ra_append(&ans->high_low_container, key, run,
+                          RUN_CONTAINER_TYPE_CODE);
+                break;
+            }
+            default:
+                fprintf(stderr, "Unknown container type, the data must be "
+                                "corrupted: %d\n", typecode);
+                roaring_bitmap_free(ans);
+                return NULL;
+        }
+    }
+    return ans;
+}
+
 roaring_bitmap_t *roaring_bitmap_portable_deserialize_safe(const char *buf, size_t maxbytes) {
+    if (maxbytes >= sizeof(uint32_t)) {
+        uint32_t cookie;
+        memcpy(&cookie, buf, sizeof(cookie));
+        if (cookie == COMPRESSED_SERIAL_COOKIE) {
+            return roaring_bitmap_compressed_deserialize(buf, maxbytes);
+        }
+    }
     roaring_bitmap_t *ans =
-        (roaring_bitmap_t *)malloc(sizeof(roaring_bitmap_t));
+        (roaring_bitmap_t *)roaring_malloc(sizeof(roaring_bitmap_t));
     if (ans == NULL) {
         return NULL;
     }
@@ -1359,7 +3549,7 @@ roaring_bitmap_t *roaring_bitmap_portable_deserialize_safe(const char *buf, size
     if(is_ok) assert(bytesread <= maxbytes);
     roaring_bitmap_set_copy_on_write(ans, false);
     if (!is_ok) {
-        free(ans);
+        roaring_free(ans);
         return NULL;
     }
     return ans;
@@ -1369,6 +3559,57 @@ roaring_bitmap_t *roaring_bitmap_portable_deserialize(const char *buf) {
     return roaring_bitmap_portable_deserialize_safe(buf, SIZE_MAX);
 }
 
+roaring_bitmap_t *roaring_bitmap_portable_deserialize_trusted(const char *buf) {
+    uint32_t cookie;
+    memcpy(&cookie, buf, sizeof(cookie));
+    if (cookie == COMPRESSED_SERIAL_COOKIE) {
+        // the compressed format has its own (validating) decoder
+        return roaring_bitmap_compressed_deserialize(buf, SIZE_MAX);
+    }
+    roaring_bitmap_t *ans =
+        (roaring_bitmap_t *)roaring_malloc(sizeof(roaring_bitmap_t));
+    if (ans == NULL) {
+        return NULL;
+    }
+    bool is_ok = ra_portable_deserialize_trusted(&ans->high_low_container, buf);
+    roaring_bitmap_set_copy_on_write(ans, false);
+    if (!is_ok) {
+        roaring_free(ans);
+        return NULL;
+    }
+    return ans;
+}
+
+roaring_bitmap_t *roaring_bitmap_portable_deserialize_run_optimized(
+    const char *buf, size_t maxbytes) {
+    if (maxbytes >= sizeof(uint32_t)) {
+        uint32_t cookie;
+        memcpy(&cookie, buf, sizeof(cookie));
+        if (cookie == COMPRESSED_SERIAL_COOKIE) {
+            // the compressed format has its own decoder; optimize afterwards
+            roaring_bitmap_t *ans =
+                roaring_bitmap_compressed_deserialize(buf, maxbytes);
+            if (ans != NULL) roaring_bitmap_run_optimize(ans);
+            return ans;
+        }
+    }
+    roaring_bitmap_t *ans =
+        (roaring_bitmap_t *)roaring_malloc(sizeof(roaring_bitmap_t));
+    if (ans == NULL) {
+        return NULL;
+    }
+    size_t bytesread;
+    bool is_ok = ra_portable_deserialize_run_optimized(&ans->high_low_container,
+                                                       buf, maxbytes, &bytesread);
+    if(is_ok) assert(bytesread <= maxbytes);
+    roaring_bitmap_set_copy_on_write(ans, false);
+    if (!is_ok) {
+        roaring_free(ans);
+        return NULL;
+    }
+    return ans;
+}
+
 
 size_t roaring_bitmap_portable_deserialize_size(const char *buf, size_t maxbytes) {
   return ra_portable_deserialize_size(buf, maxbytes);
@@ -1380,6 +3621,12 @@ size_t roaring_bitmap_portable_serialize(const roaring_bitmap_t *ra,
     return ra_portable_serialize(&ra->high_low_container, buf);
 }
 
+size_t roaring_bitmap_portable_serialize_to(const roaring_bitmap_t *ra,
+                                            roaring_writer_t writer,
+                                            void *arg) {
+    return ra_portable_serialize_to(&ra->high_low_container, writer, arg);
+}
+
 roaring_bitmap_t *roaring_bitmap_deserialize(const void *buf) {
     const char *bufaschar = (const char *)buf;
     if (*(const unsigned char *)buf == SERIALIZATION_ARRAY_UINT32) {
@@ -1421,6 +3668,50 @@ bool roaring_iterate64(const roaring_bitmap_t *ra, roaring_iterator64 iterator,
     return true;
 }
 
+// containers emit maximal ranges within their own 16-bit block; this shim
+// glues together ranges that abut across a container boundary before they
+// reach the user callback
+typedef struct roaring_range_merger_s {
+    roaring_range_iterator iterator;
+    void *ptr;
+    uint64_t start;   // pending range, valid when length != 0
+    uint64_t length;
+} roaring_range_merger_t;
+
+static bool roaring_range_merger_emit(uint32_t start, uint64_t length,
+                                      void *arg) {
+    roaring_range_merger_t *merger = (roaring_range_merger_t *)arg;
+    if (merger->length > 0) {
+        if (merger->start + merger->length == start) {
+            merger->length += length;
+            return true;
+        }
+        if (!merger->iterator((uint32_t)merger->start, merger->length,
+                              merger->ptr))
+            return false;
+    }
+    merger->start = start;
+    merger->length = length;
+    return true;
+}
+
+bool roaring_iterate_ranges(const roaring_bitmap_t *ra,
+                            roaring_range_iterator iterator, void *ptr) {
+    roaring_range_merger_t merger = {iterator, ptr, 0, 0};
+    for (int i = 0; i < ra->high_low_container.size; ++i)
+        if (!container_iterate_ranges(
+                ra->high_low_container.containers[i],
+                ra->high_low_container.typecodes[i],
+                ((uint32_t)ra->high_low_container.keys[i]) << 16,
+                roaring_range_merger_emit, &merger)) {
+            return false;
+        }
+    if (merger.length > 0) {
+        return iterator((uint32_t)merger.start, merger.length, ptr);
+    }
+    return true;
+}
+
 /****
 * begin roaring_uint32_iterator_t
 *****/
@@ -1562,6 +3853,7 @@ static bool loadfirstvalue_largeorequal(roaring_uint32_iterator_t *newit, uint32
 void roaring_init_iterator(const roaring_bitmap_t *ra,
                            roaring_uint32_iterator_t *newit) {
     newit->parent = ra;
+    newit->range_last = UINT32_MAX;
     newit->container_index = 0;
     newit->has_value = loadfirstvalue(newit);
 }
@@ -1569,13 +3861,35 @@ void roaring_init_iterator(const roaring_bitmap_t *ra,
 void roaring_init_iterator_last(const roaring_bitmap_t *ra,
                                 roaring_uint32_iterator_t *newit) {
     newit->parent = ra;
+    newit->range_last = UINT32_MAX;
     newit->container_index = newit->parent->high_low_container.size - 1;
     newit->has_value = loadlastvalue(newit);
 }
 
+bool roaring_init_iterator_range(const roaring_bitmap_t *ra,
+                                 roaring_uint32_iterator_t *newit,
+                                 uint64_t range_start, uint64_t range_end) {
+    if (range_end > UINT32_MAX + UINT64_C(1)) {
+        range_end = UINT32_MAX + UINT64_C(1);
+    }
+    roaring_init_iterator(ra, newit);
+    if (range_start >= range_end) {
+        newit->range_last = 0;
+        return (newit->has_value = false);
+    }
+    newit->range_last = (uint32_t)(range_end - 1);
+    if (newit->has_value && newit->current_value < range_start) {
+        roaring_move_uint32_iterator_equalorlarger(newit,
+                                                   (uint32_t)range_start);
+    } else if (newit->has_value && newit->current_value > newit->range_last) {
+        newit->has_value = false;
+    }
+    return newit->has_value;
+}
+
 roaring_uint32_iterator_t *roaring_create_iterator(const roaring_bitmap_t *ra) {
     roaring_uint32_iterator_t *newit =
-        (roaring_uint32_iterator_t *)malloc(sizeof(roaring_uint32_iterator_t));
+        (roaring_uint32_iterator_t *)roaring_malloc(sizeof(roaring_uint32_iterator_t));
     if (newit == NULL) return NULL;
     roaring_init_iterator(ra, newit);
     return newit;
@@ -1584,14 +3898,31 @@ roaring_uint32_iterator_t *roaring_create_iterator(const roaring_bitmap_t *ra) {
 roaring_uint32_iterator_t *roaring_copy_uint32_iterator(
     const roaring_uint32_iterator_t *it) {
     roaring_uint32_iterator_t *newit =
-        (roaring_uint32_iterator_t *)malloc(sizeof(roaring_uint32_iterator_t));
+        (roaring_uint32_iterator_t *)roaring_malloc(sizeof(roaring_uint32_iterator_t));
     memcpy(newit, it, sizeof(roaring_uint32_iterator_t));
     return newit;
 }
 
 bool roaring_move_uint32_iterator_equalorlarger(roaring_uint32_iterator_t *it, uint32_t val) {
     uint16_t hb = val >> 16;
-    const int i = ra_get_index(& it->parent->high_low_container, hb);
+    const roaring_array_t *hlc = &it->parent->high_low_container;
+    int i;
+    // seeks in a merge-join are overwhelmingly short and forward: resolve
+    // the target container relative to the current one (galloping search
+    // over the keys) before falling back to a full binary search
+    if (it->container_index >= 0 && it->container_index < hlc->size) {
+        const uint16_t current_key = hlc->keys[it->container_index];
+        if (current_key == hb) {
+            i = it->container_index;
+        } else if (current_key < hb) {
+            int32_t pos = ra_advance_until(hlc, hb, it->container_index);
+            i = (pos < hlc->size && hlc->keys[pos] == hb) ? pos : -pos - 1;
+        } else {
+            i = ra_get_index(hlc, hb);
+        }
+    } else {
+        i = ra_get_index(hlc, hb);
+    }
     if (i >= 0) {
       uint32_t lowvalue = container_maximum(it->parent->high_low_container.containers[i], it->parent->high_low_container.typecodes[i]);
       uint16_t lb = val & 0xFFFF;
@@ -1600,6 +3931,9 @@ bool roaring_move_uint32_iterator_equalorlarger(roaring_uint32_iterator_t *it, u
       } else {// the value is necessarily within the range of the container
         it->container_index = i;
         it->has_value = loadfirstvalue_largeorequal(it, val);
+        if (it->has_value && it->current_value > it->range_last) {
+            it->has_value = false;
+        }
         return it->has_value;
       }
     } else {
@@ -1607,11 +3941,41 @@ bool roaring_move_uint32_iterator_equalorlarger(roaring_uint32_iterator_t *it, u
       it->container_index = -i-1;
     }
     it->has_value = loadfirstvalue(it);
+    if (it->has_value && it->current_value > it->range_last) {
+        it->has_value = false;
+    }
     return it->has_value;
 }
 
+bool roaring_iterate_and(const roaring_bitmap_t *x1,
+                         const roaring_bitmap_t *x2,
+                         roaring_iterator iterator, void *ptr) {
+    // leapfrog join: each side seeks to the other's current value, so a
+    // dense bitmap never visits the values the sparse one skips over
+    roaring_uint32_iterator_t it1;
+    roaring_uint32_iterator_t it2;
+    roaring_init_iterator(x1, &it1);
+    roaring_init_iterator(x2, &it2);
+    while (it1.has_value && it2.has_value) {
+        if (it1.current_value == it2.current_value) {
+            if (!iterator(it1.current_value, ptr)) {
+                return false;
+            }
+            roaring_advance_uint32_iterator(&it1);
+            roaring_advance_uint32_iterator(&it2);
+        } else if (it1.current_value < it2.current_value) {
+            roaring_move_uint32_iterator_equalorlarger(&it1,
+                                                       it2.current_value);
+        } else {
+            roaring_move_uint32_iterator_equalorlarger(&it2,
+                                                       it1.current_value);
+        }
+    }
+    return true;
+}
 
-bool roaring_advance_uint32_iterator(roaring_uint32_iterator_t *it) {
+
+static bool advance_uint32_iterator_internal(roaring_uint32_iterator_t *it) {
     if (it->container_index >= it->parent->high_low_container.size) {
         return (it->has_value = false);
     }
@@ -1680,6 +4044,16 @@ bool roaring_advance_uint32_iterator(roaring_uint32_iterator_t *it) {
     return (it->has_value = loadfirstvalue(it));
 }
 
+bool roaring_advance_uint32_iterator(roaring_uint32_iterator_t *it) {
+    if (!advance_uint32_iterator_internal(it)) {
+        return false;
+    }
+    if (it->current_value > it->range_last) {
+        return (it->has_value = false);
+    }
+    return true;
+}
+
 bool roaring_previous_uint32_iterator(roaring_uint32_iterator_t *it) {
     if (it->container_index < 0) {
         return (it->has_value = false);
@@ -1743,7 +4117,7 @@ bool roaring_previous_uint32_iterator(roaring_uint32_iterator_t *it) {
     return (it->has_value = loadlastvalue(it));
 }
 
-uint32_t roaring_read_uint32_iterator(roaring_uint32_iterator_t *it, uint32_t* buf, uint32_t count) {
+static uint32_t read_uint32_iterator_internal(roaring_uint32_iterator_t *it, uint32_t* buf, uint32_t count) {
   uint32_t ret = 0;
   uint32_t num_values;
   uint32_t wordindex;  // used for bitsets
@@ -1754,28 +4128,43 @@ uint32_t roaring_read_uint32_iterator(roaring_uint32_iterator_t *it, uint32_t* b
 
   while (it->has_value && ret < count) {
     switch (it->typecode) {
-      case BITSET_CONTAINER_TYPE_CODE:
+      case BITSET_CONTAINER_TYPE_CODE: {
         bcont = (const bitset_container_t*)(it->container);
         wordindex = it->in_container_index / 64;
         word = bcont->array[wordindex] & (UINT64_MAX << (it->in_container_index % 64));
-        do {
+        while (true) {
+          // drain the current (possibly partially consumed) word bit by bit
           while (word != 0 && ret < count) {
             buf[0] = it->highbits | (wordindex * 64 + __builtin_ctzll(word));
             word = word & (word - 1);
             buf++;
             ret++;
           }
-          while (word == 0 && wordindex+1 < BITSET_CONTAINER_SIZE_IN_WORDS) {
-            wordindex++;
-            word = bcont->array[wordindex];
+          if (word != 0) {
+            // the buffer is full but the word still has bits left in it
+            it->in_container_index = wordindex * 64 + __builtin_ctzll(word);
+            it->current_value = it->highbits | it->in_container_index;
+            return ret;
           }
-        } while (word != 0 && ret < count);
-        it->has_value = (word != 0);
-        if (it->has_value) {
-          it->in_container_index = wordindex * 64 + __builtin_ctzll(word);
-          it->current_value = it->highbits | it->in_container_index;
+          wordindex++;
+          if (wordindex == BITSET_CONTAINER_SIZE_IN_WORDS) break;
+          // bulk-decode whole words straight into the caller's buffer (SIMD
+          // when available); only whole words are consumed so the scalar
+          // path above can pick up wherever the bulk decoder stopped
+          size_t words_consumed;
+          num_values = (uint32_t)bitset_extract_setbits_partial(
+              bcont->array + wordindex,
+              BITSET_CONTAINER_SIZE_IN_WORDS - wordindex, buf, count - ret,
+              it->highbits | (wordindex * 64), &words_consumed);
+          buf += num_values;
+          ret += num_values;
+          wordindex += (uint32_t)words_consumed;
+          if (wordindex == BITSET_CONTAINER_SIZE_IN_WORDS) break;
+          word = bcont->array[wordindex];
         }
+        it->has_value = false;
         break;
+      }
       case ARRAY_CONTAINER_TYPE_CODE:
         acont = (const array_container_t *)(it->container);
         num_values = minimum_uint32(acont->cardinality - it->in_container_index, count - ret);
@@ -1826,19 +4215,387 @@ uint32_t roaring_read_uint32_iterator(roaring_uint32_iterator_t *it, uint32_t* b
   return ret;
 }
 
+uint32_t roaring_read_uint32_iterator(roaring_uint32_iterator_t *it, uint32_t* buf, uint32_t count) {
+  uint32_t ret = read_uint32_iterator_internal(it, buf, count);
+  if (it->range_last != UINT32_MAX && ret > 0 && buf[ret - 1] > it->range_last) {
+    // bounded iterator: keep only the in-range prefix (the buffer is sorted)
+    uint32_t lo = 0, hi = ret;
+    while (lo < hi) {
+      uint32_t mid = lo + (hi - lo) / 2;
+      if (buf[mid] > it->range_last) {
+        hi = mid;
+      } else {
+        lo = mid + 1;
+      }
+    }
+    ret = lo;
+    it->has_value = false;
+  } else if (it->has_value && it->current_value > it->range_last) {
+    it->has_value = false;
+  }
+  return ret;
+}
 
 
-void roaring_free_uint32_iterator(roaring_uint32_iterator_t *it) { free(it); }
 
-/****
-* end of roaring_uint32_iterator_t
+uint32_t roaring_read_uint32_iterator_reverse(roaring_uint32_iterator_t *it,
+                                              uint32_t *buf, uint32_t count) {
+  uint32_t ret = 0;
+  uint32_t num_values;
+  int32_t wordindex;  // used for bitsets
+  uint64_t word;      // used for bitsets
+  const array_container_t* acont;
+  const run_container_t* rcont;
+  const bitset_container_t* bcont;
+
+  while (it->has_value && ret < count) {
+    switch (it->typecode) {
+      case BITSET_CONTAINER_TYPE_CODE: {
+        bcont = (const bitset_container_t*)(it->container);
+        wordindex = it->in_container_index / 64;
+        // keep only the current bit and the ones below it
+        word = bcont->array[wordindex] &
+               (UINT64_MAX >> (63 - (it->in_container_index % 64)));
+        while (true) {
+          // drain the current word from its top bit downwards; unlike the
+          // ascending reader there is no whole-word bulk decoder to lean
+          // on, but word-at-a-time is already far from the per-value path
+          while (word != 0 && ret < count) {
+            const int bit = 63 - __builtin_clzll(word);
+            buf[0] = it->highbits | ((uint32_t)wordindex * 64 + bit);
+            word ^= UINT64_C(1) << bit;
+            buf++;
+            ret++;
+          }
+          if (word != 0) {
+            // the buffer is full but the word still has bits left in it
+            it->in_container_index =
+                wordindex * 64 + (63 - __builtin_clzll(word));
+            it->current_value = it->highbits | it->in_container_index;
+            return ret;
+          }
+          if (--wordindex < 0) break;
+          word = bcont->array[wordindex];
+        }
+        it->has_value = false;
+        break;
+      }
+      case ARRAY_CONTAINER_TYPE_CODE:
+        acont = (const array_container_t *)(it->container);
+        num_values =
+            minimum_uint32(it->in_container_index + 1, count - ret);
+        for (uint32_t i = 0; i < num_values; i++) {
+          buf[i] = it->highbits | acont->array[it->in_container_index - i];
+        }
+        buf += num_values;
+        ret += num_values;
+        it->in_container_index -= (int32_t)num_values;
+        it->has_value = (it->in_container_index >= 0);
+        if (it->has_value) {
+          it->current_value =
+              it->highbits | acont->array[it->in_container_index];
+        }
+        break;
+      case RUN_CONTAINER_TYPE_CODE:
+        rcont = (const run_container_t*)(it->container);
+        do {
+          const uint32_t smallest_run_value =
+              it->highbits | rcont->runs[it->run_index].value;
+          // values left in the current run, minus one; bounding num_values
+          // by it keeps current_value from wrapping below zero
+          const uint32_t run_span = it->current_value - smallest_run_value;
+          num_values = minimum_uint32(run_span + 1, count - ret);
+          for (uint32_t i = 0; i < num_values; i++) {
+            buf[i] = it->current_value - i;
+          }
+          buf += num_values;
+          ret += num_values;
+
+          if (num_values > run_span) {  // the run is exhausted
+            it->run_index--;
+            if (it->run_index >= 0) {
+              it->current_value =
+                  it->highbits | (rcont->runs[it->run_index].value +
+                                  rcont->runs[it->run_index].length);
+            } else {
+              it->has_value = false;
+            }
+          } else {
+            it->current_value -= num_values;
+          }
+        } while ((ret < count) && it->has_value);
+        break;
+      default:
+        assert(false);
+    }
+    if (it->has_value) {
+      assert(ret == count);
+      return ret;
+    }
+    it->container_index--;
+    it->has_value = loadlastvalue(it);
+  }
+  return ret;
+}
+
+void roaring_free_uint32_iterator(roaring_uint32_iterator_t *it) { roaring_free(it); }
+
+/****
+* end of roaring_uint32_iterator_t
 *****/
 
+// positions 'it' on the container at it->container_index (payload pointer
+// already advanced past the previous container) and loads its first value;
+// returns false when the containers are exhausted or a payload would run
+// past the end of the buffer
+static bool portable_iterator_load_container(roaring_portable_iterator_t *it) {
+    const char *bufend = it->buf + it->maxbytes;
+    while (it->container_index < it->num_containers) {
+        uint16_t key, card16;
+        memcpy(&key, it->keyscards + 4 * it->container_index, sizeof(key));
+        memcpy(&card16, it->keyscards + 4 * it->container_index + 2,
+               sizeof(card16));
+        uint32_t thiscard = card16 + UINT32_C(1);
+        it->highbits = ((uint32_t)key) << 16;
+        bool isbitmap = (thiscard > DEFAULT_MAX_SIZE);
+        bool isrun = false;
+        if (it->run_bitmap != NULL &&
+            (it->run_bitmap[it->container_index / 8] &
+             (1 << (it->container_index % 8))) != 0) {
+            isbitmap = false;
+            isrun = true;
+        }
+        if (isbitmap) {
+            it->typecode = BITSET_CONTAINER_TYPE_CODE;
+            it->cardinality = thiscard;
+            it->payload_bytes =
+                BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
+            if (it->payload + it->payload_bytes > bufend) return false;
+            // find the first set word
+            it->word = 0;
+            it->in_container_index = -1;
+            while (it->word == 0) {
+                it->in_container_index++;
+                memcpy(&it->word,
+                       it->payload + it->in_container_index * sizeof(uint64_t),
+                       sizeof(uint64_t));
+            }
+            it->current_value =
+                it->highbits | (it->in_container_index * 64 +
+                                __builtin_ctzll(it->word));
+            it->word &= it->word - 1;
+            return true;
+        } else if (isrun) {
+            it->typecode = RUN_CONTAINER_TYPE_CODE;
+            if (it->payload + sizeof(uint16_t) > bufend) return false;
+            uint16_t n_runs;
+            memcpy(&n_runs, it->payload, sizeof(uint16_t));
+            it->payload += sizeof(uint16_t);
+            it->cardinality = n_runs;
+            it->payload_bytes = n_runs * sizeof(rle16_t);
+            if (it->payload + it->payload_bytes > bufend) return false;
+            if (n_runs > 0) {  // a serialized run container is never empty
+                uint16_t start;
+                memcpy(&start, it->payload, sizeof(start));
+                it->run_index = 0;
+                it->in_container_index = 0;
+                it->current_value = it->highbits | start;
+                return true;
+            }
+        } else {
+            it->typecode = ARRAY_CONTAINER_TYPE_CODE;
+            it->cardinality = thiscard;
+            it->payload_bytes = thiscard * sizeof(uint16_t);
+            if (it->payload + it->payload_bytes > bufend) return false;
+            uint16_t first;
+            memcpy(&first, it->payload, sizeof(first));
+            it->in_container_index = 0;
+            it->current_value = it->highbits | first;
+            return true;
+        }
+        // only reachable for a (theoretical) empty container: skip it
+        it->payload += it->payload_bytes;
+        it->container_index++;
+    }
+    return false;
+}
+
+bool roaring_init_portable_iterator(const char *buf, size_t maxbytes,
+                                    roaring_portable_iterator_t *newit) {
+    memset(newit, 0, sizeof(*newit));
+    newit->buf = buf;
+    newit->maxbytes = maxbytes;
+    newit->has_value = false;
+
+    // header parse mirrors ra_portable_deserialize
+    size_t consumed = sizeof(uint32_t);
+    if (consumed > maxbytes) return false;
+    uint32_t cookie;
+    memcpy(&cookie, buf, sizeof(uint32_t));
+    buf += sizeof(uint32_t);
+    int32_t size;
+    if ((cookie & 0xFFFF) == SERIAL_COOKIE) {
+        size = (cookie >> 16) + 1;
+    } else if (cookie == SERIAL_COOKIE_NO_RUNCONTAINER) {
+        consumed += sizeof(int32_t);
+        if (consumed > maxbytes) return false;
+        memcpy(&size, buf, sizeof(int32_t));
+        buf += sizeof(uint32_t);
+    } else {
+        return false;
+    }
+    if (size < 0 || size > (1 << 16)) {
+        return false;
+    }
+    newit->num_containers = size;
+    bool hasrun = (cookie & 0xFFFF) == SERIAL_COOKIE;
+    if (hasrun) {
+        int32_t s = (size + 7) / 8;
+        consumed += s;
+        if (consumed > maxbytes) return false;
+        newit->run_bitmap = buf;
+        buf += s;
+    }
+    consumed += size * 2 * sizeof(uint16_t);
+    if (consumed > maxbytes) return false;
+    newit->keyscards = buf;
+    buf += size * 2 * sizeof(uint16_t);
+    if ((!hasrun) || (size >= NO_OFFSET_THRESHOLD)) {
+        // skip the offsets: the iterator walks the payloads sequentially
+        consumed += size * 4;
+        if (consumed > maxbytes) return false;
+        buf += size * 4;
+    }
+    newit->payload = buf;
+    newit->container_index = 0;
+    newit->has_value = portable_iterator_load_container(newit);
+    return true;
+}
+
+bool roaring_advance_portable_iterator(roaring_portable_iterator_t *it) {
+    if (!it->has_value) return false;
+    switch (it->typecode) {
+        case BITSET_CONTAINER_TYPE_CODE: {
+            while (it->word == 0) {
+                it->in_container_index++;
+                if (it->in_container_index ==
+                    BITSET_CONTAINER_SIZE_IN_WORDS) {
+                    goto next_container;
+                }
+                memcpy(&it->word,
+                       it->payload + it->in_container_index * sizeof(uint64_t),
+                       sizeof(uint64_t));
+            }
+            it->current_value =
+                it->highbits | (it->in_container_index * 64 +
+                                __builtin_ctzll(it->word));
+            it->word &= it->word - 1;
+            return true;
+        }
+        case RUN_CONTAINER_TYPE_CODE: {
+            uint16_t start, length;
+            memcpy(&start, it->payload + it->run_index * sizeof(rle16_t),
+                   sizeof(start));
+            memcpy(&length, it->payload + it->run_index * sizeof(rle16_t) + 2,
+                   sizeof(length));
+            if ((uint32_t)it->in_container_index < (uint32_t)length) {
+                it->in_container_index++;
+                it->current_value =
+                    it->highbits | (uint32_t)(start + it->in_container_index);
+                return true;
+            }
+            it->run_index++;
+            if ((uint32_t)it->run_index < it->cardinality) {
+                memcpy(&start, it->payload + it->run_index * sizeof(rle16_t),
+                       sizeof(start));
+                it->in_container_index = 0;
+                it->current_value = it->highbits | start;
+                return true;
+            }
+            goto next_container;
+        }
+        case ARRAY_CONTAINER_TYPE_CODE: {
+            it->in_container_index++;
+            if ((uint32_t)it->in_container_index < it->cardinality) {
+                uint16_t val;
+                memcpy(&val,
+                       it->payload +
+                           it->in_container_index * sizeof(uint16_t),
+                       sizeof(val));
+                it->current_value = it->highbits | val;
+                return true;
+            }
+            goto next_container;
+        }
+        default:
+            __builtin_unreachable();
+    }
+next_container:
+    it->payload += it->payload_bytes;
+    it->container_index++;
+    it->has_value = portable_iterator_load_container(it);
+    return it->has_value;
+}
+
+// order-dependent combiner for per-container fingerprints (xxHash64 prime)
+static inline uint64_t hash_combine(uint64_t h, uint64_t v) {
+    h ^= v;
+    h *= UINT64_C(0xc2b2ae3d27d4eb4f);
+    return (h << 31) | (h >> 33);
+}
+
+uint64_t roaring_bitmap_hash(const roaring_bitmap_t *ra) {
+    if (ra->high_low_container.flags & ROARING_FLAG_HASH_VALID) {
+        return ra->high_low_container.cached_hash;
+    }
+    uint64_t hash = UINT64_C(0x27d4eb2f165667c5);
+    for (int i = 0; i < ra->high_low_container.size; ++i) {
+        uint64_t fp =
+            container_fingerprint(ra->high_low_container.containers[i],
+                                  ra->high_low_container.typecodes[i]);
+        hash = hash_combine(
+            hash, ((uint64_t)ra->high_low_container.keys[i] << 48) ^ fp);
+    }
+    // the bitmap is logically unchanged, so we allow ourselves to refresh
+    // the cache through the const pointer: subsequent calls are O(1)
+    roaring_array_t *hlc = (roaring_array_t *)&ra->high_low_container;
+    hlc->cached_hash = hash;
+    hlc->flags |= ROARING_FLAG_HASH_VALID;
+    return hash;
+}
+
+int32_t roaring_bitmap_container_fingerprints(const roaring_bitmap_t *ra,
+                                              int32_t capacity, uint16_t *keys,
+                                              uint64_t *fingerprints) {
+    const int32_t size = ra->high_low_container.size;
+    const int32_t n = (capacity < size) ? capacity : size;
+    for (int32_t i = 0; i < n; ++i) {
+        keys[i] = ra->high_low_container.keys[i];
+        fingerprints[i] =
+            container_fingerprint(ra->high_low_container.containers[i],
+                                  ra->high_low_container.typecodes[i]);
+    }
+    return size;
+}
+
 bool roaring_bitmap_equals(const roaring_bitmap_t *ra1,
                            const roaring_bitmap_t *ra2) {
     if (ra1->high_low_container.size != ra2->high_low_container.size) {
         return false;
     }
+    // valid cached totals can refute equality without content comparison
+    if ((ra1->high_low_container.flags & ra2->high_low_container.flags &
+         ROARING_FLAG_CARD_VALID) &&
+        ra1->high_low_container.cached_cardinality !=
+            ra2->high_low_container.cached_cardinality) {
+        return false;
+    }
+    if ((ra1->high_low_container.flags & ra2->high_low_container.flags &
+         ROARING_FLAG_HASH_VALID) &&
+        ra1->high_low_container.cached_hash !=
+            ra2->high_low_container.cached_hash) {
+        return false;
+    }
     for (int i = 0; i < ra1->high_low_container.size; ++i) {
         if (ra1->high_low_container.keys[i] !=
             ra2->high_low_container.keys[i]) {
@@ -1862,6 +4619,16 @@ bool roaring_bitmap_is_subset(const roaring_bitmap_t *ra1,
     const int length1 = ra1->high_low_container.size,
               length2 = ra2->high_low_container.size;
 
+    // containers are never empty, so every key of ra1 must occur in ra2
+    if (length1 > length2) return false;
+    // when both cardinalities are cached, a larger ra1 cannot be a subset
+    if ((ra1->high_low_container.flags & ROARING_FLAG_CARD_VALID) &&
+        (ra2->high_low_container.flags & ROARING_FLAG_CARD_VALID) &&
+        ra1->high_low_container.cached_cardinality >
+            ra2->high_low_container.cached_cardinality) {
+        return false;
+    }
+
     int pos1 = 0, pos2 = 0;
 
     while (pos1 < length1 && pos2 < length2) {
@@ -1956,6 +4723,10 @@ static void insert_fully_flipped_container(roaring_array_t *ans_arr,
     if (i >= 0) {
         void *container_to_flip =
             ra_get_container_at_index(x1_arr, i, &ctype_in);
+        // a full container flips to nothing: skip the key entirely
+        if (container_is_full(container_to_flip, ctype_in)) {
+            return;
+        }
         flipped_container =
             container_not(container_to_flip, ctype_in, &ctype_out);
         if (container_get_cardinality(flipped_container, ctype_out))
@@ -1978,6 +4749,12 @@ static void inplace_fully_flip_container(roaring_array_t *x1_arr, uint16_t hb) {
     if (i >= 0) {
         void *container_to_flip =
             ra_get_container_at_index(x1_arr, i, &ctype_in);
+        // a full container flips to nothing: drop it without negating
+        if (container_is_full(container_to_flip, ctype_in)) {
+            container_free(container_to_flip, ctype_in);
+            ra_remove_at_index(x1_arr, i);
+            return;
+        }
         flipped_container =
             container_inot(container_to_flip, ctype_in, &ctype_out);
 
@@ -1995,6 +4772,63 @@ static void inplace_fully_flip_container(roaring_array_t *x1_arr, uint16_t hb) {
     }
 }
 
+roaring_bitmap_t *roaring_bitmap_add_offset(const roaring_bitmap_t *bm,
+                                            int64_t offset) {
+    roaring_bitmap_t *answer = roaring_bitmap_create();
+    if (answer == NULL) return NULL;
+    roaring_bitmap_set_copy_on_write(answer, is_cow(bm));
+    // split the shift into a key part and an in-container part, keeping the
+    // in-container part non-negative
+    const int64_t container_offset =
+        (offset >= 0) ? (offset >> 16) : -((-offset + 0xFFFF) >> 16);
+    const uint16_t in_offset =
+        (uint16_t)(offset - container_offset * 0x10000);
+    const roaring_array_t *ra = &bm->high_low_container;
+    for (int32_t i = 0; i < ra->size; i++) {
+        const int64_t key = (int64_t)ra->keys[i] + container_offset;
+        if (key < -1 || key > 0xFFFF) {
+            continue;  // both destination blocks fall outside 32 bits
+        }
+        uint8_t type;
+        void *lo, *hi;
+        container_add_offset(ra->containers[i], ra->typecodes[i], &lo, &hi,
+                             &type, in_offset);
+        if (lo != NULL) {
+            if (key >= 0) {
+                roaring_array_t *ans = &answer->high_low_container;
+                if (ans->size > 0 &&
+                    ans->keys[ans->size - 1] == (uint16_t)key) {
+                    // merge with the part spilled from the previous container
+                    void *prev = ans->containers[ans->size - 1];
+                    const uint8_t prev_type = ans->typecodes[ans->size - 1];
+                    uint8_t merged_type;
+                    void *merged =
+                        container_ior(prev, prev_type, lo, type, &merged_type);
+                    if (merged != prev) {
+                        container_free(prev, prev_type);
+                    }
+                    container_free(lo, type);
+                    ans->containers[ans->size - 1] = merged;
+                    ans->typecodes[ans->size - 1] = merged_type;
+                } else {
+                    ra_append(ans, (uint16_t)key, lo, type);
+                }
+            } else {
+                container_free(lo, type);
+            }
+        }
+        if (hi != NULL) {
+            if (key + 1 <= 0xFFFF) {
+                ra_append(&answer->high_low_container, (uint16_t)(key + 1), hi,
+                          type);
+            } else {
+                container_free(hi, type);
+            }
+        }
+    }
+    return answer;
+}
+
 roaring_bitmap_t *roaring_bitmap_flip(const roaring_bitmap_t *x1,
                                       uint64_t range_start,
                                       uint64_t range_end) {
@@ -2051,6 +4885,7 @@ roaring_bitmap_t *roaring_bitmap_flip(const roaring_bitmap_t *x1,
 
 void roaring_bitmap_flip_inplace(roaring_bitmap_t *x1, uint64_t range_start,
                                  uint64_t range_end) {
+    ra_invalidate_cached_cardinality(&x1->high_low_container);
     if (range_start >= range_end) {
         return;  // empty range
     }
@@ -2119,6 +4954,7 @@ roaring_bitmap_t *roaring_bitmap_lazy_or(const roaring_bitmap_t *x1,
                                      BITSET_CONTAINER_TYPE_CODE) &&
                 (get_container_type(c2, container_type_2) !=
                  BITSET_CONTAINER_TYPE_CODE)) {
+                ROARING_INSTRUMENT(lazy_bitset_conversions);
                 void *newc1 =
                     container_mutable_unwrap_shared(c1, &container_type_1);
                 newc1 = container_to_bitset(newc1, container_type_1);
@@ -2190,6 +5026,7 @@ roaring_bitmap_t *roaring_bitmap_lazy_or(const roaring_bitmap_t *x1,
 void roaring_bitmap_lazy_or_inplace(roaring_bitmap_t *x1,
                                     const roaring_bitmap_t *x2,
                                     const bool bitsetconversion) {
+    ra_invalidate_cached_cardinality(&x1->high_low_container);
     uint8_t container_result_type = 0;
     int length1 = x1->high_low_container.size;
     const int length2 = x2->high_low_container.size;
@@ -2215,6 +5052,7 @@ void roaring_bitmap_lazy_or_inplace(roaring_bitmap_t *x1,
                     c1 = get_writable_copy_if_shared(c1, &container_type_1);
                 } else {
                     // convert to bitset
+                    ROARING_INSTRUMENT(lazy_bitset_conversions);
                     void *oldc1 = c1;
                     uint8_t oldt1 = container_type_1;
                     c1 = container_mutable_unwrap_shared(c1, &container_type_1);
@@ -2359,6 +5197,7 @@ roaring_bitmap_t *roaring_bitmap_lazy_xor(const roaring_bitmap_t *x1,
 
 void roaring_bitmap_lazy_xor_inplace(roaring_bitmap_t *x1,
                                      const roaring_bitmap_t *x2) {
+    ra_invalidate_cached_cardinality(&x1->high_low_container);
     assert(x1 != x2);
     uint8_t container_result_type = 0;
     int length1 = x1->high_low_container.size;
@@ -2429,192 +5268,983 @@ void roaring_bitmap_lazy_xor_inplace(roaring_bitmap_t *x1,
     }
 }
 
-void roaring_bitmap_repair_after_lazy(roaring_bitmap_t *ra) {
-    for (int i = 0; i < ra->high_low_container.size; ++i) {
-        const uint8_t original_typecode = ra->high_low_container.typecodes[i];
-        void *container = ra->high_low_container.containers[i];
-        uint8_t new_typecode = original_typecode;
-        void *newcontainer =
-            container_repair_after_lazy(container, &new_typecode);
-        ra->high_low_container.containers[i] = newcontainer;
-        ra->high_low_container.typecodes[i] = new_typecode;
-    }
-}
-
-
-
-/**
-* roaring_bitmap_rank returns the number of integers that are smaller or equal
-* to x.
-*/
-uint64_t roaring_bitmap_rank(const roaring_bitmap_t *bm, uint32_t x) {
-    uint64_t size = 0;
-    uint32_t xhigh = x >> 16;
-    for (int i = 0; i < bm->high_low_container.size; i++) {
-        uint32_t key = bm->high_low_container.keys[i];
-        if (xhigh > key) {
-            size +=
-                container_get_cardinality(bm->high_low_container.containers[i],
-                                          bm->high_low_container.typecodes[i]);
-        } else if (xhigh == key) {
-            return size + container_rank(bm->high_low_container.containers[i],
-                                         bm->high_low_container.typecodes[i],
-                                         x & 0xFFFF);
-        } else {
-            return size;
-        }
-    }
-    return size;
-}
-
-/**
-* roaring_bitmap_smallest returns the smallest value in the set.
-* Returns UINT32_MAX if the set is empty.
-*/
-uint32_t roaring_bitmap_minimum(const roaring_bitmap_t *bm) {
-    if (bm->high_low_container.size > 0) {
-        void *container = bm->high_low_container.containers[0];
-        uint8_t typecode = bm->high_low_container.typecodes[0];
-        uint32_t key = bm->high_low_container.keys[0];
-        uint32_t lowvalue = container_minimum(container, typecode);
-        return lowvalue | (key << 16);
-    }
-    return UINT32_MAX;
-}
-
-/**
-* roaring_bitmap_smallest returns the greatest value in the set.
-* Returns 0 if the set is empty.
-*/
-uint32_t roaring_bitmap_maximum(const roaring_bitmap_t *bm) {
-    if (bm->high_low_container.size > 0) {
-        void *container =
-            bm->high_low_container.containers[bm->high_low_container.size - 1];
-        uint8_t typecode =
-            bm->high_low_container.typecodes[bm->high_low_container.size - 1];
-        uint32_t key =
-            bm->high_low_container.keys[bm->high_low_container.size - 1];
-        uint32_t lowvalue = container_maximum(container, typecode);
-        return lowvalue | (key << 16);
-    }
-    return 0;
-}
-
-bool roaring_bitmap_select(const roaring_bitmap_t *bm, uint32_t rank,
-                           uint32_t *element) {
-    void *container;
-    uint8_t typecode;
-    uint16_t key;
-    uint32_t start_rank = 0;
-    int i = 0;
-    bool valid = false;
-    while (!valid && i < bm->high_low_container.size) {
-        container = bm->high_low_container.containers[i];
-        typecode = bm->high_low_container.typecodes[i];
-        valid =
-            container_select(container, typecode, &start_rank, rank, element);
-        i++;
-    }
-
-    if (valid) {
-        key = bm->high_low_container.keys[i - 1];
-        *element |= (((uint32_t)key) << 16);  // w/o cast, key promotes signed
-        return true;
-    } else
-        return false;
-}
-
-bool roaring_bitmap_intersect(const roaring_bitmap_t *x1,
-                                     const roaring_bitmap_t *x2) {
+roaring_bitmap_t *roaring_bitmap_lazy_and(const roaring_bitmap_t *x1,
+                                          const roaring_bitmap_t *x2) {
+    uint8_t container_result_type = 0;
     const int length1 = x1->high_low_container.size,
               length2 = x2->high_low_container.size;
-    uint64_t answer = 0;
+    uint32_t neededcap = length1 > length2 ? length2 : length1;
+    roaring_bitmap_t *answer = roaring_bitmap_create_with_capacity(neededcap);
+    roaring_bitmap_set_copy_on_write(answer, is_cow(x1) && is_cow(x2));
+
     int pos1 = 0, pos2 = 0;
 
     while (pos1 < length1 && pos2 < length2) {
-        const uint16_t s1 = ra_get_key_at_index(& x1->high_low_container, pos1);
-        const uint16_t s2 = ra_get_key_at_index(& x2->high_low_container, pos2);
+        const uint16_t s1 = ra_get_key_at_index(&x1->high_low_container, pos1);
+        const uint16_t s2 = ra_get_key_at_index(&x2->high_low_container, pos2);
 
         if (s1 == s2) {
             uint8_t container_type_1, container_type_2;
-            void *c1 = ra_get_container_at_index(& x1->high_low_container, pos1,
+            void *c1 = ra_get_container_at_index(&x1->high_low_container, pos1,
                                                  &container_type_1);
-            void *c2 = ra_get_container_at_index(& x2->high_low_container, pos2,
+            void *c2 = ra_get_container_at_index(&x2->high_low_container, pos2,
                                                  &container_type_2);
-            if( container_intersect(c1, container_type_1, c2, container_type_2) ) return true;
+            void *c =
+                container_lazy_and(c1, container_type_1, c2, container_type_2,
+                                   &container_result_type);
+            // container_nonzero_cardinality copes with the unknown-cardinality
+            // containers that the lazy computation produces
+            if (container_nonzero_cardinality(c, container_result_type)) {
+                ra_append(&answer->high_low_container, s1, c,
+                          container_result_type);
+            } else {
+                container_free(
+                    c, container_result_type);  // otherwise:memory leak!
+            }
             ++pos1;
             ++pos2;
         } else if (s1 < s2) {  // s1 < s2
-            pos1 = ra_advance_until(& x1->high_low_container, s2, pos1);
+            pos1 = ra_advance_until(&x1->high_low_container, s2, pos1);
         } else {  // s1 > s2
-            pos2 = ra_advance_until(& x2->high_low_container, s1, pos2);
+            pos2 = ra_advance_until(&x2->high_low_container, s1, pos2);
         }
     }
     return answer;
 }
 
+void roaring_bitmap_lazy_and_inplace(roaring_bitmap_t *x1,
+                                     const roaring_bitmap_t *x2) {
+    ra_invalidate_cached_cardinality(&x1->high_low_container);
+    if (x1 == x2) return;
+    int pos1 = 0, pos2 = 0, intersection_size = 0;
+    const int length1 = ra_get_size(&x1->high_low_container);
+    const int length2 = ra_get_size(&x2->high_low_container);
 
-uint64_t roaring_bitmap_and_cardinality(const roaring_bitmap_t *x1,
-                                        const roaring_bitmap_t *x2) {
-    const int length1 = x1->high_low_container.size,
-              length2 = x2->high_low_container.size;
-    uint64_t answer = 0;
-    int pos1 = 0, pos2 = 0;
-
+    // any skipped-over or newly emptied containers in x1
+    // have to be freed.
     while (pos1 < length1 && pos2 < length2) {
         const uint16_t s1 = ra_get_key_at_index(&x1->high_low_container, pos1);
         const uint16_t s2 = ra_get_key_at_index(&x2->high_low_container, pos2);
 
         if (s1 == s2) {
-            uint8_t container_type_1, container_type_2;
+            uint8_t typecode1, typecode2, typecode_result;
+            void *c1 = ra_get_container_at_index(&x1->high_low_container, pos1,
+                                                 &typecode1);
+            c1 = get_writable_copy_if_shared(c1, &typecode1);
+            void *c2 = ra_get_container_at_index(&x2->high_low_container, pos2,
+                                                 &typecode2);
+            void *c = container_lazy_iand(c1, typecode1, c2, typecode2,
+                                          &typecode_result);
+            if (c != c1) {  // in this instance a new container was created, and
+                            // we need to free the old one
+                container_free(c1, typecode1);
+            }
+            if (container_nonzero_cardinality(c, typecode_result)) {
+                ra_replace_key_and_container_at_index(&x1->high_low_container,
+                                                      intersection_size, s1, c,
+                                                      typecode_result);
+                intersection_size++;
+            } else {
+                container_free(c, typecode_result);
+            }
+            ++pos1;
+            ++pos2;
+        } else if (s1 < s2) {
+            pos1 = ra_advance_until_freeing(&x1->high_low_container, s2, pos1);
+        } else {  // s1 > s2
+            pos2 = ra_advance_until(&x2->high_low_container, s1, pos2);
+        }
+    }
+
+    // if we ended early because x2 ran out, then all remaining in x1 should be
+    // freed
+    while (pos1 < length1) {
+        container_free(x1->high_low_container.containers[pos1],
+                       x1->high_low_container.typecodes[pos1]);
+        ++pos1;
+    }
+
+    // all containers after this have either been copied or freed
+    ra_downsize(&x1->high_low_container, intersection_size);
+}
+
+roaring_bitmap_t *roaring_bitmap_lazy_andnot(const roaring_bitmap_t *x1,
+                                             const roaring_bitmap_t *x2) {
+    uint8_t container_result_type = 0;
+    const int length1 = x1->high_low_container.size,
+              length2 = x2->high_low_container.size;
+    if (0 == length1) {
+        roaring_bitmap_t *empty_bitmap = roaring_bitmap_create();
+        roaring_bitmap_set_copy_on_write(empty_bitmap, is_cow(x1) && is_cow(x2));
+        return empty_bitmap;
+    }
+    if (0 == length2) {
+        return roaring_bitmap_copy(x1);
+    }
+    roaring_bitmap_t *answer = roaring_bitmap_create_with_capacity(length1);
+    roaring_bitmap_set_copy_on_write(answer, is_cow(x1) && is_cow(x2));
+
+    int pos1 = 0, pos2 = 0;
+    uint8_t container_type_1, container_type_2;
+    uint16_t s1 = 0;
+    uint16_t s2 = 0;
+    while (true) {
+        s1 = ra_get_key_at_index(&x1->high_low_container, pos1);
+        s2 = ra_get_key_at_index(&x2->high_low_container, pos2);
+
+        if (s1 == s2) {
+            void *c1 = ra_get_container_at_index(&x1->high_low_container, pos1,
+                                                 &container_type_1);
+            void *c2 = ra_get_container_at_index(&x2->high_low_container, pos2,
+                                                 &container_type_2);
+            void *c = container_lazy_andnot(c1, container_type_1, c2,
+                                            container_type_2,
+                                            &container_result_type);
+
+            if (container_nonzero_cardinality(c, container_result_type)) {
+                ra_append(&answer->high_low_container, s1, c,
+                          container_result_type);
+            } else {
+                container_free(c, container_result_type);
+            }
+            ++pos1;
+            ++pos2;
+            if (pos1 == length1) break;
+            if (pos2 == length2) break;
+        } else if (s1 < s2) {  // s1 < s2
+            const int next_pos1 =
+                ra_advance_until(&x1->high_low_container, s2, pos1);
+            ra_append_copy_range(&answer->high_low_container,
+                                 &x1->high_low_container, pos1, next_pos1,
+                                 is_cow(x1));
+            pos1 = next_pos1;
+            if (pos1 == length1) break;
+        } else {  // s1 > s2
+            pos2 = ra_advance_until(&x2->high_low_container, s1, pos2);
+            if (pos2 == length2) break;
+        }
+    }
+    if (pos2 == length2) {
+        ra_append_copy_range(&answer->high_low_container,
+                             &x1->high_low_container, pos1, length1,
+                             is_cow(x1));
+    }
+    return answer;
+}
+
+void roaring_bitmap_lazy_andnot_inplace(roaring_bitmap_t *x1,
+                                        const roaring_bitmap_t *x2) {
+    ra_invalidate_cached_cardinality(&x1->high_low_container);
+    assert(x1 != x2);
+
+    uint8_t container_result_type = 0;
+    int length1 = x1->high_low_container.size;
+    const int length2 = x2->high_low_container.size;
+    int intersection_size = 0;
+
+    if (0 == length2) return;
+
+    if (0 == length1) {
+        roaring_bitmap_clear(x1);
+        return;
+    }
+
+    int pos1 = 0, pos2 = 0;
+    uint8_t container_type_1, container_type_2;
+    uint16_t s1 = ra_get_key_at_index(&x1->high_low_container, pos1);
+    uint16_t s2 = ra_get_key_at_index(&x2->high_low_container, pos2);
+    while (true) {
+        if (s1 == s2) {
+            void *c1 = ra_get_container_at_index(&x1->high_low_container, pos1,
+                                                 &container_type_1);
+            c1 = get_writable_copy_if_shared(c1, &container_type_1);
+
+            void *c2 = ra_get_container_at_index(&x2->high_low_container, pos2,
+                                                 &container_type_2);
+            void *c = container_lazy_iandnot(c1, container_type_1, c2,
+                                             container_type_2,
+                                             &container_result_type);
+
+            if (container_nonzero_cardinality(c, container_result_type)) {
+                ra_replace_key_and_container_at_index(&x1->high_low_container,
+                                                      intersection_size++, s1,
+                                                      c, container_result_type);
+            } else {
+                container_free(c, container_result_type);
+            }
+
+            ++pos1;
+            ++pos2;
+            if (pos1 == length1) break;
+            if (pos2 == length2) break;
+            s1 = ra_get_key_at_index(&x1->high_low_container, pos1);
+            s2 = ra_get_key_at_index(&x2->high_low_container, pos2);
+
+        } else if (s1 < s2) {  // s1 < s2
+            if (pos1 != intersection_size) {
+                void *c1 = ra_get_container_at_index(&x1->high_low_container,
+                                                     pos1, &container_type_1);
+
+                ra_replace_key_and_container_at_index(&x1->high_low_container,
+                                                      intersection_size, s1, c1,
+                                                      container_type_1);
+            }
+            intersection_size++;
+            pos1++;
+            if (pos1 == length1) break;
+            s1 = ra_get_key_at_index(&x1->high_low_container, pos1);
+
+        } else {  // s1 > s2
+            pos2 = ra_advance_until(&x2->high_low_container, s1, pos2);
+            if (pos2 == length2) break;
+            s2 = ra_get_key_at_index(&x2->high_low_container, pos2);
+        }
+    }
+
+    if (pos1 < length1) {
+        // all containers between intersection_size and
+        // pos1 are junk.  However, they have either been moved
+        // (thus still referenced) or involved in an iandnot
+        // that will clean up all containers that could not be reused.
+        // Thus we should not free the junk containers between
+        // intersection_size and pos1.
+        if (pos1 > intersection_size) {
+            // left slide of remaining items
+            ra_copy_range(&x1->high_low_container, pos1, length1,
+                          intersection_size);
+        }
+        // else current placement is fine
+        intersection_size += (length1 - pos1);
+    }
+    ra_downsize(&x1->high_low_container, intersection_size);
+}
+
+void roaring_bitmap_repair_after_lazy(roaring_bitmap_t *ra) {
+    uint64_t card = 0;
+    for (int i = 0; i < ra->high_low_container.size; ++i) {
+        const uint8_t original_typecode = ra->high_low_container.typecodes[i];
+        void *container = ra->high_low_container.containers[i];
+        uint8_t new_typecode = original_typecode;
+        void *newcontainer =
+            container_repair_after_lazy(container, &new_typecode);
+        if (newcontainer != container || new_typecode != original_typecode) {
+            ROARING_INSTRUMENT(lazy_repairs);
+        }
+        ra->high_low_container.containers[i] = newcontainer;
+        ra->high_low_container.typecodes[i] = new_typecode;
+        card += container_get_cardinality(newcontainer, new_typecode);
+    }
+    // we just visited every container, so the total cardinality comes free
+    ra->high_low_container.cached_cardinality = card;
+    ra->high_low_container.flags |= ROARING_FLAG_CARD_VALID;
+}
+
+
+
+/**
+* roaring_bitmap_rank returns the number of integers that are smaller or equal
+* to x.
+*/
+uint64_t roaring_bitmap_rank(const roaring_bitmap_t *bm, uint32_t x) {
+    const roaring_array_t *hlc = &bm->high_low_container;
+    uint32_t xhigh = x >> 16;
+    // the bitmap is logically unchanged, so we allow ourselves to build the
+    // prefix-cardinality index through the const pointer: once it is in
+    // place a rank is a binary search plus one in-container rank
+    const uint64_t *prefix = ra_get_prefix_index((roaring_array_t *)hlc);
+    if (prefix != NULL) {
+        int32_t i = ra_get_index(hlc, (uint16_t)xhigh);
+        if (i >= 0) {
+            uint64_t before = (i > 0) ? prefix[i - 1] : 0;
+            return before + container_rank(hlc->containers[i],
+                                           hlc->typecodes[i], x & 0xFFFF);
+        }
+        int32_t n_less = -i - 1;  // number of containers with a smaller key
+        return (n_less > 0) ? prefix[n_less - 1] : 0;
+    }
+    // empty bitmap, or the index allocation failed: linear scan
+    uint64_t size = 0;
+    for (int i = 0; i < hlc->size; i++) {
+        uint32_t key = hlc->keys[i];
+        if (xhigh > key) {
+            size += container_get_cardinality(hlc->containers[i],
+                                              hlc->typecodes[i]);
+        } else if (xhigh == key) {
+            return size +
+                   container_rank(hlc->containers[i], hlc->typecodes[i],
+                                  x & 0xFFFF);
+        } else {
+            return size;
+        }
+    }
+    return size;
+}
+
+/**
+ * roaring_bitmap_rank_many answers all the rank queries in [begin, end),
+ * which must be sorted in increasing order, in a single pass over the
+ * containers; the ranks are written to ans.
+ */
+void roaring_bitmap_rank_many(const roaring_bitmap_t *bm,
+                              const uint32_t *begin, const uint32_t *end,
+                              uint64_t *ans) {
+    const roaring_array_t *hlc = &bm->high_low_container;
+    uint64_t size = 0;
+    int32_t i = 0;
+    const uint32_t *iter = begin;
+    while (i < hlc->size && iter != end) {
+        uint32_t x = *iter;
+        uint32_t xhigh = x >> 16;
+        uint32_t key = hlc->keys[i];
+        if (xhigh > key) {
+            size += container_get_cardinality(hlc->containers[i],
+                                              hlc->typecodes[i]);
+            i++;
+        } else if (xhigh == key) {
+            // several queries may land in the same container
+            *ans++ = size + container_rank(hlc->containers[i],
+                                           hlc->typecodes[i], x & 0xFFFF);
+            iter++;
+        } else {
+            *ans++ = size;
+            iter++;
+        }
+    }
+    // the remaining queries fall beyond the last container
+    for (; iter != end; iter++) {
+        *ans++ = size;
+    }
+}
+
+/* Append 'before + rank' to the builder for every member of 'values' (sorted
+ * low 16 bits, in the uint32 scratch layout of container_to_uint32_array)
+ * that is present in the container; ranks are 0-based within the container.
+ * One forward pass per container, whatever its representation. Returns false
+ * only when the builder hits an allocation failure. */
+static bool rank_container_values(const void *c, uint8_t type,
+                                  const uint32_t *values, int n,
+                                  uint64_t before, roaring_builder_t *out) {
+    c = container_unwrap_shared(c, &type);
+    switch (type) {
+        case BITSET_CONTAINER_TYPE_CODE: {
+            const bitset_container_t *bc = (const bitset_container_t *)c;
+            int32_t wordindex = 0;
+            uint32_t cum = 0;  // set bits in words [0, wordindex)
+            for (int i = 0; i < n; i++) {
+                const uint16_t v = (uint16_t)values[i];
+                const int32_t w = v >> 6;
+                while (wordindex < w) {
+                    cum += (uint32_t)__builtin_popcountll(
+                        bc->array[wordindex++]);
+                }
+                const uint64_t word = bc->array[w];
+                const uint64_t bit = UINT64_C(1) << (v & 63);
+                if ((word & bit) == 0) continue;  // absent from the base
+                const uint32_t r =
+                    cum + (uint32_t)__builtin_popcountll(word & (bit - 1));
+                if (!roaring_builder_add(out, (uint32_t)(before + r))) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case ARRAY_CONTAINER_TYPE_CODE: {
+            const array_container_t *ac = (const array_container_t *)c;
+            int32_t idx = 0;
+            for (int i = 0; i < n; i++) {
+                const uint16_t v = (uint16_t)values[i];
+                while (idx < ac->cardinality && ac->array[idx] < v) idx++;
+                if (idx == ac->cardinality) return true;
+                if (ac->array[idx] != v) continue;
+                if (!roaring_builder_add(out, (uint32_t)(before + idx))) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case RUN_CONTAINER_TYPE_CODE: {
+            const run_container_t *rc = (const run_container_t *)c;
+            int32_t j = 0;
+            uint32_t cum = 0;  // values held by runs [0, j)
+            for (int i = 0; i < n; i++) {
+                const uint16_t v = (uint16_t)values[i];
+                while (j < rc->n_runs &&
+                       rc->runs[j].value + rc->runs[j].length < v) {
+                    cum += rc->runs[j].length + 1;
+                    j++;
+                }
+                if (j == rc->n_runs) return true;
+                if (v < rc->runs[j].value) continue;
+                const uint32_t r = cum + (v - rc->runs[j].value);
+                if (!roaring_builder_add(out, (uint32_t)(before + r))) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+    assert(false);
+    __builtin_unreachable();
+    return false;
+}
+
+roaring_bitmap_t *roaring_bitmap_rank_transform(const roaring_bitmap_t *base,
+                                                const roaring_bitmap_t *input) {
+    const roaring_array_t *bhlc = &base->high_low_container;
+    const roaring_array_t *ihlc = &input->high_low_container;
+    roaring_builder_t *out = roaring_builder_create();
+    if (out == NULL) return NULL;
+    // as in roaring_bitmap_rank, building the cached prefix-cardinality
+    // index through the const pointer leaves the bitmap logically unchanged;
+    // repeated transforms against the same base then skip the summing
+    const uint64_t *prefix = ra_get_prefix_index((roaring_array_t *)bhlc);
+    uint32_t *scratch = NULL;  // decoded values of one input container
+    uint64_t before = 0;       // base values held by containers [0, i)
+    int32_t i = 0, j = 0;
+    while (i < bhlc->size && j < ihlc->size) {
+        const uint16_t bkey = bhlc->keys[i], ikey = ihlc->keys[j];
+        if (bkey < ikey) {
+            if (prefix == NULL) {
+                before += container_get_cardinality(bhlc->containers[i],
+                                                    bhlc->typecodes[i]);
+            }
+            i++;
+        } else if (bkey > ikey) {
+            j++;  // no base values here: the input values are dropped
+        } else {
+            if (prefix != NULL) before = (i > 0) ? prefix[i - 1] : 0;
+            if (scratch == NULL) {
+                scratch = (uint32_t *)roaring_malloc((1 << 16) *
+                                                     sizeof(uint32_t));
+                if (scratch == NULL) {
+                    roaring_builder_free(out);
+                    return NULL;
+                }
+            }
+            int n = container_to_uint32_array(scratch, ihlc->containers[j],
+                                              ihlc->typecodes[j], 0);
+            if (!rank_container_values(bhlc->containers[i],
+                                       bhlc->typecodes[i], scratch, n, before,
+                                       out)) {
+                roaring_free(scratch);
+                roaring_builder_free(out);
+                return NULL;
+            }
+            if (prefix == NULL) {
+                before += container_get_cardinality(bhlc->containers[i],
+                                                    bhlc->typecodes[i]);
+            }
+            i++;
+            j++;
+        }
+    }
+    roaring_free(scratch);
+    return roaring_builder_finalize(out);
+}
+
+roaring_bitmap_t *roaring_bitmap_select_transform(
+    const roaring_bitmap_t *base, const roaring_bitmap_t *ranks) {
+    const roaring_array_t *bhlc = &base->high_low_container;
+    const roaring_array_t *rhlc = &ranks->high_low_container;
+    roaring_builder_t *out = roaring_builder_create();
+    if (out == NULL) return NULL;
+    uint32_t *scratch = NULL;  // decoded ranks of one container
+    uint32_t start_rank = 0;   // base values held by containers [0, i)
+    int32_t i = 0;
+    for (int32_t j = 0; j < rhlc->size && i < bhlc->size; j++) {
+        if (scratch == NULL) {
+            scratch = (uint32_t *)roaring_malloc((1 << 16) * sizeof(uint32_t));
+            if (scratch == NULL) {
+                roaring_builder_free(out);
+                return NULL;
+            }
+        }
+        int n = container_to_uint32_array(scratch, rhlc->containers[j],
+                                          rhlc->typecodes[j],
+                                          ((uint32_t)rhlc->keys[j]) << 16);
+        // as in roaring_bitmap_select_many: the ranks are sorted, so the
+        // base containers are visited once, forward only
+        for (int k = 0; k < n && i < bhlc->size;) {
+            uint32_t element;
+            // probe with a copy: see roaring_bitmap_select_many
+            uint32_t probe = start_rank;
+            if (container_select(bhlc->containers[i], bhlc->typecodes[i],
+                                 &probe, scratch[k], &element)) {
+                if (!roaring_builder_add(
+                        out, element | (((uint32_t)bhlc->keys[i]) << 16))) {
+                    roaring_free(scratch);
+                    roaring_builder_free(out);
+                    return NULL;
+                }
+                k++;  // the next rank may land in the same container
+            } else {
+                start_rank = probe;  // now includes this container
+                i++;
+            }
+        }
+    }
+    // ranks at or beyond the cardinality of the base are dropped
+    roaring_free(scratch);
+    return roaring_builder_finalize(out);
+}
+
+/**
+* roaring_bitmap_smallest returns the smallest value in the set.
+* Returns UINT32_MAX if the set is empty.
+*/
+uint32_t roaring_bitmap_minimum(const roaring_bitmap_t *bm) {
+    if (bm->high_low_container.size > 0) {
+        void *container = bm->high_low_container.containers[0];
+        uint8_t typecode = bm->high_low_container.typecodes[0];
+        uint32_t key = bm->high_low_container.keys[0];
+        uint32_t lowvalue = container_minimum(container, typecode);
+        return lowvalue | (key << 16);
+    }
+    return UINT32_MAX;
+}
+
+/**
+* roaring_bitmap_smallest returns the greatest value in the set.
+* Returns 0 if the set is empty.
+*/
+uint32_t roaring_bitmap_maximum(const roaring_bitmap_t *bm) {
+    if (bm->high_low_container.size > 0) {
+        void *container =
+            bm->high_low_container.containers[bm->high_low_container.size - 1];
+        uint8_t typecode =
+            bm->high_low_container.typecodes[bm->high_low_container.size - 1];
+        uint32_t key =
+            bm->high_low_container.keys[bm->high_low_container.size - 1];
+        uint32_t lowvalue = container_maximum(container, typecode);
+        return lowvalue | (key << 16);
+    }
+    return 0;
+}
+
+// ---- container-boundary cursor --------------------------------------
+//
+// Lets an external scheduler split a bitmap into independent work units
+// at container granularity without reaching into roaring_array_t: count
+// the containers, query the value span of each, slice a span off as a
+// zero-copy view, run ordinary operations on the slices, and concatenate
+// the private results back together.
+
+int32_t roaring_bitmap_num_containers(const roaring_bitmap_t *r) {
+    return r->high_low_container.size;
+}
+
+bool roaring_bitmap_container_range(const roaring_bitmap_t *r, int32_t i,
+                                    uint32_t *min, uint32_t *max) {
+    const roaring_array_t *ra = &r->high_low_container;
+    if (i < 0 || i >= ra->size) {
+        return false;
+    }
+    const uint32_t key = ra->keys[i];
+    *min = (key << 16) |
+           container_minimum(ra->containers[i], ra->typecodes[i]);
+    *max = (key << 16) |
+           container_maximum(ra->containers[i], ra->typecodes[i]);
+    return true;
+}
+
+roaring_bitmap_t *roaring_bitmap_container_slice(const roaring_bitmap_t *r,
+                                                 int32_t start, int32_t end) {
+    const roaring_array_t *ra = &r->high_low_container;
+    if (start < 0 || end > ra->size || start > end) {
+        return NULL;
+    }
+    roaring_bitmap_t *ans =
+        roaring_bitmap_create_with_capacity(end - start);
+    if (ans == NULL) {
+        return NULL;
+    }
+    // a compacted bitmap's payloads die with its arena, which the slice
+    // could outlive: deep-copy those instead of sharing
+    const bool share = (ra->arena == NULL);
+    for (int32_t i = start; i < end; ++i) {
+        uint8_t typecode = ra->typecodes[i];
+        // with share, wrap the container in a refcounted shared wrapper,
+        // exactly as copy-on-write copies do; the original ends up holding
+        // the same wrapper, so neither side can pull the payload out from
+        // under the other
+        void *c = get_copy_of_container(ra->containers[i], &typecode, share);
+        if (c == NULL) {
+            roaring_bitmap_free(ans);
+            return NULL;
+        }
+        if (share) {
+            ra->containers[i] = c;
+            ra->typecodes[i] = typecode;
+        }
+        ra_append(&ans->high_low_container, ra->keys[i], c, typecode);
+    }
+    roaring_bitmap_set_copy_on_write(ans, false);
+    return ans;
+}
+
+roaring_bitmap_t *roaring_bitmap_concatenate(size_t number,
+                                             roaring_bitmap_t **pieces) {
+    // validate before consuming anything: key spans must be disjoint and
+    // increasing across the pieces, so a failure leaves them untouched
+    int32_t total = 0;
+    int32_t prev_key = -1;
+    for (size_t k = 0; k < number; ++k) {
+        if (pieces[k] == NULL || is_frozen(pieces[k])) {
+            return NULL;
+        }
+        const roaring_array_t *ra = &pieces[k]->high_low_container;
+        if (ra->size == 0) {
+            continue;
+        }
+        if ((int32_t)ra->keys[0] <= prev_key) {
+            return NULL;
+        }
+        prev_key = ra->keys[ra->size - 1];
+        total += ra->size;
+    }
+    roaring_bitmap_t *answer = roaring_bitmap_create_with_capacity(total);
+    if (answer == NULL) {
+        return NULL;
+    }
+    for (size_t k = 0; k < number; ++k) {
+        roaring_bitmap_t *piece = pieces[k];
+        roaring_array_t *ra = &piece->high_low_container;
+        if (ra->arena != NULL) {
+            // compacted piece: its payloads die with its arena, so copy
+            // them out instead of moving the containers
+            ra_append_copy_range(&answer->high_low_container, ra, 0,
+                                 ra->size, false);
+            roaring_bitmap_free(piece);
+        } else {
+            ra_append_move_range(&answer->high_low_container, ra, 0,
+                                 ra->size);
+            ra_clear_without_containers(ra);
+            roaring_free(piece);
+        }
+        pieces[k] = NULL;
+    }
+    roaring_bitmap_set_copy_on_write(answer, false);
+    return answer;
+}
+
+bool roaring_bitmap_select(const roaring_bitmap_t *bm, uint32_t rank,
+                           uint32_t *element) {
+    const roaring_array_t *hlc = &bm->high_low_container;
+    // see roaring_bitmap_rank for why the const cast is acceptable
+    const uint64_t *prefix = ra_get_prefix_index((roaring_array_t *)hlc);
+    if (prefix != NULL) {
+        if ((uint64_t)rank >= prefix[hlc->size - 1]) {
+            return false;
+        }
+        // first container whose prefix sum exceeds the rank
+        int32_t lo = 0, hi = hlc->size - 1;
+        while (lo < hi) {
+            int32_t mid = lo + (hi - lo) / 2;
+            if (prefix[mid] <= rank) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        uint32_t start_rank = (uint32_t)((lo > 0) ? prefix[lo - 1] : 0);
+        if (!container_select(hlc->containers[lo], hlc->typecodes[lo],
+                              &start_rank, rank, element)) {
+            return false;  // cannot happen: the prefix sums bracket the rank
+        }
+        // w/o the cast, the key promotes signed
+        *element |= (((uint32_t)hlc->keys[lo]) << 16);
+        return true;
+    }
+    // empty bitmap, or the index allocation failed: linear scan
+    void *container;
+    uint8_t typecode;
+    uint16_t key;
+    uint32_t start_rank = 0;
+    int i = 0;
+    bool valid = false;
+    while (!valid && i < hlc->size) {
+        container = hlc->containers[i];
+        typecode = hlc->typecodes[i];
+        valid =
+            container_select(container, typecode, &start_rank, rank, element);
+        i++;
+    }
+
+    if (valid) {
+        key = hlc->keys[i - 1];
+        *element |= (((uint32_t)key) << 16);  // w/o cast, key promotes signed
+        return true;
+    } else
+        return false;
+}
+
+/**
+ * roaring_bitmap_select_many answers all the select queries in [begin, end),
+ * which must be sorted in increasing order, in a single pass over the
+ * containers; the selected values are written to ans. Returns false (leaving
+ * ans partially filled) if some rank is beyond the cardinality.
+ */
+bool roaring_bitmap_select_many(const roaring_bitmap_t *bm,
+                                const uint32_t *begin, const uint32_t *end,
+                                uint32_t *ans) {
+    const roaring_array_t *hlc = &bm->high_low_container;
+    uint32_t start_rank = 0;
+    int32_t i = 0;
+    const uint32_t *iter = begin;
+    while (iter != end) {
+        if (i >= hlc->size) {
+            return false;  // rank beyond the total cardinality
+        }
+        uint32_t element;
+        // probe with a copy: on a hit, bitset selection leaves start_rank
+        // mid-container, which would corrupt later queries landing there
+        uint32_t probe = start_rank;
+        if (container_select(hlc->containers[i], hlc->typecodes[i], &probe,
+                             *iter, &element)) {
+            *ans++ = element | (((uint32_t)hlc->keys[i]) << 16);
+            iter++;  // the next query may land in the same container
+        } else {
+            start_rank = probe;  // now includes this container
+            i++;
+        }
+    }
+    return true;
+}
+
+bool roaring_bitmap_intersect(const roaring_bitmap_t *x1,
+                                     const roaring_bitmap_t *x2) {
+    const int length1 = x1->high_low_container.size,
+              length2 = x2->high_low_container.size;
+    uint64_t answer = 0;
+
+    // skewed case: walk the keys of the smaller side, galloping through
+    // the larger one (see roaring_bitmap_and)
+    const int threshold = 64;  // subject to tuning
+    if (length1 * threshold < length2 || length2 * threshold < length1) {
+        const roaring_array_t *small = (length1 < length2)
+                                           ? &x1->high_low_container
+                                           : &x2->high_low_container;
+        const roaring_array_t *big = (length1 < length2)
+                                         ? &x2->high_low_container
+                                         : &x1->high_low_container;
+        int pos_big = 0;
+        for (int i = 0; i < small->size; ++i) {
+            const uint16_t s = small->keys[i];
+            pos_big = ra_advance_until(big, s, pos_big - 1);
+            if (pos_big == big->size) break;
+            if (big->keys[pos_big] != s) continue;
+            if (container_intersect(small->containers[i], small->typecodes[i],
+                                    big->containers[pos_big],
+                                    big->typecodes[pos_big])) {
+                return true;
+            }
+            ++pos_big;
+        }
+        return false;
+    }
+
+    int pos1 = 0, pos2 = 0;
+
+    while (pos1 < length1 && pos2 < length2) {
+        const uint16_t s1 = ra_get_key_at_index(& x1->high_low_container, pos1);
+        const uint16_t s2 = ra_get_key_at_index(& x2->high_low_container, pos2);
+
+        if (s1 == s2) {
+            uint8_t container_type_1, container_type_2;
+            void *c1 = ra_get_container_at_index(& x1->high_low_container, pos1,
+                                                 &container_type_1);
+            void *c2 = ra_get_container_at_index(& x2->high_low_container, pos2,
+                                                 &container_type_2);
+            if( container_intersect(c1, container_type_1, c2, container_type_2) ) return true;
+            ++pos1;
+            ++pos2;
+        } else if (s1 < s2) {  // s1 < s2
+            pos1 = ra_advance_until(& x1->high_low_container, s2, pos1);
+        } else {  // s1 > s2
+            pos2 = ra_advance_until(& x2->high_low_container, s1, pos2);
+        }
+    }
+    return answer;
+}
+
+bool roaring_bitmap_intersect_with_range(const roaring_bitmap_t *bm,
+                                         uint64_t x, uint64_t y) {
+    if (x >= y || x > (uint64_t)UINT32_MAX) {
+        return false;
+    }
+    roaring_uint32_iterator_t it;
+    roaring_init_iterator(bm, &it);
+    if (!roaring_move_uint32_iterator_equalorlarger(&it, (uint32_t)x)) {
+        return false;
+    }
+    return (uint64_t)it.current_value < y;
+}
+
+
+uint64_t roaring_bitmap_and_cardinality(const roaring_bitmap_t *x1,
+                                        const roaring_bitmap_t *x2) {
+    const int length1 = x1->high_low_container.size,
+              length2 = x2->high_low_container.size;
+    uint64_t answer = 0;
+
+    // skewed case: walk the keys of the smaller side, galloping through
+    // the larger one (see roaring_bitmap_and)
+    const int threshold = 64;  // subject to tuning
+    if (length1 * threshold < length2 || length2 * threshold < length1) {
+        const roaring_array_t *small = (length1 < length2)
+                                           ? &x1->high_low_container
+                                           : &x2->high_low_container;
+        const roaring_array_t *big = (length1 < length2)
+                                         ? &x2->high_low_container
+                                         : &x1->high_low_container;
+        int pos_big = 0;
+        for (int i = 0; i < small->size; ++i) {
+            const uint16_t s = small->keys[i];
+            pos_big = ra_advance_until(big, s, pos_big - 1);
+            if (pos_big == big->size) break;
+            if (big->keys[pos_big] != s) continue;
+            answer += container_and_cardinality(
+                small->containers[i], small->typecodes[i],
+                big->containers[pos_big], big->typecodes[pos_big]);
+            ++pos_big;
+        }
+        return answer;
+    }
+
+    int pos1 = 0, pos2 = 0;
+
+    while (pos1 < length1 && pos2 < length2) {
+        const uint16_t s1 = ra_get_key_at_index(&x1->high_low_container, pos1);
+        const uint16_t s2 = ra_get_key_at_index(&x2->high_low_container, pos2);
+
+        if (s1 == s2) {
+            uint8_t container_type_1, container_type_2;
+            void *c1 = ra_get_container_at_index(&x1->high_low_container, pos1,
+                                                 &container_type_1);
+            void *c2 = ra_get_container_at_index(&x2->high_low_container, pos2,
+                                                 &container_type_2);
+            answer += container_and_cardinality(c1, container_type_1, c2,
+                                                container_type_2);
+            ++pos1;
+            ++pos2;
+        } else if (s1 < s2) {  // s1 < s2
+            pos1 = ra_advance_until(&x1->high_low_container, s2, pos1);
+        } else {  // s1 > s2
+            pos2 = ra_advance_until(&x2->high_low_container, s1, pos2);
+        }
+    }
+    return answer;
+}
+
+double roaring_bitmap_jaccard_index(const roaring_bitmap_t *x1,
+                                    const roaring_bitmap_t *x2) {
+    const uint64_t c1 = roaring_bitmap_get_cardinality(x1);
+    const uint64_t c2 = roaring_bitmap_get_cardinality(x2);
+    const uint64_t inter = roaring_bitmap_and_cardinality(x1, x2);
+    return (double)inter / (double)(c1 + c2 - inter);
+}
+
+uint64_t roaring_bitmap_or_cardinality(const roaring_bitmap_t *x1,
+                                       const roaring_bitmap_t *x2) {
+    const uint64_t c1 = roaring_bitmap_get_cardinality(x1);
+    const uint64_t c2 = roaring_bitmap_get_cardinality(x2);
+    const uint64_t inter = roaring_bitmap_and_cardinality(x1, x2);
+    return c1 + c2 - inter;
+}
+
+uint64_t roaring_bitmap_andnot_cardinality(const roaring_bitmap_t *x1,
+                                           const roaring_bitmap_t *x2) {
+    const int length1 = x1->high_low_container.size,
+              length2 = x2->high_low_container.size;
+    uint64_t answer = 0;
+    int pos1 = 0, pos2 = 0;
+
+    while (pos1 < length1 && pos2 < length2) {
+        const uint16_t s1 = ra_get_key_at_index(&x1->high_low_container, pos1);
+        const uint16_t s2 = ra_get_key_at_index(&x2->high_low_container, pos2);
+
+        if (s1 == s2) {
+            uint8_t container_type_1, container_type_2;
+            void *c1 = ra_get_container_at_index(&x1->high_low_container, pos1,
+                                                 &container_type_1);
+            void *c2 = ra_get_container_at_index(&x2->high_low_container, pos2,
+                                                 &container_type_2);
+            answer += container_andnot_cardinality(c1, container_type_1, c2,
+                                                   container_type_2);
+            ++pos1;
+            ++pos2;
+        } else if (s1 < s2) {  // keys absent from x2 survive whole
+            uint8_t container_type_1;
+            void *c1 = ra_get_container_at_index(&x1->high_low_container, pos1,
+                                                 &container_type_1);
+            answer += container_get_cardinality(c1, container_type_1);
+            ++pos1;
+        } else {  // s1 > s2
+            pos2 = ra_advance_until(&x2->high_low_container, s1, pos2);
+        }
+    }
+    while (pos1 < length1) {
+        uint8_t container_type_1;
+        void *c1 = ra_get_container_at_index(&x1->high_low_container, pos1,
+                                             &container_type_1);
+        answer += container_get_cardinality(c1, container_type_1);
+        ++pos1;
+    }
+    return answer;
+}
+
+uint64_t roaring_bitmap_xor_cardinality(const roaring_bitmap_t *x1,
+                                        const roaring_bitmap_t *x2) {
+    const int length1 = x1->high_low_container.size,
+              length2 = x2->high_low_container.size;
+    uint64_t answer = 0;
+    int pos1 = 0, pos2 = 0;
+
+    while (pos1 < length1 && pos2 < length2) {
+        const uint16_t s1 = ra_get_key_at_index(&x1->high_low_container, pos1);
+        const uint16_t s2 = ra_get_key_at_index(&x2->high_low_container, pos2);
+
+        if (s1 == s2) {
+            uint8_t container_type_1, container_type_2;
             void *c1 = ra_get_container_at_index(&x1->high_low_container, pos1,
                                                  &container_type_1);
             void *c2 = ra_get_container_at_index(&x2->high_low_container, pos2,
                                                  &container_type_2);
-            answer += container_and_cardinality(c1, container_type_1, c2,
+            answer += container_xor_cardinality(c1, container_type_1, c2,
                                                 container_type_2);
             ++pos1;
             ++pos2;
-        } else if (s1 < s2) {  // s1 < s2
-            pos1 = ra_advance_until(&x1->high_low_container, s2, pos1);
+        } else if (s1 < s2) {  // keys unique to either side survive whole
+            uint8_t container_type_1;
+            void *c1 = ra_get_container_at_index(&x1->high_low_container, pos1,
+                                                 &container_type_1);
+            answer += container_get_cardinality(c1, container_type_1);
+            ++pos1;
         } else {  // s1 > s2
-            pos2 = ra_advance_until(&x2->high_low_container, s1, pos2);
+            uint8_t container_type_2;
+            void *c2 = ra_get_container_at_index(&x2->high_low_container, pos2,
+                                                 &container_type_2);
+            answer += container_get_cardinality(c2, container_type_2);
+            ++pos2;
         }
     }
+    while (pos1 < length1) {
+        uint8_t container_type_1;
+        void *c1 = ra_get_container_at_index(&x1->high_low_container, pos1,
+                                             &container_type_1);
+        answer += container_get_cardinality(c1, container_type_1);
+        ++pos1;
+    }
+    while (pos2 < length2) {
+        uint8_t container_type_2;
+        void *c2 = ra_get_container_at_index(&x2->high_low_container, pos2,
+                                             &container_type_2);
+        answer += container_get_cardinality(c2, container_type_2);
+        ++pos2;
+    }
     return answer;
 }
 
-double roaring_bitmap_jaccard_index(const roaring_bitmap_t *x1,
-                                    const roaring_bitmap_t *x2) {
-    const uint64_t c1 = roaring_bitmap_get_cardinality(x1);
-    const uint64_t c2 = roaring_bitmap_get_cardinality(x2);
-    const uint64_t inter = roaring_bitmap_and_cardinality(x1, x2);
-    return (double)inter / (double)(c1 + c2 - inter);
-}
-
-uint64_t roaring_bitmap_or_cardinality(const roaring_bitmap_t *x1,
-                                       const roaring_bitmap_t *x2) {
-    const uint64_t c1 = roaring_bitmap_get_cardinality(x1);
-    const uint64_t c2 = roaring_bitmap_get_cardinality(x2);
-    const uint64_t inter = roaring_bitmap_and_cardinality(x1, x2);
-    return c1 + c2 - inter;
-}
-
-uint64_t roaring_bitmap_andnot_cardinality(const roaring_bitmap_t *x1,
-                                           const roaring_bitmap_t *x2) {
-    const uint64_t c1 = roaring_bitmap_get_cardinality(x1);
-    const uint64_t inter = roaring_bitmap_and_cardinality(x1, x2);
-    return c1 - inter;
-}
-
-uint64_t roaring_bitmap_xor_cardinality(const roaring_bitmap_t *x1,
-                                        const roaring_bitmap_t *x2) {
-    const uint64_t c1 = roaring_bitmap_get_cardinality(x1);
-    const uint64_t c2 = roaring_bitmap_get_cardinality(x2);
-    const uint64_t inter = roaring_bitmap_and_cardinality(x1, x2);
-    return c1 + c2 - 2 * inter;
-}
-
 
 /**
  * Check whether a range of values from range_start (included) to range_end (excluded) is present
@@ -2824,31 +6454,13 @@ void roaring_bitmap_frozen_serialize(const roaring_bitmap_t *rb, char *buf) {
     memcpy(header_zone, &header, 4);
 }
 
-const roaring_bitmap_t *
-roaring_bitmap_frozen_view(const char *buf, size_t length) {
-    if ((uintptr_t)buf % 32 != 0) {
-        return NULL;
-    }
-
-    // cookie and num_containers
-    if (length < 4) {
-        return NULL;
-    }
-    uint32_t header;
-    memcpy(&header, buf + length - 4, 4); // header may be misaligned
-    if ((header & 0x7FFF) != FROZEN_COOKIE) {
-        return NULL;
-    }
-    int32_t num_containers = (header >> 15);
-
-    // typecodes, counts and keys
-    if (length < 4 + (size_t)num_containers * (1 + 2 + 2)) {
-        return NULL;
-    }
-    uint16_t *keys = (uint16_t *)(buf + length - 4 - num_containers * 5);
-    uint16_t *counts = (uint16_t *)(buf + length - 4 - num_containers * 3);
-    uint8_t *typecodes = (uint8_t *)(buf + length - 4 - num_containers * 1);
-
+// builds the arena-backed view shared by roaring_bitmap_frozen_view and
+// roaring_bitmap_frozen_view_v2: 'zones' points at the flat container data
+// and the metadata arrays alias the caller's buffer
+static const roaring_bitmap_t *frozen_view_create(
+        const char *zones, size_t zones_size, const uint16_t *keys,
+        const uint16_t *counts, const uint8_t *typecodes,
+        int32_t num_containers) {
     // {bitset,array,run}_zone
     int32_t num_bitset_containers = 0;
     int32_t num_run_containers = 0;
@@ -2874,13 +6486,12 @@ roaring_bitmap_frozen_view(const char *buf, size_t length) {
                 return NULL;
         }
     }
-    if (length != bitset_zone_size + run_zone_size + array_zone_size +
-                  5 * num_containers + 4) {
+    if (zones_size != bitset_zone_size + run_zone_size + array_zone_size) {
         return NULL;
     }
-    uint64_t *bitset_zone = (uint64_t*) (buf);
-    rle16_t *run_zone = (rle16_t*) (buf + bitset_zone_size);
-    uint16_t *array_zone = (uint16_t*) (buf + bitset_zone_size + run_zone_size);
+    uint64_t *bitset_zone = (uint64_t*) (zones);
+    rle16_t *run_zone = (rle16_t*) (zones + bitset_zone_size);
+    uint16_t *array_zone = (uint16_t*) (zones + bitset_zone_size + run_zone_size);
 
     size_t alloc_size = 0;
     alloc_size += sizeof(roaring_bitmap_t);
@@ -2889,7 +6500,7 @@ roaring_bitmap_frozen_view(const char *buf, size_t length) {
     alloc_size += num_run_containers * sizeof(run_container_t);
     alloc_size += num_array_containers * sizeof(array_container_t);
 
-    char *arena = (char *)malloc(alloc_size);
+    char *arena = (char *)roaring_malloc(alloc_size);
     if (arena == NULL) {
         return NULL;
     }
@@ -2897,6 +6508,10 @@ roaring_bitmap_frozen_view(const char *buf, size_t length) {
     roaring_bitmap_t *rb = (roaring_bitmap_t *)
             arena_alloc(&arena, sizeof(roaring_bitmap_t));
     rb->high_low_container.flags = ROARING_FLAG_FROZEN;
+    rb->high_low_container.cached_cardinality = 0;
+    rb->high_low_container.cached_hash = 0;
+    rb->high_low_container.prefix_cardinality = NULL;
+    rb->high_low_container.arena = NULL;  // the view block is freed wholesale
     rb->high_low_container.allocation_size = num_containers;
     rb->high_low_container.size = num_containers;
     rb->high_low_container.keys = (uint16_t *)keys;
@@ -2909,6 +6524,7 @@ roaring_bitmap_frozen_view(const char *buf, size_t length) {
                 bitset_container_t *bitset = (bitset_container_t *)
                         arena_alloc(&arena, sizeof(bitset_container_t));
                 bitset->array = bitset_zone;
+                bitset->borrowed = 1;  // points into the caller's buffer
                 bitset->cardinality = counts[i] + UINT32_C(1);
                 rb->high_low_container.containers[i] = bitset;
                 bitset_zone += BITSET_CONTAINER_SIZE_IN_WORDS;
@@ -2935,10 +6551,458 @@ roaring_bitmap_frozen_view(const char *buf, size_t length) {
                 break;
             }
             default:
-                free(arena);
+                roaring_free(arena);
                 return NULL;
         }
     }
 
     return rb;
 }
+
+const roaring_bitmap_t *
+roaring_bitmap_frozen_view(const char *buf, size_t length) {
+    if ((uintptr_t)buf % 32 != 0) {
+        return NULL;
+    }
+
+    // cookie and num_containers
+    if (length < 4) {
+        return NULL;
+    }
+    uint32_t header;
+    memcpy(&header, buf + length - 4, 4); // header may be misaligned
+    if ((header & 0x7FFF) != FROZEN_COOKIE) {
+        return NULL;
+    }
+    int32_t num_containers = (header >> 15);
+
+    // typecodes, counts and keys
+    if (length < 4 + (size_t)num_containers * (1 + 2 + 2)) {
+        return NULL;
+    }
+    const uint16_t *keys = (const uint16_t *)(buf + length - 4 - num_containers * 5);
+    const uint16_t *counts = (const uint16_t *)(buf + length - 4 - num_containers * 3);
+    const uint8_t *typecodes = (const uint8_t *)(buf + length - 4 - num_containers * 1);
+
+    return frozen_view_create(buf, length - 4 - 5 * (size_t)num_containers,
+                              keys, counts, typecodes, num_containers);
+}
+
+/*
+ * FROZEN SERIALIZATION FORMAT V2 DESCRIPTION
+ *
+ * Same zone layout as v1, but with a fixed-endianness (little-endian)
+ * encoding, an explicit version header at the *start* of the buffer and a
+ * 32-byte header so the bitset words keep their 32-byte alignment. A file
+ * produced on any host can be mapped with roaring_bitmap_frozen_view_v2
+ * on any little-endian host, regardless of 32/64-bit architecture.
+ *
+ * -- (beginning must be aligned by 32 bytes) --
+ * <cookie>         uint32_t = FROZEN_COOKIE_V2 (little endian)
+ * <version>        uint32_t = 2 (little endian)
+ * <num_containers> uint32_t (little endian)
+ * <reserved>       20 bytes of zeros
+ * <bitset_data>    uint64_t[..] (little endian, 32-byte aligned)
+ * <run_data>       rle16_t[..] (little endian)
+ * <array_data>     uint16_t[..] (little endian)
+ * <keys>           uint16_t[num_containers] (little endian)
+ * <counts>         uint16_t[num_containers] (little endian)
+ * <typecodes>      uint8_t[num_containers]
+ *
+ * Big-endian hosts byte-swap while serializing; the zero-copy view is only
+ * available on little-endian hosts (use portable deserialization there).
+ */
+
+#define FROZEN_V2_HEADER_BYTES 32
+#define FROZEN_V2_VERSION UINT32_C(2)
+
+#if CROARING_IS_BIG_ENDIAN
+static inline uint16_t frozen_v2_bswap16(uint16_t x) {
+    return (uint16_t)((x >> 8) | (x << 8));
+}
+
+static inline uint64_t frozen_v2_bswap64(uint64_t x) {
+    x = ((x & UINT64_C(0x00FF00FF00FF00FF)) << 8) |
+        ((x & UINT64_C(0xFF00FF00FF00FF00)) >> 8);
+    x = ((x & UINT64_C(0x0000FFFF0000FFFF)) << 16) |
+        ((x & UINT64_C(0xFFFF0000FFFF0000)) >> 16);
+    return (x << 32) | (x >> 32);
+}
+
+static void frozen_v2_write16(uint16_t *dst, const uint16_t *src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        uint16_t w = frozen_v2_bswap16(src[i]);
+        memcpy(&dst[i], &w, sizeof(w));
+    }
+}
+#endif  // CROARING_IS_BIG_ENDIAN
+
+inline static void frozen_v2_write32(uint32_t *dst, uint32_t value) {
+#if CROARING_IS_BIG_ENDIAN
+    value = (value >> 24) | ((value >> 8) & 0xFF00) |
+            ((value << 8) & 0xFF0000) | (value << 24);
+#endif
+    memcpy(dst, &value, sizeof(value));
+}
+
+inline static uint32_t frozen_v2_read32(const char *src) {
+    uint32_t value;
+    memcpy(&value, src, sizeof(value));
+#if CROARING_IS_BIG_ENDIAN
+    value = (value >> 24) | ((value >> 8) & 0xFF00) |
+            ((value << 8) & 0xFF0000) | (value << 24);
+#endif
+    return value;
+}
+
+size_t roaring_bitmap_frozen_size_in_bytes_v2(const roaring_bitmap_t *rb) {
+    // v1 counts a 4-byte trailing header; v2 uses a 32-byte leading one
+    return roaring_bitmap_frozen_size_in_bytes(rb) - 4 +
+           FROZEN_V2_HEADER_BYTES;
+}
+
+void roaring_bitmap_frozen_serialize_v2(const roaring_bitmap_t *rb,
+                                        char *buf) {
+    const roaring_array_t *ra = &rb->high_low_container;
+
+    size_t bitset_zone_size = 0;
+    size_t run_zone_size = 0;
+    size_t array_zone_size = 0;
+    for (int32_t i = 0; i < ra->size; i++) {
+        switch (ra->typecodes[i]) {
+            case BITSET_CONTAINER_TYPE_CODE: {
+                bitset_zone_size +=
+                        BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
+                break;
+            }
+            case RUN_CONTAINER_TYPE_CODE: {
+                const run_container_t *run =
+                        (const run_container_t *) ra->containers[i];
+                run_zone_size += run->n_runs * sizeof(rle16_t);
+                break;
+            }
+            case ARRAY_CONTAINER_TYPE_CODE: {
+                const array_container_t *array =
+                        (const array_container_t *) ra->containers[i];
+                array_zone_size += array->cardinality * sizeof(uint16_t);
+                break;
+            }
+            default:
+                __builtin_unreachable();
+        }
+    }
+
+    char *header_zone = (char *)arena_alloc(&buf, FROZEN_V2_HEADER_BYTES);
+    uint64_t *bitset_zone = (uint64_t *)arena_alloc(&buf, bitset_zone_size);
+    rle16_t *run_zone = (rle16_t *)arena_alloc(&buf, run_zone_size);
+    uint16_t *array_zone = (uint16_t *)arena_alloc(&buf, array_zone_size);
+    uint16_t *key_zone = (uint16_t *)arena_alloc(&buf, 2*ra->size);
+    uint16_t *count_zone = (uint16_t *)arena_alloc(&buf, 2*ra->size);
+    uint8_t *typecode_zone = (uint8_t *)arena_alloc(&buf, ra->size);
+
+    memset(header_zone, 0, FROZEN_V2_HEADER_BYTES);
+    frozen_v2_write32((uint32_t *)header_zone, FROZEN_COOKIE_V2);
+    frozen_v2_write32((uint32_t *)(header_zone + 4), FROZEN_V2_VERSION);
+    frozen_v2_write32((uint32_t *)(header_zone + 8), (uint32_t)ra->size);
+
+    for (int32_t i = 0; i < ra->size; i++) {
+        uint16_t count;
+        switch (ra->typecodes[i]) {
+            case BITSET_CONTAINER_TYPE_CODE: {
+                const bitset_container_t *bitset =
+                        (const bitset_container_t *) ra->containers[i];
+#if CROARING_IS_BIG_ENDIAN
+                for (size_t j = 0; j < BITSET_CONTAINER_SIZE_IN_WORDS; j++) {
+                    uint64_t w = frozen_v2_bswap64(bitset->array[j]);
+                    memcpy(&bitset_zone[j], &w, sizeof(w));
+                }
+#else
+                memcpy(bitset_zone, bitset->array,
+                       BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t));
+#endif
+                bitset_zone += BITSET_CONTAINER_SIZE_IN_WORDS;
+                if (bitset->cardinality != BITSET_UNKNOWN_CARDINALITY) {
+                    count = bitset->cardinality - 1;
+                } else {
+                    count = bitset_container_compute_cardinality(bitset) - 1;
+                }
+                break;
+            }
+            case RUN_CONTAINER_TYPE_CODE: {
+                const run_container_t *run =
+                        (const run_container_t *) ra->containers[i];
+#if CROARING_IS_BIG_ENDIAN
+                // rle16_t is a pair of uint16_t values
+                frozen_v2_write16((uint16_t *)run_zone,
+                                  (const uint16_t *)run->runs,
+                                  2 * (size_t)run->n_runs);
+#else
+                memcpy(run_zone, run->runs, run->n_runs * sizeof(rle16_t));
+#endif
+                run_zone += run->n_runs;
+                count = run->n_runs;
+                break;
+            }
+            case ARRAY_CONTAINER_TYPE_CODE: {
+                const array_container_t *array =
+                        (const array_container_t *) ra->containers[i];
+#if CROARING_IS_BIG_ENDIAN
+                frozen_v2_write16(array_zone, array->array,
+                                  array->cardinality);
+#else
+                memcpy(array_zone, array->array,
+                       array->cardinality * sizeof(uint16_t));
+#endif
+                array_zone += array->cardinality;
+                count = array->cardinality - 1;
+                break;
+            }
+            default:
+                __builtin_unreachable();
+        }
+#if CROARING_IS_BIG_ENDIAN
+        uint16_t swapped = frozen_v2_bswap16(count);
+        memcpy(&count_zone[i], &swapped, 2);
+#else
+        memcpy(&count_zone[i], &count, 2);
+#endif
+    }
+#if CROARING_IS_BIG_ENDIAN
+    frozen_v2_write16(key_zone, ra->keys, ra->size);
+#else
+    memcpy(key_zone, ra->keys, ra->size * sizeof(uint16_t));
+#endif
+    memcpy(typecode_zone, ra->typecodes, ra->size * sizeof(uint8_t));
+}
+
+const roaring_bitmap_t *
+roaring_bitmap_frozen_view_v2(const char *buf, size_t length) {
+#if CROARING_IS_BIG_ENDIAN
+    // the zero-copy view aliases little-endian data and cannot byte-swap;
+    // big-endian hosts must deserialize instead
+    (void)buf;
+    (void)length;
+    return NULL;
+#else
+    if ((uintptr_t)buf % 32 != 0) {
+        return NULL;
+    }
+    if (length < FROZEN_V2_HEADER_BYTES) {
+        return NULL;
+    }
+    if (frozen_v2_read32(buf) != FROZEN_COOKIE_V2 ||
+        frozen_v2_read32(buf + 4) != FROZEN_V2_VERSION) {
+        return NULL;
+    }
+    uint32_t num_containers32 = frozen_v2_read32(buf + 8);
+    if (num_containers32 > (UINT32_C(1) << 16)) {
+        return NULL;
+    }
+    int32_t num_containers = (int32_t)num_containers32;
+
+    // typecodes, counts and keys
+    if (length < FROZEN_V2_HEADER_BYTES +
+                 (size_t)num_containers * (1 + 2 + 2)) {
+        return NULL;
+    }
+    const uint16_t *keys = (const uint16_t *)(buf + length - num_containers * 5);
+    const uint16_t *counts = (const uint16_t *)(buf + length - num_containers * 3);
+    const uint8_t *typecodes = (const uint8_t *)(buf + length - num_containers * 1);
+
+    return frozen_view_create(
+        buf + FROZEN_V2_HEADER_BYTES,
+        length - FROZEN_V2_HEADER_BYTES - 5 * (size_t)num_containers, keys,
+        counts, typecodes, num_containers);
+#endif  // CROARING_IS_BIG_ENDIAN
+}
+
+const roaring_bitmap_t *
+roaring_bitmap_portable_deserialize_frozen(const char *buf) {
+    const char *start_of_buf = buf;
+    uint32_t cookie;
+    int32_t num_containers;
+    const char *bitmapOfRunContainers = NULL;
+    bool hasrun = false;
+
+    // cookie and container count (same header layout as
+    // ra_portable_deserialize)
+    memcpy(&cookie, buf, sizeof(uint32_t));
+    buf += sizeof(uint32_t);
+    if (cookie == SERIAL_COOKIE_NO_RUNCONTAINER) {
+        memcpy(&num_containers, buf, sizeof(int32_t));
+        buf += sizeof(int32_t);
+    } else if ((cookie & 0xFFFF) == SERIAL_COOKIE) {
+        num_containers = (cookie >> 16) + 1;
+        hasrun = true;
+        bitmapOfRunContainers = buf;
+        buf += (num_containers + 7) / 8;
+    } else {
+        return NULL;
+    }
+    if (num_containers < 0 || num_containers > (1 << 16)) {
+        return NULL;
+    }
+
+    // the key/cardinality pairs and the offsets may be misaligned (the run
+    // bitmap has arbitrary byte length), so they are read with memcpy below
+    const char *keyscards = buf;
+    buf += num_containers * 2 * sizeof(uint16_t);
+
+    const char *offset_headers = NULL;
+    if ((!hasrun) || (num_containers >= NO_OFFSET_THRESHOLD)) {
+        offset_headers = buf;
+        buf += num_containers * sizeof(uint32_t);
+    }
+
+    // first pass over the payloads: classify the containers and size the
+    // arena. The format carries no alignment guarantee at all — the header
+    // has odd length whenever a run bitmap is present — while the container
+    // kernels assume naturally aligned payloads (32-byte aligned in the
+    // bitset case), so every payload is copied into one aligned arena
+    // rather than aliased in place
+    int32_t num_bitset_containers = 0;
+    int32_t num_run_containers = 0;
+    int32_t num_array_containers = 0;
+    size_t arena_bytes = 0;
+    const char *payload = buf;
+    for (int32_t i = 0; i < num_containers; i++) {
+        uint16_t tmp;
+        memcpy(&tmp, keyscards + 4 * i + 2, sizeof(tmp));
+        uint32_t thiscard = tmp + UINT32_C(1);
+        if (offset_headers != NULL) {
+            uint32_t off;
+            memcpy(&off, offset_headers + 4 * i, sizeof(off));
+            payload = start_of_buf + off;
+        }
+        if (hasrun &&
+            (bitmapOfRunContainers[i / 8] & (1 << (i % 8))) != 0) {
+            num_run_containers++;
+            uint16_t n_runs;
+            memcpy(&n_runs, payload, sizeof(uint16_t));
+            payload += sizeof(uint16_t) + n_runs * sizeof(rle16_t);
+            arena_bytes += n_runs * sizeof(rle16_t);
+        } else if (thiscard > DEFAULT_MAX_SIZE) {
+            num_bitset_containers++;
+            arena_bytes = (arena_bytes + 31) & ~(size_t)31;
+            arena_bytes += BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
+            payload += BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
+        } else {
+            num_array_containers++;
+            arena_bytes += thiscard * sizeof(uint16_t);
+            payload += thiscard * sizeof(uint16_t);
+        }
+    }
+
+    char *payload_zone = NULL;
+    if (arena_bytes > 0) {
+        payload_zone = (char *)roaring_aligned_malloc(32, arena_bytes);
+        if (payload_zone == NULL) {
+            return NULL;
+        }
+    }
+
+    size_t alloc_size = 0;
+    alloc_size += sizeof(roaring_bitmap_t);
+    alloc_size += num_containers * sizeof(void *);
+    alloc_size += num_bitset_containers * sizeof(bitset_container_t);
+    alloc_size += num_run_containers * sizeof(run_container_t);
+    alloc_size += num_array_containers * sizeof(array_container_t);
+    alloc_size += num_containers * sizeof(uint16_t);  // keys
+    alloc_size += num_containers * sizeof(uint8_t);   // typecodes
+
+    char *arena = (char *)roaring_malloc(alloc_size);
+    if (arena == NULL) {
+        roaring_aligned_free(payload_zone);
+        return NULL;
+    }
+
+    roaring_bitmap_t *rb =
+        (roaring_bitmap_t *)arena_alloc(&arena, sizeof(roaring_bitmap_t));
+    rb->high_low_container.flags = ROARING_FLAG_FROZEN;
+    rb->high_low_container.cached_cardinality = 0;
+    rb->high_low_container.cached_hash = 0;
+    rb->high_low_container.prefix_cardinality = NULL;
+    // the view block itself is freed wholesale; the aligned payload arena
+    // (if any) is freed through this field
+    rb->high_low_container.arena = payload_zone;
+    rb->high_low_container.allocation_size = num_containers;
+    rb->high_low_container.size = num_containers;
+    rb->high_low_container.containers =
+        (void **)arena_alloc(&arena, sizeof(void *) * num_containers);
+    bitset_container_t *bitset_shells = (bitset_container_t *)arena_alloc(
+        &arena, sizeof(bitset_container_t) * num_bitset_containers);
+    run_container_t *run_shells = (run_container_t *)arena_alloc(
+        &arena, sizeof(run_container_t) * num_run_containers);
+    array_container_t *array_shells = (array_container_t *)arena_alloc(
+        &arena, sizeof(array_container_t) * num_array_containers);
+    uint16_t *keys =
+        (uint16_t *)arena_alloc(&arena, sizeof(uint16_t) * num_containers);
+    uint8_t *typecodes =
+        (uint8_t *)arena_alloc(&arena, sizeof(uint8_t) * num_containers);
+    rb->high_low_container.keys = keys;
+    rb->high_low_container.typecodes = typecodes;
+
+    // second pass: fill in the shells, copying each payload into its slot
+    // in the aligned arena. Bitset slots are 32-byte aligned; run and array
+    // slots only need 2-byte alignment, which falls out of every payload
+    // size being even and the arena base being 32-byte aligned
+    char *cursor = payload_zone;
+    for (int32_t i = 0; i < num_containers; i++) {
+        uint16_t tmp;
+        memcpy(&tmp, keyscards + 4 * i, sizeof(tmp));
+        keys[i] = tmp;
+        memcpy(&tmp, keyscards + 4 * i + 2, sizeof(tmp));
+        uint32_t thiscard = tmp + UINT32_C(1);
+        bool isbitmap = (thiscard > DEFAULT_MAX_SIZE);
+        bool isrun = false;
+        if (hasrun &&
+            (bitmapOfRunContainers[i / 8] & (1 << (i % 8))) != 0) {
+            isbitmap = false;
+            isrun = true;
+        }
+        if (offset_headers != NULL) {
+            uint32_t off;
+            memcpy(&off, offset_headers + 4 * i, sizeof(off));
+            buf = start_of_buf + off;
+        }
+        if (isbitmap) {
+            bitset_container_t *bitset = bitset_shells++;
+            cursor = payload_zone +
+                     (((cursor - payload_zone) + 31) & ~(ptrdiff_t)31);
+            memcpy(cursor, buf,
+                   BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t));
+            bitset->array = (uint64_t *)cursor;
+            cursor += BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
+            bitset->borrowed = 1;  // owned by the shared arena, not the shell
+            bitset->cardinality = thiscard;
+            rb->high_low_container.containers[i] = bitset;
+            typecodes[i] = BITSET_CONTAINER_TYPE_CODE;
+            buf += BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
+        } else if (isrun) {
+            run_container_t *run = run_shells++;
+            uint16_t n_runs;
+            memcpy(&n_runs, buf, sizeof(uint16_t));
+            buf += sizeof(uint16_t);
+            run->n_runs = n_runs;
+            run->capacity = n_runs;
+            memcpy(cursor, buf, n_runs * sizeof(rle16_t));
+            run->runs = (rle16_t *)cursor;
+            cursor += n_runs * sizeof(rle16_t);
+            rb->high_low_container.containers[i] = run;
+            typecodes[i] = RUN_CONTAINER_TYPE_CODE;
+            buf += n_runs * sizeof(rle16_t);
+        } else {
+            array_container_t *array = array_shells++;
+            memcpy(cursor, buf, thiscard * sizeof(uint16_t));
+            array->array = (uint16_t *)cursor;
+            cursor += thiscard * sizeof(uint16_t);
+            array->cardinality = thiscard;
+            array->capacity = thiscard;
+            rb->high_low_container.containers[i] = array;
+            typecodes[i] = ARRAY_CONTAINER_TYPE_CODE;
+            buf += thiscard * sizeof(uint16_t);
+        }
+    }
+
+    return rb;
+}
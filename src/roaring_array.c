@@ -7,6 +7,7 @@
 
 #include <roaring/containers/bitset.h>
 #include <roaring/containers/containers.h>
+#include <roaring/memory.h>
 #include <roaring/roaring_array.h>
 
 // Convention: [0,ra->size) all elements are initialized
@@ -29,31 +30,42 @@ extern inline void ra_set_container_at_index(const roaring_array_t *ra,
 static bool realloc_array(roaring_array_t *ra, int32_t new_capacity) {
     // because we combine the allocations, it is not possible to use realloc
     /*ra->keys =
-    (uint16_t *)realloc(ra->keys, sizeof(uint16_t) * new_capacity);
+    (uint16_t *)roaring_realloc(ra->keys, sizeof(uint16_t) * new_capacity);
 ra->containers =
-    (void **)realloc(ra->containers, sizeof(void *) * new_capacity);
+    (void **)roaring_realloc(ra->containers, sizeof(void *) * new_capacity);
 ra->typecodes =
-    (uint8_t *)realloc(ra->typecodes, sizeof(uint8_t) * new_capacity);
+    (uint8_t *)roaring_realloc(ra->typecodes, sizeof(uint8_t) * new_capacity);
 if (!ra->keys || !ra->containers || !ra->typecodes) {
-    free(ra->keys);
-    free(ra->containers);
-    free(ra->typecodes);
+    roaring_free(ra->keys);
+    roaring_free(ra->containers);
+    roaring_free(ra->typecodes);
     return false;
 }*/
 
-    if ( new_capacity == 0 ) {
-      free(ra->containers);
-      ra->containers = NULL;
-      ra->keys = NULL;
-      ra->typecodes = NULL;
-      ra->allocation_size = 0;
+    if (new_capacity <= ROARING_ARRAY_INLINE_SLOTS) {
+      // small enough to live in the inline slots; move back if we spilled
+      if (!ra_is_inline(ra)) {
+        void *oldbigalloc = ra->containers;
+        if (ra->size > 0) {
+          memcpy(ra->inline_containers, ra->containers,
+                 sizeof(void *) * ra->size);
+          memcpy(ra->inline_keys, ra->keys, sizeof(uint16_t) * ra->size);
+          memcpy(ra->inline_typecodes, ra->typecodes,
+                 sizeof(uint8_t) * ra->size);
+        }
+        ra->containers = ra->inline_containers;
+        ra->keys = ra->inline_keys;
+        ra->typecodes = ra->inline_typecodes;
+        roaring_free(oldbigalloc);
+      }
+      ra->allocation_size = ROARING_ARRAY_INLINE_SLOTS;
       return true;
     }
     const size_t memoryneeded =
         new_capacity * (sizeof(uint16_t) + sizeof(void *) + sizeof(uint8_t));
-    void *bigalloc = malloc(memoryneeded);
+    void *bigalloc = roaring_malloc(memoryneeded);
     if (!bigalloc) return false;
-    void *oldbigalloc = ra->containers;
+    void *oldbigalloc = ra_is_inline(ra) ? NULL : (void *)ra->containers;
     void **newcontainers = (void **)bigalloc;
     uint16_t *newkeys = (uint16_t *)(newcontainers + new_capacity);
     uint8_t *newtypecodes = (uint8_t *)(newkeys + new_capacity);
@@ -68,7 +80,7 @@ if (!ra->keys || !ra->containers || !ra->typecodes) {
     ra->keys = newkeys;
     ra->typecodes = newtypecodes;
     ra->allocation_size = new_capacity;
-    free(oldbigalloc);
+    roaring_free(oldbigalloc);
     return true;
 }
 
@@ -78,9 +90,9 @@ bool ra_init_with_capacity(roaring_array_t *new_ra, uint32_t cap) {
 
     if (cap > INT32_MAX) { return false; }
 
-    if(cap > 0) {
+    if(cap > ROARING_ARRAY_INLINE_SLOTS) {  // ra_init covers smaller requests
       void *bigalloc =
-        malloc(cap * (sizeof(uint16_t) + sizeof(void *) + sizeof(uint8_t)));
+        roaring_malloc(cap * (sizeof(uint16_t) + sizeof(void *) + sizeof(uint8_t)));
       if( bigalloc == NULL ) return false;
       new_ra->containers = (void **)bigalloc;
       new_ra->keys = (uint16_t *)(new_ra->containers + cap);
@@ -92,31 +104,43 @@ bool ra_init_with_capacity(roaring_array_t *new_ra, uint32_t cap) {
 }
 
 int ra_shrink_to_fit(roaring_array_t *ra) {
+    const bool was_inline = ra_is_inline(ra);
     int savings = (ra->allocation_size - ra->size) *
                   (sizeof(uint16_t) + sizeof(void *) + sizeof(uint8_t));
     if (!realloc_array(ra, ra->size)) {
       return 0;
     }
-    ra->allocation_size = ra->size;
+    if (ra_is_inline(ra)) {
+        // the whole heap block (if any) was released; the inline slots
+        // keep their fixed capacity
+        if (was_inline) savings = 0;
+    } else {
+        ra->allocation_size = ra->size;
+    }
     return savings;
 }
 
 void ra_init(roaring_array_t *new_ra) {
     if (!new_ra) { return; }
-    new_ra->keys = NULL;
-    new_ra->containers = NULL;
-    new_ra->typecodes = NULL;
+    // start on the inline slots; nothing hits the heap until the array
+    // grows past ROARING_ARRAY_INLINE_SLOTS
+    new_ra->keys = new_ra->inline_keys;
+    new_ra->containers = new_ra->inline_containers;
+    new_ra->typecodes = new_ra->inline_typecodes;
 
-    new_ra->allocation_size = 0;
+    new_ra->allocation_size = ROARING_ARRAY_INLINE_SLOTS;
     new_ra->size = 0;
     new_ra->flags = 0;
+    new_ra->cached_cardinality = 0;
+    new_ra->cached_hash = 0;
+    new_ra->prefix_cardinality = NULL;
+    new_ra->arena = NULL;
 }
 
 bool ra_copy(const roaring_array_t *source, roaring_array_t *dest,
              bool copy_on_write) {
     if (!ra_init_with_capacity(dest, source->size)) return false;
     dest->size = source->size;
-    dest->allocation_size = source->size;
     if(dest->size > 0) {
       memcpy(dest->keys, source->keys, dest->size * sizeof(uint16_t));
     }
@@ -134,13 +158,14 @@ bool ra_copy(const roaring_array_t *source, roaring_array_t *dest,
                dest->size * sizeof(uint8_t));
         }
     } else {
-        if(dest->size > 0) {
-          memcpy(dest->typecodes, source->typecodes,
-               dest->size * sizeof(uint8_t));
-        }
         for (int32_t i = 0; i < dest->size; i++) {
-            dest->containers[i] =
-                container_clone(source->containers[i], source->typecodes[i]);
+            // the clone of a shared container is a plain container, so the
+            // destination records the unwrapped typecode, not the source's
+            uint8_t typecode = source->typecodes[i];
+            const void *c =
+                container_unwrap_shared(source->containers[i], &typecode);
+            dest->typecodes[i] = typecode;
+            dest->containers[i] = container_clone(c, typecode);
             if (dest->containers[i] == NULL) {
                 for (int32_t j = 0; j < i; j++) {
                     container_free(dest->containers[j], dest->typecodes[j]);
@@ -150,21 +175,27 @@ bool ra_copy(const roaring_array_t *source, roaring_array_t *dest,
             }
         }
     }
+    // same values as the source, so the source's caches carry over
+    dest->cached_cardinality = source->cached_cardinality;
+    dest->cached_hash = source->cached_hash;
+    dest->flags |=
+        source->flags & (ROARING_FLAG_CARD_VALID | ROARING_FLAG_HASH_VALID);
     return true;
 }
 
 bool ra_overwrite(const roaring_array_t *source, roaring_array_t *dest,
                   bool copy_on_write) {
-    ra_clear_containers(dest);  // we are going to overwrite them
-    if (dest->allocation_size < source->size) {
-        if (!realloc_array(dest, source->size)) {
-            return false;
-        }
-    }
-    dest->size = source->size;
-    memcpy(dest->keys, source->keys, dest->size * sizeof(uint16_t));
-    // we go through the containers, turning them into shared containers...
+    ra_invalidate_prefix_index(dest);
     if (copy_on_write) {
+        ra_clear_containers(dest);  // we are going to overwrite them
+        if (dest->allocation_size < source->size) {
+            if (!realloc_array(dest, source->size)) {
+                return false;
+            }
+        }
+        dest->size = source->size;
+        memcpy(dest->keys, source->keys, dest->size * sizeof(uint16_t));
+        // we go through the containers, turning them into shared containers...
         for (int32_t i = 0; i < dest->size; ++i) {
             source->containers[i] = get_copy_of_container(
                 source->containers[i], &source->typecodes[i], copy_on_write);
@@ -175,20 +206,53 @@ bool ra_overwrite(const roaring_array_t *source, roaring_array_t *dest,
         memcpy(dest->typecodes, source->typecodes,
                dest->size * sizeof(uint8_t));
     } else {
-        memcpy(dest->typecodes, source->typecodes,
-               dest->size * sizeof(uint8_t));
+        // recycle the destination's containers in place where layouts allow,
+        // so repeated overwrites are allocation-free in the steady state
+        const int32_t keep =
+            (dest->size < source->size) ? dest->size : source->size;
+        for (int32_t i = keep; i < dest->size; ++i) {
+            container_free(dest->containers[i], dest->typecodes[i]);
+        }
+        if (dest->allocation_size < source->size) {
+            if (!realloc_array(dest, source->size)) {
+                for (int32_t i = 0; i < keep; ++i) {
+                    container_free(dest->containers[i], dest->typecodes[i]);
+                }
+                ra_clear_without_containers(dest);
+                return false;
+            }
+        }
+        dest->size = source->size;
+        memcpy(dest->keys, source->keys, dest->size * sizeof(uint16_t));
         for (int32_t i = 0; i < dest->size; i++) {
-            dest->containers[i] =
-                container_clone(source->containers[i], source->typecodes[i]);
+            if (i < keep) {
+                dest->containers[i] = container_overwrite(
+                    dest->containers[i], dest->typecodes[i],
+                    source->containers[i], source->typecodes[i],
+                    &dest->typecodes[i]);
+            } else {
+                dest->typecodes[i] = source->typecodes[i];
+                dest->containers[i] = container_clone(source->containers[i],
+                                                      source->typecodes[i]);
+            }
             if (dest->containers[i] == NULL) {
                 for (int32_t j = 0; j < i; j++) {
                     container_free(dest->containers[j], dest->typecodes[j]);
                 }
+                // destination containers not yet recycled are still ours
+                for (int32_t j = i + 1; j < keep; j++) {
+                    container_free(dest->containers[j], dest->typecodes[j]);
+                }
                 ra_clear_without_containers(dest);
                 return false;
             }
         }
     }
+    dest->cached_cardinality = source->cached_cardinality;
+    dest->cached_hash = source->cached_hash;
+    dest->flags &= ~(ROARING_FLAG_CARD_VALID | ROARING_FLAG_HASH_VALID);
+    dest->flags |=
+        source->flags & (ROARING_FLAG_CARD_VALID | ROARING_FLAG_HASH_VALID);
     return true;
 }
 
@@ -200,24 +264,58 @@ void ra_clear_containers(roaring_array_t *ra) {
 
 void ra_reset(roaring_array_t *ra) {
   ra_clear_containers(ra);
+  if (ra->arena != NULL) {  // no container borrows from it anymore
+    roaring_aligned_free(ra->arena);
+    ra->arena = NULL;
+  }
   ra->size = 0;
   ra_shrink_to_fit(ra);
+  ra->cached_cardinality = 0;
+  ra->flags |= ROARING_FLAG_CARD_VALID;
+  ra->flags &= ~ROARING_FLAG_HASH_VALID;
+  ra_invalidate_prefix_index(ra);
 }
 
 void ra_clear_without_containers(roaring_array_t *ra) {
-    free(ra->containers);    // keys and typecodes are allocated with containers
+    if (!ra_is_inline(ra)) {
+        // keys and typecodes are allocated with containers
+        roaring_free(ra->containers);
+    }
+    ra_invalidate_prefix_index(ra);
     ra->size = 0;
-    ra->allocation_size = 0;
-    ra->containers = NULL;
-    ra->keys = NULL;
-    ra->typecodes = NULL;
+    ra->allocation_size = ROARING_ARRAY_INLINE_SLOTS;
+    ra->containers = ra->inline_containers;
+    ra->keys = ra->inline_keys;
+    ra->typecodes = ra->inline_typecodes;
 }
 
 void ra_clear(roaring_array_t *ra) {
     ra_clear_containers(ra);
+    if (ra->arena != NULL) {  // no container borrows from it anymore
+        roaring_aligned_free(ra->arena);
+        ra->arena = NULL;
+    }
     ra_clear_without_containers(ra);
 }
 
+const uint64_t *ra_get_prefix_index(roaring_array_t *ra) {
+    if (ra->prefix_cardinality != NULL) return ra->prefix_cardinality;
+    if (ra->size == 0) return NULL;
+    uint64_t *prefix =
+        (uint64_t *)roaring_malloc(sizeof(uint64_t) * ra->size);
+    if (prefix == NULL) return NULL;
+    uint64_t total = 0;
+    for (int32_t i = 0; i < ra->size; i++) {
+        total += container_get_cardinality(ra->containers[i], ra->typecodes[i]);
+        prefix[i] = total;
+    }
+    ra->prefix_cardinality = prefix;
+    // we just summed every container, so the total comes free
+    ra->cached_cardinality = total;
+    ra->flags |= ROARING_FLAG_CARD_VALID;
+    return prefix;
+}
+
 bool extend_array(roaring_array_t *ra, int32_t k) {
     int32_t desired_size = ra->size + k;
     assert(desired_size <= MAX_CONTAINERS);
@@ -504,7 +602,7 @@ bool ra_range_uint32_array(const roaring_array_t *ra, size_t offset, size_t limi
                 //first_skip = t_limit - (ctr + t_limit - offset);
                 first_skip = offset - ctr;
                 first = true;
-                t_ans = (uint32_t *)malloc(sizeof(*t_ans) * (first_skip + limit));
+                t_ans = (uint32_t *)roaring_malloc(sizeof(*t_ans) * (first_skip + limit));
                 if(t_ans == NULL) {
                   return false;
                 }
@@ -512,15 +610,15 @@ bool ra_range_uint32_array(const roaring_array_t *ra, size_t offset, size_t limi
                 cur_len = first_skip + limit;
             }
             if (dtr + t_limit > cur_len){
-                uint32_t * append_ans = (uint32_t *)malloc(sizeof(*append_ans) * (cur_len + t_limit));
+                uint32_t * append_ans = (uint32_t *)roaring_malloc(sizeof(*append_ans) * (cur_len + t_limit));
                 if(append_ans == NULL) {
-                  if(t_ans != NULL) free(t_ans);
+                  if(t_ans != NULL) roaring_free(t_ans);
                   return false;
                 }
                 memset(append_ans, 0, sizeof(*append_ans) * (cur_len + t_limit));
                 cur_len = cur_len + t_limit;
                 memcpy(append_ans, t_ans, dtr * sizeof(uint32_t));
-                free(t_ans);
+                roaring_free(t_ans);
                 t_ans = append_ans;
             }
             switch (ra->typecodes[i]) {
@@ -547,7 +645,7 @@ bool ra_range_uint32_array(const roaring_array_t *ra, size_t offset, size_t limi
     }
     if(t_ans != NULL) {
       memcpy(ans, t_ans+first_skip, limit * sizeof(uint32_t));
-      free(t_ans);
+      roaring_free(t_ans);
     }
     return true;
 }
@@ -592,7 +690,7 @@ size_t ra_portable_serialize(const roaring_array_t *ra, char *buf) {
         memcpy(buf, &cookie, sizeof(cookie));
         buf += sizeof(cookie);
         uint32_t s = (ra->size + 7) / 8;
-        uint8_t *bitmapOfRunContainers = (uint8_t *)calloc(s, 1);
+        uint8_t *bitmapOfRunContainers = (uint8_t *)roaring_calloc(s, 1);
         assert(bitmapOfRunContainers != NULL);  // todo: handle
         for (int32_t i = 0; i < ra->size; ++i) {
             if (get_container_type(ra->containers[i], ra->typecodes[i]) ==
@@ -602,7 +700,7 @@ size_t ra_portable_serialize(const roaring_array_t *ra, char *buf) {
         }
         memcpy(buf, bitmapOfRunContainers, s);
         buf += s;
-        free(bitmapOfRunContainers);
+        roaring_free(bitmapOfRunContainers);
         if (ra->size < NO_OFFSET_THRESHOLD) {
             startOffset = 4 + 4 * ra->size + s;
         } else {
@@ -644,6 +742,109 @@ size_t ra_portable_serialize(const roaring_array_t *ra, char *buf) {
     return buf - initbuf;
 }
 
+// streams one container's payload to the writer, pointing straight into
+// container memory rather than staging it in a buffer
+static bool container_write_to(const void *container, uint8_t typecode,
+                               roaring_writer_t writer, void *arg) {
+    container = container_unwrap_shared(container, &typecode);
+    switch (typecode) {
+        case BITSET_CONTAINER_TYPE_CODE: {
+            const bitset_container_t *bitset =
+                (const bitset_container_t *)container;
+            return writer((const char *)bitset->array,
+                          BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t),
+                          arg);
+        }
+        case RUN_CONTAINER_TYPE_CODE: {
+            const run_container_t *run = (const run_container_t *)container;
+            uint16_t cast_16 = (uint16_t)run->n_runs;
+            if (!writer((const char *)&cast_16, sizeof(uint16_t), arg)) {
+                return false;
+            }
+            return writer((const char *)run->runs,
+                          run->n_runs * sizeof(rle16_t), arg);
+        }
+        case ARRAY_CONTAINER_TYPE_CODE: {
+            const array_container_t *array =
+                (const array_container_t *)container;
+            return writer((const char *)array->array,
+                          array->cardinality * sizeof(uint16_t), arg);
+        }
+        default:
+            assert(false);
+            __builtin_unreachable();
+            return false;
+    }
+}
+
+size_t ra_portable_serialize_to(const roaring_array_t *ra,
+                                roaring_writer_t writer, void *arg) {
+    size_t written = 0;
+    uint32_t startOffset = 0;
+    bool hasrun = ra_has_run_container(ra);
+    if (hasrun) {
+        uint32_t cookie = SERIAL_COOKIE | ((ra->size - 1) << 16);
+        if (!writer((const char *)&cookie, sizeof(cookie), arg)) return 0;
+        written += sizeof(cookie);
+        uint32_t s = (ra->size + 7) / 8;
+        // at most (1 << 16) containers, so the run bitmap fits on the stack
+        uint8_t bitmapOfRunContainers[(1 << 16) / 8];
+        memset(bitmapOfRunContainers, 0, s);
+        for (int32_t i = 0; i < ra->size; ++i) {
+            if (get_container_type(ra->containers[i], ra->typecodes[i]) ==
+                RUN_CONTAINER_TYPE_CODE) {
+                bitmapOfRunContainers[i / 8] |= (1 << (i % 8));
+            }
+        }
+        if (!writer((const char *)bitmapOfRunContainers, s, arg)) return 0;
+        written += s;
+        if (ra->size < NO_OFFSET_THRESHOLD) {
+            startOffset = 4 + 4 * ra->size + s;
+        } else {
+            startOffset = 4 + 8 * ra->size + s;
+        }
+    } else {  // backwards compatibility
+        uint32_t cookie = SERIAL_COOKIE_NO_RUNCONTAINER;
+
+        if (!writer((const char *)&cookie, sizeof(cookie), arg)) return 0;
+        written += sizeof(cookie);
+        if (!writer((const char *)&ra->size, sizeof(ra->size), arg)) return 0;
+        written += sizeof(ra->size);
+
+        startOffset = 4 + 4 + 4 * ra->size + 4 * ra->size;
+    }
+    for (int32_t k = 0; k < ra->size; ++k) {
+        uint16_t keycard[2];
+        keycard[0] = ra->keys[k];
+        // get_cardinality returns a value in [1,1<<16], subtracting one
+        // we get [0,1<<16 - 1] which fits in 16 bits
+        keycard[1] = (uint16_t)(
+            container_get_cardinality(ra->containers[k], ra->typecodes[k]) - 1);
+        if (!writer((const char *)keycard, sizeof(keycard), arg)) return 0;
+        written += sizeof(keycard);
+    }
+    if ((!hasrun) || (ra->size >= NO_OFFSET_THRESHOLD)) {
+        // writing the containers offsets
+        for (int32_t k = 0; k < ra->size; k++) {
+            if (!writer((const char *)&startOffset, sizeof(startOffset), arg)) {
+                return 0;
+            }
+            written += sizeof(startOffset);
+            startOffset =
+                startOffset +
+                container_size_in_bytes(ra->containers[k], ra->typecodes[k]);
+        }
+    }
+    for (int32_t k = 0; k < ra->size; ++k) {
+        if (!container_write_to(ra->containers[k], ra->typecodes[k], writer,
+                                arg)) {
+            return 0;
+        }
+        written += container_size_in_bytes(ra->containers[k], ra->typecodes[k]);
+    }
+    return written;
+}
+
 // Quickly checks whether there is a serialized bitmap at the pointer,
 // not exceeding size "maxbytes" in bytes. This function does not allocate
 // memory dynamically.
@@ -732,10 +933,74 @@ size_t ra_portable_deserialize_size(const char *buf, const size_t maxbytes) {
 }
 
 
+/* Scan the raw 8 kB payload of a serialized bitset container, appending each
+ * run of consecutive set bits to out (when out is not NULL) and returning the
+ * number of runs. Counting and emission share this one loop so that the
+ * emission pass cannot overflow a run container sized from the counting pass.
+ * The payload may be unaligned, hence the word-at-a-time memcpy. */
+static int32_t bitset_payload_runs(const char *buf, rle16_t *out) {
+    int32_t n_runs = 0;
+    bool open = false;  // run from the previous word continues at bit 0
+    for (int32_t i = 0; i < BITSET_CONTAINER_SIZE_IN_WORDS; ++i) {
+        uint64_t word;
+        memcpy(&word, buf + i * sizeof(uint64_t), sizeof(uint64_t));
+        bool continues = open;
+        open = false;
+        int pos = 0;
+        while (pos < 64) {
+            uint64_t shifted = word >> pos;
+            if (shifted == 0) break;
+            int start = pos + __builtin_ctzll(shifted);
+            uint64_t ones = shifted >> (start - pos);
+            int length =
+                (~ones == UINT64_C(0)) ? 64 - start : __builtin_ctzll(~ones);
+            if (continues && start == 0) {
+                if (out != NULL) out[n_runs - 1].length += length;
+            } else {
+                if (out != NULL) {
+                    out[n_runs].value = (uint16_t)(i * 64 + start);
+                    out[n_runs].length = (uint16_t)(length - 1);
+                }
+                n_runs++;
+            }
+            continues = false;
+            pos = start + length;
+            open = (pos == 64);
+        }
+    }
+    return n_runs;
+}
+
+/* Same idea for the payload of a serialized array container: count
+ * (out == NULL) or emit the runs among the cardinality sorted values. */
+static int32_t array_payload_runs(const char *buf, uint32_t cardinality,
+                                  rle16_t *out) {
+    int32_t n_runs = 0;
+    uint32_t prev = 0;
+    for (uint32_t i = 0; i < cardinality; ++i) {
+        uint16_t value;
+        memcpy(&value, buf + i * sizeof(uint16_t), sizeof(uint16_t));
+        if (i > 0 && value == prev + 1) {
+            if (out != NULL) out[n_runs - 1].length++;
+        } else {
+            if (out != NULL) {
+                out[n_runs].value = value;
+                out[n_runs].length = 0;
+            }
+            n_runs++;
+        }
+        prev = value;
+    }
+    return n_runs;
+}
+
 // this function populates answer from the content of buf (reading up to maxbytes bytes).
 // The function returns false if a properly serialized bitmap cannot be found.
 // if it returns true, readbytes is populated by how many bytes were read, we have that *readbytes <= maxbytes.
-bool ra_portable_deserialize(roaring_array_t *answer, const char *buf, const size_t maxbytes, size_t * readbytes) {
+// When run_optimize is set, each container lands directly in the representation
+// that convert_run_optimize would pick, decided from the serialized payload so
+// that the rejected representation is never materialized.
+static bool ra_portable_deserialize_impl(roaring_array_t *answer, const char *buf, const size_t maxbytes, size_t * readbytes, bool run_optimize) {
     *readbytes = sizeof(int32_t);// for cookie
     if(*readbytes > maxbytes) {
       fprintf(stderr, "Ran out of bytes while reading first 4 bytes.\n");
@@ -834,6 +1099,32 @@ bool ra_portable_deserialize(roaring_array_t *answer, const char *buf, const siz
               return false;
             }
             // it is now safe to read
+            if (run_optimize) {
+                if (thiscard == (1 << 16)) {  // all ones: the shared instance
+                    answer->size++;
+                    answer->containers[k] = run_container_full();
+                    answer->typecodes[k] = RUN_CONTAINER_TYPE_CODE;
+                    buf += containersize;
+                    continue;
+                }
+                int32_t n_runs = bitset_payload_runs(buf, NULL);
+                if (run_container_serialized_size_in_bytes(n_runs) <
+                    bitset_container_serialized_size_in_bytes()) {
+                    run_container_t *c =
+                        run_container_create_given_capacity(n_runs);
+                    if(c == NULL) {// memory allocation failure
+                      fprintf(stderr, "Failed to allocate memory for a run container.\n");
+                      ra_clear(answer);// we need to clear the containers already allocated, and the roaring array
+                      return false;
+                    }
+                    c->n_runs = bitset_payload_runs(buf, c->runs);
+                    answer->size++;
+                    answer->containers[k] = c;
+                    answer->typecodes[k] = RUN_CONTAINER_TYPE_CODE;
+                    buf += containersize;
+                    continue;
+                }
+            }
             bitset_container_t *c = bitset_container_create();
             if(c == NULL) {// memory allocation failure
               fprintf(stderr, "Failed to allocate memory for a bitset container.\n");
@@ -862,6 +1153,90 @@ bool ra_portable_deserialize(roaring_array_t *answer, const char *buf, const siz
               return false;
             }
             // it is now safe to read
+            if (run_optimize && n_runs > 0) {
+                // decide the destination representation from the sizes alone,
+                // the same comparison convert_run_to_efficient_container makes
+                int32_t size_as_run =
+                    run_container_serialized_size_in_bytes(n_runs);
+                int32_t size_as_bitset =
+                    bitset_container_serialized_size_in_bytes();
+                int32_t size_as_array =
+                    array_container_serialized_size_in_bytes(thiscard);
+                int32_t min_size_non_run = size_as_bitset < size_as_array
+                                               ? size_as_bitset
+                                               : size_as_array;
+                const char *payload = buf + sizeof(uint16_t);
+                rle16_t first;
+                memcpy(&first, payload, sizeof(rle16_t));
+                if (n_runs == 1 && first.value == 0 && first.length == 0xFFFF) {
+                    answer->size++;
+                    answer->containers[k] = run_container_full();
+                    answer->typecodes[k] = RUN_CONTAINER_TYPE_CODE;
+                    buf += sizeof(uint16_t) + containersize;
+                    continue;
+                }
+                if (size_as_run > min_size_non_run) {
+                    // expanding untrusted runs writes beyond the serialized
+                    // bytes, so unlike the copying path we must validate them
+                    uint32_t sum = 0;
+                    bool valid = true;
+                    for (uint32_t j = 0; j < n_runs; ++j) {
+                        rle16_t run;
+                        memcpy(&run, payload + j * sizeof(rle16_t),
+                               sizeof(rle16_t));
+                        if ((uint32_t)run.value + run.length > 0xFFFF) valid = false;
+                        sum += run.length + 1;
+                    }
+                    if ((!valid) || (sum != thiscard)) {
+                      fprintf(stderr, "Run container disagrees with its advertised cardinality, the data must be corrupted.\n");
+                      ra_clear(answer);// we need to clear the containers already allocated, and the roaring array
+                      return false;
+                    }
+                    if (thiscard <= DEFAULT_MAX_SIZE) {
+                        array_container_t *c =
+                            array_container_create_given_capacity(thiscard);
+                        if(c == NULL) {// memory allocation failure
+                          fprintf(stderr, "Failed to allocate memory for an array container.\n");
+                          ra_clear(answer);// we need to clear the containers already allocated, and the roaring array
+                          return false;
+                        }
+                        uint16_t *out = c->array;
+                        for (uint32_t j = 0; j < n_runs; ++j) {
+                            rle16_t run;
+                            memcpy(&run, payload + j * sizeof(rle16_t),
+                                   sizeof(rle16_t));
+                            for (uint32_t v = run.value;
+                                 v <= (uint32_t)run.value + run.length; ++v) {
+                                *out++ = (uint16_t)v;
+                            }
+                        }
+                        c->cardinality = (int32_t)(out - c->array);
+                        answer->size++;
+                        answer->containers[k] = c;
+                        answer->typecodes[k] = ARRAY_CONTAINER_TYPE_CODE;
+                    } else {
+                        bitset_container_t *c = bitset_container_create();
+                        if(c == NULL) {// memory allocation failure
+                          fprintf(stderr, "Failed to allocate memory for a bitset container.\n");
+                          ra_clear(answer);// we need to clear the containers already allocated, and the roaring array
+                          return false;
+                        }
+                        for (uint32_t j = 0; j < n_runs; ++j) {
+                            rle16_t run;
+                            memcpy(&run, payload + j * sizeof(rle16_t),
+                                   sizeof(rle16_t));
+                            bitset_set_lenrange(c->array, run.value,
+                                                run.length);
+                        }
+                        c->cardinality = thiscard;
+                        answer->size++;
+                        answer->containers[k] = c;
+                        answer->typecodes[k] = BITSET_CONTAINER_TYPE_CODE;
+                    }
+                    buf += sizeof(uint16_t) + containersize;
+                    continue;
+                }
+            }
 
             run_container_t *c = run_container_create();
             if(c == NULL) {// memory allocation failure
@@ -883,6 +1258,25 @@ bool ra_portable_deserialize(roaring_array_t *answer, const char *buf, const siz
               return false;
             }
             // it is now safe to read
+            if (run_optimize && thiscard > 0) {
+                int32_t n_runs = array_payload_runs(buf, thiscard, NULL);
+                if (run_container_serialized_size_in_bytes(n_runs) <
+                    array_container_serialized_size_in_bytes(thiscard)) {
+                    run_container_t *c =
+                        run_container_create_given_capacity(n_runs);
+                    if(c == NULL) {// memory allocation failure
+                      fprintf(stderr, "Failed to allocate memory for a run container.\n");
+                      ra_clear(answer);// we need to clear the containers already allocated, and the roaring array
+                      return false;
+                    }
+                    c->n_runs = array_payload_runs(buf, thiscard, c->runs);
+                    answer->size++;
+                    answer->containers[k] = c;
+                    answer->typecodes[k] = RUN_CONTAINER_TYPE_CODE;
+                    buf += containersize;
+                    continue;
+                }
+            }
             array_container_t *c =
                 array_container_create_given_capacity(thiscard);
             if(c == NULL) {// memory allocation failure
@@ -898,3 +1292,155 @@ bool ra_portable_deserialize(roaring_array_t *answer, const char *buf, const siz
     }
     return true;
 }
+
+bool ra_portable_deserialize(roaring_array_t *answer, const char *buf, const size_t maxbytes, size_t * readbytes) {
+    return ra_portable_deserialize_impl(answer, buf, maxbytes, readbytes, false);
+}
+
+bool ra_portable_deserialize_run_optimized(roaring_array_t *answer, const char *buf, const size_t maxbytes, size_t * readbytes) {
+    return ra_portable_deserialize_impl(answer, buf, maxbytes, readbytes, true);
+}
+
+bool ra_portable_deserialize_trusted(roaring_array_t *answer, const char *buf) {
+    // the buffer is taken at its word: no bounds or sanity checks beyond
+    // what is needed to walk the format. All container payloads land in
+    // one 32-byte-aligned arena (the containers borrow from it, as after
+    // roaring_bitmap_compact), so the decode is one allocation for the
+    // payload bytes plus one small shell per container.
+    uint32_t cookie;
+    memcpy(&cookie, buf, sizeof(uint32_t));
+    buf += sizeof(uint32_t);
+    int32_t size;
+    if ((cookie & 0xFFFF) == SERIAL_COOKIE) {
+        size = (cookie >> 16) + 1;
+    } else {
+        memcpy(&size, buf, sizeof(int32_t));
+        buf += sizeof(uint32_t);
+    }
+    const char *bitmapOfRunContainers = NULL;
+    bool hasrun = (cookie & 0xFFFF) == SERIAL_COOKIE;
+    if (hasrun) {
+        bitmapOfRunContainers = buf;
+        buf += (size + 7) / 8;
+    }
+    uint16_t *keyscards = (uint16_t *)buf;
+    buf += size * 2 * sizeof(uint16_t);
+    if ((!hasrun) || (size >= NO_OFFSET_THRESHOLD)) {
+        buf += size * 4;  // skipping the offsets
+    }
+
+    if (!ra_init_with_capacity(answer, size)) {
+        fprintf(stderr, "Failed to allocate memory for roaring array. Bailing out.\n");
+        return false;
+    }
+    for (int32_t k = 0; k < size; ++k) {
+        uint16_t tmp;
+        memcpy(&tmp, keyscards + 2*k, sizeof(tmp));
+        answer->keys[k] = tmp;
+    }
+
+    // first pass over the payload stream: size the arena, padding bitset
+    // payloads to 32-byte alignment as roaring_bitmap_compact does
+    const char *payload = buf;
+    size_t total = 0;
+    for (int32_t k = 0; k < size; ++k) {
+        uint16_t tmp;
+        memcpy(&tmp, keyscards + 2*k + 1, sizeof(tmp));
+        uint32_t thiscard = tmp + 1;
+        bool isbitmap = (thiscard > DEFAULT_MAX_SIZE);
+        bool isrun = hasrun &&
+                     ((bitmapOfRunContainers[k / 8] & (1 << (k % 8))) != 0);
+        if (isrun) {
+            uint16_t n_runs;
+            memcpy(&n_runs, payload, sizeof(uint16_t));
+            payload += sizeof(uint16_t) + n_runs * sizeof(rle16_t);
+            total += n_runs * sizeof(rle16_t);
+        } else if (isbitmap) {
+            total = (total + 31) & ~(size_t)31;
+            payload += BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
+            total += BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
+        } else {
+            payload += thiscard * sizeof(uint16_t);
+            total += thiscard * sizeof(uint16_t);
+        }
+    }
+    char *arena = NULL;
+    if (total > 0) {
+        arena = (char *)roaring_aligned_malloc(32, total);
+        if (arena == NULL) {
+            fprintf(stderr, "Failed to allocate memory for the container payloads. Bailing out.\n");
+            ra_clear(answer);
+            return false;
+        }
+    }
+    // installed before the shells so that ra_clear reclaims it on failure
+    answer->arena = arena;
+
+    char *cursor = arena;
+    for (int32_t k = 0; k < size; ++k) {
+        uint16_t tmp;
+        memcpy(&tmp, keyscards + 2*k + 1, sizeof(tmp));
+        uint32_t thiscard = tmp + 1;
+        bool isbitmap = (thiscard > DEFAULT_MAX_SIZE);
+        bool isrun = hasrun &&
+                     ((bitmapOfRunContainers[k / 8] & (1 << (k % 8))) != 0);
+        if (isrun) {
+            uint16_t n_runs;
+            memcpy(&n_runs, buf, sizeof(uint16_t));
+            buf += sizeof(uint16_t);
+            run_container_t *c =
+                (run_container_t *)roaring_malloc(sizeof(run_container_t));
+            if (c == NULL) {
+              fprintf(stderr, "Failed to allocate memory for a run container.\n");
+              ra_clear(answer);
+              return false;
+            }
+            memcpy(cursor, buf, n_runs * sizeof(rle16_t));
+            c->runs = (rle16_t *)cursor;
+            c->n_runs = n_runs;
+            c->capacity = -(int32_t)n_runs;  // borrowed from the arena
+            cursor += n_runs * sizeof(rle16_t);
+            buf += n_runs * sizeof(rle16_t);
+            answer->size++;
+            answer->containers[k] = c;
+            answer->typecodes[k] = RUN_CONTAINER_TYPE_CODE;
+        } else if (isbitmap) {
+            bitset_container_t *c = (bitset_container_t *)roaring_malloc(
+                sizeof(bitset_container_t));
+            if (c == NULL) {
+              fprintf(stderr, "Failed to allocate memory for a bitset container.\n");
+              ra_clear(answer);
+              return false;
+            }
+            cursor = arena + (((cursor - arena) + 31) & ~(ptrdiff_t)31);
+            memcpy(cursor, buf,
+                   BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t));
+            c->array = (uint64_t *)cursor;
+            c->cardinality = thiscard;
+            c->borrowed = 1;
+            cursor += BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
+            buf += BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
+            answer->size++;
+            answer->containers[k] = c;
+            answer->typecodes[k] = BITSET_CONTAINER_TYPE_CODE;
+        } else {
+            array_container_t *c =
+                (array_container_t *)roaring_malloc(sizeof(array_container_t));
+            if (c == NULL) {
+              fprintf(stderr, "Failed to allocate memory for an array container.\n");
+              ra_clear(answer);
+              return false;
+            }
+            memcpy(cursor, buf, thiscard * sizeof(uint16_t));
+            c->array = (uint16_t *)cursor;
+            c->cardinality = thiscard;
+            c->capacity = -(int32_t)thiscard;  // borrowed from the arena
+            cursor += thiscard * sizeof(uint16_t);
+            buf += thiscard * sizeof(uint16_t);
+            answer->size++;
+            answer->containers[k] = c;
+            answer->typecodes[k] = ARRAY_CONTAINER_TYPE_CODE;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,232 @@
+/*
+ * roaring_atomic_ref.c
+ *
+ * Atomic reference to a published bitmap; see roaring_atomic_ref.h for the
+ * reader/writer contract.
+ *
+ * Each published version is a snapshot: a bitmap (every container behind a
+ * shared_container_t wrapper, so checking out a writable copy only bumps
+ * reference counts and never writes to the published arrays) plus its own
+ * reference count — one reference held by the roaring_atomic_ref_t, one per
+ * outstanding acquire. The only hazard a plain refcount cannot cover is a
+ * reader caught between loading the version pointer and pinning it; the
+ * epoch counters below close it. Readers register in the current epoch's
+ * parity slot for the duration of that window, and publish flips the epoch
+ * after swapping the pointer, then waits for the old parity slot to drain:
+ * any reader registering afterwards observes the new pointer, so the
+ * displaced version can safely lose the reference's pin. The operations on
+ * ref fields use the default sequentially consistent ordering — the drain
+ * argument relies on a total order between the slot updates and the pointer
+ * accesses.
+ */
+
+#include <assert.h>
+
+#include <roaring/containers/containers.h>
+#include <roaring/memory.h>
+#include <roaring/roaring_array.h>
+#include <roaring/roaring_atomic_ref.h>
+
+typedef struct roaring_snapshot_s {
+    roaring_bitmap_t bitmap;  // must stay first: acquire hands out &bitmap
+    croaring_refcount_t counter;
+} roaring_snapshot_t;
+
+struct roaring_atomic_ref_s {
+#ifdef ROARING_ATOMIC_REFCOUNT
+    _Atomic(roaring_snapshot_t *) current;
+    _Atomic(uint32_t) epoch;
+    _Atomic(uint32_t) acquiring[2];  // readers mid-acquire, by epoch parity
+#else
+    roaring_snapshot_t *current;
+#endif
+};
+
+// drops one reference to the version; the last one tears it down
+static void snapshot_unref(roaring_snapshot_t *snap) {
+#ifdef ROARING_ATOMIC_REFCOUNT
+    // release/acquire as in croaring_refcount_dec: every prior access to
+    // the version is visible to the thread that performs the teardown
+    uint32_t old =
+        atomic_fetch_sub_explicit(&snap->counter, 1, memory_order_release);
+    assert(old > 0);
+    if (old != 1) return;
+    atomic_thread_fence(memory_order_acquire);
+#else
+    assert(snap->counter > 0);
+    snap->counter -= 1;
+    if (snap->counter != 0) return;
+#endif
+    ra_clear(&snap->bitmap.high_low_container);
+    roaring_free(snap);
+}
+
+// puts every container behind a shared wrapper owned by the version (the
+// full-run singleton is shareable as-is, mirroring get_copy_of_container)
+static bool snapshot_share_all(roaring_array_t *ra) {
+    for (int32_t i = 0; i < ra->size; i++) {
+        if (ra->typecodes[i] == SHARED_CONTAINER_TYPE_CODE) continue;
+        if (ra->typecodes[i] == RUN_CONTAINER_TYPE_CODE &&
+            run_container_is_full_singleton(
+                (run_container_t *)ra->containers[i])) {
+            continue;
+        }
+        shared_container_t *shared =
+            (shared_container_t *)roaring_malloc(sizeof(shared_container_t));
+        if (shared == NULL) return false;
+        shared->container = ra->containers[i];
+        shared->typecode = ra->typecodes[i];
+        shared->counter = 1;
+        ra->containers[i] = shared;
+        ra->typecodes[i] = SHARED_CONTAINER_TYPE_CODE;
+    }
+    return true;
+}
+
+// turns a caller-owned bitmap into a version with one reference, consuming
+// the bitmap's heap shell; returns NULL on allocation failure, leaving the
+// bitmap caller-owned (and still valid, even if some containers were
+// already wrapped)
+static roaring_snapshot_t *snapshot_wrap(roaring_bitmap_t *bitmap) {
+    roaring_snapshot_t *snap =
+        (roaring_snapshot_t *)roaring_malloc(sizeof(roaring_snapshot_t));
+    if (snap == NULL) return NULL;
+    roaring_bitmap_set_copy_on_write(bitmap, true);
+    // prime the cardinality cache and the prefix-cardinality index:
+    // readers treat the version as read-only, so the first query (or
+    // rank/select, which builds the index lazily) must not race to fill it
+    (void)roaring_bitmap_get_cardinality(bitmap);
+    (void)ra_get_prefix_index(&bitmap->high_low_container);
+    if (!snapshot_share_all(&bitmap->high_low_container)) {
+        roaring_free(snap);
+        return NULL;
+    }
+    snap->bitmap = *bitmap;
+    // a small array is backed by its inline slots: repoint the copy at its
+    // own slots before the shell they used to live in is freed
+    ra_rebase_inline(&snap->bitmap.high_low_container,
+                     &bitmap->high_low_container);
+    roaring_free(bitmap);
+    snap->counter = 1;
+    return snap;
+}
+
+roaring_atomic_ref_t *roaring_atomic_ref_create(roaring_bitmap_t *initial) {
+    roaring_atomic_ref_t *ref =
+        (roaring_atomic_ref_t *)roaring_malloc(sizeof(roaring_atomic_ref_t));
+    if (ref == NULL) return NULL;
+    roaring_snapshot_t *snap = snapshot_wrap(initial);
+    if (snap == NULL) {
+        roaring_free(ref);
+        return NULL;
+    }
+#ifdef ROARING_ATOMIC_REFCOUNT
+    atomic_init(&ref->current, snap);
+    atomic_init(&ref->epoch, 0);
+    atomic_init(&ref->acquiring[0], 0);
+    atomic_init(&ref->acquiring[1], 0);
+#else
+    ref->current = snap;
+#endif
+    return ref;
+}
+
+const roaring_bitmap_t *roaring_atomic_ref_acquire(roaring_atomic_ref_t *ref) {
+#ifdef ROARING_ATOMIC_REFCOUNT
+    // register in the current epoch before loading the pointer: publish
+    // drains this parity slot before unpinning the version it displaced,
+    // so the version cannot die between our load and our pin. The epoch
+    // may flip between our load of it and our registration, leaving us
+    // registered under a parity publish already drained — re-check and
+    // migrate until the registration and the epoch agree, so the pointer
+    // below is always loaded under a parity the next publish will drain
+    uint32_t parity = atomic_load(&ref->epoch) & 1;
+    atomic_fetch_add(&ref->acquiring[parity], 1);
+    for (;;) {
+        uint32_t now = atomic_load(&ref->epoch) & 1;
+        if (now == parity) break;
+        atomic_fetch_add(&ref->acquiring[now], 1);
+        atomic_fetch_sub(&ref->acquiring[parity], 1);
+        parity = now;
+    }
+    roaring_snapshot_t *snap = atomic_load(&ref->current);
+    atomic_fetch_add_explicit(&snap->counter, 1, memory_order_relaxed);
+    atomic_fetch_sub(&ref->acquiring[parity], 1);
+#else
+    roaring_snapshot_t *snap = ref->current;
+    snap->counter += 1;
+#endif
+    return &snap->bitmap;
+}
+
+void roaring_atomic_ref_release(const roaring_bitmap_t *snapshot) {
+    if (snapshot == NULL) return;
+    // the bitmap is the first member of its snapshot
+    snapshot_unref((roaring_snapshot_t *)snapshot);
+}
+
+roaring_bitmap_t *roaring_atomic_ref_checkout(roaring_atomic_ref_t *ref) {
+#ifdef ROARING_ATOMIC_REFCOUNT
+    roaring_snapshot_t *snap = atomic_load(&ref->current);
+#else
+    roaring_snapshot_t *snap = ref->current;
+#endif
+    const roaring_array_t *src = &snap->bitmap.high_low_container;
+    roaring_bitmap_t *ans =
+        (roaring_bitmap_t *)roaring_malloc(sizeof(roaring_bitmap_t));
+    if (ans == NULL) return NULL;
+    if (!ra_init_with_capacity(&ans->high_low_container, src->size)) {
+        roaring_free(ans);
+        return NULL;
+    }
+    roaring_bitmap_set_copy_on_write(ans, true);
+    for (int32_t i = 0; i < src->size; i++) {
+        uint8_t typecode = src->typecodes[i];
+        // every container of a published version is shared (or the full-run
+        // singleton), so this only bumps a count — unlike ra_copy, which
+        // would write wrappers back into the arrays readers are iterating
+        void *c = get_copy_of_container(src->containers[i], &typecode, true);
+        if (c == NULL) {
+            roaring_bitmap_free(ans);
+            return NULL;
+        }
+        ra_append(&ans->high_low_container, src->keys[i], c, typecode);
+    }
+    // same values as the version, so its caches carry over
+    ans->high_low_container.cached_cardinality = src->cached_cardinality;
+    ans->high_low_container.cached_hash = src->cached_hash;
+    ans->high_low_container.flags |=
+        src->flags & (ROARING_FLAG_CARD_VALID | ROARING_FLAG_HASH_VALID);
+    return ans;
+}
+
+bool roaring_atomic_ref_publish(roaring_atomic_ref_t *ref,
+                                roaring_bitmap_t *updated) {
+    roaring_snapshot_t *snap = snapshot_wrap(updated);
+    if (snap == NULL) return false;
+#ifdef ROARING_ATOMIC_REFCOUNT
+    roaring_snapshot_t *old = atomic_exchange(&ref->current, snap);
+    // flip the epoch, then wait out the readers registered under the old
+    // parity: they are between loading a version pointer and pinning it.
+    // Readers registering after the flip load the new pointer, so the
+    // drain terminates even under a continuous stream of acquires.
+    uint32_t parity = atomic_fetch_add(&ref->epoch, 1) & 1;
+    while (atomic_load(&ref->acquiring[parity]) != 0) {
+    }
+#else
+    roaring_snapshot_t *old = ref->current;
+    ref->current = snap;
+#endif
+    snapshot_unref(old);
+    return true;
+}
+
+void roaring_atomic_ref_free(roaring_atomic_ref_t *ref) {
+    if (ref == NULL) return;
+#ifdef ROARING_ATOMIC_REFCOUNT
+    snapshot_unref(atomic_load(&ref->current));
+#else
+    snapshot_unref(ref->current);
+#endif
+    roaring_free(ref);
+}
@@ -0,0 +1,151 @@
+/*
+ * roaring_collection.c
+ *
+ * Single-file collections of frozen v2 bitmaps with a sorted key index.
+ * The layout is documented in roaring_collection.h.
+ */
+
+#include <string.h>
+
+#include <roaring/memory.h>
+#include <roaring/roaring_collection.h>
+
+#define COLLECTION_COOKIE UINT32_C(13866)
+#define COLLECTION_VERSION UINT32_C(1)
+#define COLLECTION_HEADER_BYTES 16
+
+// every frozen blob must start on a 32-byte boundary within the file, so
+// that views taken from an aligned (e.g. mmap'ed) buffer are themselves
+// aligned as roaring_bitmap_frozen_view_v2 requires
+static inline size_t collection_pad(size_t bytes) {
+    return (bytes + 31) & ~(size_t)31;
+}
+
+struct roaring_collection_s {
+    const char *buf;
+    size_t length;
+    uint64_t count;
+    const uint64_t *keys;     // sorted, unique
+    const uint64_t *offsets;  // absolute, multiples of 32
+    const uint64_t *sizes;    // frozen v2 blob sizes
+};
+
+size_t roaring_collection_size_in_bytes(size_t number,
+                                        const roaring_bitmap_t **bitmaps) {
+    size_t bytes =
+        COLLECTION_HEADER_BYTES + number * 3 * sizeof(uint64_t);
+    for (size_t i = 0; i < number; i++) {
+        bytes = collection_pad(bytes);
+        bytes += roaring_bitmap_frozen_size_in_bytes_v2(bitmaps[i]);
+    }
+    return bytes;
+}
+
+size_t roaring_collection_serialize(size_t number, const uint64_t *keys,
+                                    const roaring_bitmap_t **bitmaps,
+                                    char *buf) {
+    for (size_t i = 1; i < number; i++) {
+        if (keys[i] <= keys[i - 1]) return 0;  // index must be sorted, unique
+    }
+    const uint32_t cookie = COLLECTION_COOKIE;
+    const uint32_t version = COLLECTION_VERSION;
+    const uint64_t count = (uint64_t)number;
+    memcpy(buf, &cookie, sizeof(uint32_t));
+    memcpy(buf + 4, &version, sizeof(uint32_t));
+    memcpy(buf + 8, &count, sizeof(uint64_t));
+    char *index_keys = buf + COLLECTION_HEADER_BYTES;
+    char *index_offsets = index_keys + number * sizeof(uint64_t);
+    char *index_sizes = index_offsets + number * sizeof(uint64_t);
+    size_t pos = COLLECTION_HEADER_BYTES + number * 3 * sizeof(uint64_t);
+    for (size_t i = 0; i < number; i++) {
+        const size_t padded = collection_pad(pos);
+        memset(buf + pos, 0, padded - pos);  // deterministic output
+        pos = padded;
+        const uint64_t offset = (uint64_t)pos;
+        const uint64_t size =
+            (uint64_t)roaring_bitmap_frozen_size_in_bytes_v2(bitmaps[i]);
+        roaring_bitmap_frozen_serialize_v2(bitmaps[i], buf + pos);
+        memcpy(index_keys + i * sizeof(uint64_t), &keys[i], sizeof(uint64_t));
+        memcpy(index_offsets + i * sizeof(uint64_t), &offset,
+               sizeof(uint64_t));
+        memcpy(index_sizes + i * sizeof(uint64_t), &size, sizeof(uint64_t));
+        pos += (size_t)size;
+    }
+    return pos;
+}
+
+const roaring_collection_t *roaring_collection_frozen_view(const char *buf,
+                                                           size_t length) {
+    if ((uintptr_t)buf % 32 != 0) return NULL;
+    if (length < COLLECTION_HEADER_BYTES) return NULL;
+    uint32_t cookie, version;
+    uint64_t count;
+    memcpy(&cookie, buf, sizeof(uint32_t));
+    memcpy(&version, buf + 4, sizeof(uint32_t));
+    memcpy(&count, buf + 8, sizeof(uint64_t));
+    if (cookie != COLLECTION_COOKIE || version != COLLECTION_VERSION) {
+        return NULL;
+    }
+    if (count > (length - COLLECTION_HEADER_BYTES) / (3 * sizeof(uint64_t))) {
+        return NULL;
+    }
+    // the index sits at 8-byte aligned addresses inside the aligned buffer
+    const uint64_t *keys =
+        (const uint64_t *)(buf + COLLECTION_HEADER_BYTES);
+    const uint64_t *offsets = keys + count;
+    const uint64_t *sizes = offsets + count;
+    for (uint64_t i = 0; i < count; i++) {
+        if (offsets[i] % 32 != 0) return NULL;
+        if (offsets[i] > length || sizes[i] > length - offsets[i]) {
+            return NULL;
+        }
+        if (i > 0 && keys[i] <= keys[i - 1]) return NULL;
+    }
+    roaring_collection_t *collection = (roaring_collection_t *)roaring_malloc(
+        sizeof(roaring_collection_t));
+    if (collection == NULL) return NULL;
+    collection->buf = buf;
+    collection->length = length;
+    collection->count = count;
+    collection->keys = keys;
+    collection->offsets = offsets;
+    collection->sizes = sizes;
+    return collection;
+}
+
+void roaring_collection_free(const roaring_collection_t *collection) {
+    roaring_free((void *)collection);
+}
+
+size_t roaring_collection_count(const roaring_collection_t *collection) {
+    return (size_t)collection->count;
+}
+
+uint64_t roaring_collection_key_at(const roaring_collection_t *collection,
+                                   size_t i) {
+    return collection->keys[i];
+}
+
+const roaring_bitmap_t *roaring_collection_get_at(
+    const roaring_collection_t *collection, size_t i) {
+    return roaring_bitmap_frozen_view_v2(
+        collection->buf + collection->offsets[i],
+        (size_t)collection->sizes[i]);
+}
+
+const roaring_bitmap_t *roaring_collection_get(
+    const roaring_collection_t *collection, uint64_t key) {
+    size_t low = 0, high = (size_t)collection->count;
+    while (low < high) {
+        const size_t middle = (low + high) >> 1;
+        if (collection->keys[middle] < key) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low == (size_t)collection->count || collection->keys[low] != key) {
+        return NULL;
+    }
+    return roaring_collection_get_at(collection, low);
+}
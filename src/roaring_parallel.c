@@ -0,0 +1,625 @@
+/*
+ * roaring_parallel.c
+ *
+ * Multi-threaded aggregation over many bitmaps.  Containers with distinct
+ * high-16-bit keys are independent, so the key space can be partitioned
+ * across worker threads: each worker unions its share of the keys with the
+ * lazy container kernels and repairs its shard, and the shards are then
+ * stitched together (a pointer move, no copying) on the calling thread.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <roaring/containers/container_pool.h>
+#include <roaring/containers/convert.h>
+#include <roaring/memory.h>
+#include <roaring/roaring.h>
+#include <roaring/roaring_array.h>
+
+#if !defined(_WIN32)
+#define ROARING_HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef ROARING_HAVE_PTHREAD
+
+typedef struct roaring_or_shard_job_s {
+    const roaring_bitmap_t **bitmaps;
+    size_t number;
+    uint32_t key_begin;  // first key of the shard
+    uint32_t key_end;    // one past the last key of the shard
+    roaring_bitmap_t *result;
+    bool failed;  // set on allocation failure inside the worker
+} roaring_or_shard_job_t;
+
+static void *or_shard_worker(void *arg) {
+    roaring_or_shard_job_t *job = (roaring_or_shard_job_t *)arg;
+    const size_t number = job->number;
+    int32_t *pos = (int32_t *)roaring_malloc(number * sizeof(int32_t));
+    if (pos == NULL) {
+        job->failed = true;
+        return NULL;
+    }
+    // worker threads start with recycling disabled: borrow promotion
+    // buffers through the per-thread pool for the length of the shard
+    const bool scratch_pool = (roaring_container_pool_capacity() == 0);
+    if (scratch_pool) roaring_container_pool_set_capacity(8);
+    // per-bitmap cursor, starting at the first key of the shard
+    for (size_t i = 0; i < number; i++) {
+        pos[i] = ra_advance_until(&job->bitmaps[i]->high_low_container,
+                                  (uint16_t)job->key_begin, -1);
+    }
+    while (true) {
+        // find the smallest pending key in our range
+        uint32_t min_key = job->key_end;
+        for (size_t i = 0; i < number; i++) {
+            const roaring_array_t *ra = &job->bitmaps[i]->high_low_container;
+            if (pos[i] < ra->size) {
+                const uint32_t key = ra_get_key_at_index(ra, pos[i]);
+                if (key < min_key) min_key = key;
+            }
+        }
+        if (min_key >= job->key_end) break;
+        // union all the containers with that key
+        void *first_c = NULL;
+        uint8_t first_type = 0;
+        void *c = NULL;
+        uint8_t ctype = 0;
+        for (size_t i = 0; i < number; i++) {
+            const roaring_array_t *ra = &job->bitmaps[i]->high_low_container;
+            if (pos[i] >= ra->size ||
+                ra_get_key_at_index(ra, pos[i]) != min_key) {
+                continue;
+            }
+            uint8_t type;
+            void *ci = ra_get_container_at_index(ra, pos[i], &type);
+            pos[i]++;
+            if (first_c == NULL && c == NULL) {
+                // borrow the first container: no work if it is the only one
+                first_c = ci;
+                first_type = type;
+            } else if (c == NULL) {
+                // second container: produce a fresh (owned) lazy union
+                c = container_lazy_or(first_c, first_type, ci, type, &ctype);
+                first_c = NULL;
+            } else {
+                uint8_t newtype;
+                void *newc = container_lazy_ior(c, ctype, ci, type, &newtype);
+                if (newc != c) {
+                    container_free(c, ctype);
+                }
+                c = newc;
+                ctype = newtype;
+            }
+        }
+        if (c == NULL) {
+            // a single bitmap had this key: the result owns a copy
+            uint8_t type = first_type;
+            const void *unwrapped = container_unwrap_shared(first_c, &type);
+            c = container_clone(unwrapped, type);
+            ctype = type;
+        }
+        ra_append(&job->result->high_low_container, (uint16_t)min_key, c,
+                  ctype);
+    }
+    roaring_free(pos);
+    // repair in the worker so this pass is parallel too
+    roaring_bitmap_repair_after_lazy(job->result);
+    if (scratch_pool) roaring_container_pool_set_capacity(0);
+    return NULL;
+}
+
+roaring_bitmap_t *roaring_bitmap_or_many_parallel(size_t number,
+                                                  const roaring_bitmap_t **x,
+                                                  unsigned int num_threads) {
+    if (number == 0) {
+        return roaring_bitmap_create();
+    }
+    if (number == 1) {
+        return roaring_bitmap_copy(x[0]);
+    }
+    if (num_threads <= 1) {
+        return roaring_bitmap_or_many(number, x);
+    }
+    if (num_threads > (1 << 16)) num_threads = (1 << 16);
+
+    roaring_or_shard_job_t *jobs = (roaring_or_shard_job_t *)roaring_malloc(
+        num_threads * sizeof(roaring_or_shard_job_t));
+    pthread_t *threads =
+        (pthread_t *)roaring_malloc(num_threads * sizeof(pthread_t));
+    if (jobs == NULL || threads == NULL) {
+        roaring_free(jobs);
+        roaring_free(threads);
+        return roaring_bitmap_or_many(number, x);
+    }
+    // split the key space evenly; container counts per shard can be skewed,
+    // but for aggregations spanning much of the 32-bit space this is close
+    // enough and keeps the partitioning free
+    const uint32_t span = (1 << 16);
+    uint32_t key = 0;
+    for (unsigned int t = 0; t < num_threads; t++) {
+        jobs[t].bitmaps = x;
+        jobs[t].number = number;
+        jobs[t].key_begin = key;
+        key = (uint32_t)(((uint64_t)span * (t + 1)) / num_threads);
+        jobs[t].key_end = key;
+        jobs[t].result = roaring_bitmap_create();
+        jobs[t].failed = (jobs[t].result == NULL);
+    }
+    unsigned int started = 0;
+    for (; started < num_threads; started++) {
+        if (jobs[started].failed ||
+            pthread_create(&threads[started], NULL, or_shard_worker,
+                           &jobs[started]) != 0) {
+            break;
+        }
+    }
+    // any job we could not hand to a thread runs on the calling thread
+    for (unsigned int t = started; t < num_threads; t++) {
+        if (!jobs[t].failed) {
+            or_shard_worker(&jobs[t]);
+        }
+    }
+    for (unsigned int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    // stitch the shards together: keys are disjoint and increasing across
+    // shards, so this is a pointer move
+    roaring_bitmap_t *answer = roaring_bitmap_create();
+    bool failed = (answer == NULL);
+    for (unsigned int t = 0; t < num_threads; t++) {
+        roaring_bitmap_t *shard = jobs[t].result;
+        failed = failed || jobs[t].failed;
+        if (shard == NULL) continue;
+        if (!failed) {
+            ra_append_move_range(&answer->high_low_container,
+                                 &shard->high_low_container, 0,
+                                 shard->high_low_container.size);
+            ra_clear_without_containers(&shard->high_low_container);
+        }
+        roaring_bitmap_free(shard);
+    }
+    roaring_free(threads);
+    roaring_free(jobs);
+    if (failed) {
+        if (answer != NULL) roaring_bitmap_free(answer);
+        return NULL;
+    }
+    return answer;
+}
+
+typedef struct roaring_extract_job_s {
+    const roaring_bitmap_t *bitmap;
+    uint32_t *ans;
+    const uint64_t *offsets;  // output position of each container
+    int32_t begin;            // first container of the shard
+    int32_t end;              // one past the last container of the shard
+} roaring_extract_job_t;
+
+static void *extract_shard_worker(void *arg) {
+    roaring_extract_job_t *job = (roaring_extract_job_t *)arg;
+    const roaring_array_t *ra = &job->bitmap->high_low_container;
+    for (int32_t i = job->begin; i < job->end; i++) {
+        container_to_uint32_array(job->ans + job->offsets[i],
+                                  ra->containers[i], ra->typecodes[i],
+                                  ((uint32_t)ra->keys[i]) << 16);
+    }
+    return NULL;
+}
+
+void roaring_bitmap_to_uint32_array_parallel(const roaring_bitmap_t *ra,
+                                             uint32_t *ans,
+                                             unsigned int num_threads) {
+    const int32_t size = ra->high_low_container.size;
+    if (num_threads <= 1 || size < 2) {
+        roaring_bitmap_to_uint32_array(ra, ans);
+        return;
+    }
+    if (num_threads > (unsigned int)size) num_threads = (unsigned int)size;
+    // every container lands at a prefix sum of the cardinalities
+    uint64_t *offsets = (uint64_t *)roaring_malloc(size * sizeof(uint64_t));
+    roaring_extract_job_t *jobs = (roaring_extract_job_t *)roaring_malloc(
+        num_threads * sizeof(roaring_extract_job_t));
+    pthread_t *threads =
+        (pthread_t *)roaring_malloc(num_threads * sizeof(pthread_t));
+    if (offsets == NULL || jobs == NULL || threads == NULL) {
+        roaring_free(offsets);
+        roaring_free(jobs);
+        roaring_free(threads);
+        roaring_bitmap_to_uint32_array(ra, ans);
+        return;
+    }
+    uint64_t total = 0;
+    for (int32_t i = 0; i < size; i++) {
+        offsets[i] = total;
+        total += container_get_cardinality(ra->high_low_container.containers[i],
+                                           ra->high_low_container.typecodes[i]);
+    }
+    // split the containers so each shard decodes a similar number of values
+    int32_t next = 0;
+    for (unsigned int t = 0; t < num_threads; t++) {
+        jobs[t].bitmap = ra;
+        jobs[t].ans = ans;
+        jobs[t].offsets = offsets;
+        jobs[t].begin = next;
+        const uint64_t target = total * (t + 1) / num_threads;
+        while (next < size && offsets[next] < target) next++;
+        jobs[t].end = next;
+    }
+    jobs[num_threads - 1].end = size;
+    unsigned int started = 0;
+    for (; started < num_threads; started++) {
+        if (pthread_create(&threads[started], NULL, extract_shard_worker,
+                           &jobs[started]) != 0) {
+            break;
+        }
+    }
+    // any job we could not hand to a thread runs on the calling thread
+    for (unsigned int t = started; t < num_threads; t++) {
+        extract_shard_worker(&jobs[t]);
+    }
+    for (unsigned int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    roaring_free(threads);
+    roaring_free(jobs);
+    roaring_free(offsets);
+}
+
+/*
+ * Batched scoring against a fixed query bitmap.  The query is prepared once:
+ * its shared containers are unwrapped and its large array containers are
+ * converted to bitsets, which turns the per-candidate intersection into bit
+ * tests and word popcounts.  The prepared containers are read-only, so the
+ * candidates can then be scored from any number of threads.
+ */
+
+// query array containers at least this populated are worth a bitset copy
+#define SCORER_BITSET_THRESHOLD 2048
+
+typedef struct roaring_query_scorer_s {
+    const roaring_array_t *ra;  // the query's keys
+    void **containers;          // per query container, possibly converted
+    uint8_t *typecodes;
+    bool *owned;  // true for the converted (heap-owned) containers
+} roaring_query_scorer_t;
+
+static bool scorer_init(roaring_query_scorer_t *scorer,
+                        const roaring_bitmap_t *query) {
+    const roaring_array_t *ra = &query->high_low_container;
+    scorer->ra = ra;
+    scorer->containers = (void **)roaring_malloc(ra->size * sizeof(void *));
+    scorer->typecodes = (uint8_t *)roaring_malloc(ra->size * sizeof(uint8_t));
+    scorer->owned = (bool *)roaring_malloc(ra->size * sizeof(bool));
+    if (scorer->containers == NULL || scorer->typecodes == NULL ||
+        scorer->owned == NULL) {
+        roaring_free(scorer->containers);
+        roaring_free(scorer->typecodes);
+        roaring_free(scorer->owned);
+        return false;
+    }
+    for (int32_t i = 0; i < ra->size; i++) {
+        uint8_t type = ra->typecodes[i];
+        void *c = (void *)container_unwrap_shared(ra->containers[i], &type);
+        bool owned = false;
+        if (type == ARRAY_CONTAINER_TYPE_CODE &&
+            ((const array_container_t *)c)->cardinality >=
+                SCORER_BITSET_THRESHOLD) {
+            bitset_container_t *bc =
+                bitset_container_from_array((const array_container_t *)c);
+            if (bc != NULL) {
+                c = bc;
+                type = BITSET_CONTAINER_TYPE_CODE;
+                owned = true;
+            }
+        }
+        scorer->containers[i] = c;
+        scorer->typecodes[i] = type;
+        scorer->owned[i] = owned;
+    }
+    return true;
+}
+
+static void scorer_release(roaring_query_scorer_t *scorer) {
+    for (int32_t i = 0; i < scorer->ra->size; i++) {
+        if (scorer->owned[i]) {
+            container_free(scorer->containers[i], scorer->typecodes[i]);
+        }
+    }
+    roaring_free(scorer->containers);
+    roaring_free(scorer->typecodes);
+    roaring_free(scorer->owned);
+}
+
+static uint64_t scorer_and_cardinality(const roaring_query_scorer_t *scorer,
+                                       const roaring_bitmap_t *candidate) {
+    const roaring_array_t *ra1 = scorer->ra;
+    const roaring_array_t *ra2 = &candidate->high_low_container;
+    const int32_t length1 = ra1->size, length2 = ra2->size;
+    uint64_t answer = 0;
+    int32_t pos1 = 0, pos2 = 0;
+    while (pos1 < length1 && pos2 < length2) {
+        const uint16_t s1 = ra_get_key_at_index(ra1, pos1);
+        const uint16_t s2 = ra_get_key_at_index(ra2, pos2);
+        if (s1 == s2) {
+            uint8_t type2;
+            void *c2 = ra_get_container_at_index(ra2, pos2, &type2);
+            answer += container_and_cardinality(scorer->containers[pos1],
+                                                scorer->typecodes[pos1], c2,
+                                                type2);
+            ++pos1;
+            ++pos2;
+        } else if (s1 < s2) {
+            pos1 = ra_advance_until(ra1, s2, pos1);
+        } else {
+            pos2 = ra_advance_until(ra2, s1, pos2);
+        }
+    }
+    return answer;
+}
+
+typedef struct roaring_score_job_s {
+    const roaring_query_scorer_t *scorer;
+    const roaring_bitmap_t **candidates;
+    uint64_t *intersections;  // per-candidate and-cardinality
+    double *jaccards;         // may be NULL
+    uint64_t query_cardinality;
+    size_t begin;  // first candidate of the shard
+    size_t end;    // one past the last candidate of the shard
+} roaring_score_job_t;
+
+static void *score_shard_worker(void *arg) {
+    roaring_score_job_t *job = (roaring_score_job_t *)arg;
+    for (size_t i = job->begin; i < job->end; i++) {
+        const uint64_t inter =
+            scorer_and_cardinality(job->scorer, job->candidates[i]);
+        job->intersections[i] = inter;
+        if (job->jaccards != NULL) {
+            const uint64_t card =
+                roaring_bitmap_get_cardinality(job->candidates[i]);
+            job->jaccards[i] =
+                (double)inter /
+                (double)(job->query_cardinality + card - inter);
+        }
+    }
+    return NULL;
+}
+
+// shared engine behind the two public batch-scoring entry points; exactly
+// one of intersections/jaccards may be NULL
+static void roaring_bitmap_score_many(const roaring_bitmap_t *query,
+                                      size_t number,
+                                      const roaring_bitmap_t **candidates,
+                                      uint64_t *intersections, double *jaccards,
+                                      unsigned int num_threads) {
+    uint64_t *inters = intersections;
+    if (inters == NULL) {
+        inters = (uint64_t *)roaring_malloc(number * sizeof(uint64_t));
+        if (inters == NULL) {  // fall back to the one-at-a-time API
+            for (size_t i = 0; i < number; i++) {
+                jaccards[i] =
+                    roaring_bitmap_jaccard_index(query, candidates[i]);
+            }
+            return;
+        }
+    }
+    roaring_query_scorer_t scorer;
+    if (!scorer_init(&scorer, query)) {
+        for (size_t i = 0; i < number; i++) {
+            inters[i] = roaring_bitmap_and_cardinality(query, candidates[i]);
+            if (jaccards != NULL) {
+                jaccards[i] = roaring_bitmap_jaccard_index(query,
+                                                           candidates[i]);
+            }
+        }
+        if (inters != intersections) roaring_free(inters);
+        return;
+    }
+    const uint64_t query_cardinality =
+        (jaccards != NULL) ? roaring_bitmap_get_cardinality(query) : 0;
+    roaring_score_job_t serial_job = {&scorer,  candidates, inters, jaccards,
+                                      query_cardinality, 0,      number};
+    if (num_threads <= 1 || number < 2) {
+        score_shard_worker(&serial_job);
+    } else {
+        if (num_threads > number) num_threads = (unsigned int)number;
+        roaring_score_job_t *jobs = (roaring_score_job_t *)roaring_malloc(
+            num_threads * sizeof(roaring_score_job_t));
+        pthread_t *threads =
+            (pthread_t *)roaring_malloc(num_threads * sizeof(pthread_t));
+        if (jobs == NULL || threads == NULL) {
+            roaring_free(jobs);
+            roaring_free(threads);
+            score_shard_worker(&serial_job);
+        } else {
+            for (unsigned int t = 0; t < num_threads; t++) {
+                jobs[t] = serial_job;
+                jobs[t].begin = number * t / num_threads;
+                jobs[t].end = number * (t + 1) / num_threads;
+            }
+            unsigned int started = 0;
+            for (; started < num_threads; started++) {
+                if (pthread_create(&threads[started], NULL, score_shard_worker,
+                                   &jobs[started]) != 0) {
+                    break;
+                }
+            }
+            // any job we could not hand to a thread runs on the calling thread
+            for (unsigned int t = started; t < num_threads; t++) {
+                score_shard_worker(&jobs[t]);
+            }
+            for (unsigned int t = 0; t < started; t++) {
+                pthread_join(threads[t], NULL);
+            }
+            roaring_free(threads);
+            roaring_free(jobs);
+        }
+    }
+    scorer_release(&scorer);
+    if (inters != intersections) roaring_free(inters);
+}
+
+void roaring_bitmap_and_cardinality_many(const roaring_bitmap_t *query,
+                                         size_t number,
+                                         const roaring_bitmap_t **candidates,
+                                         uint64_t *answers,
+                                         unsigned int num_threads) {
+    roaring_bitmap_score_many(query, number, candidates, answers, NULL,
+                              num_threads);
+}
+
+void roaring_bitmap_jaccard_index_many(const roaring_bitmap_t *query,
+                                       size_t number,
+                                       const roaring_bitmap_t **candidates,
+                                       double *answers,
+                                       unsigned int num_threads) {
+    roaring_bitmap_score_many(query, number, candidates, NULL, answers,
+                              num_threads);
+}
+
+typedef struct roaring_deserialize_job_s {
+    const char **bufs;
+    const size_t *sizes;
+    roaring_bitmap_t **answers;
+    size_t begin;  // first buffer of the shard
+    size_t end;    // one past the last buffer of the shard
+} roaring_deserialize_job_t;
+
+static void *deserialize_shard_worker(void *arg) {
+    roaring_deserialize_job_t *job = (roaring_deserialize_job_t *)arg;
+    for (size_t i = job->begin; i < job->end; i++) {
+        job->answers[i] =
+            roaring_bitmap_portable_deserialize_safe(job->bufs[i],
+                                                     job->sizes[i]);
+    }
+    return NULL;
+}
+
+static size_t roaring_bitmap_portable_deserialize_many_serial(
+    size_t number, const char **bufs, const size_t *sizes,
+    roaring_bitmap_t **answers) {
+    size_t ok = 0;
+    for (size_t i = 0; i < number; i++) {
+        answers[i] = roaring_bitmap_portable_deserialize_safe(bufs[i],
+                                                              sizes[i]);
+        if (answers[i] != NULL) ok++;
+    }
+    return ok;
+}
+
+size_t roaring_bitmap_portable_deserialize_many(size_t number,
+                                                const char **bufs,
+                                                const size_t *sizes,
+                                                roaring_bitmap_t **answers,
+                                                unsigned int num_threads) {
+    if (num_threads <= 1 || number < 2) {
+        return roaring_bitmap_portable_deserialize_many_serial(number, bufs,
+                                                               sizes, answers);
+    }
+    if (num_threads > number) num_threads = (unsigned int)number;
+    roaring_deserialize_job_t *jobs =
+        (roaring_deserialize_job_t *)roaring_malloc(
+            num_threads * sizeof(roaring_deserialize_job_t));
+    pthread_t *threads =
+        (pthread_t *)roaring_malloc(num_threads * sizeof(pthread_t));
+    if (jobs == NULL || threads == NULL) {
+        roaring_free(jobs);
+        roaring_free(threads);
+        return roaring_bitmap_portable_deserialize_many_serial(number, bufs,
+                                                               sizes, answers);
+    }
+    // deserialization cost tracks the serialized size, so split the buffers
+    // by cumulative bytes rather than by count
+    uint64_t total = 0;
+    for (size_t i = 0; i < number; i++) total += sizes[i];
+    size_t next = 0;
+    uint64_t consumed = 0;
+    for (unsigned int t = 0; t < num_threads; t++) {
+        jobs[t].bufs = bufs;
+        jobs[t].sizes = sizes;
+        jobs[t].answers = answers;
+        jobs[t].begin = next;
+        const uint64_t target = total * (t + 1) / num_threads;
+        while (next < number && consumed < target) consumed += sizes[next++];
+        jobs[t].end = next;
+    }
+    jobs[num_threads - 1].end = number;
+    unsigned int started = 0;
+    for (; started < num_threads; started++) {
+        if (pthread_create(&threads[started], NULL, deserialize_shard_worker,
+                           &jobs[started]) != 0) {
+            break;
+        }
+    }
+    // any job we could not hand to a thread runs on the calling thread
+    for (unsigned int t = started; t < num_threads; t++) {
+        deserialize_shard_worker(&jobs[t]);
+    }
+    for (unsigned int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    roaring_free(threads);
+    roaring_free(jobs);
+    size_t ok = 0;
+    for (size_t i = 0; i < number; i++) {
+        if (answers[i] != NULL) ok++;
+    }
+    return ok;
+}
+
+#else  // ROARING_HAVE_PTHREAD
+
+// no portable thread support on this platform: run the serial engine
+roaring_bitmap_t *roaring_bitmap_or_many_parallel(size_t number,
+                                                  const roaring_bitmap_t **x,
+                                                  unsigned int num_threads) {
+    (void)num_threads;
+    return roaring_bitmap_or_many(number, x);
+}
+
+void roaring_bitmap_to_uint32_array_parallel(const roaring_bitmap_t *ra,
+                                             uint32_t *ans,
+                                             unsigned int num_threads) {
+    (void)num_threads;
+    roaring_bitmap_to_uint32_array(ra, ans);
+}
+
+size_t roaring_bitmap_portable_deserialize_many(size_t number,
+                                                const char **bufs,
+                                                const size_t *sizes,
+                                                roaring_bitmap_t **answers,
+                                                unsigned int num_threads) {
+    (void)num_threads;
+    size_t ok = 0;
+    for (size_t i = 0; i < number; i++) {
+        answers[i] = roaring_bitmap_portable_deserialize_safe(bufs[i],
+                                                              sizes[i]);
+        if (answers[i] != NULL) ok++;
+    }
+    return ok;
+}
+
+void roaring_bitmap_and_cardinality_many(const roaring_bitmap_t *query,
+                                         size_t number,
+                                         const roaring_bitmap_t **candidates,
+                                         uint64_t *answers,
+                                         unsigned int num_threads) {
+    (void)num_threads;
+    for (size_t i = 0; i < number; i++) {
+        answers[i] = roaring_bitmap_and_cardinality(query, candidates[i]);
+    }
+}
+
+void roaring_bitmap_jaccard_index_many(const roaring_bitmap_t *query,
+                                       size_t number,
+                                       const roaring_bitmap_t **candidates,
+                                       double *answers,
+                                       unsigned int num_threads) {
+    (void)num_threads;
+    for (size_t i = 0; i < number; i++) {
+        answers[i] = roaring_bitmap_jaccard_index(query, candidates[i]);
+    }
+}
+
+#endif  // ROARING_HAVE_PTHREAD
@@ -1,3 +1,4 @@
+#include <roaring/memory.h>
 #include <roaring/roaring.h>
 
 struct roaring_pq_element_s {
@@ -33,9 +34,9 @@ static void pq_add(roaring_pq_t *pq, roaring_pq_element_t *t) {
 }
 
 static void pq_free(roaring_pq_t *pq) {
-    free(pq->elements);
+    roaring_free(pq->elements);
     pq->elements = NULL;  // paranoid
-    free(pq);
+    roaring_free(pq);
 }
 
 static void percolate_down(roaring_pq_t *pq, uint32_t i) {
@@ -62,9 +63,9 @@ static void percolate_down(roaring_pq_t *pq, uint32_t i) {
 }
 
 static roaring_pq_t *create_pq(const roaring_bitmap_t **arr, uint32_t length) {
-    roaring_pq_t *answer = (roaring_pq_t *)malloc(sizeof(roaring_pq_t));
+    roaring_pq_t *answer = (roaring_pq_t *)roaring_malloc(sizeof(roaring_pq_t));
     answer->elements =
-        (roaring_pq_element_t *)malloc(sizeof(roaring_pq_element_t) * length);
+        (roaring_pq_element_t *)roaring_malloc(sizeof(roaring_pq_element_t) * length);
     answer->size = length;
     for (uint32_t i = 0; i < length; i++) {
         answer->elements[i].bitmap = (roaring_bitmap_t *)arr[i];
@@ -180,8 +181,8 @@ static roaring_bitmap_t *lazy_or_from_lazy_inputs(roaring_bitmap_t *x1,
     }
     ra_clear_without_containers(&x1->high_low_container);
     ra_clear_without_containers(&x2->high_low_container);
-    free(x1);
-    free(x2);
+    roaring_free(x1);
+    roaring_free(x2);
     return answer;
 }
 
@@ -239,3 +240,220 @@ roaring_bitmap_t *roaring_bitmap_or_many_heap(uint32_t number,
     pq_free(pq);
     return answer;
 }
+
+/*
+ * A much smaller heap for the k-way merge: one cursor per input bitmap,
+ * ordered by the cursor's next key.  Unlike the bitmap heap above, no
+ * intermediate bitmaps are ever created.
+ */
+typedef struct roaring_kway_cursor_s {
+    uint16_t key;    // next key of this input
+    uint32_t input;  // index into the array of input bitmaps
+} roaring_kway_cursor_t;
+
+static inline bool kway_compare(const roaring_kway_cursor_t *t1,
+                                const roaring_kway_cursor_t *t2) {
+    return t1->key < t2->key;
+}
+
+static void kway_add(roaring_kway_cursor_t *heap, uint64_t *size,
+                     roaring_kway_cursor_t t) {
+    uint64_t i = (*size)++;
+    while (i > 0) {
+        uint64_t p = (i - 1) >> 1;
+        roaring_kway_cursor_t ap = heap[p];
+        if (!kway_compare(&t, &ap)) break;
+        heap[i] = ap;
+        i = p;
+    }
+    heap[i] = t;
+}
+
+static roaring_kway_cursor_t kway_poll(roaring_kway_cursor_t *heap,
+                                       uint64_t *size) {
+    roaring_kway_cursor_t ans = heap[0];
+    // sift the last element down from the root
+    roaring_kway_cursor_t t = heap[--(*size)];
+    const uint64_t hsize = *size;
+    uint64_t i = 0;
+    while (true) {
+        uint64_t child = 2 * i + 1;
+        if (child >= hsize) break;
+        if (child + 1 < hsize &&
+            kway_compare(&heap[child + 1], &heap[child])) {
+            child++;
+        }
+        if (!kway_compare(&heap[child], &t)) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = t;
+    return ans;
+}
+
+/**
+ * Compute the union of 'number' bitmaps with a k-way merge over their key
+ * arrays: all the containers sharing a key are unioned directly into the
+ * output with the lazy kernels.
+ */
+roaring_bitmap_t *roaring_bitmap_or_many_kway(size_t number,
+                                              const roaring_bitmap_t **x) {
+    if (number == 0) {
+        return roaring_bitmap_create();
+    }
+    if (number == 1) {
+        return roaring_bitmap_copy(x[0]);
+    }
+    int32_t *pos = (int32_t *)roaring_malloc(number * sizeof(int32_t));
+    roaring_kway_cursor_t *heap = (roaring_kway_cursor_t *)roaring_malloc(
+        number * sizeof(roaring_kway_cursor_t));
+    roaring_bitmap_t *answer = roaring_bitmap_create();
+    if (pos == NULL || heap == NULL || answer == NULL) {
+        roaring_free(pos);
+        roaring_free(heap);
+        if (answer != NULL) roaring_bitmap_free(answer);
+        return NULL;
+    }
+    uint64_t heap_size = 0;
+    for (size_t i = 0; i < number; i++) {
+        pos[i] = 0;
+        if (x[i]->high_low_container.size > 0) {
+            roaring_kway_cursor_t cursor = {
+                .key = ra_get_key_at_index(&x[i]->high_low_container, 0),
+                .input = (uint32_t)i};
+            kway_add(heap, &heap_size, cursor);
+        }
+    }
+    while (heap_size > 0) {
+        const uint16_t key = heap[0].key;
+        // union every container carrying this key straight into the output
+        void *first_c = NULL;
+        uint8_t first_type = 0;
+        void *c = NULL;
+        uint8_t ctype = 0;
+        while (heap_size > 0 && heap[0].key == key) {
+            roaring_kway_cursor_t cursor = kway_poll(heap, &heap_size);
+            const roaring_array_t *ra =
+                &x[cursor.input]->high_low_container;
+            uint8_t type;
+            void *ci = ra_get_container_at_index(ra, pos[cursor.input], &type);
+            if (first_c == NULL && c == NULL) {
+                // borrow the first container: no work if it is the only one
+                first_c = ci;
+                first_type = type;
+            } else if (c == NULL) {
+                // second container: produce a fresh (owned) lazy union
+                c = container_lazy_or(first_c, first_type, ci, type, &ctype);
+                first_c = NULL;
+            } else {
+                uint8_t newtype;
+                void *newc = container_lazy_ior(c, ctype, ci, type, &newtype);
+                if (newc != c) {
+                    container_free(c, ctype);
+                }
+                c = newc;
+                ctype = newtype;
+            }
+            pos[cursor.input]++;
+            if (pos[cursor.input] < ra->size) {
+                cursor.key = ra_get_key_at_index(ra, pos[cursor.input]);
+                kway_add(heap, &heap_size, cursor);
+            }
+        }
+        if (c == NULL) {
+            // a single bitmap had this key: the result owns a copy
+            uint8_t type = first_type;
+            const void *unwrapped = container_unwrap_shared(first_c, &type);
+            c = container_clone(unwrapped, type);
+            ctype = type;
+        }
+        ra_append(&answer->high_low_container, key, c, ctype);
+    }
+    roaring_free(pos);
+    roaring_free(heap);
+    roaring_bitmap_repair_after_lazy(answer);
+    return answer;
+}
+
+/**
+ * Compute the xor of 'number' bitmaps with the same k-way merge as
+ * roaring_bitmap_or_many_kway.  Unlike the lazy pairwise approach of
+ * roaring_bitmap_xor_many, memory usage never exceeds the final result
+ * plus one container, and containers that cancel out are dropped
+ * immediately.
+ */
+roaring_bitmap_t *roaring_bitmap_xor_many_heap(uint32_t number,
+                                               const roaring_bitmap_t **x) {
+    if (number == 0) {
+        return roaring_bitmap_create();
+    }
+    if (number == 1) {
+        return roaring_bitmap_copy(x[0]);
+    }
+    int32_t *pos = (int32_t *)roaring_malloc(number * sizeof(int32_t));
+    roaring_kway_cursor_t *heap = (roaring_kway_cursor_t *)roaring_malloc(
+        number * sizeof(roaring_kway_cursor_t));
+    roaring_bitmap_t *answer = roaring_bitmap_create();
+    if (pos == NULL || heap == NULL || answer == NULL) {
+        roaring_free(pos);
+        roaring_free(heap);
+        if (answer != NULL) roaring_bitmap_free(answer);
+        return NULL;
+    }
+    uint64_t heap_size = 0;
+    for (uint32_t i = 0; i < number; i++) {
+        pos[i] = 0;
+        if (x[i]->high_low_container.size > 0) {
+            roaring_kway_cursor_t cursor = {
+                .key = ra_get_key_at_index(&x[i]->high_low_container, 0),
+                .input = i};
+            kway_add(heap, &heap_size, cursor);
+        }
+    }
+    while (heap_size > 0) {
+        const uint16_t key = heap[0].key;
+        // xor every container carrying this key; we use the eager kernels
+        // so that containers that cancel out can be detected and dropped
+        void *first_c = NULL;
+        uint8_t first_type = 0;
+        void *c = NULL;
+        uint8_t ctype = 0;
+        while (heap_size > 0 && heap[0].key == key) {
+            roaring_kway_cursor_t cursor = kway_poll(heap, &heap_size);
+            const roaring_array_t *ra =
+                &x[cursor.input]->high_low_container;
+            uint8_t type;
+            void *ci = ra_get_container_at_index(ra, pos[cursor.input], &type);
+            if (first_c == NULL && c == NULL) {
+                first_c = ci;
+                first_type = type;
+            } else if (c == NULL) {
+                c = container_xor(first_c, first_type, ci, type, &ctype);
+                first_c = NULL;
+            } else {
+                // container_ixor consumes its first argument
+                c = container_ixor(c, ctype, ci, type, &ctype);
+            }
+            pos[cursor.input]++;
+            if (pos[cursor.input] < ra->size) {
+                cursor.key = ra_get_key_at_index(ra, pos[cursor.input]);
+                kway_add(heap, &heap_size, cursor);
+            }
+        }
+        if (c == NULL) {
+            // a single bitmap had this key: the result owns a copy
+            uint8_t type = first_type;
+            const void *unwrapped = container_unwrap_shared(first_c, &type);
+            c = container_clone(unwrapped, type);
+            ctype = type;
+        }
+        if (container_nonzero_cardinality(c, ctype)) {
+            ra_append(&answer->high_low_container, key, c, ctype);
+        } else {
+            container_free(c, ctype);
+        }
+    }
+    roaring_free(pos);
+    roaring_free(heap);
+    return answer;
+}
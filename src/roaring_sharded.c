@@ -0,0 +1,238 @@
+/*
+ * roaring_sharded.c
+ *
+ * Sharded facade over one logical bitmap; see roaring_sharded.h for the
+ * locking contract. Values are routed by their container key, so the key
+ * sets of the shards are disjoint regardless of the policy: a merge is a
+ * union of bitmaps that never share a key, and an aggregate never has to
+ * reconcile two shards' views of the same container.
+ */
+
+#include <string.h>
+
+#include <roaring/containers/containers.h>
+#include <roaring/memory.h>
+#include <roaring/roaring_array.h>
+#include <roaring/roaring_sharded.h>
+
+#if !defined(_WIN32)
+#define ROARING_HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+struct roaring_sharded_s {
+    uint32_t num_shards;
+    roaring_shard_policy_t policy;
+    roaring_bitmap_t **shards;
+#ifdef ROARING_HAVE_PTHREAD
+    pthread_mutex_t *locks;
+#endif
+};
+
+static inline uint32_t shard_of(const roaring_sharded_t *rs, uint16_t key) {
+    uint32_t h = key;
+    if (rs->policy == ROARING_SHARD_BY_HASH) {
+        // 16-bit Fibonacci multiplier, to spread consecutive keys
+        h = (uint32_t)(uint16_t)(h * 40503);
+    }
+    // maps [0, 65536) onto [0, num_shards) without a division
+    return (h * rs->num_shards) >> 16;
+}
+
+static inline void shard_lock(const roaring_sharded_t *rs, uint32_t s) {
+#ifdef ROARING_HAVE_PTHREAD
+    pthread_mutex_lock(&rs->locks[s]);
+#else
+    (void)rs;
+    (void)s;
+#endif
+}
+
+static inline void shard_unlock(const roaring_sharded_t *rs, uint32_t s) {
+#ifdef ROARING_HAVE_PTHREAD
+    pthread_mutex_unlock(&rs->locks[s]);
+#else
+    (void)rs;
+    (void)s;
+#endif
+}
+
+roaring_sharded_t *roaring_sharded_create(uint32_t num_shards,
+                                          roaring_shard_policy_t policy) {
+    if (num_shards == 0) num_shards = 1;
+    roaring_sharded_t *rs =
+        (roaring_sharded_t *)roaring_malloc(sizeof(roaring_sharded_t));
+    if (rs == NULL) return NULL;
+    rs->num_shards = num_shards;
+    rs->policy = policy;
+    rs->shards = (roaring_bitmap_t **)roaring_calloc(num_shards,
+                                                     sizeof(roaring_bitmap_t *));
+    if (rs->shards == NULL) {
+        roaring_free(rs);
+        return NULL;
+    }
+#ifdef ROARING_HAVE_PTHREAD
+    rs->locks = (pthread_mutex_t *)roaring_malloc(num_shards *
+                                                  sizeof(pthread_mutex_t));
+    if (rs->locks == NULL) {
+        roaring_free(rs->shards);
+        roaring_free(rs);
+        return NULL;
+    }
+    for (uint32_t s = 0; s < num_shards; s++) {
+        pthread_mutex_init(&rs->locks[s], NULL);
+    }
+#endif
+    for (uint32_t s = 0; s < num_shards; s++) {
+        rs->shards[s] = roaring_bitmap_create();
+        if (rs->shards[s] == NULL) {
+            roaring_sharded_free(rs);
+            return NULL;
+        }
+    }
+    return rs;
+}
+
+void roaring_sharded_free(roaring_sharded_t *rs) {
+    if (rs == NULL) return;
+    for (uint32_t s = 0; s < rs->num_shards; s++) {
+        if (rs->shards[s] != NULL) roaring_bitmap_free(rs->shards[s]);
+    }
+#ifdef ROARING_HAVE_PTHREAD
+    for (uint32_t s = 0; s < rs->num_shards; s++) {
+        pthread_mutex_destroy(&rs->locks[s]);
+    }
+    roaring_free(rs->locks);
+#endif
+    roaring_free(rs->shards);
+    roaring_free(rs);
+}
+
+void roaring_sharded_add(roaring_sharded_t *rs, uint32_t x) {
+    const uint32_t s = shard_of(rs, (uint16_t)(x >> 16));
+    shard_lock(rs, s);
+    roaring_bitmap_add(rs->shards[s], x);
+    shard_unlock(rs, s);
+}
+
+void roaring_sharded_add_bulk(roaring_sharded_t *rs, size_t n_args,
+                              const uint32_t *vals) {
+    if (n_args == 0) return;
+    // bucket the values by shard, so each lock is taken once per call
+    uint32_t *counts =
+        (uint32_t *)roaring_calloc(rs->num_shards, sizeof(uint32_t));
+    uint32_t *buckets = (uint32_t *)roaring_malloc(n_args * sizeof(uint32_t));
+    if (counts == NULL || buckets == NULL) {
+        // degrade to per-value routing rather than fail
+        roaring_free(counts);
+        roaring_free(buckets);
+        for (size_t i = 0; i < n_args; i++) roaring_sharded_add(rs, vals[i]);
+        return;
+    }
+    for (size_t i = 0; i < n_args; i++) {
+        counts[shard_of(rs, (uint16_t)(vals[i] >> 16))]++;
+    }
+    uint32_t offset = 0;
+    for (uint32_t s = 0; s < rs->num_shards; s++) {
+        const uint32_t count = counts[s];
+        counts[s] = offset;  // becomes the write cursor of shard s
+        offset += count;
+    }
+    for (size_t i = 0; i < n_args; i++) {
+        buckets[counts[shard_of(rs, (uint16_t)(vals[i] >> 16))]++] = vals[i];
+    }
+    uint32_t begin = 0;
+    for (uint32_t s = 0; s < rs->num_shards; s++) {
+        const uint32_t end = counts[s];  // cursor stopped one past the bucket
+        if (end > begin) {
+            shard_lock(rs, s);
+            roaring_bitmap_add_many(rs->shards[s], end - begin,
+                                    buckets + begin);
+            shard_unlock(rs, s);
+        }
+        begin = end;
+    }
+    roaring_free(buckets);
+    roaring_free(counts);
+}
+
+void roaring_sharded_remove(roaring_sharded_t *rs, uint32_t x) {
+    const uint32_t s = shard_of(rs, (uint16_t)(x >> 16));
+    shard_lock(rs, s);
+    roaring_bitmap_remove(rs->shards[s], x);
+    shard_unlock(rs, s);
+}
+
+bool roaring_sharded_contains(const roaring_sharded_t *rs, uint32_t x) {
+    const uint32_t s = shard_of(rs, (uint16_t)(x >> 16));
+    shard_lock(rs, s);
+    const bool answer = roaring_bitmap_contains(rs->shards[s], x);
+    shard_unlock(rs, s);
+    return answer;
+}
+
+uint64_t roaring_sharded_get_cardinality(const roaring_sharded_t *rs) {
+    uint64_t card = 0;
+    for (uint32_t s = 0; s < rs->num_shards; s++) {
+        shard_lock(rs, s);
+        card += roaring_bitmap_get_cardinality(rs->shards[s]);
+        shard_unlock(rs, s);
+    }
+    return card;
+}
+
+void roaring_sharded_or_inplace(roaring_sharded_t *rs,
+                                const roaring_bitmap_t *x2) {
+    const roaring_array_t *sa = &x2->high_low_container;
+    for (int32_t i = 0; i < sa->size; i++) {
+        const uint16_t key = sa->keys[i];
+        const uint32_t s = shard_of(rs, key);
+        shard_lock(rs, s);
+        roaring_array_t *ra = &rs->shards[s]->high_low_container;
+        ra_invalidate_cached_cardinality(ra);
+        uint8_t type2 = sa->typecodes[i];
+        const void *c2 = container_unwrap_shared(sa->containers[i], &type2);
+        const int32_t idx = ra_get_index(ra, key);
+        if (idx >= 0) {
+            uint8_t type1;
+            void *c1 = ra_get_container_at_index(ra, idx, &type1);
+            if (!container_is_full(c1, type1)) {
+                c1 = get_writable_copy_if_shared(c1, &type1);
+                uint8_t result_type;
+                void *c = container_ior(c1, type1, c2, type2, &result_type);
+                if (c != c1) {
+                    container_free(c1, type1);
+                }
+                ra_set_container_at_index(ra, idx, c, result_type);
+            }
+        } else {
+            void *c = container_clone(c2, type2);
+            ra_insert_new_key_value_at(ra, -idx - 1, key, c, type2);
+        }
+        shard_unlock(rs, s);
+    }
+}
+
+roaring_bitmap_t *roaring_sharded_merge(const roaring_sharded_t *rs) {
+    roaring_bitmap_t *ans = roaring_bitmap_create();
+    if (ans == NULL) return NULL;
+    if (rs->policy == ROARING_SHARD_BY_RANGE) {
+        // the shards hold ascending disjoint key ranges: a straight append
+        for (uint32_t s = 0; s < rs->num_shards; s++) {
+            shard_lock(rs, s);
+            const roaring_array_t *ra = &rs->shards[s]->high_low_container;
+            ra_append_copy_range(&ans->high_low_container, ra, 0, ra->size,
+                                 false);
+            shard_unlock(rs, s);
+        }
+    } else {
+        // hashed keys interleave; the key sets are still disjoint, so a
+        // union merges them without touching any container twice
+        for (uint32_t s = 0; s < rs->num_shards; s++) {
+            shard_lock(rs, s);
+            roaring_bitmap_or_inplace(ans, rs->shards[s]);
+            shard_unlock(rs, s);
+        }
+    }
+    return ans;
+}
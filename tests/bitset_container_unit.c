@@ -248,6 +248,26 @@ void select_test() {
     bitset_container_free(B);
 }
 
+// dense enough to exercise the vectorized word-skipping in select and rank
+void select_rank_dense_test() {
+    bitset_container_t* B = bitset_container_create();
+    assert_non_null(B);
+    int card = 0;
+    for (uint32_t value = 0; value < 65536; value += 3) {
+        bitset_container_add(B, (uint16_t)value);
+        card++;
+    }
+    uint32_t element = 0;
+    for (int rank = 0; rank < card; rank += 97) {
+        uint32_t start_rank = 0;
+        assert_true(bitset_container_select(B, &start_rank, rank, &element));
+        assert_int_equal(element, 3 * rank);
+        assert_int_equal(bitset_container_rank(B, (uint16_t)element), rank + 1);
+    }
+    assert_int_equal(bitset_container_rank(B, 65535), card);
+    bitset_container_free(B);
+}
+
 int main() {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_bitset_lenrange_cardinality),
@@ -255,6 +275,7 @@ int main() {
         cmocka_unit_test(and_or_test), cmocka_unit_test(xor_test),
         cmocka_unit_test(andnot_test), cmocka_unit_test(to_uint32_array_test),
         cmocka_unit_test(select_test),
+        cmocka_unit_test(select_rank_dense_test),
         cmocka_unit_test(test_bitset_compute_cardinality),
     };
 
@@ -342,6 +342,70 @@ void test_run_compression_cpp_64(bool copy_on_write) {
   return;
 }
 
+void test_cpp_batch_queries_64(void **) {
+    Roaring64Map r;
+    std::vector<uint64_t> values;
+    // several shards, including ones beyond 32 bits, with gaps in between
+    for (uint64_t i = 0; i < 2000; i++) {
+        values.push_back(i * 37);
+    }
+    for (uint64_t i = 0; i < 2000; i++) {
+        values.push_back((5ull << 32) + i * 1001);
+    }
+    for (uint64_t i = 0; i < 100; i++) {
+        values.push_back((1ull << 60) + i);
+    }
+    r.addMany(values.size(), values.data());
+    assert_true(r.cardinality() == values.size());
+
+    // containsMany: probes mixing hits, misses and absent shards
+    std::vector<uint64_t> probes;
+    for (uint64_t i = 0; i < 3000; i++) {
+        probes.push_back(i * 19);
+    }
+    for (uint64_t i = 0; i < 500; i++) {
+        probes.push_back((3ull << 32) + i);  // absent shard
+    }
+    for (uint64_t i = 0; i < 500; i++) {
+        probes.push_back((5ull << 32) + i * 2002);
+    }
+    std::vector<bool> expected;
+    for (uint64_t probe : probes) {
+        expected.push_back(r.contains(probe));
+    }
+    std::vector<char> results(probes.size());
+    r.containsMany(probes.size(), probes.data(), (bool *)results.data());
+    for (size_t i = 0; i < probes.size(); i++) {
+        assert_true((bool)results[i] == expected[i]);
+    }
+
+    // rankMany on sorted queries must agree with rank
+    std::vector<uint64_t> sorted_probes(probes);
+    std::sort(sorted_probes.begin(), sorted_probes.end());
+    std::vector<uint64_t> ranks(sorted_probes.size());
+    r.rankMany(sorted_probes.data(),
+               sorted_probes.data() + sorted_probes.size(), ranks.data());
+    for (size_t i = 0; i < sorted_probes.size(); i++) {
+        assert_true(ranks[i] == r.rank(sorted_probes[i]));
+    }
+
+    // selectMany over every rank recovers the sorted values
+    std::vector<uint64_t> rnks;
+    for (uint64_t i = 0; i < values.size(); i++) {
+        rnks.push_back(i);
+    }
+    std::vector<uint64_t> selected(values.size());
+    assert_true(r.selectMany(rnks.data(), rnks.data() + rnks.size(),
+                             selected.data()));
+    std::sort(values.begin(), values.end());
+    assert_true(selected == values);
+
+    // an out-of-range rank fails, as with select
+    uint64_t oob = values.size();
+    uint64_t dummy;
+    assert_false(r.selectMany(&oob, &oob + 1, &dummy));
+}
+
 void test_example_cpp_64(bool copy_on_write) {
     // create a new empty bitmap
     Roaring64Map r1;
@@ -546,6 +610,100 @@ void test_cpp_clear_64(void **) {
     assert_true(roaring.isEmpty());
 }
 
+void test_cpp_parallel_serialization_64(void **) {
+    Roaring64Map roaring;
+    for (uint64_t shard = 0; shard < 10; ++shard) {
+        for (uint64_t i = 0; i < 1000; ++i) {
+            roaring.add((shard << 32) + i * 71);
+        }
+    }
+
+    size_t expectedsize = roaring.getSizeInBytes();
+    char *serialized = new char[expectedsize];
+    assert_true(roaring.write(serialized) == expectedsize);
+
+    // the parallel writer must produce the exact same bytes
+    char *parallelserialized = new char[expectedsize];
+    assert_true(roaring.writeParallel(parallelserialized, 4) == expectedsize);
+    assert_true(memcmp(serialized, parallelserialized, expectedsize) == 0);
+
+    Roaring64Map t = Roaring64Map::readParallel(serialized, 4);
+    assert_true(roaring == t);
+
+    delete[] serialized;
+    delete[] parallelserialized;
+}
+
+void test_cpp_parallel_ops_64(void **) {
+    // two bitmaps with partly overlapping shards, so the parallel paths
+    // exercise matched pairs, left-only and right-only shards
+    Roaring64Map a, b;
+    for (uint64_t shard = 0; shard < 12; ++shard) {
+        for (uint64_t i = 0; i < 800; ++i) {
+            a.add((shard << 32) + i * 37);
+        }
+    }
+    for (uint64_t shard = 6; shard < 18; ++shard) {
+        for (uint64_t i = 0; i < 800; ++i) {
+            b.add((shard << 32) + i * 41);
+        }
+    }
+
+    Roaring64Map expected_and(a), expected_or(a), expected_xor(a),
+        expected_andnot(a);
+    expected_and &= b;
+    expected_or |= b;
+    expected_xor ^= b;
+    expected_andnot -= b;
+
+    Roaring64Map r_and(a), r_or(a), r_xor(a), r_andnot(a);
+    r_and.andInplaceParallel(b, 4);
+    r_or.orInplaceParallel(b, 4);
+    r_xor.xorInplaceParallel(b, 4);
+    r_andnot.andnotInplaceParallel(b, 4);
+    assert_true(r_and == expected_and);
+    assert_true(r_or == expected_or);
+    assert_true(r_xor == expected_xor);
+    assert_true(r_andnot == expected_andnot);
+
+    assert_true(a.cardinalityParallel(4) == a.cardinality());
+    assert_true(r_or.cardinalityParallel(4) == expected_or.cardinality());
+
+    std::vector<uint64_t> serial(a.cardinality()), parallel(a.cardinality());
+    a.toUint64Array(serial.data());
+    a.toUint64ArrayParallel(parallel.data(), 4);
+    assert_true(serial == parallel);
+
+    // degenerate cases fall back to the serial paths
+    Roaring64Map empty;
+    assert_true(empty.cardinalityParallel(4) == 0);
+    empty.orInplaceParallel(b, 4);
+    assert_true(empty == b);
+    empty.andnotInplaceParallel(b, 4);
+    assert_true(empty.isEmpty());
+}
+
+void test_cpp_add_many_64(void **) {
+    Roaring64Map roaring;
+
+    // descending shards, ascending shards and repeat visits to a shard,
+    // so the bulk path has to both insert and revisit
+    uint64_t values64[8] = { 0xA00000000AULL, 123ULL, 0xA000000000ULL,
+                             0xAFFFFFFF7ULL, 0xFFFFFFFFFULL, 124ULL,
+                             0xA00000000BULL, 122ULL};
+    roaring.addMany(8, values64);
+
+    Roaring64Map expected;
+    for (int i = 0; i < 8; ++i) {
+        expected.add(values64[i]);
+    }
+    assert_true(roaring == expected);
+    assert_true(roaring.cardinality() == 8);
+    for (int i = 0; i < 8; ++i) {
+        assert_true(roaring.contains(values64[i]));
+    }
+}
+
 void test_cpp_move_64(void **) {
     Roaring64Map roaring;
 
@@ -591,6 +749,35 @@ void test_cpp_bidirectional_iterator_64(void **) {
 	assert_true(i == roaring.begin());
 }
 
+void test_cpp_rvalue_operator_chaining(void **) {
+    Roaring a = Roaring::bitmapOf(6, 1, 2, 3, 100, 1000, 70000);
+    Roaring b = Roaring::bitmapOf(5, 2, 3, 200, 1000, 70000);
+    Roaring c = Roaring::bitmapOf(4, 3, 1000, 70000, 500000);
+    Roaring d = Roaring::bitmapOf(3, 9, 70000, 500000);
+
+    // step-by-step in-place reference
+    Roaring expected = a;
+    expected &= b;
+    expected &= c;
+    expected |= d;
+    expected -= Roaring::bitmapOf(1, 9);
+
+    // the chained expression should fuse into in-place operations on the
+    // temporaries produced along the way
+    Roaring actual = (((a & b) & c) | d) - Roaring::bitmapOf(1, 9);
+    assert_true(actual == expected);
+
+    Roaring x = (a ^ b) ^ c;
+    Roaring y = a;
+    y ^= b;
+    y ^= c;
+    assert_true(x == y);
+
+    // lvalue operands must be left untouched
+    assert_true(a == Roaring::bitmapOf(6, 1, 2, 3, 100, 1000, 70000));
+    assert_true(b == Roaring::bitmapOf(5, 2, 3, 200, 1000, 70000));
+}
+
 int main() {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(serial_test),
@@ -598,6 +785,7 @@ int main() {
         cmocka_unit_test(test_example_false),
         cmocka_unit_test(test_example_cpp_true),
         cmocka_unit_test(test_example_cpp_false),
+        cmocka_unit_test(test_cpp_batch_queries_64),
         cmocka_unit_test(test_example_cpp_64_true),
         cmocka_unit_test(test_example_cpp_64_false),
         cmocka_unit_test(test_cpp_add_remove_checked),
@@ -606,9 +794,13 @@ int main() {
         cmocka_unit_test(test_run_compression_cpp_64_false),
         cmocka_unit_test(test_run_compression_cpp_true),
         cmocka_unit_test(test_run_compression_cpp_false),
+		cmocka_unit_test(test_cpp_parallel_serialization_64),
+		cmocka_unit_test(test_cpp_parallel_ops_64),
+		cmocka_unit_test(test_cpp_add_many_64),
 		cmocka_unit_test(test_cpp_clear_64),
 		cmocka_unit_test(test_cpp_move_64),
-		cmocka_unit_test(test_cpp_bidirectional_iterator_64)};
+		cmocka_unit_test(test_cpp_bidirectional_iterator_64),
+		cmocka_unit_test(test_cpp_rvalue_operator_chaining)};
 
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
@@ -203,12 +203,33 @@ void remove_range_test() {
     run_container_free(run);
 }
 
+void rank_many_runs_test() {
+    run_container_t* B = run_container_create();
+    assert_non_null(B);
+
+    // thousands of short runs, evenly spread across the whole range
+    for (size_t x = 0; x < 1 << 16; x++) {
+        if (x % 7 < 3) assert_true(run_container_add(B, x));
+    }
+
+    int expected_rank = 0;
+    for (size_t x = 0; x < 1 << 16; x++) {
+        const bool present = (x % 7 < 3);
+        if (present) ++expected_rank;
+        assert_int_equal(run_container_contains(B, x), present);
+        assert_int_equal(run_container_rank(B, x), expected_rank);
+    }
+
+    run_container_free(B);
+}
+
 int main() {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(printf_test), cmocka_unit_test(add_contains_test),
         cmocka_unit_test(and_or_test), cmocka_unit_test(to_uint32_array_test),
         cmocka_unit_test(select_test),
         cmocka_unit_test(remove_range_test),
+        cmocka_unit_test(rank_many_runs_test),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -4,7 +4,18 @@
 #include <string.h>
 #include <time.h>
 
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
+
+#include <roaring/containers/container_pool.h>
+#include <roaring/containers/perfparameters.h>
+#include <roaring/instrumentation.h>
+#include <roaring/memory.h>
 #include <roaring/roaring.h>
+#include <roaring/roaring_atomic_ref.h>
+#include <roaring/roaring_collection.h>
+#include <roaring/roaring_sharded.h>
 
 #include "test.h"
 
@@ -47,6 +58,997 @@ void range_contains() {
     roaring_bitmap_free(bm);
 }
 
+void test_add_bulk_contains_bulk() {
+    roaring_bitmap_t *bm = roaring_bitmap_create();
+    roaring_bulk_context_t context = {0};
+    // mostly-clustered values, with container type changes (array to
+    // bitset) and excursions to other keys along the way
+    for (uint32_t i = 0; i < 10000; i++) {
+        roaring_bitmap_add_bulk(bm, &context, i * 2);
+        roaring_bitmap_add_bulk(bm, &context, 0x10000000 + i);
+        roaring_bitmap_add_bulk(bm, &context, i * 2);  // deliberate repeat
+    }
+    assert_int_equal(roaring_bitmap_get_cardinality(bm), 20000);
+
+    roaring_bulk_context_t lookup_context = {0};
+    for (uint32_t i = 0; i < 10000; i++) {
+        assert_true(roaring_bitmap_contains_bulk(bm, &lookup_context, i * 2));
+        assert_true(
+            roaring_bitmap_contains_bulk(bm, &lookup_context, 0x10000000 + i));
+        assert_false(
+            roaring_bitmap_contains_bulk(bm, &lookup_context, i * 2 + 1));
+    }
+    // missing key: must not disturb the context
+    assert_false(roaring_bitmap_contains_bulk(bm, &lookup_context, 0x20000000));
+    assert_true(roaring_bitmap_contains_bulk(bm, &lookup_context, 0));
+
+    // the bulk bitmap must match one built with roaring_bitmap_add
+    roaring_bitmap_t *expected = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 10000; i++) {
+        roaring_bitmap_add(expected, i * 2);
+        roaring_bitmap_add(expected, 0x10000000 + i);
+    }
+    assert_true(roaring_bitmap_equals(bm, expected));
+    roaring_bitmap_free(expected);
+    roaring_bitmap_free(bm);
+}
+
+void test_remove_bulk() {
+    roaring_bitmap_t *bm = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 3 * 65536; i += 2) {
+        roaring_bitmap_add(bm, i);
+    }
+    // a copy-on-write copy makes the containers shared, so removal must
+    // unshare before writing
+    roaring_bitmap_set_copy_on_write(bm, true);
+    roaring_bitmap_t *cow = roaring_bitmap_copy(bm);
+
+    // sorted removal: container type changes (bitset back to array), a
+    // fully emptied middle container, and misses on absent keys/values
+    roaring_bulk_context_t context = {0};
+    for (uint32_t i = 0; i < 3 * 65536; i += 2) {
+        if (i >= 65536 && i < 2 * 65536) {
+            roaring_bitmap_remove_bulk(bm, &context, i);  // empties key 1
+        } else if ((i & 4) == 0) {
+            roaring_bitmap_remove_bulk(bm, &context, i);
+            roaring_bitmap_remove_bulk(bm, &context, i + 1);  // absent value
+        }
+    }
+    roaring_bitmap_remove_bulk(bm, &context, 0x10000000);  // absent key
+
+    roaring_bitmap_t *expected = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 3 * 65536; i += 2) {
+        if (i >= 65536 && i < 2 * 65536) continue;
+        if ((i & 4) == 0) continue;
+        roaring_bitmap_add(expected, i);
+    }
+    assert_true(roaring_bitmap_equals(bm, expected));
+
+    // the copy must still hold the original content
+    assert_int_equal(3 * 65536 / 2, roaring_bitmap_get_cardinality(cow));
+
+    roaring_bitmap_free(expected);
+    roaring_bitmap_free(cow);
+    roaring_bitmap_free(bm);
+}
+
+void test_instrumentation() {
+    roaring_instrumentation_reset();
+    // provoke an array->bitset conversion and some reallocations
+    roaring_bitmap_t *bm = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 10000; i++) {
+        roaring_bitmap_add(bm, i * 2);
+    }
+    roaring_instrumentation_t snap;
+    roaring_instrumentation_snapshot(&snap);
+    if (roaring_instrumentation_is_enabled()) {
+        assert_true(snap.array_to_bitset_conversions > 0);
+        assert_true(snap.array_grows > 0);
+        roaring_instrumentation_reset();
+        roaring_instrumentation_snapshot(&snap);
+    }
+    // without ROARING_INSTRUMENTATION (and always after a reset) the
+    // counters read as zero
+    assert_int_equal(0, (int)snap.array_to_bitset_conversions);
+    assert_int_equal(0, (int)snap.array_grows);
+    assert_int_equal(0, (int)snap.lazy_repairs);
+    roaring_bitmap_free(bm);
+}
+
+void test_runtime_tuning() {
+    roaring_tuning_t tuning;
+    roaring_tuning_get(&tuning);
+    assert_int_equal(4096, tuning.array_bitset_threshold);
+
+    // out-of-range values are rejected and leave the tuning unchanged
+    roaring_tuning_t bad = tuning;
+    bad.array_bitset_threshold = 0;
+    assert_false(roaring_tuning_set(&bad));
+    roaring_tuning_get(&tuning);
+    assert_int_equal(4096, tuning.array_bitset_threshold);
+
+    // convert to bitsets much earlier, and back to arrays much later
+    tuning.array_bitset_threshold = 256;
+    tuning.bitset_array_threshold = 128;
+    assert_true(roaring_tuning_set(&tuning));
+
+    roaring_bitmap_t *r = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 1000; i++) {
+        roaring_bitmap_add(r, i * 64);  // a single key, too sparse for runs
+    }
+    roaring_statistics_t stats;
+    roaring_bitmap_statistics(r, &stats);
+    assert_int_equal(1, stats.n_bitset_containers);
+    assert_int_equal(1000, roaring_bitmap_get_cardinality(r));
+
+    // removals cross the lowered downgrade threshold
+    for (uint32_t i = 1000; i-- > 100;) {
+        roaring_bitmap_remove(r, i * 64);
+    }
+    roaring_bitmap_statistics(r, &stats);
+    assert_int_equal(0, stats.n_bitset_containers);
+    assert_int_equal(1, stats.n_array_containers);
+    assert_int_equal(100, roaring_bitmap_get_cardinality(r));
+    roaring_bitmap_free(r);
+
+    roaring_tuning_reset();
+    roaring_tuning_get(&tuning);
+    assert_int_equal(4096, tuning.array_bitset_threshold);
+    assert_int_equal(1024, tuning.lazy_arrays_lowerbound);
+
+    // growth policy: a configured factor must actually grow the buffer
+    bad = tuning;
+    bad.container_growth_numerator = 1;
+    bad.container_growth_denominator = 2;
+    assert_false(roaring_tuning_set(&bad));
+
+    // quadrupling with size-class rounding, exercised through an ingest
+    tuning.container_growth_numerator = 4;
+    tuning.container_growth_denominator = 1;
+    tuning.container_growth_round_to_size_class = true;
+    assert_true(roaring_tuning_set(&tuning));
+    roaring_bitmap_t *g = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 4000; i++) roaring_bitmap_add(g, i * 2);
+    roaring_bitmap_add_range_closed(g, 1 << 16, (1 << 16) + 100);
+    roaring_bitmap_run_optimize(g);  // run container growth too
+    roaring_bitmap_add(g, (1 << 16) + 200);
+    assert_int_equal(4102, roaring_bitmap_get_cardinality(g));
+    roaring_bitmap_free(g);
+
+    // pre-sizing to the conversion threshold: the first allocation lands
+    // on the final capacity, so a mid-size container grows exactly once
+    tuning.container_growth_numerator = 0;
+    tuning.container_growth_denominator = 0;
+    tuning.container_initial_capacity = 4096;
+    tuning.container_growth_round_to_size_class = false;
+    assert_true(roaring_tuning_set(&tuning));
+    roaring_instrumentation_reset();
+    roaring_bitmap_t *p = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 4000; i++) roaring_bitmap_add(p, i * 2);
+    if (roaring_instrumentation_is_enabled()) {
+        roaring_instrumentation_t snap;
+        roaring_instrumentation_snapshot(&snap);
+        assert_true(snap.array_grows <= 1);
+    }
+    assert_int_equal(4000, roaring_bitmap_get_cardinality(p));
+    roaring_bitmap_free(p);
+    roaring_instrumentation_reset();
+
+    roaring_tuning_reset();
+    roaring_tuning_get(&tuning);
+    assert_int_equal(0, tuning.container_growth_denominator);
+    assert_int_equal(0, tuning.container_initial_capacity);
+}
+
+void test_contains_many() {
+    roaring_bitmap_t *bm = roaring_bitmap_create();
+    // an array container, a bitset container, a run container and an
+    // untouched key in between
+    for (uint32_t i = 0; i < 1000; i++) {
+        roaring_bitmap_add(bm, i * 60);  // key 0, array
+    }
+    for (uint32_t i = 0; i < 30000; i++) {
+        roaring_bitmap_add(bm, 0x20000 + i * 2);  // key 2, bitset
+    }
+    roaring_bitmap_add_range_closed(bm, 0x40000, 0x4CCCC);  // key 4, run
+    roaring_bitmap_run_optimize(bm);
+
+    const size_t n = 4000;
+    uint32_t *probes = (uint32_t *)malloc(n * sizeof(uint32_t));
+    bool *results = (bool *)malloc(n * sizeof(bool));
+    for (size_t i = 0; i < n; i++) {
+        // clustered probes sweeping all four keys, hits and misses mixed
+        probes[i] = (uint32_t)((i / 1000) << 16) * 2 + (uint32_t)(i * 17 % 0x10000);
+    }
+    roaring_bitmap_contains_many(bm, n, probes, results);
+    for (size_t i = 0; i < n; i++) {
+        assert_true(results[i] == roaring_bitmap_contains(bm, probes[i]));
+    }
+
+    // unsorted probes must get the same answers, just more slowly
+    for (size_t i = 0; i < n; i++) {
+        size_t j = (size_t)rand() % n;
+        uint32_t tmp = probes[i];
+        probes[i] = probes[j];
+        probes[j] = tmp;
+    }
+    roaring_bitmap_contains_many(bm, n, probes, results);
+    for (size_t i = 0; i < n; i++) {
+        assert_true(results[i] == roaring_bitmap_contains(bm, probes[i]));
+    }
+
+    // empty bitmap: everything is absent
+    roaring_bitmap_t *empty = roaring_bitmap_create();
+    roaring_bitmap_contains_many(empty, n, probes, results);
+    for (size_t i = 0; i < n; i++) {
+        assert_false(results[i]);
+    }
+    roaring_bitmap_free(empty);
+
+    free(results);
+    free(probes);
+    roaring_bitmap_free(bm);
+}
+
+static int compare_uint32s(const void *a, const void *b) {
+    uint32_t w1 = *(const uint32_t *)a;
+    uint32_t w2 = *(const uint32_t *)b;
+    return (w1 > w2) - (w1 < w2);
+}
+
+void test_and_or_array() {
+    roaring_bitmap_t *bm = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 1000; i++) {
+        roaring_bitmap_add(bm, i * 60);  // key 0, array
+    }
+    for (uint32_t i = 0; i < 30000; i++) {
+        roaring_bitmap_add(bm, 0x20000 + i * 2);  // key 2, bitset
+    }
+    roaring_bitmap_add_range_closed(bm, 0x40000, 0x4CCCC);  // key 4, run
+    roaring_bitmap_run_optimize(bm);
+
+    // sorted candidates sweeping present and absent keys, with duplicates
+    const size_t n = 5000;
+    uint32_t *candidates = (uint32_t *)malloc(n * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) {
+        candidates[i] = (uint32_t)(i * 77);  // keys 0 through 5
+        if (i % 16 == 0 && i > 0) candidates[i] = candidates[i - 1];
+    }
+    qsort(candidates, n, sizeof(uint32_t), compare_uint32s);
+
+    uint32_t *expected = (uint32_t *)malloc(n * sizeof(uint32_t));
+    size_t n_expected = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i > 0 && candidates[i] == candidates[i - 1]) continue;
+        if (roaring_bitmap_contains(bm, candidates[i])) {
+            expected[n_expected++] = candidates[i];
+        }
+    }
+
+    uint32_t *out = (uint32_t *)malloc(n * sizeof(uint32_t));
+    size_t n_out = roaring_bitmap_and_array(bm, n, candidates, out);
+    assert_true(n_out == n_expected);
+    assert_true(memcmp(out, expected, n_out * sizeof(uint32_t)) == 0);
+
+    // out may alias the input to filter in place
+    uint32_t *aliased = (uint32_t *)malloc(n * sizeof(uint32_t));
+    memcpy(aliased, candidates, n * sizeof(uint32_t));
+    n_out = roaring_bitmap_and_array(bm, n, aliased, aliased);
+    assert_true(n_out == n_expected);
+    assert_true(memcmp(aliased, expected, n_out * sizeof(uint32_t)) == 0);
+    free(aliased);
+    free(out);
+    free(expected);
+
+    // or_array_inplace must agree with adding the values one by one
+    roaring_bitmap_t *r1 = roaring_bitmap_copy(bm);
+    roaring_bitmap_t *r2 = roaring_bitmap_copy(bm);
+    roaring_bitmap_or_array_inplace(r1, n, candidates);
+    roaring_bitmap_add_many(r2, n, candidates);
+    assert_true(roaring_bitmap_equals(r1, r2));
+    roaring_bitmap_free(r1);
+    roaring_bitmap_free(r2);
+
+    // fresh containers: a large bucket becomes a bitset, a small one an array
+    const size_t m = 12000;
+    uint32_t *fresh = (uint32_t *)malloc(m * sizeof(uint32_t));
+    for (size_t i = 0; i < m - 100; i++) {
+        fresh[i] = 0x70000 + (uint32_t)i * 5;  // key 7, over 4096 values
+    }
+    for (size_t i = m - 100; i < m; i++) {
+        fresh[i] = 0x80000 + (uint32_t)(i - (m - 100));  // key 8, 100 values
+    }
+    roaring_bitmap_t *r3 = roaring_bitmap_create();
+    roaring_bitmap_or_array_inplace(r3, m, fresh);
+    roaring_bitmap_t *r4 = roaring_bitmap_of_ptr(m, fresh);
+    assert_true(roaring_bitmap_equals(r3, r4));
+    roaring_bitmap_free(r4);
+
+    // copy-on-write containers must be unshared before the in-place union
+    roaring_bitmap_set_copy_on_write(r3, true);
+    roaring_bitmap_t *cow = roaring_bitmap_copy(r3);
+    uint64_t cow_card = roaring_bitmap_get_cardinality(cow);
+    roaring_bitmap_or_array_inplace(r3, n, candidates);
+    assert_true(roaring_bitmap_get_cardinality(cow) == cow_card);
+    assert_true(roaring_bitmap_contains(r3, candidates[0]));
+    roaring_bitmap_free(cow);
+    roaring_bitmap_free(r3);
+
+    // empty inputs are no-ops
+    assert_true(roaring_bitmap_and_array(bm, 0, fresh, fresh) == 0);
+    roaring_bitmap_or_array_inplace(bm, 0, fresh);
+    free(fresh);
+    free(candidates);
+    roaring_bitmap_free(bm);
+}
+
+void test_of_sorted() {
+    // empty input
+    roaring_bitmap_t *empty = roaring_bitmap_of_sorted(0, NULL);
+    assert_true(roaring_bitmap_is_empty(empty));
+    roaring_bitmap_free(empty);
+
+    // sorted input with duplicates covering sparse chunks (arrays), a dense
+    // chunk (bitset) and a dense-with-duplicates chunk that dedups back to
+    // an array
+    size_t count = 0;
+    uint32_t *values = malloc(sizeof(uint32_t) * 300000);
+    for (uint32_t i = 0; i < 1000; i++) {  // sparse chunk
+        values[count++] = i * 7;
+        values[count++] = i * 7;  // duplicate
+    }
+    for (uint32_t i = 0; i < 60000; i++) {  // dense chunk
+        values[count++] = 0x10000 + i;
+    }
+    for (uint32_t i = 0; i < 3000; i++) {  // many duplicates, few values
+        values[count++] = 0x20000 + (i % 100);
+    }
+    for (uint32_t i = 0; i < 100; i++) {  // top of the 32-bit space
+        values[count++] = 0xFFFF0000 + i * 3;
+    }
+    // the duplicated chunk above is not generated in order: sort the input,
+    // as roaring_bitmap_of_sorted requires
+    qsort(values, count, sizeof(uint32_t), compare_uint32s);
+
+    roaring_bitmap_t *bm = roaring_bitmap_of_sorted(count, values);
+    roaring_bitmap_t *expected = roaring_bitmap_of_ptr(count, values);
+    assert_true(roaring_bitmap_equals(bm, expected));
+    roaring_bitmap_free(expected);
+    roaring_bitmap_free(bm);
+    free(values);
+}
+
+void test_builder() {
+    // empty builder
+    roaring_builder_t *b = roaring_builder_create();
+    roaring_bitmap_t *empty = roaring_builder_finalize(b);
+    assert_true(roaring_bitmap_is_empty(empty));
+    roaring_bitmap_free(empty);
+
+    // run-heavy interval stream: long runs, key-crossing ranges, adjacent
+    // ranges that must merge, isolated values and a sparse tail
+    b = roaring_builder_create();
+    roaring_bitmap_t *expected = roaring_bitmap_create();
+    assert_true(roaring_builder_add_range_closed(b, 10, 500));
+    roaring_bitmap_add_range_closed(expected, 10, 500);
+    assert_true(roaring_builder_add_range_closed(b, 501, 600));  // merges
+    roaring_bitmap_add_range_closed(expected, 501, 600);
+    assert_true(roaring_builder_add(b, 1000));
+    roaring_bitmap_add(expected, 1000);
+    assert_true(roaring_builder_add_range_closed(b, 0x0FFF0, 0x30010));
+    roaring_bitmap_add_range_closed(expected, 0x0FFF0, 0x30010);
+    for (uint32_t i = 0; i < 5000; i++) {  // dense-but-broken key: bitset
+        assert_true(roaring_builder_add(b, 0x40000 + i * 2));
+        roaring_bitmap_add(expected, 0x40000 + i * 2);
+    }
+    for (uint32_t i = 0; i < 50; i++) {  // sparse key: array
+        assert_true(roaring_builder_add(b, 0x50000 + i * 100));
+        roaring_bitmap_add(expected, 0x50000 + i * 100);
+    }
+    assert_true(
+        roaring_builder_add_range_closed(b, 0xFFFF0000, 0xFFFFFFFF));
+    roaring_bitmap_add_range_closed(expected, 0xFFFF0000, 0xFFFFFFFF);
+
+    // out-of-order appends are rejected and append nothing
+    assert_false(roaring_builder_add(b, 42));
+    assert_false(roaring_builder_add_range_closed(b, 0xFFFFFFFF, 0xFFFFFFFF));
+    assert_false(roaring_builder_add_range_closed(b, 7, 3));
+
+    roaring_bitmap_t *built = roaring_builder_finalize(b);
+    assert_true(roaring_bitmap_equals(built, expected));
+    // the builder must pick the compact representations by itself
+    assert_true(roaring_bitmap_size_in_bytes(built) <=
+                roaring_bitmap_size_in_bytes(expected));
+    roaring_bitmap_free(built);
+    roaring_bitmap_free(expected);
+
+    // abandoning a builder must not leak the bitmap under construction
+    b = roaring_builder_create();
+    assert_true(roaring_builder_add_range_closed(b, 5, 1000000));
+    roaring_builder_free(b);
+}
+
+void test_or_many_parallel() {
+    const size_t count = 16;
+    roaring_bitmap_t *bitmaps[16];
+    for (size_t i = 0; i < count; i++) {
+        bitmaps[i] = roaring_bitmap_create();
+        // spread values over the key space, with overlaps between bitmaps,
+        // dense blocks and single-key stragglers
+        for (uint32_t j = 0; j < 50000; j++) {
+            roaring_bitmap_add(bitmaps[i], (uint32_t)(i * 1000003 + j * 97));
+        }
+        roaring_bitmap_add(bitmaps[i], 0xFFFFFFFF - (uint32_t)i);
+        roaring_bitmap_add_range(bitmaps[i], i * 0x100000,
+                                 i * 0x100000 + 70000);
+    }
+    roaring_bitmap_t *expected =
+        roaring_bitmap_or_many(count, (const roaring_bitmap_t **)bitmaps);
+    for (unsigned int threads = 1; threads <= 7; threads += 3) {
+        roaring_bitmap_t *answer = roaring_bitmap_or_many_parallel(
+            count, (const roaring_bitmap_t **)bitmaps, threads);
+        assert_true(roaring_bitmap_equals(answer, expected));
+        roaring_bitmap_free(answer);
+    }
+    roaring_bitmap_t *kway =
+        roaring_bitmap_or_many_kway(count, (const roaring_bitmap_t **)bitmaps);
+    assert_true(roaring_bitmap_equals(kway, expected));
+    roaring_bitmap_free(kway);
+    roaring_bitmap_free(expected);
+    for (size_t i = 0; i < count; i++) {
+        roaring_bitmap_free(bitmaps[i]);
+    }
+}
+
+static void portable_iterator_compare(roaring_bitmap_t *r) {
+    size_t num_bytes = roaring_bitmap_portable_size_in_bytes(r);
+    char *buf = (char *)malloc(num_bytes);
+    assert_non_null(buf);
+    roaring_bitmap_portable_serialize(r, buf);
+
+    roaring_portable_iterator_t it;
+    assert_true(roaring_init_portable_iterator(buf, num_bytes, &it));
+    roaring_uint32_iterator_t *expected = roaring_create_iterator(r);
+    while (expected->has_value) {
+        assert_true(it.has_value);
+        assert_int_equal(expected->current_value, it.current_value);
+        roaring_advance_uint32_iterator(expected);
+        roaring_advance_portable_iterator(&it);
+    }
+    assert_false(it.has_value);
+    roaring_free_uint32_iterator(expected);
+    free(buf);
+    roaring_bitmap_free(r);
+}
+
+void test_portable_iterator() {
+    // garbage is rejected
+    roaring_portable_iterator_t it;
+    char garbage[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+    assert_false(roaring_init_portable_iterator(garbage, sizeof(garbage), &it));
+
+    // empty bitmap: valid header, no values
+    roaring_bitmap_t *empty = roaring_bitmap_create();
+    size_t num_bytes = roaring_bitmap_portable_size_in_bytes(empty);
+    char *buf = (char *)malloc(num_bytes);
+    assert_non_null(buf);
+    roaring_bitmap_portable_serialize(empty, buf);
+    assert_true(roaring_init_portable_iterator(buf, num_bytes, &it));
+    assert_false(it.has_value);
+    free(buf);
+    roaring_bitmap_free(empty);
+
+    // array containers only (no run bitmap in the header)
+    roaring_bitmap_t *r = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 2000; i++) {
+        roaring_bitmap_add(r, i * 5003);
+    }
+    portable_iterator_compare(r);
+
+    // mix of bitset, run and array containers
+    r = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 100000; i += 2) {
+        roaring_bitmap_add(r, i);
+    }
+    roaring_bitmap_add_range(r, 500000, 700000);
+    for (uint32_t i = 0; i < 1000; i++) {
+        roaring_bitmap_add(r, 1000000 + i * 61);
+    }
+    roaring_bitmap_add(r, UINT32_MAX);
+    roaring_bitmap_run_optimize(r);
+    portable_iterator_compare(r);
+}
+
+typedef struct stream_sink_s {
+    char *data;
+    size_t size;
+    size_t capacity;
+    size_t fail_after;  // stop accepting bytes past this point
+} stream_sink_t;
+
+static bool stream_sink_write(const char *data, size_t len, void *arg) {
+    stream_sink_t *sink = (stream_sink_t *)arg;
+    if (sink->size + len > sink->fail_after) return false;
+    if (sink->size + len > sink->capacity) {
+        size_t newcap = (sink->size + len) * 2;
+        sink->data = (char *)realloc(sink->data, newcap);
+        assert_non_null(sink->data);
+        sink->capacity = newcap;
+    }
+    memcpy(sink->data + sink->size, data, len);
+    sink->size += len;
+    return true;
+}
+
+static void streaming_serialize_compare(roaring_bitmap_t *r) {
+    size_t num_bytes = roaring_bitmap_portable_size_in_bytes(r);
+    char *expected = (char *)malloc(num_bytes);
+    assert_non_null(expected);
+    roaring_bitmap_portable_serialize(r, expected);
+
+    stream_sink_t sink = {NULL, 0, 0, SIZE_MAX};
+    size_t written = roaring_bitmap_portable_serialize_to(
+        r, stream_sink_write, &sink);
+    assert_int_equal(num_bytes, written);
+    assert_int_equal(num_bytes, sink.size);
+    assert_memory_equal(expected, sink.data, num_bytes);
+
+    // a failing writer aborts the serialization
+    sink.size = 0;
+    sink.fail_after = num_bytes / 2;
+    assert_int_equal(
+        0, roaring_bitmap_portable_serialize_to(r, stream_sink_write, &sink));
+
+    free(sink.data);
+    free(expected);
+    roaring_bitmap_free(r);
+}
+
+void test_portable_serialize_to() {
+    // no run containers: the backwards-compatible header path
+    roaring_bitmap_t *r = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 50000; i += 2) {
+        roaring_bitmap_add(r, i * 33);
+    }
+    streaming_serialize_compare(r);
+
+    // run containers present, above and below NO_OFFSET_THRESHOLD
+    r = roaring_bitmap_from_range(100, 200000, 1);
+    roaring_bitmap_run_optimize(r);
+    streaming_serialize_compare(r);
+
+    r = roaring_bitmap_from_range(0, 30000000, 1);
+    for (uint32_t i = 0; i < 1000; i++) {
+        roaring_bitmap_add(r, 40000000 + i * 7919);
+    }
+    roaring_bitmap_run_optimize(r);
+    streaming_serialize_compare(r);
+}
+
+void test_portable_deserialize_frozen() {
+    roaring_bitmap_t *r = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 100000; i += 2) {
+        roaring_bitmap_add(r, i);  // bitset containers
+    }
+    for (uint32_t i = 1000000; i < 1000100; i++) {
+        roaring_bitmap_add(r, i * 17);  // array containers
+    }
+    roaring_bitmap_add_range(r, 2000000, 2200000);  // run containers
+    roaring_bitmap_run_optimize(r);
+    size_t num_bytes = roaring_bitmap_portable_size_in_bytes(r);
+    char *buf = (char *)malloc(num_bytes);
+    assert_non_null(buf);
+    assert_int_equal(num_bytes, roaring_bitmap_portable_serialize(r, buf));
+
+    const roaring_bitmap_t *view =
+        roaring_bitmap_portable_deserialize_frozen(buf);
+    assert_non_null(view);
+    assert_true(roaring_bitmap_equals(view, r));
+    assert_true(roaring_bitmap_contains(view, 12344));
+    assert_false(roaring_bitmap_contains(view, 12345));
+    assert_true(roaring_bitmap_contains(view, 2100000));
+    assert_int_equal(roaring_bitmap_get_cardinality(r),
+                     roaring_bitmap_get_cardinality(view));
+    roaring_bitmap_free(view);
+
+    // small bitmaps with runs omit the offset header: exercise that path
+    roaring_bitmap_t *small = roaring_bitmap_from_range(10, 1000, 1);
+    roaring_bitmap_add(small, 5);
+    roaring_bitmap_run_optimize(small);
+    size_t small_bytes = roaring_bitmap_portable_size_in_bytes(small);
+    char *small_buf = (char *)malloc(small_bytes);
+    assert_non_null(small_buf);
+    roaring_bitmap_portable_serialize(small, small_buf);
+    const roaring_bitmap_t *small_view =
+        roaring_bitmap_portable_deserialize_frozen(small_buf);
+    assert_non_null(small_view);
+    assert_true(roaring_bitmap_equals(small_view, small));
+    roaring_bitmap_free(small_view);
+
+    // a deliberately misaligned buffer: the view must still satisfy the
+    // 32-byte alignment the bitset kernels assume
+    char *shifted = (char *)malloc(num_bytes + 1);
+    assert_non_null(shifted);
+    memcpy(shifted + 1, buf, num_bytes);
+    const roaring_bitmap_t *shifted_view =
+        roaring_bitmap_portable_deserialize_frozen(shifted + 1);
+    assert_non_null(shifted_view);
+    assert_true(roaring_bitmap_equals(shifted_view, r));
+    roaring_bitmap_free(shifted_view);
+    free(shifted);
+
+    roaring_bitmap_free(small);
+    roaring_bitmap_free(r);
+    free(buf);
+    free(small_buf);
+}
+
+void test_inline_storage() {
+    // bitmaps with at most ROARING_ARRAY_INLINE_SLOTS containers must not
+    // heap-allocate the key/container/typecode arrays
+    roaring_bitmap_t *r = roaring_bitmap_create();
+    assert_true(ra_is_inline(&r->high_low_container));
+    for (int i = 0; i < 50; i++) {
+        roaring_bitmap_add(r, i * 3);             // key 0
+        roaring_bitmap_add(r, 65536 + i * 7);     // key 1
+    }
+    assert_true(ra_is_inline(&r->high_low_container));
+    assert_int_equal(100, roaring_bitmap_get_cardinality(r));
+    assert_true(roaring_bitmap_contains(r, 147));
+    assert_true(roaring_bitmap_contains(r, 65536 + 343));
+
+    // a third container spills to the heap
+    roaring_bitmap_add(r, 2 * 65536 + 5);
+    assert_false(ra_is_inline(&r->high_low_container));
+    assert_int_equal(101, roaring_bitmap_get_cardinality(r));
+    assert_true(roaring_bitmap_contains(r, 147));
+
+    // copies of tiny bitmaps stay inline, spilled ones compare equal
+    roaring_bitmap_t *copy = roaring_bitmap_copy(r);
+    assert_true(roaring_bitmap_equals(r, copy));
+    roaring_bitmap_remove(copy, 2 * 65536 + 5);
+    roaring_bitmap_t *small = roaring_bitmap_copy(copy);
+    assert_true(ra_is_inline(&small->high_low_container));
+    assert_true(roaring_bitmap_equals(small, copy));
+
+    // shrinking below the threshold moves the slots back inline
+    roaring_bitmap_remove(r, 2 * 65536 + 5);
+    roaring_bitmap_shrink_to_fit(r);
+    assert_true(ra_is_inline(&r->high_low_container));
+    assert_true(roaring_bitmap_equals(r, small));
+
+    // serialization of an inline-backed bitmap round-trips
+    size_t size = roaring_bitmap_portable_size_in_bytes(small);
+    char *buf = (char *)malloc(size);
+    roaring_bitmap_portable_serialize(small, buf);
+    roaring_bitmap_t *back = roaring_bitmap_portable_deserialize_safe(buf, size);
+    assert_non_null(back);
+    assert_true(roaring_bitmap_equals(back, small));
+
+    // clearing returns to the inline state and the bitmap stays usable
+    roaring_bitmap_clear(copy);
+    assert_true(ra_is_inline(&copy->high_low_container));
+    roaring_bitmap_add(copy, 42);
+    assert_int_equal(1, roaring_bitmap_get_cardinality(copy));
+
+    free(buf);
+    roaring_bitmap_free(back);
+    roaring_bitmap_free(small);
+    roaring_bitmap_free(copy);
+    roaring_bitmap_free(r);
+}
+
+void test_container_pool() {
+    roaring_container_pool_set_capacity(64);
+    // steady-state loop: every iteration frees containers (empty results,
+    // type conversions) and allocates fresh ones, which the pool recycles
+    for (int iter = 0; iter < 10; iter++) {
+        roaring_bitmap_t *dense = roaring_bitmap_create();
+        roaring_bitmap_t *sparse = roaring_bitmap_create();
+        for (uint32_t i = 0; i < 200000; i += 2) {
+            roaring_bitmap_add(dense, i);
+        }
+        for (uint32_t i = 0; i < 200000; i += 101) {
+            roaring_bitmap_add(sparse, i);
+        }
+        roaring_bitmap_and_inplace(dense, sparse);
+        uint64_t card = roaring_bitmap_get_cardinality(dense);
+        assert_int_equal(991, card);  // multiples of 202 below 200000
+        assert_true(roaring_bitmap_contains(dense, 202));
+        roaring_bitmap_free(dense);
+        roaring_bitmap_free(sparse);
+    }
+    roaring_container_pool_drain();
+    roaring_container_pool_set_capacity(0);
+    assert_int_equal(roaring_container_pool_capacity(), 0);
+    // the or_many fold borrows a scratch pool internally and must restore
+    // the caller's (disabled) configuration afterwards
+    roaring_bitmap_t *inputs[20];
+    const roaring_bitmap_t *cinputs[20];
+    for (int i = 0; i < 20; i++) {
+        inputs[i] = roaring_bitmap_create();
+        for (uint32_t j = 0; j < 5000; j++) {
+            roaring_bitmap_add(inputs[i], (j * 67 + i * 13) % 300000);
+        }
+        cinputs[i] = inputs[i];
+    }
+    roaring_bitmap_t *unioned = roaring_bitmap_or_many(20, cinputs);
+    assert_true(roaring_bitmap_contains(unioned, 67));
+    assert_int_equal(roaring_container_pool_capacity(), 0);
+    roaring_bitmap_free(unioned);
+    for (int i = 0; i < 20; i++) roaring_bitmap_free(inputs[i]);
+}
+
+static int64_t memory_hook_balance = 0;      // allocations minus frees
+static int64_t memory_hook_allocations = 0;  // allocation calls, of any kind
+
+static void *counting_malloc(size_t n) {
+    memory_hook_balance++;
+    memory_hook_allocations++;
+    return malloc(n);
+}
+
+static void *counting_realloc(void *p, size_t n) {
+    if (p == NULL) memory_hook_balance++;
+    memory_hook_allocations++;
+    return realloc(p, n);
+}
+
+static void *counting_calloc(size_t n, size_t sz) {
+    memory_hook_balance++;
+    memory_hook_allocations++;
+    return calloc(n, sz);
+}
+
+static void counting_free(void *p) {
+    if (p != NULL) memory_hook_balance--;
+    free(p);
+}
+
+static void *counting_aligned_malloc(size_t alignment, size_t size) {
+    void *p = NULL;
+    memory_hook_balance++;
+    memory_hook_allocations++;
+    if (posix_memalign(&p, alignment, size) != 0) return NULL;
+    return p;
+}
+
+static void counting_aligned_free(void *p) {
+    if (p != NULL) memory_hook_balance--;
+    free(p);
+}
+
+void test_memory_hook() {
+    roaring_memory_t default_hook = {
+        .malloc = malloc,
+        .realloc = realloc,
+        .calloc = calloc,
+        .free = free,
+        .aligned_malloc = roaring_bitmap_aligned_malloc,
+        .aligned_free = roaring_bitmap_aligned_free,
+    };
+    roaring_memory_t counting_hook = {
+        .malloc = counting_malloc,
+        .realloc = counting_realloc,
+        .calloc = counting_calloc,
+        .free = counting_free,
+        .aligned_malloc = counting_aligned_malloc,
+        .aligned_free = counting_aligned_free,
+    };
+    roaring_init_memory_hook(counting_hook);
+    roaring_bitmap_t *r = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 100000; i += 3) {
+        roaring_bitmap_add(r, i);  // both array and bitset containers
+    }
+    roaring_bitmap_run_optimize(r);
+    roaring_bitmap_t *copy = roaring_bitmap_copy(r);
+    assert_true(roaring_bitmap_equals(copy, r));
+    assert_true(memory_hook_balance > 0);  // the hooks were actually used
+    roaring_bitmap_free(copy);
+    roaring_bitmap_free(r);
+    // every allocation the library made was returned through the hooks
+    assert_int_equal(0, memory_hook_balance);
+    roaring_init_memory_hook(default_hook);
+}
+
+typedef struct budgeted_union_s {
+    size_t n;
+    const roaring_bitmap_t **inputs;
+    roaring_bitmap_t *result;
+} budgeted_union_t;
+
+static void run_budgeted_union(void *arg) {
+    budgeted_union_t *job = (budgeted_union_t *)arg;
+    job->result = roaring_bitmap_or_many(job->n, job->inputs);
+}
+
+void test_memory_budget() {
+    roaring_memory_t default_hook = {
+        .malloc = malloc,
+        .realloc = realloc,
+        .calloc = calloc,
+        .free = free,
+        .aligned_malloc = roaring_bitmap_aligned_malloc,
+        .aligned_free = roaring_bitmap_aligned_free,
+    };
+    roaring_memory_t counting_hook = {
+        .malloc = counting_malloc,
+        .realloc = counting_realloc,
+        .calloc = counting_calloc,
+        .free = counting_free,
+        .aligned_malloc = counting_aligned_malloc,
+        .aligned_free = counting_aligned_free,
+    };
+    roaring_init_memory_hook(counting_hook);
+    const int64_t balance_before = memory_hook_balance;
+
+    roaring_bitmap_t *inputs[8];
+    const roaring_bitmap_t *cinputs[8];
+    for (int i = 0; i < 8; i++) {
+        inputs[i] = roaring_bitmap_create();
+        for (uint32_t j = 0; j < 20000; j++) {
+            roaring_bitmap_add(inputs[i], (j * 9 + i) % 150000);
+        }
+        cinputs[i] = inputs[i];
+    }
+    budgeted_union_t job = {.n = 8, .inputs = cinputs, .result = NULL};
+    roaring_memory_budget_t budget;
+
+    // a generous budget: the union succeeds and reports its footprint
+    assert_true(
+        roaring_budget_run(&budget, 1 << 26, run_budgeted_union, &job));
+    assert_false(budget.exceeded);
+    assert_true(budget.used > 0);
+    assert_true(budget.high_water >= budget.used);
+    roaring_bitmap_t *expected = roaring_bitmap_or_many(8, cinputs);
+    assert_true(roaring_bitmap_equals(expected, job.result));
+    roaring_bitmap_free(expected);
+    roaring_bitmap_free(job.result);
+    const size_t peak = budget.high_water;
+
+    // far below the observed peak: the union fails and is rolled back,
+    // without ever holding more than the limit
+    job.result = NULL;
+    assert_false(
+        roaring_budget_run(&budget, peak / 8, run_budgeted_union, &job));
+    assert_true(budget.exceeded);
+    assert_int_equal(0, budget.used);
+    assert_true(budget.high_water <= peak / 8);
+    assert_null(job.result);
+
+    // a zero limit only accounts, and sees the same peak again
+    assert_true(roaring_budget_run(&budget, 0, run_budgeted_union, &job));
+    assert_false(budget.exceeded);
+    assert_int_equal(peak, budget.high_water);
+    roaring_bitmap_free(job.result);
+
+    for (int i = 0; i < 8; i++) roaring_bitmap_free(inputs[i]);
+    // the rolled-back run returned everything it had allocated
+    assert_int_equal(balance_before, memory_hook_balance);
+    roaring_init_memory_hook(default_hook);
+}
+
+void test_xor_many_heap() {
+    const size_t count = 8;
+    roaring_bitmap_t *bitmaps[8];
+    for (size_t i = 0; i < count; i++) {
+        bitmaps[i] = roaring_bitmap_create();
+        for (uint32_t j = 0; j < 40000; j++) {
+            roaring_bitmap_add(bitmaps[i], (uint32_t)(i * 500009 + j * 61));
+        }
+        // shared range so that many containers cancel out (count is even)
+        roaring_bitmap_add_range(bitmaps[i], 0x2000000, 0x2000000 + 131072);
+        roaring_bitmap_add(bitmaps[i], 0xFFFFFFF0 + (uint32_t)i);
+    }
+    roaring_bitmap_t *expected =
+        roaring_bitmap_xor_many(count, (const roaring_bitmap_t **)bitmaps);
+    roaring_bitmap_t *answer = roaring_bitmap_xor_many_heap(
+        count, (const roaring_bitmap_t **)bitmaps);
+    assert_true(roaring_bitmap_equals(answer, expected));
+    roaring_bitmap_free(answer);
+    roaring_bitmap_free(expected);
+    // xor of a bitmap with itself must come back empty, with no
+    // zero-cardinality containers left behind
+    const roaring_bitmap_t *pair[2] = {bitmaps[0], bitmaps[0]};
+    roaring_bitmap_t *empty = roaring_bitmap_xor_many_heap(2, pair);
+    assert_true(roaring_bitmap_is_empty(empty));
+    assert_int_equal(0, empty->high_low_container.size);
+    roaring_bitmap_free(empty);
+    for (size_t i = 0; i < count; i++) {
+        roaring_bitmap_free(bitmaps[i]);
+    }
+}
+
+void test_and_many() {
+    const size_t count = 5;
+    roaring_bitmap_t *bitmaps[5];
+    for (size_t i = 0; i < count; i++) {
+        bitmaps[i] = roaring_bitmap_create();
+        // all inputs share multiples of 60 = lcm(2, 3, 4, 5, 6)
+        for (uint32_t j = 0; j < 200000; j++) {
+            roaring_bitmap_add(bitmaps[i], j * (uint32_t)(i + 2));
+        }
+    }
+    roaring_bitmap_t *expected = roaring_bitmap_copy(bitmaps[0]);
+    for (size_t i = 1; i < count; i++) {
+        roaring_bitmap_and_inplace(expected, bitmaps[i]);
+    }
+    roaring_bitmap_t *answer =
+        roaring_bitmap_and_many(count, (const roaring_bitmap_t **)bitmaps);
+    assert_true(roaring_bitmap_equals(answer, expected));
+    assert_true(roaring_bitmap_contains(answer, 60));
+    roaring_bitmap_free(answer);
+    roaring_bitmap_free(expected);
+    // a disjoint input must drive the result to empty
+    roaring_bitmap_t *disjoint = roaring_bitmap_from_range(1, 1000000, 2310);
+    roaring_bitmap_t *shifted = roaring_bitmap_create();
+    roaring_bitmap_add(shifted, 7);
+    const roaring_bitmap_t *with_disjoint[3] = {bitmaps[0], disjoint, shifted};
+    roaring_bitmap_t *empty = roaring_bitmap_and_many(3, with_disjoint);
+    assert_true(roaring_bitmap_is_empty(empty));
+    roaring_bitmap_free(empty);
+    roaring_bitmap_free(disjoint);
+    roaring_bitmap_free(shifted);
+    for (size_t i = 0; i < count; i++) {
+        roaring_bitmap_free(bitmaps[i]);
+    }
+}
+
+void test_cached_cardinality() {
+    roaring_bitmap_t *r = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 100000; i += 3) {
+        roaring_bitmap_add(r, i);
+    }
+    assert_int_equal(33334, roaring_bitmap_get_cardinality(r));
+    // the second call is served from the cache
+    assert_int_equal(33334, roaring_bitmap_get_cardinality(r));
+
+    // checked point updates keep the cache in sync
+    assert_true(roaring_bitmap_add_checked(r, 1));
+    assert_false(roaring_bitmap_add_checked(r, 1));
+    assert_int_equal(33335, roaring_bitmap_get_cardinality(r));
+    assert_true(roaring_bitmap_remove_checked(r, 1));
+    assert_false(roaring_bitmap_remove_checked(r, 1));
+    assert_int_equal(33334, roaring_bitmap_get_cardinality(r));
+
+    // unchecked updates invalidate it instead
+    roaring_bitmap_add(r, 1);
+    assert_int_equal(33335, roaring_bitmap_get_cardinality(r));
+    roaring_bitmap_remove(r, 1);
+    assert_int_equal(33334, roaring_bitmap_get_cardinality(r));
+    const uint32_t fresh[] = {1, 2, 400000, 400001};
+    roaring_bitmap_add_many(r, 4, fresh);
+    assert_int_equal(33338, roaring_bitmap_get_cardinality(r));
+    for (int i = 0; i < 4; i++) roaring_bitmap_remove(r, fresh[i]);
+    assert_int_equal(33334, roaring_bitmap_get_cardinality(r));
+    roaring_bitmap_add_range(r, 200000, 201000);
+    assert_int_equal(34334, roaring_bitmap_get_cardinality(r));
+    roaring_bitmap_remove_range(r, 200000, 201000);
+    assert_int_equal(33334, roaring_bitmap_get_cardinality(r));
+
+    // lazy operations leave the cache dirty; the repair pass refills it
+    roaring_bitmap_t *other = roaring_bitmap_from_range(100002, 100514, 1);
+    roaring_bitmap_lazy_or_inplace(r, other, true);
+    roaring_bitmap_repair_after_lazy(r);
+    assert_int_equal(33334 + 512, roaring_bitmap_get_cardinality(r));
+
+    // copies carry the cached value over
+    roaring_bitmap_t *copy = roaring_bitmap_copy(r);
+    assert_int_equal(roaring_bitmap_get_cardinality(r),
+                     roaring_bitmap_get_cardinality(copy));
+
+    roaring_bitmap_and_inplace(copy, other);
+    assert_int_equal(512, roaring_bitmap_get_cardinality(copy));
+
+    roaring_bitmap_clear(copy);
+    assert_int_equal(0, roaring_bitmap_get_cardinality(copy));
+    assert_true(roaring_bitmap_is_empty(copy));
+
+    roaring_bitmap_free(copy);
+    roaring_bitmap_free(other);
+    roaring_bitmap_free(r);
+}
+
 void is_really_empty() {
     roaring_bitmap_t *bm = roaring_bitmap_create();
     assert_true(roaring_bitmap_is_empty(bm));
@@ -366,6 +1368,64 @@ void test_stats() {
     roaring_bitmap_free(r1);
 }
 
+void test_prefetch() {
+    // prefetching is a pure hint: it must leave the bitmap untouched
+    roaring_bitmap_t *r1 = roaring_bitmap_create();
+    assert_non_null(r1);
+    for (uint32_t i = 100; i < 1000; i++) {
+        roaring_bitmap_add(r1, i);  // array container
+    }
+    for (uint32_t i = 65536; i < 165536; i += 2) {
+        roaring_bitmap_add(r1, i);  // bitset containers
+    }
+    roaring_bitmap_add_range(r1, 300000, 320000);  // run container
+    roaring_bitmap_run_optimize(r1);
+    uint64_t card = roaring_bitmap_get_cardinality(r1);
+    roaring_bitmap_prefetch(r1);
+    assert_true(roaring_bitmap_get_cardinality(r1) == card);
+
+    double contiguity = roaring_bitmap_memory_contiguity(r1);
+    assert_true(contiguity >= 0.0 && contiguity <= 1.0);
+
+    // frozen views pack all payloads into one arena (grouped by type, so
+    // mixed-type bitmaps are not necessarily 1.0)
+    size_t num_bytes = roaring_bitmap_frozen_size_in_bytes(r1);
+    char *buf = roaring_bitmap_aligned_malloc(32, num_bytes);
+    roaring_bitmap_frozen_serialize(r1, buf);
+    const roaring_bitmap_t *r2 = roaring_bitmap_frozen_view(buf, num_bytes);
+    assert_non_null(r2);
+    roaring_bitmap_prefetch(r2);
+    assert_true(roaring_bitmap_equals(r1, r2));
+    contiguity = roaring_bitmap_memory_contiguity(r2);
+    assert_true(contiguity >= 0.0 && contiguity <= 1.0);
+    roaring_bitmap_free(r2);
+    roaring_bitmap_aligned_free(buf);
+    roaring_bitmap_free(r1);
+
+    // a frozen view of same-type containers is fully contiguous
+    roaring_bitmap_t *dense = roaring_bitmap_from_range(0, 3 << 16, 2);
+    num_bytes = roaring_bitmap_frozen_size_in_bytes(dense);
+    buf = roaring_bitmap_aligned_malloc(32, num_bytes);
+    roaring_bitmap_frozen_serialize(dense, buf);
+    const roaring_bitmap_t *dense_view =
+        roaring_bitmap_frozen_view(buf, num_bytes);
+    assert_non_null(dense_view);
+    assert_true(roaring_bitmap_memory_contiguity(dense_view) == 1.0);
+    roaring_bitmap_free(dense_view);
+    roaring_bitmap_aligned_free(buf);
+    roaring_bitmap_free(dense);
+
+    // fewer than two containers is trivially contiguous
+    roaring_bitmap_t *r3 = roaring_bitmap_from_range(10, 20, 1);
+    assert_true(roaring_bitmap_memory_contiguity(r3) == 1.0);
+    roaring_bitmap_prefetch(r3);
+    roaring_bitmap_free(r3);
+    roaring_bitmap_t *empty = roaring_bitmap_create();
+    assert_true(roaring_bitmap_memory_contiguity(empty) == 1.0);
+    roaring_bitmap_prefetch(empty);
+    roaring_bitmap_free(empty);
+}
+
 // this should expose memory leaks
 // (https://github.com/RoaringBitmap/CRoaring/pull/70)
 void leaks_with_empty(bool copy_on_write) {
@@ -488,6 +1548,33 @@ void check_full_flip() {
   roaring_bitmap_free(rorg);
 }
 
+void check_flip_full_containers() {
+    // mixed container types, a full container, and gaps between keys
+    roaring_bitmap_t *r1 = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 1000; i++) roaring_bitmap_add(r1, i * 3);
+    for (uint32_t i = 0; i < 10000; i++) roaring_bitmap_add(r1, 65536 + i * 2);
+    roaring_bitmap_add_range(r1, 131072 + 5, 131072 + 40000);
+    roaring_bitmap_run_optimize(r1);
+    roaring_bitmap_add_range(r1, 262144, 262144 + 65536);  // full container
+    roaring_bitmap_t *orig = roaring_bitmap_copy(r1);
+    // flipping the same wide range twice is a no-op
+    roaring_bitmap_flip_inplace(r1, 1, UINT64_C(0x100000000) - 1);
+    roaring_bitmap_flip_inplace(r1, 1, UINT64_C(0x100000000) - 1);
+    assert_true(roaring_bitmap_equals(r1, orig));
+    roaring_bitmap_t *r2 = roaring_bitmap_flip(orig, 1, UINT64_C(0x100000000) - 1);
+    roaring_bitmap_t *r3 = roaring_bitmap_flip(r2, 1, UINT64_C(0x100000000) - 1);
+    assert_true(roaring_bitmap_equals(r3, orig));
+    // flipping exactly the full container empties it
+    roaring_bitmap_flip_inplace(r1, 262144, 262144 + 65536);
+    assert_false(roaring_bitmap_contains(r1, 262144));
+    assert_int_equal(roaring_bitmap_get_cardinality(r1),
+                     roaring_bitmap_get_cardinality(orig) - 65536);
+    roaring_bitmap_free(r3);
+    roaring_bitmap_free(r2);
+    roaring_bitmap_free(orig);
+    roaring_bitmap_free(r1);
+}
+
 void test_stress_memory(bool copy_on_write) {
 	for (size_t i = 0; i < 5; i++) {
 		roaring_bitmap_t *r1 = roaring_bitmap_create();
@@ -1025,6 +2112,66 @@ void test_iterate() {
     roaring_bitmap_free(r1);
 }
 
+static bool iterate_and_collect(uint32_t value, void *param) {
+    roaring_bitmap_add((roaring_bitmap_t *)param, value);
+    return true;
+}
+
+static bool iterate_and_stop_early(uint32_t value, void *param) {
+    (void)value;
+    uint32_t *countdown = (uint32_t *)param;
+    if (*countdown == 0) return false;
+    (*countdown)--;
+    return true;
+}
+
+void test_iterate_and() {
+    // a dense side (runs and bitsets after optimize) joined against a
+    // sparse side, so the leapfrog seeks cross container boundaries
+    roaring_bitmap_t *dense = roaring_bitmap_create();
+    roaring_bitmap_add_range(dense, 100000, 400000);
+    for (uint32_t i = 0; i < 100000; i += 2) {
+        roaring_bitmap_add(dense, i);
+    }
+    roaring_bitmap_run_optimize(dense);
+
+    roaring_bitmap_t *sparse = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 1000000; i += 997) {
+        roaring_bitmap_add(sparse, i);
+    }
+    roaring_bitmap_add(sparse, 20000000);
+
+    roaring_bitmap_t *expected = roaring_bitmap_and(dense, sparse);
+    roaring_bitmap_t *collected = roaring_bitmap_create();
+    assert_true(
+        roaring_iterate_and(dense, sparse, iterate_and_collect, collected));
+    assert_true(roaring_bitmap_equals(expected, collected));
+
+    // symmetric in its arguments
+    roaring_bitmap_clear(collected);
+    assert_true(
+        roaring_iterate_and(sparse, dense, iterate_and_collect, collected));
+    assert_true(roaring_bitmap_equals(expected, collected));
+
+    // a false return from the callback stops the join
+    uint32_t countdown = 10;
+    assert_false(
+        roaring_iterate_and(dense, sparse, iterate_and_stop_early, &countdown));
+    assert_int_equal(0, countdown);
+
+    // empty intersection: the callback is never invoked
+    roaring_bitmap_t *disjoint = roaring_bitmap_from_range(2000000, 2100000, 3);
+    assert_true(roaring_iterate_and(disjoint, sparse, iterate_and_stop_early,
+                                    &countdown));
+    assert_int_equal(0, countdown);
+
+    roaring_bitmap_free(disjoint);
+    roaring_bitmap_free(collected);
+    roaring_bitmap_free(expected);
+    roaring_bitmap_free(sparse);
+    roaring_bitmap_free(dense);
+}
+
 void test_iterate_empty() {
     roaring_bitmap_t *r1 = roaring_bitmap_create();
     assert_non_null(r1);
@@ -1176,6 +2323,194 @@ void test_portable_serialize() {
     roaring_bitmap_free(r2);
 }
 
+static void compressed_serialize_roundtrip(roaring_bitmap_t *r1) {
+    size_t expectedsize = roaring_bitmap_portable_size_in_bytes_compressed(r1);
+    char *serialized = (char *)malloc(expectedsize);
+    size_t serialize_len =
+        roaring_bitmap_portable_serialize_compressed(r1, serialized);
+    assert_int_equal(serialize_len, expectedsize);
+
+    // portable_deserialize_safe auto-detects the frame by its cookie
+    roaring_bitmap_t *r2 =
+        roaring_bitmap_portable_deserialize_safe(serialized, serialize_len);
+    assert_non_null(r2);
+    assert_true(roaring_bitmap_equals(r1, r2));
+    roaring_bitmap_free(r2);
+
+    // truncated buffers must fail cleanly, never crash
+    for (size_t cut = 0; cut < serialize_len; cut += (serialize_len / 13) + 1) {
+        assert_null(roaring_bitmap_portable_deserialize_safe(serialized, cut));
+    }
+    free(serialized);
+}
+
+void test_compressed_serialize() {
+    // sparse clustered arrays, a bitset and runs in one bitmap
+    roaring_bitmap_t *r1 =
+        roaring_bitmap_of(8, 1, 2, 3, 100, 1000, 10000, 1000000, 20000000);
+    for (int i = 0; i < 50000; i++) {
+        roaring_bitmap_add(r1, 5 * i);
+    }
+    roaring_bitmap_add_range(r1, 500000, 600000);
+    roaring_bitmap_run_optimize(r1);
+    compressed_serialize_roundtrip(r1);
+
+    // clustered values compress well below the portable format
+    assert_true(roaring_bitmap_portable_size_in_bytes_compressed(r1) <
+                roaring_bitmap_portable_size_in_bytes(r1));
+    roaring_bitmap_free(r1);
+
+    // wide gaps force the full 16-bit width
+    r1 = roaring_bitmap_of(6, 2946000, 2997491, 10478289, 10490227, 10502444,
+                           19866827);
+    compressed_serialize_roundtrip(r1);
+    roaring_bitmap_free(r1);
+
+    // a large array container with irregular gaps (vectorized unpack path)
+    r1 = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 3000; i++) {
+        roaring_bitmap_add(r1, i * 7 + (i % 5));
+    }
+    compressed_serialize_roundtrip(r1);
+    roaring_bitmap_free(r1);
+
+    // single-value and empty bitmaps
+    r1 = roaring_bitmap_of(1, 42);
+    compressed_serialize_roundtrip(r1);
+    roaring_bitmap_free(r1);
+    r1 = roaring_bitmap_create();
+    size_t emptysize = roaring_bitmap_portable_size_in_bytes_compressed(r1);
+    char *buf = (char *)malloc(emptysize);
+    assert_int_equal(emptysize,
+                     roaring_bitmap_portable_serialize_compressed(r1, buf));
+    roaring_bitmap_t *r2 =
+        roaring_bitmap_portable_deserialize_safe(buf, emptysize);
+    assert_non_null(r2);
+    assert_true(roaring_bitmap_equals(r1, r2));
+    roaring_bitmap_free(r2);
+    free(buf);
+    roaring_bitmap_free(r1);
+}
+
+void test_portable_deserialize_run_optimized() {
+    roaring_memory_t default_hook = {
+        .malloc = malloc,
+        .realloc = realloc,
+        .calloc = calloc,
+        .free = free,
+        .aligned_malloc = roaring_bitmap_aligned_malloc,
+        .aligned_free = roaring_bitmap_aligned_free,
+    };
+    roaring_memory_t counting_hook = {
+        .malloc = counting_malloc,
+        .realloc = counting_realloc,
+        .calloc = counting_calloc,
+        .free = counting_free,
+        .aligned_malloc = counting_aligned_malloc,
+        .aligned_free = counting_aligned_free,
+    };
+
+    // a latency-bound writer stores bitmaps un-optimized: runs arrive
+    // serialized as bitsets and arrays
+    roaring_bitmap_t *r1 = roaring_bitmap_create();
+    // chunk 0: a dense range, a bitset that should become a run container
+    for (uint32_t v = 1000; v < 60000; v++) roaring_bitmap_add(r1, v);
+    // chunk 1: stride two, a bitset that should stay a bitset
+    for (uint32_t v = 1 << 16; v < (2 << 16); v += 2) roaring_bitmap_add(r1, v);
+    // chunk 2: blocks of consecutive values, an array that should become runs
+    for (uint32_t v = 0; v < 3000; v++)
+        roaring_bitmap_add(r1, (2 << 16) + (v / 500) * 5000 + (v % 500));
+    // chunk 3: scattered values, an array that should stay an array
+    for (uint32_t v = 0; v < 1000; v++)
+        roaring_bitmap_add(r1, (3 << 16) + v * 17);
+    // chunk 4: all ones already as a run, serialized with the run cookie
+    roaring_bitmap_add_range_closed(r1, 4 << 16, (5 << 16) - 1);
+    // chunk 5: all ones built up as a bitset
+    for (uint32_t v = 5 << 16; v < (6 << 16); v++) roaring_bitmap_add(r1, v);
+
+    size_t size = roaring_bitmap_portable_size_in_bytes(r1);
+    char *buf = (char *)malloc(size);
+    assert_int_equal(size, roaring_bitmap_portable_serialize(r1, buf));
+
+    // reference: the two-pass read side this function replaces
+    roaring_bitmap_t *ref = roaring_bitmap_portable_deserialize_safe(buf, size);
+    assert_non_null(ref);
+    roaring_bitmap_run_optimize(ref);
+
+    roaring_bitmap_t *r2 =
+        roaring_bitmap_portable_deserialize_run_optimized(buf, size);
+    assert_non_null(r2);
+    assert_true(roaring_bitmap_equals(r1, r2));
+
+    // every container landed in the representation run_optimize picks
+    roaring_statistics_t s_ref, s_new;
+    roaring_bitmap_statistics(ref, &s_ref);
+    roaring_bitmap_statistics(r2, &s_new);
+    assert_int_equal(s_ref.n_run_containers, s_new.n_run_containers);
+    assert_int_equal(s_ref.n_array_containers, s_new.n_array_containers);
+    assert_int_equal(s_ref.n_bitset_containers, s_new.n_bitset_containers);
+    // the all-ones chunks collapse straight onto the shared full container
+    assert_true(r2->high_low_container.containers[4] ==
+                (void *)run_container_full());
+    assert_true(r2->high_low_container.containers[5] ==
+                (void *)run_container_full());
+
+    // truncated buffers must fail cleanly, never crash
+    for (size_t cut = 0; cut < size; cut += (size / 13) + 1) {
+        assert_null(roaring_bitmap_portable_deserialize_run_optimized(buf, cut));
+    }
+
+    // single pass, one allocation per container instead of two
+    roaring_init_memory_hook(counting_hook);
+    int64_t before = memory_hook_allocations;
+    roaring_bitmap_t *two_pass_bm =
+        roaring_bitmap_portable_deserialize_safe(buf, size);
+    roaring_bitmap_run_optimize(two_pass_bm);
+    const int64_t two_pass = memory_hook_allocations - before;
+    before = memory_hook_allocations;
+    roaring_bitmap_t *one_pass_bm =
+        roaring_bitmap_portable_deserialize_run_optimized(buf, size);
+    const int64_t one_pass = memory_hook_allocations - before;
+    assert_true(one_pass < two_pass);
+    assert_true(roaring_bitmap_equals(two_pass_bm, one_pass_bm));
+    roaring_bitmap_free(one_pass_bm);
+    roaring_bitmap_free(two_pass_bm);
+    roaring_init_memory_hook(default_hook);
+    free(buf);
+
+    // an already-optimized serialization deserializes unchanged
+    size = roaring_bitmap_portable_size_in_bytes(ref);
+    buf = (char *)malloc(size);
+    assert_int_equal(size, roaring_bitmap_portable_serialize(ref, buf));
+    roaring_bitmap_t *r3 =
+        roaring_bitmap_portable_deserialize_run_optimized(buf, size);
+    assert_non_null(r3);
+    assert_true(roaring_bitmap_equals(r1, r3));
+    roaring_bitmap_statistics(r3, &s_new);
+    assert_int_equal(s_ref.n_run_containers, s_new.n_run_containers);
+    assert_int_equal(s_ref.n_array_containers, s_new.n_array_containers);
+    assert_int_equal(s_ref.n_bitset_containers, s_new.n_bitset_containers);
+    free(buf);
+
+    // empty bitmaps roundtrip as well
+    roaring_bitmap_t *empty = roaring_bitmap_create();
+    size = roaring_bitmap_portable_size_in_bytes(empty);
+    buf = (char *)malloc(size);
+    assert_int_equal(size, roaring_bitmap_portable_serialize(empty, buf));
+    roaring_bitmap_t *empty2 =
+        roaring_bitmap_portable_deserialize_run_optimized(buf, size);
+    assert_non_null(empty2);
+    assert_true(roaring_bitmap_equals(empty, empty2));
+    free(buf);
+
+    roaring_bitmap_free(empty2);
+    roaring_bitmap_free(empty);
+    roaring_bitmap_free(r3);
+    roaring_bitmap_free(r2);
+    roaring_bitmap_free(ref);
+    roaring_bitmap_free(r1);
+}
+
 void test_serialize() {
     roaring_bitmap_t *r1 =
         roaring_bitmap_of(8, 1, 2, 3, 100, 1000, 10000, 1000000, 20000000);
@@ -1530,17 +2865,979 @@ void test_union(bool copy_on_write) {
     assert_true(roaring_bitmap_get_cardinality(r1_or_r2) ==
                 roaring_bitmap_or_cardinality(r1, r2));
 
-    roaring_bitmap_set_copy_on_write(r1_or_r2, copy_on_write);
-    assert_int_equal(roaring_bitmap_get_cardinality(r1_or_r2), 166);
+    roaring_bitmap_set_copy_on_write(r1_or_r2, copy_on_write);
+    assert_int_equal(roaring_bitmap_get_cardinality(r1_or_r2), 166);
+
+    roaring_bitmap_free(r1_or_r2);
+    roaring_bitmap_free(r2);
+    roaring_bitmap_free(r1);
+}
+
+void test_union_true() { test_union(true); }
+
+void test_union_false() { test_union(false); }
+
+// operands made entirely of bitset containers take a dedicated monomorphic
+// path in roaring_bitmap_and / roaring_bitmap_or
+void test_all_bitset_fast_paths() {
+    roaring_bitmap_t *r1 = roaring_bitmap_create();
+    roaring_bitmap_t *r2 = roaring_bitmap_create();
+    // every container holds more than 4096 scattered values, so each one
+    // is stored as a bitset
+    const uint32_t keys1[] = {0, 2, 3, 7};
+    for (int k = 0; k < 4; k++) {
+        const uint32_t base = keys1[k] << 16;
+        const uint32_t stride = (keys1[k] == 7) ? 6 : 2;
+        for (uint32_t v = 0; v + stride <= 65536; v += stride) {
+            roaring_bitmap_add(r1, base + v);
+        }
+    }
+    const uint32_t keys2[] = {2, 3, 5, 7};
+    for (int k = 0; k < 4; k++) {
+        const uint32_t base = keys2[k] << 16;
+        const uint32_t stride = (keys2[k] == 7) ? 8 : 2;
+        const uint32_t offset = (keys2[k] == 3) ? 1 : 0;  // odd, no overlap
+        for (uint32_t v = 0; v + stride <= 65536; v += stride) {
+            roaring_bitmap_add(r2, base + v + offset);
+        }
+    }
+
+    // shared key 2 overlaps fully, key 3 not at all (evens versus odds),
+    // and key 7 only on multiples of 24, few enough to become an array
+    roaring_bitmap_t *expected_and = roaring_bitmap_create();
+    for (uint32_t v = 0; v < 65536; v += 2) {
+        roaring_bitmap_add(expected_and, (2 << 16) + v);
+    }
+    for (uint32_t v = 0; v < 65536; v += 24) {
+        roaring_bitmap_add(expected_and, (7 << 16) + v);
+    }
+    roaring_bitmap_t *r1_and_r2 = roaring_bitmap_and(r1, r2);
+    assert_true(roaring_bitmap_equals(r1_and_r2, expected_and));
+    assert_true(roaring_bitmap_get_cardinality(r1_and_r2) ==
+                roaring_bitmap_and_cardinality(r1, r2));
+    roaring_statistics_t stats;
+    roaring_bitmap_statistics(r1_and_r2, &stats);
+    assert_int_equal(1, stats.n_bitset_containers);
+    assert_int_equal(1, stats.n_array_containers);  // the key 7 leftovers
+
+    roaring_bitmap_t *expected_or = roaring_bitmap_create();
+    roaring_bitmap_add_range_closed(expected_or, 3 << 16, (4 << 16) - 1);
+    const uint32_t or_keys[] = {0, 2, 5};
+    for (int k = 0; k < 3; k++) {
+        for (uint32_t v = 0; v < 65536; v += 2) {
+            roaring_bitmap_add(expected_or, (or_keys[k] << 16) + v);
+        }
+    }
+    for (uint32_t v = 0; v + 6 <= 65536; v += 6) {
+        roaring_bitmap_add(expected_or, (7 << 16) + v);
+    }
+    for (uint32_t v = 0; v + 8 <= 65536; v += 8) {
+        roaring_bitmap_add(expected_or, (7 << 16) + v);
+    }
+    roaring_bitmap_t *r1_or_r2 = roaring_bitmap_or(r1, r2);
+    assert_true(roaring_bitmap_equals(r1_or_r2, expected_or));
+    assert_true(roaring_bitmap_get_cardinality(r1_or_r2) ==
+                roaring_bitmap_or_cardinality(r1, r2));
+
+    // copy-on-write operands keep to the generic, sharing path
+    roaring_bitmap_t *c1 = roaring_bitmap_copy(r1);
+    roaring_bitmap_t *c2 = roaring_bitmap_copy(r2);
+    roaring_bitmap_set_copy_on_write(c1, true);
+    roaring_bitmap_set_copy_on_write(c2, true);
+    roaring_bitmap_t *cow_or = roaring_bitmap_or(c1, c2);
+    assert_true(roaring_bitmap_equals(cow_or, expected_or));
+
+    roaring_bitmap_free(cow_or);
+    roaring_bitmap_free(c2);
+    roaring_bitmap_free(c1);
+    roaring_bitmap_free(r1_or_r2);
+    roaring_bitmap_free(expected_or);
+    roaring_bitmap_free(r1_and_r2);
+    roaring_bitmap_free(expected_and);
+    roaring_bitmap_free(r2);
+    roaring_bitmap_free(r1);
+}
+
+void test_optimize_for() {
+    // key 0: a full consecutive range, best stored as a run
+    // key 1: a sparse array; key 2: stride two, best left a bitset
+    roaring_bitmap_t *r = roaring_bitmap_create();
+    for (uint32_t v = 0; v < 65536; v++) {
+        roaring_bitmap_add(r, v);
+    }
+    for (uint32_t v = 0; v < 100; v++) {
+        roaring_bitmap_add(r, (1 << 16) + v * 100);
+    }
+    for (uint32_t v = 0; v < 65536; v += 2) {
+        roaring_bitmap_add(r, (2 << 16) + v);
+    }
+
+    roaring_bitmap_t *tight = roaring_bitmap_copy(r);
+    assert_true(
+        roaring_bitmap_optimize_for(tight, ROARING_WORKLOAD_MEMORY_TIGHT));
+    assert_true(roaring_bitmap_equals(tight, r));
+    roaring_statistics_t stats;
+    roaring_bitmap_statistics(tight, &stats);
+    assert_int_equal(1, stats.n_run_containers);     // the full range
+    assert_int_equal(1, stats.n_bitset_containers);  // stride two stays
+    assert_int_equal(1, stats.n_array_containers);
+
+    // read-heavy: the dense run expands back into a bitset
+    assert_true(
+        roaring_bitmap_optimize_for(tight, ROARING_WORKLOAD_READ_HEAVY));
+    roaring_bitmap_statistics(tight, &stats);
+    assert_int_equal(0, stats.n_run_containers);
+    assert_int_equal(2, stats.n_bitset_containers);
+    assert_true(roaring_bitmap_equals(tight, r));
+    roaring_bitmap_free(tight);
+
+    roaring_bitmap_t *sparse_runs = roaring_bitmap_create();
+    roaring_bitmap_add_range_closed(sparse_runs, 10, 200);
+    roaring_bitmap_add_range_closed(sparse_runs, 1000, 1400);
+    roaring_bitmap_run_optimize(sparse_runs);
+    roaring_bitmap_statistics(sparse_runs, &stats);
+    assert_int_equal(1, stats.n_run_containers);
+
+    roaring_optimization_advice_t advice;
+    roaring_bitmap_advise_optimization(&stats, ROARING_WORKLOAD_READ_HEAVY,
+                                       &advice);
+    assert_false(advice.remove_run_compression);  // too sparse to expand
+    roaring_bitmap_advise_optimization(&stats, ROARING_WORKLOAD_WRITE_HEAVY,
+                                       &advice);
+    assert_true(advice.remove_run_compression);
+    assert_false(advice.shrink_to_fit);
+    roaring_bitmap_advise_optimization(&stats, ROARING_WORKLOAD_MEMORY_TIGHT,
+                                       &advice);
+    assert_false(advice.run_optimize);  // nothing left to compress
+    assert_true(advice.shrink_to_fit);
+
+    // write-heavy expands runs no matter how sparse
+    assert_true(roaring_bitmap_optimize_for(sparse_runs,
+                                            ROARING_WORKLOAD_WRITE_HEAVY));
+    roaring_bitmap_statistics(sparse_runs, &stats);
+    assert_int_equal(0, stats.n_run_containers);
+    roaring_bitmap_free(sparse_runs);
+    roaring_bitmap_free(r);
+}
+
+void test_and_or_into() {
+    // mixed shapes: bitsets, arrays, runs, disjoint keys, and a shared key
+    // (3) whose intersection is empty
+    roaring_bitmap_t *r1 = roaring_bitmap_create();
+    roaring_bitmap_t *r2 = roaring_bitmap_create();
+    for (uint32_t v = 0; v < 65536; v += 2) roaring_bitmap_add(r1, v);
+    for (uint32_t v = 0; v < 65536; v += 3) roaring_bitmap_add(r2, v);
+    for (uint32_t v = 0; v < 65536; v += 500) {
+        roaring_bitmap_add(r1, (2 << 16) + v);
+        roaring_bitmap_add(r2, (2 << 16) + v * 2);
+    }
+    for (uint32_t v = 0; v < 1000; v += 2) {
+        roaring_bitmap_add(r1, (3 << 16) + v);
+        roaring_bitmap_add(r2, (3 << 16) + v + 1);
+    }
+    roaring_bitmap_add_range_closed(r1, 4 << 16, (4 << 16) + 70000);
+    roaring_bitmap_add_range_closed(r2, (4 << 16) + 50000, (4 << 16) + 90000);
+    roaring_bitmap_run_optimize(r1);
+    roaring_bitmap_run_optimize(r2);
+    for (uint32_t v = 0; v < 100; v++) roaring_bitmap_add(r1, (7 << 16) + v);
+
+    // the result starts out holding unrelated content to recycle
+    roaring_bitmap_t *result = roaring_bitmap_create();
+    for (uint32_t v = 0; v < 30000; v++) roaring_bitmap_add(result, v * 5);
+    roaring_bitmap_t *expected = roaring_bitmap_and(r1, r2);
+    assert_true(roaring_bitmap_and_into(result, r1, r2));
+    assert_true(roaring_bitmap_equals(result, expected));
+    assert_int_equal(roaring_bitmap_get_cardinality(expected),
+                     roaring_bitmap_get_cardinality(result));
+    roaring_bitmap_free(expected);
+
+    expected = roaring_bitmap_or(r1, r2);
+    assert_true(roaring_bitmap_or_into(result, r1, r2));
+    assert_true(roaring_bitmap_equals(result, expected));
+    // and again, recycling the union's own containers
+    assert_true(roaring_bitmap_or_into(result, r1, r2));
+    assert_true(roaring_bitmap_equals(result, expected));
+    // shrinking back down to the intersection frees the extra containers
+    roaring_bitmap_free(expected);
+    expected = roaring_bitmap_and(r1, r2);
+    assert_true(roaring_bitmap_and_into(result, r1, r2));
+    assert_true(roaring_bitmap_equals(result, expected));
+    roaring_bitmap_free(expected);
+    roaring_bitmap_free(result);
+    roaring_bitmap_free(r2);
+    roaring_bitmap_free(r1);
+
+    // steady state: with run containers out of the picture, a warmed-up
+    // result bitmap absorbs repeated operations without a single allocation
+    roaring_memory_t default_hook = {
+        .malloc = malloc,
+        .realloc = realloc,
+        .calloc = calloc,
+        .free = free,
+        .aligned_malloc = roaring_bitmap_aligned_malloc,
+        .aligned_free = roaring_bitmap_aligned_free,
+    };
+    roaring_memory_t counting_hook = {
+        .malloc = counting_malloc,
+        .realloc = counting_realloc,
+        .calloc = counting_calloc,
+        .free = counting_free,
+        .aligned_malloc = counting_aligned_malloc,
+        .aligned_free = counting_aligned_free,
+    };
+    roaring_init_memory_hook(counting_hook);
+    roaring_bitmap_t *a1 = roaring_bitmap_create();
+    roaring_bitmap_t *a2 = roaring_bitmap_create();
+    for (uint32_t v = 0; v < 65536; v += 2) roaring_bitmap_add(a1, v);
+    for (uint32_t v = 0; v < 65536; v += 3) roaring_bitmap_add(a2, v);
+    for (uint32_t v = 0; v < 65536; v += 30) roaring_bitmap_add(a1, (1 << 16) + v);
+    for (uint32_t v = 0; v < 65536; v += 42) roaring_bitmap_add(a2, (1 << 16) + v);
+    for (uint32_t v = 0; v < 100; v++) roaring_bitmap_add(a1, (5 << 16) + v);
+
+    roaring_bitmap_t *into = roaring_bitmap_create();
+    assert_true(roaring_bitmap_and_into(into, a1, a2));  // warm up
+    assert_true(roaring_bitmap_and_into(into, a1, a2));
+    int64_t allocations = memory_hook_allocations;
+    assert_true(roaring_bitmap_and_into(into, a1, a2));
+    assert_int_equal(allocations, memory_hook_allocations);
+    expected = roaring_bitmap_and(a1, a2);
+    assert_true(roaring_bitmap_equals(into, expected));
+    roaring_bitmap_free(expected);
+
+    assert_true(roaring_bitmap_or_into(into, a1, a2));  // warm up
+    assert_true(roaring_bitmap_or_into(into, a1, a2));
+    allocations = memory_hook_allocations;
+    assert_true(roaring_bitmap_or_into(into, a1, a2));
+    assert_int_equal(allocations, memory_hook_allocations);
+    expected = roaring_bitmap_or(a1, a2);
+    assert_true(roaring_bitmap_equals(into, expected));
+    roaring_bitmap_free(expected);
+
+    roaring_bitmap_free(into);
+    roaring_bitmap_free(a2);
+    roaring_bitmap_free(a1);
+    roaring_init_memory_hook(default_hook);
+}
+
+void test_full_container_singleton() {
+    roaring_memory_t default_hook = {
+        .malloc = malloc,
+        .realloc = realloc,
+        .calloc = calloc,
+        .free = free,
+        .aligned_malloc = roaring_bitmap_aligned_malloc,
+        .aligned_free = roaring_bitmap_aligned_free,
+    };
+    roaring_memory_t counting_hook = {
+        .malloc = counting_malloc,
+        .realloc = counting_realloc,
+        .calloc = counting_calloc,
+        .free = counting_free,
+        .aligned_malloc = counting_aligned_malloc,
+        .aligned_free = counting_aligned_free,
+    };
+    roaring_init_memory_hook(counting_hook);
+    const int64_t balance_before = memory_hook_balance;
+
+    // two complementary bitsets: their union is an all-ones chunk
+    roaring_bitmap_t *evens = roaring_bitmap_create();
+    roaring_bitmap_t *odds = roaring_bitmap_create();
+    for (uint32_t v = 0; v < 65536; v += 2) {
+        roaring_bitmap_add(evens, v);
+        roaring_bitmap_add(odds, v + 1);
+    }
+    roaring_bitmap_t *all = roaring_bitmap_or(evens, odds);
+    assert_int_equal(1, all->high_low_container.size);
+    assert_int_equal(RUN_CONTAINER_TYPE_CODE,
+                     all->high_low_container.typecodes[0]);
+    assert_true(all->high_low_container.containers[0] ==
+                (void *)run_container_full());
+    assert_int_equal(65536, roaring_bitmap_get_cardinality(all));
+    assert_true(roaring_bitmap_contains(all, 0));
+    assert_true(roaring_bitmap_contains(all, 65535));
+
+    // clones of a full container are the very same shared instance
+    roaring_bitmap_t *copy = roaring_bitmap_copy(all);
+    assert_true(copy->high_low_container.containers[0] ==
+                (void *)run_container_full());
+
+    // mutating a bitmap holding the singleton materializes a private copy
+    roaring_bitmap_remove(copy, 100);
+    assert_false(roaring_bitmap_contains(copy, 100));
+    assert_true(roaring_bitmap_contains(all, 100));
+    assert_true(all->high_low_container.containers[0] ==
+                (void *)run_container_full());
+    assert_int_equal(65536, roaring_bitmap_get_cardinality(all));
+
+    // in-place unions and full-chunk range additions produce it as well
+    roaring_bitmap_or_inplace(evens, odds);
+    assert_true(evens->high_low_container.containers[0] ==
+                (void *)run_container_full());
+    roaring_bitmap_t *range = roaring_bitmap_create();
+    roaring_bitmap_add_range_closed(range, 5 << 16, (6 << 16) - 1);
+    assert_true(range->high_low_container.containers[0] ==
+                (void *)run_container_full());
+
+    // lazy unions of two run containers collapse onto the singleton as
+    // well, without leaking the owned union they convert away
+    roaring_bitmap_t *low_half = roaring_bitmap_create();
+    roaring_bitmap_t *high_half = roaring_bitmap_create();
+    roaring_bitmap_add_range_closed(low_half, 0, 32767);
+    roaring_bitmap_add_range_closed(high_half, 32768, 65535);
+    const roaring_bitmap_t *halves[2] = {low_half, high_half};
+    roaring_bitmap_t *lazy_all = roaring_bitmap_or_many_heap(2, halves);
+    assert_true(roaring_bitmap_equals(lazy_all, all));
+    assert_true(lazy_all->high_low_container.containers[0] ==
+                (void *)run_container_full());
+    roaring_bitmap_free(lazy_all);
+    roaring_bitmap_free(high_half);
+    roaring_bitmap_free(low_half);
+
+    // the singleton serializes like any other full run container
+    size_t size = roaring_bitmap_portable_size_in_bytes(all);
+    char *buf = (char *)malloc(size);
+    assert_int_equal(size, roaring_bitmap_portable_serialize(all, buf));
+    roaring_bitmap_t *roundtrip = roaring_bitmap_portable_deserialize(buf);
+    free(buf);
+    assert_true(roaring_bitmap_equals(all, roundtrip));
+    // deserialization builds an owned container; run_optimize collapses it
+    roaring_bitmap_run_optimize(roundtrip);
+    assert_true(roundtrip->high_low_container.containers[0] ==
+                (void *)run_container_full());
+
+    roaring_bitmap_free(roundtrip);
+    roaring_bitmap_free(range);
+    roaring_bitmap_free(copy);
+    roaring_bitmap_free(all);
+    roaring_bitmap_free(odds);
+    roaring_bitmap_free(evens);
+    // nothing leaked: the singleton itself was never counted nor freed
+    assert_int_equal(balance_before, memory_hook_balance);
+    roaring_init_memory_hook(default_hook);
+}
+
+void test_compact() {
+    roaring_memory_t default_hook = {
+        .malloc = malloc,
+        .realloc = realloc,
+        .calloc = calloc,
+        .free = free,
+        .aligned_malloc = roaring_bitmap_aligned_malloc,
+        .aligned_free = roaring_bitmap_aligned_free,
+    };
+    roaring_memory_t counting_hook = {
+        .malloc = counting_malloc,
+        .realloc = counting_realloc,
+        .calloc = counting_calloc,
+        .free = counting_free,
+        .aligned_malloc = counting_aligned_malloc,
+        .aligned_free = counting_aligned_free,
+    };
+    roaring_init_memory_hook(counting_hook);
+    const int64_t balance_before = memory_hook_balance;
+
+    // a mixed-shape bitmap: arrays, bitsets and runs interleaved by key
+    roaring_bitmap_t *r = roaring_bitmap_create();
+    for (uint32_t k = 0; k < 40; k++) {
+        uint32_t base = k << 16;
+        switch (k % 4) {
+            case 0:  // array container
+                for (uint32_t v = 0; v < 3000; v++)
+                    roaring_bitmap_add(r, base + v * 7);
+                break;
+            case 1:  // bitset container
+                for (uint32_t v = 0; v < 65536; v += 3)
+                    roaring_bitmap_add(r, base + v);
+                break;
+            case 2:  // run container (after run_optimize)
+                roaring_bitmap_add_range_closed(r, base + 100, base + 20000);
+                break;
+            default:  // small array container
+                for (uint32_t v = 0; v < 100; v++)
+                    roaring_bitmap_add(r, base + v * 500);
+                break;
+        }
+    }
+    roaring_bitmap_run_optimize(r);
+    roaring_bitmap_t *expected = roaring_bitmap_copy(r);
+
+    assert_true(roaring_bitmap_compact(r));
+    assert_true(roaring_bitmap_equals(expected, r));
+    // every payload now sits in one block, in key order
+    assert_true(roaring_bitmap_memory_contiguity(r) == 1.0);
+    assert_int_equal(roaring_bitmap_and_cardinality(r, expected),
+                     roaring_bitmap_get_cardinality(expected));
+
+    // the bitmap stays mutable: these hit array growth, in-place bitset
+    // edits, run growth and brand-new containers
+    roaring_bitmap_add(r, (0 << 16) + 5);       // array grows off the arena
+    roaring_bitmap_add(expected, (0 << 16) + 5);
+    roaring_bitmap_remove(r, (1 << 16) + 3);    // bitset edited in place
+    roaring_bitmap_remove(expected, (1 << 16) + 3);
+    roaring_bitmap_add(r, (2 << 16) + 50000);   // run container grows
+    roaring_bitmap_add(expected, (2 << 16) + 50000);
+    roaring_bitmap_add_range_closed(r, 100 << 16, (100 << 16) + 10);
+    roaring_bitmap_add_range_closed(expected, 100 << 16, (100 << 16) + 10);
+    assert_true(roaring_bitmap_equals(expected, r));
+
+    // shrinking is a no-op on borrowed payloads, never a realloc of them
+    roaring_bitmap_shrink_to_fit(r);
+    assert_true(roaring_bitmap_equals(expected, r));
+
+    // compacting again reclaims the bytes grown containers left behind
+    assert_true(roaring_bitmap_compact(r));
+    assert_true(roaring_bitmap_equals(expected, r));
+    assert_true(roaring_bitmap_memory_contiguity(r) == 1.0);
+
+    // serialization does not care where the payloads live
+    size_t size = roaring_bitmap_portable_size_in_bytes(r);
+    char *buf = (char *)malloc(size);
+    assert_int_equal(size, roaring_bitmap_portable_serialize(r, buf));
+    roaring_bitmap_t *roundtrip = roaring_bitmap_portable_deserialize(buf);
+    free(buf);
+    assert_true(roaring_bitmap_equals(expected, roundtrip));
+    roaring_bitmap_free(roundtrip);
+
+    // copies own their payloads and outlive the compacted original
+    roaring_bitmap_t *copy = roaring_bitmap_copy(r);
+    roaring_bitmap_free(r);
+    assert_true(roaring_bitmap_equals(expected, copy));
+
+    // refused under copy-on-write: containers could outlive the arena
+    roaring_bitmap_set_copy_on_write(copy, true);
+    assert_false(roaring_bitmap_compact(copy));
+    roaring_bitmap_set_copy_on_write(copy, false);
+    assert_true(roaring_bitmap_compact(copy));
+    assert_true(roaring_bitmap_equals(expected, copy));
+
+    roaring_bitmap_free(copy);
+    roaring_bitmap_free(expected);
+    assert_int_equal(balance_before, memory_hook_balance);
+    roaring_init_memory_hook(default_hook);
+}
+
+void test_container_cursor() {
+    // a mix of container shapes, one per 16-bit key block
+    roaring_bitmap_t *r = roaring_bitmap_create();
+    roaring_bitmap_t *other = roaring_bitmap_create();
+    for (uint32_t k = 0; k < 16; k++) {
+        uint32_t base = k << 16;
+        switch (k % 3) {
+            case 0:
+                for (uint32_t v = 0; v < 2000; v++)
+                    roaring_bitmap_add(r, base + v * 11);
+                break;
+            case 1:
+                for (uint32_t v = 0; v < 65536; v += 2)
+                    roaring_bitmap_add(r, base + v);
+                break;
+            default:
+                roaring_bitmap_add_range_closed(r, base + 10, base + 30000);
+                break;
+        }
+        for (uint32_t v = 0; v < 65536; v += 5)
+            roaring_bitmap_add(other, base + v);
+    }
+    roaring_bitmap_run_optimize(r);
+
+    int32_t n = roaring_bitmap_num_containers(r);
+    roaring_statistics_t stats;
+    roaring_bitmap_statistics(r, &stats);
+    assert_int_equal(stats.n_containers, n);
+
+    // per-container spans tile the bitmap from minimum to maximum
+    uint32_t min, max, prev_max = 0;
+    for (int32_t i = 0; i < n; i++) {
+        assert_true(roaring_bitmap_container_range(r, i, &min, &max));
+        assert_true(min <= max);
+        if (i > 0) assert_true(min > prev_max);
+        prev_max = max;
+    }
+    assert_true(roaring_bitmap_container_range(r, 0, &min, &max));
+    assert_int_equal(roaring_bitmap_minimum(r), min);
+    assert_true(roaring_bitmap_container_range(r, n - 1, &min, &max));
+    assert_int_equal(roaring_bitmap_maximum(r), max);
+    assert_false(roaring_bitmap_container_range(r, -1, &min, &max));
+    assert_false(roaring_bitmap_container_range(r, n, &min, &max));
+
+    // parallel-style AND: operate on four disjoint slices, then recombine
+    roaring_bitmap_t *serial = roaring_bitmap_and(r, other);
+    roaring_bitmap_t *pieces[4];
+    for (int32_t t = 0; t < 4; t++) {
+        int32_t start = t * n / 4;
+        int32_t end = (t + 1) * n / 4;
+        roaring_bitmap_t *slice = roaring_bitmap_container_slice(r, start, end);
+        assert_non_null(slice);
+        pieces[t] = roaring_bitmap_and(slice, other);
+        roaring_bitmap_free(slice);
+    }
+    roaring_bitmap_t *combined = roaring_bitmap_concatenate(4, pieces);
+    assert_non_null(combined);
+    for (int32_t t = 0; t < 4; t++) assert_null(pieces[t]);
+    assert_true(roaring_bitmap_equals(serial, combined));
+    roaring_bitmap_free(combined);
+    roaring_bitmap_free(serial);
+
+    // overlapping pieces are rejected and left untouched
+    pieces[0] = roaring_bitmap_container_slice(r, 0, 4);
+    pieces[1] = roaring_bitmap_container_slice(r, 2, 8);
+    assert_null(roaring_bitmap_concatenate(2, pieces));
+    assert_non_null(pieces[0]);
+    assert_int_equal(roaring_bitmap_num_containers(pieces[1]), 6);
+    roaring_bitmap_free(pieces[1]);
+
+    // slices share containers with the original: a mutation on either
+    // side copies the affected container instead of leaking through
+    roaring_bitmap_t *before = roaring_bitmap_copy(pieces[0]);
+    roaring_bitmap_add(r, 5);
+    assert_true(roaring_bitmap_equals(before, pieces[0]));
+    roaring_bitmap_remove(pieces[0], 0);
+    assert_true(roaring_bitmap_contains(r, 0));
+    assert_false(roaring_bitmap_contains(pieces[0], 0));
+    roaring_bitmap_free(before);
+    roaring_bitmap_free(pieces[0]);
+
+    // degenerate cases: empty slice, invalid range, slice outliving r
+    roaring_bitmap_t *empty = roaring_bitmap_container_slice(r, 3, 3);
+    assert_non_null(empty);
+    assert_int_equal(roaring_bitmap_num_containers(empty), 0);
+    roaring_bitmap_free(empty);
+    assert_null(roaring_bitmap_container_slice(r, 0, n + 1));
+    roaring_bitmap_t *tail = roaring_bitmap_container_slice(r, n - 2, n);
+    uint64_t tail_card = roaring_bitmap_get_cardinality(tail);
+    roaring_bitmap_free(r);
+    assert_int_equal(tail_card, roaring_bitmap_get_cardinality(tail));
+    roaring_bitmap_free(tail);
+    roaring_bitmap_free(other);
+}
+
+void test_skewed_intersection() {
+    // a 400-container index against a 4-container filter: well past the
+    // 64x container-count ratio where the key walk switches to galloping
+    // from the smaller side
+    roaring_bitmap_t *big = roaring_bitmap_create();
+    for (uint32_t k = 0; k < 400; k++) {
+        for (uint32_t v = 0; v < 800; v++)
+            roaring_bitmap_add(big, (k << 16) + v * 13);
+    }
+    roaring_bitmap_t *small = roaring_bitmap_create();
+    roaring_bitmap_t *expected = roaring_bitmap_create();
+    uint32_t small_keys[4] = {3, 200, 399, 450};  // 450 is absent from big
+    for (int i = 0; i < 4; i++) {
+        uint32_t base = small_keys[i] << 16;
+        for (uint32_t v = 0; v < 500; v++) {
+            // offset so that the key-200 chunk intersects in values too
+            uint32_t value = base + v * ((small_keys[i] == 200) ? 13 : 7);
+            roaring_bitmap_add(small, value);
+            if (roaring_bitmap_contains(big, value))
+                roaring_bitmap_add(expected, value);
+        }
+    }
+
+    // both argument orders take the skewed path
+    roaring_bitmap_t *inter = roaring_bitmap_and(small, big);
+    assert_true(roaring_bitmap_equals(expected, inter));
+    roaring_bitmap_free(inter);
+    inter = roaring_bitmap_and(big, small);
+    assert_true(roaring_bitmap_equals(expected, inter));
+    roaring_bitmap_free(inter);
+    assert_int_equal(roaring_bitmap_get_cardinality(expected),
+                     roaring_bitmap_and_cardinality(small, big));
+    assert_int_equal(roaring_bitmap_get_cardinality(expected),
+                     roaring_bitmap_and_cardinality(big, small));
+    assert_true(roaring_bitmap_intersect(small, big));
+    assert_true(roaring_bitmap_intersect(big, small));
+
+    // a filter whose keys all miss: galloping runs off the end of big
+    roaring_bitmap_t *disjoint = roaring_bitmap_create();
+    roaring_bitmap_add(disjoint, 401 << 16);
+    roaring_bitmap_add(disjoint, 500 << 16);
+    assert_false(roaring_bitmap_intersect(disjoint, big));
+    assert_int_equal(0, roaring_bitmap_and_cardinality(disjoint, big));
+    inter = roaring_bitmap_and(disjoint, big);
+    assert_true(roaring_bitmap_is_empty(inter));
+    roaring_bitmap_free(inter);
+    roaring_bitmap_free(disjoint);
+
+    roaring_bitmap_free(expected);
+    roaring_bitmap_free(small);
+    roaring_bitmap_free(big);
+}
+
+void test_bitset_bridge() {
+    // one chunk of each container shape plus an empty chunk and a
+    // partial final chunk (maxwords not a multiple of 1024)
+    roaring_bitmap_t *r = roaring_bitmap_create();
+    for (uint32_t v = 0; v < 3000; v++) roaring_bitmap_add(r, v * 9);
+    for (uint32_t v = 0; v < 65536; v += 2)
+        roaring_bitmap_add(r, (1 << 16) + v);
+    roaring_bitmap_add_range_closed(r, 2 << 16, (3 << 16) - 1);  // full
+    // key 3 left empty; key 4 holds a few values low in the chunk
+    for (uint32_t v = 0; v < 50; v++) roaring_bitmap_add(r, (4 << 16) + v);
+    roaring_bitmap_run_optimize(r);
+
+    const size_t maxwords = 4 * 1024 + 10;  // covers max value (4<<16)+49
+    uint64_t *words = (uint64_t *)malloc(maxwords * sizeof(uint64_t));
+    memset(words, 0xAA, maxwords * sizeof(uint64_t));  // must all be rewritten
+    assert_true(roaring_bitmap_to_bitset(r, words, maxwords));
+
+    uint64_t card = 0;
+    for (size_t i = 0; i < maxwords; i++) {
+        for (uint64_t w = words[i]; w != 0; w &= w - 1) card++;
+    }
+    assert_int_equal(roaring_bitmap_get_cardinality(r), card);
+    for (uint32_t v = 0; v < maxwords * 64; v += 7) {
+        bool bit = (words[v >> 6] >> (v & 63)) & 1;
+        assert_true(bit == roaring_bitmap_contains(r, v));
+    }
+
+    roaring_bitmap_t *back = roaring_bitmap_from_bitset(words, maxwords);
+    assert_true(roaring_bitmap_equals(r, back));
+    // representative container types survive the round trip
+    roaring_statistics_t stats;
+    roaring_bitmap_statistics(back, &stats);
+    assert_int_equal(1, stats.n_bitset_containers);
+    assert_int_equal(1, stats.n_run_containers);  // all-ones chunk
+    roaring_bitmap_free(back);
+
+    // too small a buffer fails and leaves it cleared
+    assert_false(roaring_bitmap_to_bitset(r, words, 2 * 1024));
+    for (size_t i = 0; i < 2 * 1024; i++) assert_int_equal(0, words[i]);
+
+    // empty in both directions
+    roaring_bitmap_t *empty = roaring_bitmap_create();
+    assert_true(roaring_bitmap_to_bitset(empty, words, 16));
+    roaring_bitmap_t *empty2 = roaring_bitmap_from_bitset(words, 16);
+    assert_true(roaring_bitmap_is_empty(empty2));
+    roaring_bitmap_free(empty2);
+    roaring_bitmap_free(empty);
+
+    free(words);
+    roaring_bitmap_free(r);
+}
+
+void test_trusted_deserialize() {
+    roaring_memory_t default_hook = {
+        .malloc = malloc,
+        .realloc = realloc,
+        .calloc = calloc,
+        .free = free,
+        .aligned_malloc = roaring_bitmap_aligned_malloc,
+        .aligned_free = roaring_bitmap_aligned_free,
+    };
+    roaring_memory_t counting_hook = {
+        .malloc = counting_malloc,
+        .realloc = counting_realloc,
+        .calloc = counting_calloc,
+        .free = counting_free,
+        .aligned_malloc = counting_aligned_malloc,
+        .aligned_free = counting_aligned_free,
+    };
+    roaring_init_memory_hook(counting_hook);
+    const int64_t balance_before = memory_hook_balance;
+
+    // arrays, bitsets, runs and a full container in one bitmap
+    roaring_bitmap_t *r = roaring_bitmap_create();
+    for (uint32_t v = 0; v < 2000; v++) roaring_bitmap_add(r, v * 11);
+    for (uint32_t v = 0; v < 65536; v += 2)
+        roaring_bitmap_add(r, (1 << 16) + v);
+    roaring_bitmap_add_range_closed(r, (2 << 16) + 5, (2 << 16) + 40000);
+    roaring_bitmap_add_range_closed(r, 3 << 16, (4 << 16) - 1);
+    roaring_bitmap_run_optimize(r);
 
-    roaring_bitmap_free(r1_or_r2);
-    roaring_bitmap_free(r2);
-    roaring_bitmap_free(r1);
+    size_t size = roaring_bitmap_portable_size_in_bytes(r);
+    char *buf = (char *)malloc(size);
+    assert_int_equal(size, roaring_bitmap_portable_serialize(r, buf));
+
+    roaring_bitmap_t *trusted = roaring_bitmap_portable_deserialize_trusted(buf);
+    assert_non_null(trusted);
+    assert_true(roaring_bitmap_equals(r, trusted));
+    // the payloads were bulk-copied into one arena
+    assert_true(roaring_bitmap_memory_contiguity(trusted) == 1.0);
+    const char *reason = "set me";
+    assert_true(roaring_bitmap_internal_validate(trusted, &reason));
+    assert_null(reason);
+
+    // the result is a normal mutable bitmap
+    roaring_bitmap_add(trusted, 5);       // array grows off the arena
+    roaring_bitmap_add(r, 5);
+    roaring_bitmap_remove(trusted, (1 << 16) + 2);  // bitset edit in place
+    roaring_bitmap_remove(r, (1 << 16) + 2);
+    assert_true(roaring_bitmap_equals(r, trusted));
+    assert_true(roaring_bitmap_internal_validate(trusted, &reason));
+    roaring_bitmap_free(trusted);
+
+    // validation catches corruption the trusted decoder would never see
+    roaring_bitmap_t *broken = roaring_bitmap_portable_deserialize_trusted(buf);
+    uint16_t swap = broken->high_low_container.keys[0];
+    broken->high_low_container.keys[0] = broken->high_low_container.keys[1];
+    broken->high_low_container.keys[1] = swap;
+    assert_false(roaring_bitmap_internal_validate(broken, &reason));
+    assert_non_null(reason);
+    broken->high_low_container.keys[1] = broken->high_low_container.keys[0];
+    broken->high_low_container.keys[0] = swap;
+    assert_true(roaring_bitmap_internal_validate(broken, NULL));
+    // a sorted array container with two values transposed
+    assert_int_equal(ARRAY_CONTAINER_TYPE_CODE,
+                     broken->high_low_container.typecodes[0]);
+    array_container_t *arr =
+        (array_container_t *)broken->high_low_container.containers[0];
+    uint16_t v0 = arr->array[0];
+    arr->array[0] = arr->array[1];
+    arr->array[1] = v0;
+    assert_false(roaring_bitmap_internal_validate(broken, &reason));
+    assert_string_equal("array values not strictly increasing", reason);
+    arr->array[1] = arr->array[0];
+    arr->array[0] = v0;
+    // a lying cardinality cache
+    broken->high_low_container.cached_cardinality = 42;
+    broken->high_low_container.flags |= ROARING_FLAG_CARD_VALID;
+    assert_false(roaring_bitmap_internal_validate(broken, &reason));
+    assert_non_null(reason);
+    roaring_bitmap_free(broken);
+    free(buf);
+
+    // empty bitmap round trip
+    roaring_bitmap_t *empty = roaring_bitmap_create();
+    size = roaring_bitmap_portable_size_in_bytes(empty);
+    buf = (char *)malloc(size);
+    roaring_bitmap_portable_serialize(empty, buf);
+    roaring_bitmap_t *empty2 = roaring_bitmap_portable_deserialize_trusted(buf);
+    assert_true(roaring_bitmap_is_empty(empty2));
+    assert_true(roaring_bitmap_internal_validate(empty2, &reason));
+    roaring_bitmap_free(empty2);
+    roaring_bitmap_free(empty);
+    free(buf);
+
+    roaring_bitmap_free(r);
+    assert_int_equal(balance_before, memory_hook_balance);
+    roaring_init_memory_hook(default_hook);
+}
+
+void test_atomic_ref() {
+    roaring_memory_t default_hook = {
+        .malloc = malloc,
+        .realloc = realloc,
+        .calloc = calloc,
+        .free = free,
+        .aligned_malloc = roaring_bitmap_aligned_malloc,
+        .aligned_free = roaring_bitmap_aligned_free,
+    };
+    roaring_memory_t counting_hook = {
+        .malloc = counting_malloc,
+        .realloc = counting_realloc,
+        .calloc = counting_calloc,
+        .free = counting_free,
+        .aligned_malloc = counting_aligned_malloc,
+        .aligned_free = counting_aligned_free,
+    };
+    roaring_init_memory_hook(counting_hook);
+    const int64_t balance_before = memory_hook_balance;
+
+    // arrays, a bitset and a full run in the first version
+    roaring_bitmap_t *v0 = roaring_bitmap_create();
+    for (uint32_t v = 0; v < 100000; v += 3) roaring_bitmap_add(v0, v);
+    roaring_bitmap_add_range_closed(v0, 0x30000, 0x3FFFF);
+    roaring_bitmap_run_optimize(v0);
+    const uint64_t card0 = roaring_bitmap_get_cardinality(v0);
+
+    roaring_atomic_ref_t *ref = roaring_atomic_ref_create(v0);
+    assert_non_null(ref);  // ref owns v0 now
+
+    // two independent pins on the same version
+    const roaring_bitmap_t *s0 = roaring_atomic_ref_acquire(ref);
+    const roaring_bitmap_t *s0b = roaring_atomic_ref_acquire(ref);
+    assert_true(s0 == s0b);
+    assert_int_equal(card0, roaring_bitmap_get_cardinality(s0));
+    assert_true(roaring_bitmap_internal_validate(s0, NULL));
+
+    // the writer's working copy shares containers until it mutates them
+    roaring_bitmap_t *w = roaring_atomic_ref_checkout(ref);
+    assert_non_null(w);
+    roaring_bitmap_add(w, 999999);
+    roaring_bitmap_remove(w, 0);
+    assert_true(roaring_bitmap_contains(s0, 0));
+    assert_false(roaring_bitmap_contains(s0, 999999));
+    assert_true(roaring_atomic_ref_publish(ref, w));
+
+    // the new version is visible to fresh pins, the old one to existing ones
+    const roaring_bitmap_t *s1 = roaring_atomic_ref_acquire(ref);
+    assert_true(s1 != s0);
+    assert_true(roaring_bitmap_contains(s1, 999999));
+    assert_false(roaring_bitmap_contains(s1, 0));
+    assert_int_equal(card0, roaring_bitmap_get_cardinality(s0));
+    assert_true(roaring_bitmap_internal_validate(s1, NULL));
+
+    // the displaced version survives until its last pin is gone
+    roaring_atomic_ref_release(s0);
+    assert_true(roaring_bitmap_contains(s0b, 0));
+    roaring_atomic_ref_release(s0b);
+
+    // several publishes while a reader holds on to one version
+    for (uint32_t round = 0; round < 4; round++) {
+        roaring_bitmap_t *next = roaring_atomic_ref_checkout(ref);
+        roaring_bitmap_add(next, 2000000 + round);
+        assert_true(roaring_atomic_ref_publish(ref, next));
+    }
+    assert_false(roaring_bitmap_contains(s1, 2000000));
+    const roaring_bitmap_t *s2 = roaring_atomic_ref_acquire(ref);
+    for (uint32_t round = 0; round < 4; round++) {
+        assert_true(roaring_bitmap_contains(s2, 2000000 + round));
+    }
+    roaring_atomic_ref_release(s1);
+
+    // pins outlive the reference itself
+    roaring_atomic_ref_free(ref);
+    assert_true(roaring_bitmap_contains(s2, 999999));
+    roaring_atomic_ref_release(s2);
+
+    // small bitmaps ride the inline container slots, which a publish must
+    // rebase when it steals the struct
+    roaring_bitmap_t *tiny = roaring_bitmap_create();
+    roaring_bitmap_add(tiny, 42);
+    roaring_bitmap_add(tiny, 0x10001);
+    ref = roaring_atomic_ref_create(tiny);
+    const roaring_bitmap_t *st = roaring_atomic_ref_acquire(ref);
+    assert_true(roaring_bitmap_contains(st, 42));
+    assert_true(roaring_bitmap_contains(st, 0x10001));
+    roaring_bitmap_t *tiny2 = roaring_atomic_ref_checkout(ref);
+    roaring_bitmap_add(tiny2, 7);
+    assert_true(roaring_atomic_ref_publish(ref, tiny2));
+    assert_int_equal(2, roaring_bitmap_get_cardinality(st));
+    roaring_atomic_ref_release(st);
+    st = roaring_atomic_ref_acquire(ref);
+    assert_true(roaring_bitmap_contains(st, 7));
+    roaring_atomic_ref_release(st);
+    roaring_atomic_ref_free(ref);
+
+    assert_int_equal(balance_before, memory_hook_balance);
+    roaring_init_memory_hook(default_hook);
+}
+
+#if !defined(_WIN32)
+typedef struct sharded_writer_job_s {
+    roaring_sharded_t *rs;
+    uint32_t stride_offset;  // this writer adds the values v*4 + offset
+    uint32_t number;
+} sharded_writer_job_t;
+
+static void *sharded_writer(void *arg) {
+    sharded_writer_job_t *job = (sharded_writer_job_t *)arg;
+    enum { BATCH = 1024 };
+    uint32_t batch[BATCH];
+    uint32_t filled = 0;
+    for (uint32_t i = 0; i < job->number; i++) {
+        batch[filled++] = i * 4 + job->stride_offset;
+        if (filled == BATCH) {
+            roaring_sharded_add_bulk(job->rs, filled, batch);
+            filled = 0;
+        }
+    }
+    roaring_sharded_add_bulk(job->rs, filled, batch);
+    return NULL;
 }
+#endif
 
-void test_union_true() { test_union(true); }
+void test_sharded() {
+    roaring_memory_t default_hook = {
+        .malloc = malloc,
+        .realloc = realloc,
+        .calloc = calloc,
+        .free = free,
+        .aligned_malloc = roaring_bitmap_aligned_malloc,
+        .aligned_free = roaring_bitmap_aligned_free,
+    };
+    roaring_memory_t counting_hook = {
+        .malloc = counting_malloc,
+        .realloc = counting_realloc,
+        .calloc = counting_calloc,
+        .free = counting_free,
+        .aligned_malloc = counting_aligned_malloc,
+        .aligned_free = counting_aligned_free,
+    };
+    roaring_init_memory_hook(counting_hook);
+    const int64_t balance_before = memory_hook_balance;
+
+    const roaring_shard_policy_t policies[] = {ROARING_SHARD_BY_RANGE,
+                                               ROARING_SHARD_BY_HASH};
+    for (int p = 0; p < 2; p++) {
+        roaring_sharded_t *rs = roaring_sharded_create(7, policies[p]);
+        assert_non_null(rs);
+        roaring_bitmap_t *oracle = roaring_bitmap_create();
+
+        // point adds spanning many container keys
+        for (uint32_t v = 0; v < 3000000; v += 1013) {
+            roaring_sharded_add(rs, v);
+            roaring_bitmap_add(oracle, v);
+        }
+        // a bulk add in scrambled order, overlapping the point adds
+        enum { BULK = 20000 };
+        uint32_t *vals = malloc(BULK * sizeof(uint32_t));
+        for (uint32_t i = 0; i < BULK; i++) {
+            vals[i] = (i * 2654435761u) % 4000000u;
+            roaring_bitmap_add(oracle, vals[i]);
+        }
+        roaring_sharded_add_bulk(rs, BULK, vals);
+        free(vals);
+        // a union with an ordinary bitmap, including a dense chunk
+        roaring_bitmap_t *extra = roaring_bitmap_create();
+        roaring_bitmap_add_range_closed(extra, 0x50000, 0x6FFFF);
+        for (uint32_t v = 5000000; v < 5004000; v += 2) {
+            roaring_bitmap_add(extra, v);
+        }
+        roaring_sharded_or_inplace(rs, extra);
+        roaring_bitmap_or_inplace(oracle, extra);
+        roaring_bitmap_free(extra);
+        // and some removals
+        for (uint32_t v = 0; v < 3000000; v += 7091) {
+            roaring_sharded_remove(rs, v);
+            roaring_bitmap_remove(oracle, v);
+        }
 
-void test_union_false() { test_union(false); }
+        assert_int_equal(roaring_bitmap_get_cardinality(oracle),
+                         roaring_sharded_get_cardinality(rs));
+        assert_true(roaring_sharded_contains(rs, 0x50000));
+        assert_false(roaring_sharded_contains(rs, 4999999));
+        for (uint32_t v = 0; v < 3000000; v += 101501) {
+            assert_int_equal(roaring_bitmap_contains(oracle, v),
+                             roaring_sharded_contains(rs, v));
+        }
+        roaring_bitmap_t *merged = roaring_sharded_merge(rs);
+        assert_true(roaring_bitmap_equals(merged, oracle));
+        roaring_bitmap_free(merged);
+        roaring_bitmap_free(oracle);
+        roaring_sharded_free(rs);
+    }
+
+    assert_int_equal(balance_before, memory_hook_balance);
+    // the counting hooks keep their tally in a plain global, so the
+    // multi-threaded part runs with the default allocator
+    roaring_init_memory_hook(default_hook);
+
+#if !defined(_WIN32)
+    // four writers, each adding one residue class of a contiguous range
+    roaring_sharded_t *rs = roaring_sharded_create(16, ROARING_SHARD_BY_HASH);
+    sharded_writer_job_t jobs[4];
+    pthread_t threads[4];
+    for (uint32_t t = 0; t < 4; t++) {
+        jobs[t].rs = rs;
+        jobs[t].stride_offset = t;
+        jobs[t].number = 100000;
+        pthread_create(&threads[t], NULL, sharded_writer, &jobs[t]);
+    }
+    for (uint32_t t = 0; t < 4; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    assert_int_equal(400000, roaring_sharded_get_cardinality(rs));
+    roaring_bitmap_t *merged = roaring_sharded_merge(rs);
+    roaring_bitmap_t *range = roaring_bitmap_create();
+    roaring_bitmap_add_range_closed(range, 0, 399999);
+    assert_true(roaring_bitmap_equals(merged, range));
+    roaring_bitmap_free(range);
+    roaring_bitmap_free(merged);
+    roaring_sharded_free(rs);
+#endif
+}
 
 // density factor changes as one gets further into bitmap
 static roaring_bitmap_t *gen_bitmap(double start_density,
@@ -1563,6 +3860,295 @@ static roaring_bitmap_t *gen_bitmap(double start_density,
     return ans;
 }
 
+void test_to_uint32_array_parallel() {
+    // arrays, bitsets and runs, with an empty stretch in the middle
+    roaring_bitmap_t *r =
+        gen_bitmap(0.5, -0.000001, 100, 130000, 270000, 500000);
+    uint64_t card = roaring_bitmap_get_cardinality(r);
+    uint32_t *serial = malloc(card * sizeof(uint32_t));
+    uint32_t *parallel = malloc(card * sizeof(uint32_t));
+    roaring_bitmap_to_uint32_array(r, serial);
+    for (unsigned int num_threads = 1; num_threads <= 8; num_threads++) {
+        memset(parallel, 0, card * sizeof(uint32_t));
+        roaring_bitmap_to_uint32_array_parallel(r, parallel, num_threads);
+        assert_true(memcmp(serial, parallel, card * sizeof(uint32_t)) == 0);
+    }
+    // more threads than containers
+    roaring_bitmap_to_uint32_array_parallel(r, parallel, 1000);
+    assert_true(memcmp(serial, parallel, card * sizeof(uint32_t)) == 0);
+    free(parallel);
+    free(serial);
+    roaring_bitmap_free(r);
+}
+
+void test_portable_deserialize_many() {
+    enum { NUM = 30 };
+    roaring_bitmap_t *bitmaps[NUM];
+    char *bufs[NUM];
+    size_t sizes[NUM];
+    for (int i = 0; i < NUM; i++) {
+        roaring_bitmap_t *r = roaring_bitmap_create();
+        for (uint32_t v = 0; v < 1000u * (i + 1); v += (i % 7) + 1) {
+            roaring_bitmap_add(r, v * 31 + i);
+        }
+        if (i % 2 == 0) roaring_bitmap_run_optimize(r);
+        sizes[i] = roaring_bitmap_portable_size_in_bytes(r);
+        bufs[i] = malloc(sizes[i]);
+        roaring_bitmap_portable_serialize(r, bufs[i]);
+        bitmaps[i] = r;
+    }
+    for (unsigned int num_threads = 1; num_threads <= 4; num_threads += 3) {
+        roaring_bitmap_t *answers[NUM];
+        size_t ok = roaring_bitmap_portable_deserialize_many(
+            NUM, (const char **)bufs, sizes, answers, num_threads);
+        assert_int_equal(ok, NUM);
+        for (int i = 0; i < NUM; i++) {
+            assert_non_null(answers[i]);
+            assert_true(roaring_bitmap_equals(answers[i], bitmaps[i]));
+            roaring_bitmap_free(answers[i]);
+        }
+    }
+    // a corrupt buffer yields a NULL slot, the others still load
+    memset(bufs[7], 0x55, sizes[7] < 16 ? sizes[7] : 16);
+    roaring_bitmap_t *answers[NUM];
+    size_t ok = roaring_bitmap_portable_deserialize_many(
+        NUM, (const char **)bufs, sizes, answers, 4);
+    assert_int_equal(ok, NUM - 1);
+    assert_null(answers[7]);
+    for (int i = 0; i < NUM; i++) {
+        if (answers[i] != NULL) roaring_bitmap_free(answers[i]);
+        roaring_bitmap_free(bitmaps[i]);
+        free(bufs[i]);
+    }
+}
+
+void test_and_cardinality_many() {
+    enum { NUM = 24 };
+    // query with array, bitset and run containers, including one array
+    // container dense enough to be promoted to a bitset during preparation
+    roaring_bitmap_t *query = roaring_bitmap_create();
+    for (uint32_t v = 0; v < 3000; v++) roaring_bitmap_add(query, v * 16);
+    roaring_bitmap_add_range(query, 200000, 240000);
+    for (uint32_t v = 400000; v < 470000; v += 2) roaring_bitmap_add(query, v);
+    roaring_bitmap_run_optimize(query);
+    roaring_bitmap_t *candidates[NUM];
+    for (int i = 0; i < NUM; i++) {
+        roaring_bitmap_t *r = roaring_bitmap_create();
+        for (uint32_t v = 0; v < 20000u; v += (i % 5) + 1) {
+            roaring_bitmap_add(r, v * (i + 3));
+        }
+        if (i % 3 == 0) roaring_bitmap_run_optimize(r);
+        candidates[i] = r;
+    }
+    roaring_bitmap_clear(candidates[NUM - 1]);  // empty, never intersects
+    for (unsigned int num_threads = 1; num_threads <= 4; num_threads += 3) {
+        uint64_t counts[NUM];
+        double jaccards[NUM];
+        roaring_bitmap_and_cardinality_many(
+            query, NUM, (const roaring_bitmap_t **)candidates, counts,
+            num_threads);
+        roaring_bitmap_jaccard_index_many(
+            query, NUM, (const roaring_bitmap_t **)candidates, jaccards,
+            num_threads);
+        for (int i = 0; i < NUM; i++) {
+            assert_int_equal(
+                counts[i],
+                roaring_bitmap_and_cardinality(query, candidates[i]));
+            assert_true(jaccards[i] ==
+                        roaring_bitmap_jaccard_index(query, candidates[i]));
+        }
+    }
+    for (int i = 0; i < NUM; i++) roaring_bitmap_free(candidates[i]);
+    roaring_bitmap_free(query);
+}
+
+void test_add_offset() {
+    // arrays, bitsets and runs, with an empty stretch in the middle
+    roaring_bitmap_t *r =
+        gen_bitmap(0.5, -0.000001, 100, 130000, 270000, 500000);
+    uint64_t card = roaring_bitmap_get_cardinality(r);
+    uint32_t *values = malloc(card * sizeof(uint32_t));
+    roaring_bitmap_to_uint32_array(r, values);
+    const int64_t offsets[] = {0,         1,         -1,        65536,
+                               -65536,    0x123456,  -0x123456, 3000000000,
+                               -3000000000, 5000000000, -5000000000};
+    for (size_t k = 0; k < sizeof(offsets) / sizeof(offsets[0]); ++k) {
+        const int64_t offset = offsets[k];
+        roaring_bitmap_t *expected = roaring_bitmap_create();
+        for (uint64_t i = 0; i < card; ++i) {
+            const int64_t shifted = (int64_t)values[i] + offset;
+            if (shifted >= 0 && shifted < (int64_t)(UINT64_C(1) << 32)) {
+                roaring_bitmap_add(expected, (uint32_t)shifted);
+            }
+        }
+        roaring_bitmap_t *shifted = roaring_bitmap_add_offset(r, offset);
+        assert_true(roaring_bitmap_equals(shifted, expected));
+        roaring_bitmap_free(shifted);
+        roaring_bitmap_free(expected);
+    }
+    free(values);
+    roaring_bitmap_free(r);
+}
+
+void test_hash() {
+    // equal contents in different representations must hash identically
+    roaring_bitmap_t *r1 = roaring_bitmap_create();
+    roaring_bitmap_t *r2 = roaring_bitmap_create();
+    for (uint32_t v = 0; v < 100; v++) {
+        roaring_bitmap_add(r1, v * 3);
+        roaring_bitmap_add(r2, v * 3);
+    }
+    for (uint32_t v = 131072; v < 141072; v++) {
+        roaring_bitmap_add(r1, v);
+        roaring_bitmap_add(r2, v);
+    }
+    roaring_bitmap_run_optimize(r1);  // r1 gets a run container, r2 a bitset
+    const uint64_t hash1 = roaring_bitmap_hash(r1);
+    assert_int_equal(hash1, roaring_bitmap_hash(r2));
+    assert_int_equal(hash1, roaring_bitmap_hash(r1));  // cached result
+
+    // a mutation invalidates the cache, including through the checked paths
+    assert_true(roaring_bitmap_add_checked(r2, 77));
+    assert_true(hash1 != roaring_bitmap_hash(r2));
+    assert_false(roaring_bitmap_equals(r1, r2));  // refuted via cached hashes
+    assert_true(roaring_bitmap_remove_checked(r2, 77));
+    assert_int_equal(hash1, roaring_bitmap_hash(r2));
+    assert_true(roaring_bitmap_equals(r1, r2));
+
+    // add_many must drop the cache too: with a stale hash the equals
+    // short-circuit would refute two equal bitmaps
+    const uint32_t extra[] = {400, 402, 65000};
+    (void)roaring_bitmap_hash(r2);  // cache a hash about to go stale
+    roaring_bitmap_add_many(r2, 3, extra);
+    for (int i = 0; i < 3; i++) roaring_bitmap_add(r1, extra[i]);
+    assert_int_equal(roaring_bitmap_hash(r1), roaring_bitmap_hash(r2));
+    assert_true(roaring_bitmap_equals(r1, r2));
+
+    // per-container fingerprints localize the change
+    int32_t n = roaring_bitmap_container_fingerprints(r1, 0, NULL, NULL);
+    assert_int_equal(n, 2);
+    uint16_t keys1[2], keys2[2];
+    uint64_t fps1[2], fps2[2];
+    roaring_bitmap_container_fingerprints(r1, n, keys1, fps1);
+    roaring_bitmap_add(r2, 150000);  // touches only the second container
+    roaring_bitmap_container_fingerprints(r2, n, keys2, fps2);
+    for (int32_t i = 0; i < n; i++) {
+        assert_int_equal(keys1[i], keys2[i]);
+        if (i < n - 1) {
+            assert_int_equal(fps1[i], fps2[i]);
+        } else {
+            assert_true(fps1[i] != fps2[i]);
+        }
+    }
+
+    roaring_bitmap_free(r2);
+    roaring_bitmap_free(r1);
+}
+
+void test_overwrite() {
+    // a steady-state refresh: same container shapes, slightly changed content
+    roaring_bitmap_t *src = roaring_bitmap_create();
+    for (uint32_t v = 0; v < 100; v++) roaring_bitmap_add(src, v * 3);
+    for (uint32_t v = 0; v < 5000; v++) roaring_bitmap_add(src, 65536 + 2 * v);
+    for (uint32_t v = 0; v < 1000; v++) roaring_bitmap_add(src, 131072 + v);
+    roaring_bitmap_run_optimize(src);
+
+    roaring_bitmap_t *dest = roaring_bitmap_create();
+    assert_true(roaring_bitmap_overwrite(dest, src));
+    assert_true(roaring_bitmap_equals(dest, src));
+    void *prev_containers[3];
+    for (int i = 0; i < 3; i++) {
+        prev_containers[i] = dest->high_low_container.containers[i];
+    }
+
+    // small changes that keep every container's type and fit its capacity
+    roaring_bitmap_remove(src, 0);
+    roaring_bitmap_remove(src, 65536);
+    roaring_bitmap_add(src, 131072 + 1000);  // extends the run
+    assert_true(roaring_bitmap_overwrite(dest, src));
+    assert_true(roaring_bitmap_equals(dest, src));
+    for (int i = 0; i < 3; i++) {  // storage was recycled, not reallocated
+        assert_ptr_equal(dest->high_low_container.containers[i],
+                         prev_containers[i]);
+    }
+
+    // shrinking and changing types still yields the right content
+    roaring_bitmap_t *src2 = roaring_bitmap_create();
+    for (uint32_t v = 0; v < 5000; v++) roaring_bitmap_add(src2, 2 * v);
+    assert_true(roaring_bitmap_overwrite(dest, src2));
+    assert_true(roaring_bitmap_equals(dest, src2));
+    assert_true(roaring_bitmap_overwrite(dest, src));
+    assert_true(roaring_bitmap_equals(dest, src));
+
+    roaring_bitmap_free(src2);
+    roaring_bitmap_free(dest);
+    roaring_bitmap_free(src);
+}
+
+typedef struct iterate_ranges_state_s {
+    uint32_t starts[64];
+    uint64_t lengths[64];
+    int count;
+} iterate_ranges_state_t;
+
+static bool collect_range(uint32_t start, uint64_t length, void *arg) {
+    iterate_ranges_state_t *state = (iterate_ranges_state_t *)arg;
+    state->starts[state->count] = start;
+    state->lengths[state->count] = length;
+    state->count++;
+    return true;
+}
+
+static bool stop_after_two_ranges(uint32_t start, uint64_t length, void *arg) {
+    (void)start;
+    (void)length;
+    int *count = (int *)arg;
+    (*count)++;
+    return *count < 2;
+}
+
+void test_iterate_ranges() {
+    roaring_bitmap_t *r = roaring_bitmap_create();
+    // isolated value, short stretch, and a range crossing a container boundary
+    roaring_bitmap_add(r, 100);
+    for (uint32_t v = 200; v < 203; ++v) roaring_bitmap_add(r, v);
+    for (uint32_t v = 60000; v < 70000; ++v) roaring_bitmap_add(r, v);
+    for (uint32_t v = 131072; v < 136072; ++v) roaring_bitmap_add(r, v);
+    roaring_bitmap_run_optimize(r);  // the above become run containers
+    // a bitset container with one long range and two lone bits
+    for (uint32_t v = 200000; v < 208192; ++v) roaring_bitmap_add(r, v);
+    roaring_bitmap_add(r, 210000);
+    roaring_bitmap_add(r, 210002);
+    // a sparse array container
+    roaring_bitmap_add(r, 327687);
+    roaring_bitmap_add(r, 327688);
+    roaring_bitmap_add(r, 327689);
+    roaring_bitmap_add(r, 327730);
+    roaring_bitmap_add(r, 328680);
+
+    const uint32_t expected_starts[] = {100,    200,    60000,  131072, 200000,
+                                        210000, 210002, 327687, 327730, 328680};
+    const uint64_t expected_lengths[] = {1, 3, 10000, 5000, 8192, 1, 1, 3, 1, 1};
+    const int expected_count =
+        (int)(sizeof(expected_starts) / sizeof(expected_starts[0]));
+
+    iterate_ranges_state_t state;
+    state.count = 0;
+    assert_true(roaring_iterate_ranges(r, collect_range, &state));
+    assert_int_equal(state.count, expected_count);
+    for (int i = 0; i < expected_count; ++i) {
+        assert_int_equal(state.starts[i], expected_starts[i]);
+        assert_int_equal(state.lengths[i], expected_lengths[i]);
+    }
+
+    // a false return from the callback stops the scan
+    int seen = 0;
+    assert_false(roaring_iterate_ranges(r, stop_after_two_ranges, &seen));
+    assert_int_equal(seen, 2);
+
+    roaring_bitmap_free(r);
+}
+
 static roaring_bitmap_t *synthesized_xor(roaring_bitmap_t *r1,
                                          roaring_bitmap_t *r2) {
     unsigned universe_size = 0;
@@ -1938,6 +4524,151 @@ void test_xor_lazy_inplace_true() { test_xor_lazy_inplace(true); }
 
 void test_xor_lazy_inplace_false() { test_xor_lazy_inplace(false); }
 
+void test_and_andnot_lazy(bool copy_on_write) {
+    // synthetic data covering array, bitset and run containers
+    roaring_bitmap_t *r[] = {
+        // ascending density, last containers might be runs
+        gen_bitmap(0.0, 1e-6, 1, 0, 0, 1000000),
+        // descending density, first containers might be runs
+        gen_bitmap(1.0, -1e-6, 1, 0, 0, 1000000),
+        // uniformly rather sparse
+        gen_bitmap(1e-5, 0.0, 1, 0, 0, 2000000),
+        // uniformly rather sparse with runs
+        gen_bitmap(1e-5, 0.0, 3, 0, 0, 2000000),
+        // uniformly rather dense
+        gen_bitmap(1e-1, 0.0, 1, 0, 0, 2000000),
+        // descending with a gap
+        gen_bitmap(0.5, -1e-6, 1, 600000, 800000, 1000000),
+        //  gap elsewhere
+        gen_bitmap(1, -1e-6, 1, 300000, 500000, 1000000),
+        0  // sentinel
+    };
+    for (int i = 0; r[i]; ++i) {
+        roaring_bitmap_set_copy_on_write(r[i], copy_on_write);
+    }
+
+    for (int i = 0; r[i]; ++i) {
+        for (int j = i; r[j]; ++j) {
+            // intersection
+            roaring_bitmap_t *expected = roaring_bitmap_and(r[i], r[j]);
+
+            roaring_bitmap_t *result = roaring_bitmap_lazy_and(r[i], r[j]);
+            roaring_bitmap_repair_after_lazy(result);
+            assert_true(roaring_bitmap_equals(expected, result));
+            roaring_bitmap_free(result);
+
+            result = roaring_bitmap_copy(r[i]);
+            roaring_bitmap_lazy_and_inplace(result, r[j]);
+            roaring_bitmap_repair_after_lazy(result);
+            assert_true(roaring_bitmap_equals(expected, result));
+            roaring_bitmap_free(result);
+            roaring_bitmap_free(expected);
+
+            // difference
+            expected = roaring_bitmap_andnot(r[i], r[j]);
+
+            result = roaring_bitmap_lazy_andnot(r[i], r[j]);
+            roaring_bitmap_repair_after_lazy(result);
+            assert_true(roaring_bitmap_equals(expected, result));
+            roaring_bitmap_free(result);
+
+            if (i != j) {  // the inplace version requires x1 != x2
+                result = roaring_bitmap_copy(r[i]);
+                roaring_bitmap_lazy_andnot_inplace(result, r[j]);
+                roaring_bitmap_repair_after_lazy(result);
+                assert_true(roaring_bitmap_equals(expected, result));
+                roaring_bitmap_free(result);
+            }
+            roaring_bitmap_free(expected);
+        }
+    }
+
+    // chaining several lazy operations before a single repair
+    roaring_bitmap_t *chained = roaring_bitmap_lazy_and(r[0], r[1]);
+    roaring_bitmap_lazy_and_inplace(chained, r[4]);
+    roaring_bitmap_lazy_andnot_inplace(chained, r[2]);
+    roaring_bitmap_repair_after_lazy(chained);
+
+    roaring_bitmap_t *eager = roaring_bitmap_and(r[0], r[1]);
+    roaring_bitmap_and_inplace(eager, r[4]);
+    roaring_bitmap_andnot_inplace(eager, r[2]);
+    assert_true(roaring_bitmap_equals(eager, chained));
+    roaring_bitmap_free(eager);
+    roaring_bitmap_free(chained);
+
+    for (int i = 0; r[i]; ++i) roaring_bitmap_free(r[i]);
+}
+
+void test_and_andnot_lazy_true() { test_and_andnot_lazy(true); }
+
+void test_and_andnot_lazy_false() { test_and_andnot_lazy(false); }
+
+void test_expression() {
+    roaring_bitmap_t *a = gen_bitmap(0.0, 1e-6, 1, 0, 0, 1000000);
+    roaring_bitmap_t *b = gen_bitmap(1.0, -1e-6, 1, 0, 0, 1000000);
+    roaring_bitmap_t *c = gen_bitmap(1e-1, 0.0, 1, 0, 0, 2000000);
+    roaring_bitmap_t *d = gen_bitmap(0.5, -1e-6, 1, 600000, 800000, 1000000);
+    roaring_bitmap_t *e = gen_bitmap(1e-5, 0.0, 3, 0, 0, 2000000);
+
+    // ((a & b & c) &~ d) | e computed one operator at a time
+    roaring_bitmap_t *expected = roaring_bitmap_and(a, b);
+    roaring_bitmap_and_inplace(expected, c);
+    roaring_bitmap_andnot_inplace(expected, d);
+    roaring_bitmap_or_inplace(expected, e);
+
+    roaring_expression_t *expr = roaring_expression_operation(
+        ROARING_EXPR_OR,
+        roaring_expression_operation(
+            ROARING_EXPR_ANDNOT,
+            roaring_expression_operation(
+                ROARING_EXPR_AND,
+                roaring_expression_operation(ROARING_EXPR_AND,
+                                             roaring_expression_input(a),
+                                             roaring_expression_input(b)),
+                roaring_expression_input(c)),
+            roaring_expression_input(d)),
+        roaring_expression_input(e));
+    assert_non_null(expr);
+
+    roaring_bitmap_t *result = roaring_expression_evaluate(expr);
+    assert_non_null(result);
+    assert_true(roaring_bitmap_equals(expected, result));
+    roaring_bitmap_free(result);
+
+    // the expression can be evaluated repeatedly
+    result = roaring_expression_evaluate(expr);
+    assert_true(roaring_bitmap_equals(expected, result));
+    roaring_bitmap_free(result);
+    roaring_expression_free(expr);
+    roaring_bitmap_free(expected);
+
+    // xor branches and a same-bitmap leaf on both sides
+    expr = roaring_expression_operation(ROARING_EXPR_XOR,
+                                        roaring_expression_input(a),
+                                        roaring_expression_input(b));
+    expected = roaring_bitmap_xor(a, b);
+    result = roaring_expression_evaluate(expr);
+    assert_true(roaring_bitmap_equals(expected, result));
+    roaring_bitmap_free(result);
+    roaring_expression_free(expr);
+    roaring_bitmap_free(expected);
+
+    // a &~ a is empty; no container should survive
+    expr = roaring_expression_operation(ROARING_EXPR_ANDNOT,
+                                        roaring_expression_input(a),
+                                        roaring_expression_input(a));
+    result = roaring_expression_evaluate(expr);
+    assert_true(roaring_bitmap_is_empty(result));
+    roaring_bitmap_free(result);
+    roaring_expression_free(expr);
+
+    roaring_bitmap_free(a);
+    roaring_bitmap_free(b);
+    roaring_bitmap_free(c);
+    roaring_bitmap_free(d);
+    roaring_bitmap_free(e);
+}
+
 static roaring_bitmap_t *roaring_from_sentinel_array(int *data,
                                                      bool copy_on_write) {
     roaring_bitmap_t *ans = roaring_bitmap_create();
@@ -2130,6 +4861,8 @@ void test_andnot(bool copy_on_write) {
         for (int j = i; r[j]; ++j) {
             roaring_bitmap_t *expected = synthesized_andnot(r[i], r[j]);
             roaring_bitmap_t *result = roaring_bitmap_andnot(r[i], r[j]);
+            assert_true(roaring_bitmap_get_cardinality(result) ==
+                        roaring_bitmap_andnot_cardinality(r[i], r[j]));
 
             bool is_equal = roaring_bitmap_equals(expected, result);
 
@@ -3316,6 +6049,135 @@ static uint64_t rank(uint32_t *arr, size_t length, uint32_t x) {
     return sum;
 }
 
+void test_rank_select_many() {
+    roaring_bitmap_t *r = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 300000; i += 7) {
+        roaring_bitmap_add(r, i * 3);
+    }
+    roaring_bitmap_add_range(r, 1000000, 1002000);
+    for (uint32_t i = 2000000; i < 2100000; i += 2) {
+        roaring_bitmap_add(r, i);  // bitset containers, probed repeatedly
+    }
+    roaring_bitmap_run_optimize(r);
+
+    uint64_t card = roaring_bitmap_get_cardinality(r);
+    uint32_t *values = malloc(card * sizeof(uint32_t));
+    roaring_bitmap_to_uint32_array(r, values);
+
+    // rank_many over a sorted probe set matches one-at-a-time ranking
+    uint32_t probes[1000];
+    uint64_t ranks[1000];
+    for (uint32_t i = 0; i < 1000; i++) {
+        probes[i] = i * 1101;
+    }
+    roaring_bitmap_rank_many(r, probes, probes + 1000, ranks);
+    for (uint32_t i = 0; i < 1000; i++) {
+        assert_true(ranks[i] == roaring_bitmap_rank(r, probes[i]));
+    }
+
+    // select_many over sorted ranks matches one-at-a-time selection
+    uint32_t sel_ranks[500];
+    uint32_t selected[500];
+    for (uint32_t i = 0; i < 500; i++) {
+        sel_ranks[i] = (uint32_t)((card * i) / 500);
+    }
+    assert_true(
+        roaring_bitmap_select_many(r, sel_ranks, sel_ranks + 500, selected));
+    for (uint32_t i = 0; i < 500; i++) {
+        assert_int_equal(values[sel_ranks[i]], selected[i]);
+        uint32_t single;
+        assert_true(roaring_bitmap_select(r, sel_ranks[i], &single));
+        assert_int_equal(single, selected[i]);
+    }
+
+    // a rank beyond the cardinality fails
+    uint32_t bad_rank = (uint32_t)card;
+    uint32_t dummy;
+    assert_false(
+        roaring_bitmap_select_many(r, &bad_rank, &bad_rank + 1, &dummy));
+    assert_false(roaring_bitmap_select(r, bad_rank, &dummy));
+
+    // add_many must drop the prefix index built by the queries above
+    const uint32_t fresh[] = {5, 3000001, 3000002};
+    roaring_bitmap_add_many(r, 3, fresh);
+    card += 3;
+    assert_int_equal(card, roaring_bitmap_rank(r, UINT32_MAX));
+    uint32_t last;
+    assert_true(roaring_bitmap_select(r, (uint32_t)card - 1, &last));
+    assert_int_equal(3000002, last);
+
+    free(values);
+    roaring_bitmap_free(r);
+}
+
+void test_rank_transform() {
+    // a dictionary with a bitset chunk, an array chunk, a run chunk, and a
+    // chunk the input never touches
+    roaring_bitmap_t *base = roaring_bitmap_create();
+    for (uint32_t v = 0; v < 65536; v += 2) roaring_bitmap_add(base, v);
+    for (uint32_t v = 0; v < 65536; v += 100) {
+        roaring_bitmap_add(base, (1 << 16) + v);
+        roaring_bitmap_add(base, (4 << 16) + v);
+    }
+    roaring_bitmap_add_range_closed(base, 2 << 16, (2 << 16) + 20000);
+    roaring_bitmap_run_optimize(base);
+
+    // the filter: some values in the dictionary, some not, plus values in
+    // chunks the dictionary lacks entirely
+    roaring_bitmap_t *input = roaring_bitmap_create();
+    for (uint32_t v = 0; v < 65536; v += 7) roaring_bitmap_add(input, v);
+    for (uint32_t v = 0; v < 65536; v += 300) {
+        roaring_bitmap_add(input, (1 << 16) + v);
+    }
+    roaring_bitmap_add_range_closed(input, (2 << 16) + 1000, (2 << 16) + 3000);
+    roaring_bitmap_add(input, 3 << 16);  // no such chunk in the dictionary
+    roaring_bitmap_add(input, UINT32_MAX);
+
+    roaring_bitmap_t *ranks = roaring_bitmap_rank_transform(base, input);
+    assert_non_null(ranks);
+
+    // one-at-a-time reference: 0-based rank of every common value
+    roaring_bitmap_t *common = roaring_bitmap_and(base, input);
+    roaring_bitmap_t *expected = roaring_bitmap_create();
+    roaring_uint32_iterator_t it;
+    roaring_init_iterator(common, &it);
+    while (it.has_value) {
+        roaring_bitmap_add(
+            expected, (uint32_t)(roaring_bitmap_rank(base, it.current_value) - 1));
+        roaring_advance_uint32_iterator(&it);
+    }
+    assert_true(roaring_bitmap_equals(ranks, expected));
+
+    // the batched select inverts the transform back to the common values
+    roaring_bitmap_t *back = roaring_bitmap_select_transform(base, ranks);
+    assert_non_null(back);
+    assert_true(roaring_bitmap_equals(back, common));
+    roaring_bitmap_free(back);
+
+    // ranks beyond the cardinality of the base are dropped
+    uint64_t card = roaring_bitmap_get_cardinality(base);
+    roaring_bitmap_add(ranks, (uint32_t)card);
+    roaring_bitmap_add(ranks, (uint32_t)card + 1000);
+    back = roaring_bitmap_select_transform(base, ranks);
+    assert_non_null(back);
+    assert_true(roaring_bitmap_equals(back, common));
+    roaring_bitmap_free(back);
+
+    // disjoint operands produce an empty mapping
+    roaring_bitmap_t *elsewhere = roaring_bitmap_from_range(9 << 16, 10 << 16, 1);
+    roaring_bitmap_t *none = roaring_bitmap_rank_transform(base, elsewhere);
+    assert_non_null(none);
+    assert_true(roaring_bitmap_is_empty(none));
+    roaring_bitmap_free(none);
+    roaring_bitmap_free(elsewhere);
+
+    roaring_bitmap_free(expected);
+    roaring_bitmap_free(common);
+    roaring_bitmap_free(ranks);
+    roaring_bitmap_free(input);
+    roaring_bitmap_free(base);
+}
+
 void test_rank() {
     for (uint32_t mymin = 123; mymin < 1000000; mymin *= 2) {
         // just arrays
@@ -3431,6 +6293,31 @@ void test_subset() {
     assert_true(roaring_bitmap_is_strict_subset(rb1, rb2));
     roaring_bitmap_free(rb1);
     roaring_bitmap_free(rb2);
+    // Skewed operands: a handful of values against large array and run
+    // containers, exercising the galloping kernels
+    rb1 = roaring_bitmap_create();
+    rb2 = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 4000; i++) {
+        roaring_bitmap_add(rb2, i * 16);  // large array container
+        roaring_bitmap_add(rb2, 65536 + i * 16);
+    }
+    for (uint32_t i = 0; i < 1000; i++) {  // a thousand short runs
+        roaring_bitmap_add_range(rb2, 131072 + i * 48, 131072 + i * 48 + 3);
+    }
+    roaring_bitmap_t *rb3 = roaring_bitmap_copy(rb2);
+    roaring_bitmap_run_optimize(rb3);
+    for (uint32_t i = 0; i < 10; i++) {
+        roaring_bitmap_add(rb1, i * 4096);
+        roaring_bitmap_add(rb1, 131072 + (i * 100) * 48);
+    }
+    assert_true(roaring_bitmap_is_subset(rb1, rb2));
+    assert_true(roaring_bitmap_is_subset(rb1, rb3));
+    roaring_bitmap_add(rb1, 63999);  // not a multiple of 16
+    assert_false(roaring_bitmap_is_subset(rb1, rb2));
+    assert_false(roaring_bitmap_is_subset(rb1, rb3));
+    roaring_bitmap_free(rb1);
+    roaring_bitmap_free(rb2);
+    roaring_bitmap_free(rb3);
 }
 
 void test_or_many_memory_leak() {
@@ -3585,6 +6472,8 @@ void test_read_uint32_iterator(uint8_t type) {
     read_compare(r, ref_values, ref_count, 1);
     read_compare(r, ref_values, ref_count, 2);
     read_compare(r, ref_values, ref_count, 7);
+    read_compare(r, ref_values, ref_count, 65); // trigger the bulk decoder
+    read_compare(r, ref_values, ref_count, 1000);
     read_compare(r, ref_values, ref_count, ref_count-1);
     read_compare(r, ref_values, ref_count, ref_count);
     read_compare(r, ref_values, ref_count, UINT32_MAX); // special value
@@ -3593,6 +6482,88 @@ void test_read_uint32_iterator(uint8_t type) {
     free(ref_values);
 }
 
+/*
+ * Same as read_compare, but walks the bitmap newest-first with the
+ * descending bulk reader, starting from roaring_init_iterator_last.
+ */
+void read_compare_reverse(roaring_bitmap_t* r, const uint32_t* ref_values,
+                          uint32_t ref_count, uint32_t step) {
+    roaring_uint32_iterator_t iter;
+    roaring_init_iterator_last(r, &iter);
+    uint32_t* buffer = malloc(sizeof(uint32_t) * (step == UINT32_MAX ? 65536 : step));
+    const uint32_t* next = ref_values + ref_count;  // one past the largest
+    while (ref_count > 0) {
+        assert(iter.has_value == true);
+        assert(iter.current_value == next[-1]);
+
+        uint32_t num_ask = step;
+        if (step == UINT32_MAX) {
+            num_ask = 0;
+            for (uint32_t i = 0; i < ref_count; i++) {
+                if ((next[-1 - (int32_t)i] >> 16) == (next[-1] >> 16)) {
+                    num_ask++;
+                } else {
+                    break;
+                }
+            }
+        }
+
+        uint32_t num_got =
+            roaring_read_uint32_iterator_reverse(&iter, buffer, num_ask);
+        assert(num_got == minimum_uint32(num_ask, ref_count));
+        for (uint32_t i = 0; i < num_got; i++) {
+            assert(next[-1 - (int32_t)i] == buffer[i]);
+        }
+        next -= num_got;
+        ref_count -= num_got;
+    }
+
+    assert(iter.has_value == false);
+    assert(roaring_read_uint32_iterator_reverse(&iter, buffer, step) == 0);
+    assert(iter.has_value == false);
+
+    free(buffer);
+}
+
+void test_read_uint32_iterator_reverse(uint8_t type) {
+    uint32_t* ref_values;
+    uint32_t ref_count;
+    test_iterator_generate_data(&ref_values, &ref_count);
+
+    roaring_bitmap_t *r = roaring_bitmap_create();
+    for (uint32_t i = 0; i < ref_count; i++) {
+        roaring_bitmap_add(r, ref_values[i]);
+    }
+    if (type != UINT8_MAX) {
+        convert_all_containers(r, type);
+    }
+
+    read_compare_reverse(r, ref_values, ref_count, 1);
+    read_compare_reverse(r, ref_values, ref_count, 2);
+    read_compare_reverse(r, ref_values, ref_count, 7);
+    read_compare_reverse(r, ref_values, ref_count, 65);
+    read_compare_reverse(r, ref_values, ref_count, 1000);
+    read_compare_reverse(r, ref_values, ref_count, ref_count-1);
+    read_compare_reverse(r, ref_values, ref_count, ref_count);
+    read_compare_reverse(r, ref_values, ref_count, UINT32_MAX); // special value
+
+    roaring_bitmap_free(r);
+    free(ref_values);
+}
+
+void test_read_uint32_iterator_reverse_array() {
+    test_read_uint32_iterator_reverse(ARRAY_CONTAINER_TYPE_CODE);
+}
+void test_read_uint32_iterator_reverse_bitset() {
+    test_read_uint32_iterator_reverse(BITSET_CONTAINER_TYPE_CODE);
+}
+void test_read_uint32_iterator_reverse_run() {
+    test_read_uint32_iterator_reverse(RUN_CONTAINER_TYPE_CODE);
+}
+void test_read_uint32_iterator_reverse_native() {
+    test_read_uint32_iterator_reverse(UINT8_MAX); // special value
+}
+
 void test_read_uint32_iterator_array() {
     test_read_uint32_iterator(ARRAY_CONTAINER_TYPE_CODE);
 }
@@ -3606,6 +6577,66 @@ void test_read_uint32_iterator_native() {
     test_read_uint32_iterator(UINT8_MAX); // special value
 }
 
+void test_range_iterator() {
+    roaring_bitmap_t *r = roaring_bitmap_create();
+    for (uint32_t i = 100; i < 1000000; i += 997) {
+        roaring_bitmap_add(r, i);
+    }
+    roaring_bitmap_add_range(r, 5000000, 5001000);
+    roaring_bitmap_run_optimize(r);
+
+    // intersection with a value range, with and without hits
+    assert_true(roaring_bitmap_intersect_with_range(r, 0, 101));
+    assert_false(roaring_bitmap_intersect_with_range(r, 0, 100));
+    assert_true(roaring_bitmap_intersect_with_range(r, 4999999, 5000001));
+    assert_false(roaring_bitmap_intersect_with_range(r, 1100000, 5000000));
+    assert_true(roaring_bitmap_intersect_with_range(r, 1100000, 5000001));
+    assert_false(roaring_bitmap_intersect_with_range(r, 600, 600));
+
+    // a bounded iterator visits exactly the values in [min, max)
+    const uint64_t min = 250000, max = 750000;
+    roaring_uint32_iterator_t it;
+    bool has = roaring_init_iterator_range(r, &it, min, max);
+    roaring_uint32_iterator_t *full = roaring_create_iterator(r);
+    while (full->has_value && full->current_value < min) {
+        roaring_advance_uint32_iterator(full);
+    }
+    uint64_t count = 0;
+    while (full->has_value && full->current_value < max) {
+        assert_true(has);
+        assert_int_equal(full->current_value, it.current_value);
+        count++;
+        roaring_advance_uint32_iterator(full);
+        has = roaring_advance_uint32_iterator(&it);
+    }
+    assert_false(has);
+    assert_false(it.has_value);
+    roaring_free_uint32_iterator(full);
+
+    // batched reads respect the bound
+    assert_true(roaring_init_iterator_range(r, &it, min, max));
+    uint32_t buffer[128];
+    uint64_t read_count = 0;
+    while (true) {
+        uint32_t n = roaring_read_uint32_iterator(&it, buffer, 128);
+        for (uint32_t i = 0; i < n; i++) {
+            assert_true(buffer[i] >= min && buffer[i] < max);
+        }
+        read_count += n;
+        if (n < 128) break;
+    }
+    assert_false(it.has_value);
+    assert_true(count == read_count);
+
+    // empty and out-of-range windows
+    assert_false(roaring_init_iterator_range(r, &it, 600, 600));
+    assert_false(roaring_init_iterator_range(r, &it, 6000000, 7000000));
+    assert_true(roaring_init_iterator_range(r, &it, 0, UINT64_MAX));
+    assert_int_equal(roaring_bitmap_minimum(r), it.current_value);
+
+    roaring_bitmap_free(r);
+}
+
 void test_previous_iterator(uint8_t type) {
     uint32_t* ref_values;
     uint32_t ref_count;
@@ -4082,6 +7113,101 @@ void frozen_serialization_compare(roaring_bitmap_t *r1) {
     roaring_bitmap_aligned_free(buf);
 }
 
+void frozen_serialization_compare_v2(roaring_bitmap_t *r1) {
+    size_t num_bytes = roaring_bitmap_frozen_size_in_bytes_v2(r1);
+    char *buf = roaring_bitmap_aligned_malloc(32, num_bytes);
+    roaring_bitmap_frozen_serialize_v2(r1, buf);
+
+    const roaring_bitmap_t *r2 = roaring_bitmap_frozen_view_v2(buf, num_bytes);
+
+    assert(roaring_bitmap_equals(r1, r2));
+    assert(roaring_bitmap_frozen_view_v2(buf, num_bytes - 1) == NULL);
+    // v1 and v2 cookies must not be confused for one another
+    assert(roaring_bitmap_frozen_view(buf, num_bytes) == NULL);
+
+    roaring_bitmap_free(r1);
+    roaring_bitmap_free(r2);
+    roaring_bitmap_aligned_free(buf);
+}
+
+void test_collection() {
+    enum { NUM = 5 };
+    const uint64_t keys[NUM] = {3, 10, 11, 500, UINT64_C(1) << 40};
+    roaring_bitmap_t *bitmaps[NUM];
+    for (int i = 0; i < NUM; i++) {
+        roaring_bitmap_t *r = roaring_bitmap_create();
+        for (uint32_t v = 0; v < 2000u * (i + 1); v += i + 1) {
+            roaring_bitmap_add(r, v * 17);
+        }
+        roaring_bitmap_run_optimize(r);
+        bitmaps[i] = r;
+    }
+    size_t num_bytes = roaring_collection_size_in_bytes(
+        NUM, (const roaring_bitmap_t **)bitmaps);
+    char *buf = roaring_bitmap_aligned_malloc(32, num_bytes);
+    size_t written = roaring_collection_serialize(
+        NUM, keys, (const roaring_bitmap_t **)bitmaps, buf);
+    assert_int_equal(written, num_bytes);
+
+    const roaring_collection_t *collection =
+        roaring_collection_frozen_view(buf, num_bytes);
+    assert_non_null(collection);
+    assert_int_equal(roaring_collection_count(collection), NUM);
+    for (int i = 0; i < NUM; i++) {
+        assert_int_equal(roaring_collection_key_at(collection, i), keys[i]);
+        const roaring_bitmap_t *view =
+            roaring_collection_get(collection, keys[i]);
+        assert_non_null(view);
+        assert_true(roaring_bitmap_equals(view, bitmaps[i]));
+        roaring_bitmap_free(view);
+    }
+    assert_null(roaring_collection_get(collection, 4));
+    assert_null(roaring_collection_get(collection, UINT64_C(1) << 41));
+
+    // views outlive the collection handle, but not the buffer
+    const roaring_bitmap_t *view = roaring_collection_get_at(collection, 1);
+    roaring_collection_free(collection);
+    assert_int_equal(roaring_bitmap_get_cardinality(view),
+                     roaring_bitmap_get_cardinality(bitmaps[1]));
+    roaring_bitmap_free(view);
+
+    // unsorted keys are rejected, as are misaligned or corrupt buffers
+    const uint64_t bad_keys[NUM] = {3, 2, 11, 500, 600};
+    assert_int_equal(roaring_collection_serialize(
+                         NUM, bad_keys, (const roaring_bitmap_t **)bitmaps,
+                         buf),
+                     0);
+    roaring_collection_serialize(NUM, keys, (const roaring_bitmap_t **)bitmaps,
+                                 buf);
+    assert_null(roaring_collection_frozen_view(buf + 1, num_bytes - 1));
+    buf[0] ^= 1;
+    assert_null(roaring_collection_frozen_view(buf, num_bytes));
+    buf[0] ^= 1;
+    assert_non_null(collection = roaring_collection_frozen_view(buf, num_bytes));
+    roaring_collection_free(collection);
+
+    for (int i = 0; i < NUM; i++) roaring_bitmap_free(bitmaps[i]);
+    roaring_bitmap_aligned_free(buf);
+}
+
+void test_frozen_serialization_v2() {
+    const uint64_t s = 65536;
+
+    roaring_bitmap_t *r = roaring_bitmap_create();
+    roaring_bitmap_add(r, 0);
+    roaring_bitmap_add(r, UINT32_MAX);
+    roaring_bitmap_add(r, 1000);
+    roaring_bitmap_add(r, 2000);
+    roaring_bitmap_add(r, 100000);
+    roaring_bitmap_add(r, 200000);
+    roaring_bitmap_add_range(r, s*10 + 100, s*13 - 100);
+    for (uint64_t i = 0; i < s*3; i += 2) {
+        roaring_bitmap_add(r, s*20 + i);
+    }
+    roaring_bitmap_run_optimize(r);
+    frozen_serialization_compare_v2(r);
+}
+
 void test_frozen_serialization() {
     const uint64_t s = 65536;
 
@@ -4117,6 +7243,32 @@ int main() {
         cmocka_unit_test(issue208),
         cmocka_unit_test(issue208b),
         cmocka_unit_test(range_contains),
+        cmocka_unit_test(test_add_bulk_contains_bulk),
+        cmocka_unit_test(test_remove_bulk),
+        cmocka_unit_test(test_instrumentation),
+        cmocka_unit_test(test_runtime_tuning),
+        cmocka_unit_test(test_to_uint32_array_parallel),
+        cmocka_unit_test(test_add_offset),
+        cmocka_unit_test(test_iterate_ranges),
+        cmocka_unit_test(test_overwrite),
+        cmocka_unit_test(test_hash),
+        cmocka_unit_test(test_portable_deserialize_many),
+        cmocka_unit_test(test_and_cardinality_many),
+        cmocka_unit_test(test_contains_many),
+        cmocka_unit_test(test_and_or_array),
+        cmocka_unit_test(test_of_sorted),
+        cmocka_unit_test(test_builder),
+        cmocka_unit_test(test_or_many_parallel),
+        cmocka_unit_test(test_memory_hook),
+        cmocka_unit_test(test_memory_budget),
+        cmocka_unit_test(test_inline_storage),
+        cmocka_unit_test(test_container_pool),
+        cmocka_unit_test(test_portable_serialize_to),
+        cmocka_unit_test(test_portable_deserialize_frozen),
+        cmocka_unit_test(test_portable_iterator),
+        cmocka_unit_test(test_xor_many_heap),
+        cmocka_unit_test(test_and_many),
+        cmocka_unit_test(test_cached_cardinality),
         cmocka_unit_test(inplaceorwide),
         cmocka_unit_test(test_contains_range),
         cmocka_unit_test(check_range_contains_from_end),
@@ -4126,6 +7278,7 @@ int main() {
         cmocka_unit_test(check_full_flip),
         cmocka_unit_test(test_adversarial_range),
         cmocka_unit_test(check_full_inplace_flip),
+        cmocka_unit_test(check_flip_full_containers),
         cmocka_unit_test(test_stress_memory_true),
         cmocka_unit_test(test_stress_memory_false),
         cmocka_unit_test(check_interval),
@@ -4138,8 +7291,11 @@ int main() {
         cmocka_unit_test(test_intersect_small_run_bitset),
         cmocka_unit_test(is_really_empty),
         cmocka_unit_test(test_rank),
+        cmocka_unit_test(test_rank_select_many),
+        cmocka_unit_test(test_rank_transform),
         cmocka_unit_test(test_maximum_minimum),
         cmocka_unit_test(test_stats),
+        cmocka_unit_test(test_prefetch),
         cmocka_unit_test(test_addremove),
         cmocka_unit_test(test_addremoverun),
         cmocka_unit_test(test_basic_add),
@@ -4157,11 +7313,14 @@ int main() {
         cmocka_unit_test(test_printf_withbitmap),
         cmocka_unit_test(test_printf_withrun),
         cmocka_unit_test(test_iterate),
+        cmocka_unit_test(test_iterate_and),
         cmocka_unit_test(test_iterate_empty),
         cmocka_unit_test(test_iterate_withbitmap),
         cmocka_unit_test(test_iterate_withrun),
         cmocka_unit_test(test_serialize),
         cmocka_unit_test(test_portable_serialize),
+        cmocka_unit_test(test_portable_deserialize_run_optimized),
+        cmocka_unit_test(test_compressed_serialize),
         cmocka_unit_test(test_add),
         cmocka_unit_test(test_add_checked),
         cmocka_unit_test(test_remove_checked),
@@ -4172,6 +7331,17 @@ int main() {
         cmocka_unit_test(test_intersection_bitset_x_bitset_inplace),
         cmocka_unit_test(test_union_true),
         cmocka_unit_test(test_union_false),
+        cmocka_unit_test(test_all_bitset_fast_paths),
+        cmocka_unit_test(test_optimize_for),
+        cmocka_unit_test(test_and_or_into),
+        cmocka_unit_test(test_full_container_singleton),
+        cmocka_unit_test(test_compact),
+        cmocka_unit_test(test_container_cursor),
+        cmocka_unit_test(test_skewed_intersection),
+        cmocka_unit_test(test_bitset_bridge),
+        cmocka_unit_test(test_trusted_deserialize),
+        cmocka_unit_test(test_atomic_ref),
+        cmocka_unit_test(test_sharded),
         cmocka_unit_test(test_xor_false),
         cmocka_unit_test(test_xor_inplace_false),
         cmocka_unit_test(test_xor_lazy_false),
@@ -4184,6 +7354,9 @@ int main() {
         cmocka_unit_test(test_andnot_inplace_false),
         cmocka_unit_test(test_andnot_true),
         cmocka_unit_test(test_andnot_inplace_true),
+        cmocka_unit_test(test_and_andnot_lazy_false),
+        cmocka_unit_test(test_and_andnot_lazy_true),
+        cmocka_unit_test(test_expression),
         cmocka_unit_test(test_conversion_to_int_array),
         cmocka_unit_test(test_array_to_run),
         cmocka_unit_test(test_array_to_self),
@@ -4223,6 +7396,11 @@ int main() {
         cmocka_unit_test(test_read_uint32_iterator_bitset),
         cmocka_unit_test(test_read_uint32_iterator_run),
         cmocka_unit_test(test_read_uint32_iterator_native),
+        cmocka_unit_test(test_read_uint32_iterator_reverse_array),
+        cmocka_unit_test(test_read_uint32_iterator_reverse_bitset),
+        cmocka_unit_test(test_read_uint32_iterator_reverse_run),
+        cmocka_unit_test(test_read_uint32_iterator_reverse_native),
+        cmocka_unit_test(test_range_iterator),
         cmocka_unit_test(test_previous_iterator_array),
         cmocka_unit_test(test_previous_iterator_bitset),
         cmocka_unit_test(test_previous_iterator_run),
@@ -4234,6 +7412,8 @@ int main() {
         cmocka_unit_test(test_remove_many),
         cmocka_unit_test(test_range_cardinality),
         cmocka_unit_test(test_frozen_serialization),
+        cmocka_unit_test(test_frozen_serialization_v2),
+        cmocka_unit_test(test_collection),
         cmocka_unit_test(test_frozen_serialization_max_containers),
     };
 
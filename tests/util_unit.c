@@ -8,10 +8,119 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <roaring/array_util.h>
 #include <roaring/bitset_util.h>
 
 #include "test.h"
 
+// plain merge intersection, as a reference for the skewed kernels
+static int32_t intersect_uint16_reference(const uint16_t* A, size_t lenA,
+                                          const uint16_t* B, size_t lenB,
+                                          uint16_t* out) {
+    size_t ia = 0, ib = 0;
+    int32_t pos = 0;
+    while (ia < lenA && ib < lenB) {
+        if (A[ia] < B[ib]) {
+            ia++;
+        } else if (B[ib] < A[ia]) {
+            ib++;
+        } else {
+            out[pos++] = A[ia];
+            ia++;
+            ib++;
+        }
+    }
+    return pos;
+}
+
+void skewedintersection_uint16() {
+    const size_t size_l = 4000;
+    uint16_t* large = malloc(size_l * sizeof(uint16_t));
+    for (size_t k = 0; k < size_l; ++k) {
+        large[k] = (uint16_t)(16 * k + (k % 5));
+    }
+    // sweep small sizes across every block-size boundary (8/4/2/1)
+    for (size_t size_s = 0; size_s <= 40; size_s++) {
+        uint16_t* small = malloc((size_s + 1) * sizeof(uint16_t));
+        uint16_t* buffer = malloc((size_s + 1) * sizeof(uint16_t));
+        uint16_t* expected = malloc((size_s + 1) * sizeof(uint16_t));
+        for (int trial = 0; trial < 100; trial++) {
+            // strictly increasing and bounded: 40 steps of at most 1024
+            // starting below 1024 always stay within 16 bits
+            uint32_t v = (uint32_t)(rand() % 1024);
+            for (size_t k = 0; k < size_s; ++k) {
+                small[k] = (uint16_t)v;
+                v += 1 + (uint32_t)(rand() % 1024);
+            }
+            int32_t expected_card = intersect_uint16_reference(
+                small, size_s, large, size_l, expected);
+            int32_t card = intersect_skewed_uint16(small, size_s, large,
+                                                   size_l, buffer);
+            assert_int_equal(expected_card, card);
+            for (int32_t k = 0; k < card; ++k) {
+                assert_int_equal(expected[k], buffer[k]);
+            }
+            assert_int_equal(expected_card,
+                             intersect_skewed_uint16_cardinality(
+                                 small, size_s, large, size_l));
+        }
+        free(expected);
+        free(buffer);
+        free(small);
+    }
+    free(large);
+}
+
+void binarysearch_large_uint16() {
+    // sizes around the ra_get_index cutoff and well past the vector tail
+    const int32_t sizes[] = {0, 1, 31, 32, 33, 64, 65, 1000, 5000};
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        const int32_t size = sizes[s];
+        uint16_t* array = malloc((size + 1) * sizeof(uint16_t));
+        for (int32_t k = 0; k < size; ++k) {
+            array[k] = (uint16_t)(3 * k + 5);
+        }
+        for (int trial = 0; trial < 10000; trial++) {
+            uint16_t ikey = (uint16_t)(rand() % (1 << 16));
+            assert_int_equal(binarySearch(array, size, ikey),
+                             binarySearchLarge(array, size, ikey));
+        }
+        // hits, and misses at both ends
+        for (int32_t k = 0; k < size; ++k) {
+            assert_int_equal(k, binarySearchLarge(array, size, array[k]));
+        }
+        assert_int_equal(-1, binarySearchLarge(array, size, 0));
+        assert_int_equal(-(size + 1),
+                         binarySearchLarge(array, size, UINT16_MAX));
+        free(array);
+    }
+}
+
+void lowerbound_uint16() {
+    // sizes straddling the 16-key block and the eight-wide vector tail
+    const int32_t sizes[] = {0, 1, 2, 7, 8, 15, 16, 17, 100, 4096, 20000};
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        const int32_t size = sizes[s];
+        uint16_t* array = malloc((size + 1) * sizeof(uint16_t));
+        for (int32_t k = 0; k < size; ++k) {
+            array[k] = (uint16_t)(3 * k + 5);
+        }
+        for (int trial = 0; trial < 10000; trial++) {
+            uint16_t ikey = (uint16_t)(rand() % (1 << 16));
+            const int32_t found = binarySearch(array, size, ikey);
+            const int32_t expected = found >= 0 ? found : -found - 1;
+            assert_int_equal(expected, lower_bound_uint16(array, size, ikey));
+        }
+        // hits, and misses at both ends
+        for (int32_t k = 0; k < size; ++k) {
+            assert_int_equal(k, lower_bound_uint16(array, size, array[k]));
+        }
+        assert_int_equal(0, lower_bound_uint16(array, size, 0));
+        assert_int_equal(size, lower_bound_uint16(array, size, UINT16_MAX));
+        free(array);
+    }
+}
+
 void setandextract_uint16() {
     const unsigned int bitset_size = 1 << 16;
     const unsigned int bitset_size_in_words =
@@ -131,6 +240,9 @@ void setandextract_avx2_uint32() {
 
 int main() {
     const struct CMUnitTest tests[] = {
+        cmocka_unit_test(skewedintersection_uint16),
+        cmocka_unit_test(binarysearch_large_uint16),
+        cmocka_unit_test(lowerbound_uint16),
         cmocka_unit_test(setandextract_uint16),
 #ifdef IS_X64
         cmocka_unit_test(setandextract_sse_uint16),
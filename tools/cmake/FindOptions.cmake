@@ -31,6 +31,10 @@ endif()
 if(ROARING_DISABLE_NEON)
   set (OPT_FLAGS "${OPT_FLAGS} -DDISABLENEON" )
 endif()
+if(ROARING_ENABLE_INSTRUMENTATION)
+  # compile in the operation counters (see include/roaring/instrumentation.h)
+  set (OPT_FLAGS "${OPT_FLAGS} -DROARING_INSTRUMENTATION" )
+endif()
 
 if(FORCE_AVX) # some compilers like clang do not automagically define __AVX2__ and __BMI2__ even when the hardware supports it
 if(NOT MSVC)